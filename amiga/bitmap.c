@@ -19,6 +19,7 @@
 #include "assert.h"
 #include "image/bitmap.h"
 #include "amiga/bitmap.h"
+#include "image/scale_cache.h"
 #include <proto/exec.h>
 #include <proto/picasso96api.h>
 #include <graphics/composite.h>
@@ -111,6 +112,7 @@ void bitmap_destroy(void *bitmap)
 
 	if(bm)
 	{
+		scale_cache_invalidate(bm);
 		if(bm->nativebm) p96FreeBitMap(bm->nativebm);
 		FreeVec(bm->pixdata);
 		bm->pixdata = NULL;
@@ -156,6 +158,8 @@ bool bitmap_save(void *bitmap, const char *path, unsigned flags)
 void bitmap_modified(void *bitmap) {
 	struct bitmap *bm = bitmap;
 
+	scale_cache_invalidate(bm);
+
 	p96FreeBitMap(bm->nativebm);
 	bm->nativebm = NULL;
 }
@@ -35,7 +35,9 @@
 extern "C" {
 #include "content/content.h"
 #include "image/bitmap.h"
+#include "image/scale_cache.h"
 #include "utils/log.h"
+#include "utils/pixel.h"
 }
 #include "beos/beos_bitmap.h"
 #include "beos/beos_gui.h"
@@ -79,16 +81,7 @@ static inline void nsbeos_rgba_to_bgra(void *src, void *dst, int width, int heig
 	rowstride >>= 2;
 
 	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			to[x].b = from[x].b;
-			to[x].g = from[x].g;
-			to[x].r = from[x].r;
-			to[x].a = from[x].a;
-			/*
-			if (from[x].a == 0)
-				*(rgb_color *)&to[x] = B_TRANSPARENT_32_BIT;
-			*/
-		}
+		pixel_swap_rb((uint8_t *)to, (const uint8_t *)from, width);
 		from += rowstride;
 		to += rowstride;
 	}
@@ -222,6 +215,36 @@ size_t bitmap_get_bpp(void *vbitmap)
 }
 
 
+/**
+ * Find the width of a bitmap.
+ *
+ * \param  vbitmap  a bitmap, as returned by bitmap_create()
+ * \return width of the bitmap in pixels
+ */
+
+int bitmap_get_width(void *vbitmap)
+{
+	struct bitmap *bitmap = (struct bitmap *)vbitmap;
+	assert(bitmap);
+	return bitmap->primary->Bounds().Width() + 1;
+}
+
+
+/**
+ * Find the height of a bitmap.
+ *
+ * \param  vbitmap  a bitmap, as returned by bitmap_create()
+ * \return height of the bitmap in pixels
+ */
+
+int bitmap_get_height(void *vbitmap)
+{
+	struct bitmap *bitmap = (struct bitmap *)vbitmap;
+	assert(bitmap);
+	return bitmap->primary->Bounds().Height() + 1;
+}
+
+
 static void
 nsbeos_bitmap_free_pretiles(struct bitmap *bitmap)
 {
@@ -242,6 +265,7 @@ void bitmap_destroy(void *vbitmap)
 {
 	struct bitmap *bitmap = (struct bitmap *)vbitmap;
 	assert(bitmap);
+	scale_cache_invalidate(bitmap);
 	nsbeos_bitmap_free_pretiles(bitmap);
 	delete bitmap->primary;
 	delete bitmap->shadow;
@@ -300,6 +324,7 @@ void bitmap_modified(void *vbitmap) {
 		bitmap->primary->Bounds().Height() + 1,
 		bitmap->primary->BytesPerRow());
 	nsbeos_bitmap_free_pretiles(bitmap);
+	scale_cache_invalidate(bitmap);
 }
 
 
@@ -36,6 +36,8 @@
 #include "content/hlcache.h"
 #include "css/css.h"
 #include "image/bitmap.h"
+#include "image/image_cache.h"
+#include "desktop/browser.h"
 #include "desktop/options.h"
 #include "render/directory.h"
 #include "render/html.h"
@@ -284,12 +286,14 @@ static const struct handler_entry handler_map[] = {
 	{nscss_create, nscss_process_data, nscss_convert, 0, nscss_destroy, 
 		0, 0, 0, 0, 0, nscss_clone, false},
 #ifdef WITH_JPEG
-	{0, 0, nsjpeg_convert, 0, nsjpeg_destroy, 0,
-		nsjpeg_redraw, nsjpeg_redraw_tiled, 0, 0, nsjpeg_clone, false},
+	{nsjpeg_create, nsjpeg_process_data, nsjpeg_convert, 0,
+		nsjpeg_destroy, 0, nsjpeg_redraw, nsjpeg_redraw_tiled,
+		0, 0, nsjpeg_clone, false},
 #endif
 #ifdef WITH_GIF
-	{nsgif_create, 0, nsgif_convert, 0, nsgif_destroy, 0,
-		nsgif_redraw, nsgif_redraw_tiled, 0, 0, nsgif_clone, false},
+	{nsgif_create, nsgif_process_data, nsgif_convert, 0,
+		nsgif_destroy, 0, nsgif_redraw, nsgif_redraw_tiled,
+		0, 0, nsgif_clone, false},
 #endif
 #ifdef WITH_BMP
 	{nsbmp_create, 0, nsbmp_convert, 0, nsbmp_destroy, 0,
@@ -354,7 +358,8 @@ static const struct handler_entry handler_map[] = {
 #endif
 #ifdef WITH_RSVG
 	{rsvg_create, rsvg_process_data, rsvg_convert,
-		0, rsvg_destroy, 0, rsvg_redraw, 0, 0, 0, rsvg_clone, false},
+		0, rsvg_destroy, 0, rsvg_redraw, rsvg_redraw_tiled,
+		0, 0, rsvg_clone, false},
 #endif
 	{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, false}
 };
@@ -364,6 +369,10 @@ static nserror content_llcache_callback(llcache_handle *llcache,
 		const llcache_event *event, void *pw);
 static void content_convert(struct content *c);
 static void content_update_status(struct content *c);
+static void content_progress_redraw(void *p);
+
+/** Minimum time between redraws of a content which is still loading / cs */
+#define CONTENT_PROGRESS_INTERVAL 25
 
 
 /**
@@ -466,6 +475,9 @@ struct content * content_create(llcache_handle *llcache,
 	c->quirks = quirks;
 	c->refresh = 0;
 	c->bitmap = NULL;
+	c->image_cache = NULL;
+	c->progress_y0 = 0;
+	c->progress_y1 = 0;
 	c->fresh = false;
 	c->time = wallclock();
 	c->size = 0;
@@ -646,15 +658,22 @@ void content_update_status(struct content *c)
 
 void content_convert(struct content *c)
 {
+	bool partial;
+
 	assert(c);
 	assert(c->type < HANDLER_MAP_COUNT);
-	assert(c->status == CONTENT_STATUS_LOADING);
+	assert(c->status == CONTENT_STATUS_LOADING ||
+			c->status == CONTENT_STATUS_READY);
 	
 	if (c->locked == true)
 		return;
 	
 	LOG(("content %s (%p)", llcache_handle_get_url(c->llcache), c));
 
+	/* contents which are displayed while loading are already READY */
+	partial = (c->status == CONTENT_STATUS_READY);
+	schedule_remove(content_progress_redraw, c);
+
 	c->locked = true;
 	if (handler_map[c->type].convert) {
 		if (!handler_map[c->type].convert(c)) {
@@ -665,10 +684,17 @@ void content_convert(struct content *c)
 	}
 	c->locked = false;
 
-	if (c->status == CONTENT_STATUS_READY)
+	if (c->status == CONTENT_STATUS_READY && !partial)
 		content_set_ready(c);
 	if (c->status == CONTENT_STATUS_DONE) {
-		content_set_ready(c);
+		if (partial) {
+			/* replace whatever was displayed while loading */
+			c->progress_y0 = 0;
+			c->progress_y1 = c->height;
+			content_progress_redraw(c);
+		} else {
+			content_set_ready(c);
+		}
 		content_set_done(c);
 	}
 }
@@ -686,6 +712,81 @@ void content_set_ready(struct content *c)
 	content_broadcast(c, CONTENT_MSG_READY, msg_data);
 }
 
+/**
+ * Record that more of a content which is still loading can be displayed.
+ *
+ * \param c   content in status CONTENT_STATUS_LOADING or READY
+ * \param y0  top of area which has changed
+ * \param y1  bottom of area which has changed, exclusive
+ *
+ * Used by image contents which are displayed as their data arrives.  The
+ * changed rows are accumulated and a redraw of them is requested at most
+ * once every CONTENT_PROGRESS_INTERVAL, once the content is READY.
+ */
+
+void content__progress(struct content *c, int y0, int y1)
+{
+	assert(c->status == CONTENT_STATUS_LOADING ||
+			c->status == CONTENT_STATUS_READY);
+
+	if (y1 <= y0)
+		return;
+
+	if (c->progress_y1 <= c->progress_y0) {
+		c->progress_y0 = y0;
+		c->progress_y1 = y1;
+		schedule(CONTENT_PROGRESS_INTERVAL, content_progress_redraw, c);
+		return;
+	}
+
+	if (y0 < c->progress_y0)
+		c->progress_y0 = y0;
+	if (c->progress_y1 < y1)
+		c->progress_y1 = y1;
+}
+
+
+/**
+ * Request a redraw of the rows of a content recorded by content__progress().
+ *
+ * \param p  content to redraw
+ */
+
+void content_progress_redraw(void *p)
+{
+	struct content *c = p;
+	union content_msg_data data;
+
+	if (c->status == CONTENT_STATUS_LOADING) {
+		/* not displayable yet: try again later */
+		schedule(CONTENT_PROGRESS_INTERVAL, content_progress_redraw, c);
+		return;
+	}
+
+	if (c->status == CONTENT_STATUS_ERROR ||
+			c->progress_y1 <= c->progress_y0)
+		return;
+
+	data.redraw.x = 0;
+	data.redraw.y = c->progress_y0;
+	data.redraw.width = c->width;
+	data.redraw.height = c->progress_y1 - c->progress_y0;
+
+	/* parts of the image may not be decoded yet */
+	data.redraw.full_redraw = true;
+
+	data.redraw.object = c;
+	data.redraw.object_x = 0;
+	data.redraw.object_y = 0;
+	data.redraw.object_width = c->width;
+	data.redraw.object_height = c->height;
+
+	c->progress_y0 = c->progress_y1 = 0;
+
+	content_broadcast(c, CONTENT_MSG_REDRAW, data);
+}
+
+
 /**
  * Put a content in status CONTENT_STATUS_DONE.
  */
@@ -742,6 +843,8 @@ void content_destroy(struct content *c)
 	LOG(("content %p %s", c, llcache_handle_get_url(c->llcache)));
 	assert(!c->locked);
 
+	schedule_remove(content_progress_redraw, c);
+
 	if (c->type < HANDLER_MAP_COUNT && handler_map[c->type].destroy)
 		handler_map[c->type].destroy(c);
 
@@ -769,6 +872,10 @@ void content_request_redraw(struct hlcache_handle *h,
 	if (c == NULL)
 		return;
 
+	/* the document has changed, so any recorded redraw is stale */
+	if (c->type == CONTENT_HTML)
+		html_redraw_discard_display_list(c);
+
 	data.redraw.x = x;
 	data.redraw.y = y;
 	data.redraw.width = width;
@@ -1341,9 +1448,43 @@ struct bitmap *content__get_bitmap(struct content *c)
 	if (c == NULL)
 		return NULL;
 
+#ifdef WITH_JPEG
+	/* callers expect the image at full size */
+	if (c->type == CONTENT_JPEG)
+		return nsjpeg_get_bitmap(c, c->width, c->height);
+#endif
+
+	if (c->image_cache != NULL)
+		return image_cache_get_bitmap(c);
+
 	return c->bitmap;
 }
 
+/**
+ * Find whether an image content is opaque, without decoding it
+ *
+ * \param h  Content to examine
+ * \return true if the content's bitmap is known to be opaque
+ */
+bool content_get_opaque(hlcache_handle *h)
+{
+	return content__get_opaque(hlcache_handle_get_content(h));
+}
+
+bool content__get_opaque(struct content *c)
+{
+	if (c == NULL)
+		return false;
+
+	if (c->image_cache != NULL)
+		return image_cache_get_opaque(c);
+
+	if (c->bitmap == NULL)
+		return false;
+
+	return bitmap_get_opaque(c->bitmap);
+}
+
 /**
  * Return whether a content is currently locked
  *
@@ -78,6 +78,7 @@
 
 
 struct bitmap;
+struct image_cache_entry;
 struct content;
 
 /** Linked list of users of a content. */
@@ -154,6 +155,12 @@ struct content {
 
 	/** Bitmap, for various image contents. */
 	struct bitmap *bitmap;
+	/** Decoded image cache entry, if the bitmap is managed by the cache.
+	 *  The bitmap may then be NULL until image_cache_get_bitmap(). */
+	struct image_cache_entry *image_cache;
+	/** Rows of an image which have been decoded while loading, but not
+	 *  yet redrawn, from progress_y0 to progress_y1 exclusive. */
+	int progress_y0, progress_y1;
 
 	/** This content may be given to new users. Indicates that the content
 	 *  was fetched using a simple GET, has not expired, and may be
@@ -197,6 +204,7 @@ extern const char * const content_status_name[];
 
 void content_set_ready(struct content *c);
 void content_set_done(struct content *c);
+void content__progress(struct content *c, int y0, int y1);
 void content_set_status(struct content *c, const char *status_message, ...);
 void content_broadcast(struct content *c, content_msg msg,
 		union content_msg_data data);
@@ -220,6 +228,7 @@ const char *content__get_source_data(struct content *c, unsigned long *size);
 void content__invalidate_reuse_data(struct content *c);
 const char *content__get_refresh_url(struct content *c);
 struct bitmap *content__get_bitmap(struct content *c);
+bool content__get_opaque(struct content *c);
 
 bool content__is_locked(struct content *c);
 
@@ -159,6 +159,7 @@ struct url_internal_data {
 	unsigned int visits;	/**< Visit count */
 	time_t last_visit;	/**< Last visit time */
 	content_type type;	/**< Type of resource */
+	char *charset;		/**< Encoding of document; not saved */
 };
 
 struct path_data {
@@ -871,6 +872,38 @@ void urldb_set_url_content_type(const char *url, content_type type)
 	p->urld.type = type;
 }
 
+/**
+ * Set the encoding a document at an URL was found to be in, replacing any
+ * existing one
+ *
+ * \param url The URL to look for
+ * \param charset The encoding name to use (copied)
+ *
+ * This is remembered for the session only, so that reloading or revisiting
+ * the document needn't discover it again.
+ */
+void urldb_set_url_charset(const char *url, const char *charset)
+{
+	struct path_data *p;
+	char *temp;
+
+	assert(url && charset);
+
+	p = urldb_find_url(url);
+	if (!p)
+		return;
+
+	if (p->urld.charset && strcasecmp(p->urld.charset, charset) == 0)
+		return;
+
+	temp = strdup(charset);
+	if (!temp)
+		return;
+
+	free(p->urld.charset);
+	p->urld.charset = temp;
+}
+
 /**
  * Update an URL's visit data
  *
@@ -4022,6 +4055,7 @@ void urldb_destroy_path_node_content(struct path_data *node)
 		bitmap_destroy(node->thumb);
 
 	free(node->urld.title);
+	free(node->urld.charset);
 
 	for (a = node->cookies; a; a = b) {
 		b = a->next;
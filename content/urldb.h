@@ -39,6 +39,7 @@ struct url_data {
 	unsigned int visits;		/**< Visit count */
 	time_t last_visit;		/**< Last visit time */
 	content_type type;		/**< Type of resource */
+	const char *charset;		/**< Encoding of document, or 0 */
 };
 
 struct cookie_data {
@@ -77,6 +78,7 @@ bool urldb_add_url(const char *url);
 /* URL data modification / lookup */
 void urldb_set_url_title(const char *url, const char *title);
 void urldb_set_url_content_type(const char *url, content_type type);
+void urldb_set_url_charset(const char *url, const char *charset);
 void urldb_update_url_visit_data(const char *url);
 void urldb_reset_url_visit_data(const char *url);
 const struct url_data *urldb_get_url_data(const char *url);
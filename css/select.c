@@ -73,6 +73,8 @@ static css_error node_presentational_hint(void *pw, void *node,
 static css_error ua_default_for_property(void *pw, uint32_t property,
 		css_hint *hint);
 
+static const char *node_attribute(xmlNode *n, const char *name,
+		xmlChar **copy);
 static int cmp_colour_name(const void *a, const void *b);
 static bool parse_named_colour(const char *data, css_color *result);
 static bool parse_dimension(const char *data, bool strict,
@@ -405,6 +407,37 @@ bool nscss_parse_colour(const char *data, css_color *result)
  * Style selection callbacks                                                  *
  ******************************************************************************/
 
+/**
+ * Find the value of an attribute of a node, copying it only if necessary.
+ *
+ * \param n     DOM node
+ * \param name  attribute name
+ * \param copy  updated to a copy of the value, which must be freed with
+ *              xmlFree(), or NULL if the attribute's own text is returned
+ * \return  attribute value, or NULL if the node has no such attribute
+ */
+const char *node_attribute(xmlNode *n, const char *name, xmlChar **copy)
+{
+	xmlAttr *attr;
+
+	*copy = NULL;
+
+	attr = xmlHasProp(n, (const xmlChar *) name);
+	if (attr == NULL)
+		return NULL;
+
+	if (attr->children != NULL && attr->children->next == NULL &&
+			attr->children->children == NULL) {
+		/* Simple case -- no XML entities */
+		return (const char *) attr->children->content;
+	}
+
+	/* Awkward case -- fall back to string copying */
+	*copy = xmlGetProp(n, (const xmlChar *) name);
+
+	return (const char *) *copy;
+}
+
 /**
  * Callback to retrieve a node's name.
  *
@@ -452,8 +485,7 @@ css_error node_classes(void *pw, void *node,
 		lwc_string ***classes, uint32_t *n_classes)
 {
 	xmlNode *n = node;
-	xmlAttr *class;
-	xmlChar *value = NULL;
+	xmlChar *value;
 	const char *p;
 	const char *start;
 	lwc_string **result = NULL;
@@ -465,24 +497,10 @@ css_error node_classes(void *pw, void *node,
 	*n_classes = 0;
 
 	/* See if there is a class attribute on this node */
-	class = xmlHasProp(n, (const xmlChar *) "class");
-	if (class == NULL)
+	start = node_attribute(n, "class", &value);
+	if (start == NULL)
 		return CSS_OK;
 
-	/* We have a class attribute -- extract its value */
-	if (class->children != NULL && class->children->next == NULL &&
-			class->children->children == NULL) {
-		/* Simple case -- no XML entities */
-		start = (const char *) class->children->content;
-	} else {
-		/* Awkward case -- fall back to string copying */
-		value = xmlGetProp(n, (const xmlChar *) "class");
-		if (value == NULL)
-			return CSS_OK;
-
-		start = (const char *) value;
-	}
-
 	/* The class attribute is a space separated list of tokens. */
 	do {
 		lwc_string **temp;
@@ -553,8 +571,7 @@ cleanup:
 css_error node_id(void *pw, void *node, lwc_string **id)
 {
 	xmlNode *n = node;
-	xmlAttr *attr;
-	xmlChar *value = NULL;
+	xmlChar *value;
 	const char *start;
 	lwc_error lerror;
 	css_error error = CSS_OK;
@@ -562,24 +579,10 @@ css_error node_id(void *pw, void *node, lwc_string **id)
 	*id = NULL;
 
 	/* See if there's an id attribute on this node */
-	attr = xmlHasProp(n, (const xmlChar *) "id");
-	if (attr == NULL)
+	start = node_attribute(n, "id", &value);
+	if (start == NULL)
 		return CSS_OK;
 
-	/* We have an id attribute -- extract its value */
-	if (attr->children != NULL && attr->children->next == NULL &&
-			attr->children->children == NULL) {
-		/* Simple case -- no XML entities */
-		start = (const char *) attr->children->content;
-	} else {
-		/* Awkward case -- fall back to string copying */
-		value = xmlGetProp(n, (const xmlChar *) "id");
-		if (value == NULL)
-			return CSS_OK;
-
-		start = (const char *) value;
-	}
-
 	/* Intern value */
 	lerror = lwc_intern_string(start, strlen(start), id);
 	switch (lerror) {
@@ -781,8 +784,7 @@ css_error node_has_class(void *pw, void *node,
 {
 	struct content *html = pw;
 	xmlNode *n = node;
-	xmlAttr *class;
-	xmlChar *value = NULL;
+	xmlChar *value;
 	const char *p;
 	const char *start;
 	const char *data;
@@ -798,24 +800,10 @@ css_error node_has_class(void *pw, void *node,
 	*match = false;
 
 	/* See if there is a class attribute on this node */
-	class = xmlHasProp(n, (const xmlChar *) "class");
-	if (class == NULL)
+	start = node_attribute(n, "class", &value);
+	if (start == NULL)
 		return CSS_OK;
 
-	/* We have a class attribute -- extract its value */
-	if (class->children != NULL && class->children->next == NULL &&
-			class->children->children == NULL) {
-		/* Simple case -- no XML entities */
-		start = (const char *) class->children->content;
-	} else {
-		/* Awkward case -- fall back to string copying */
-		value = xmlGetProp(n, (const xmlChar *) "class");
-		if (value == NULL)
-			return CSS_OK;
-
-		start = (const char *) value;
-	}
-
 	/* Extract expected class name data */
 	data = lwc_string_data(name);
 	len = lwc_string_length(name);
@@ -860,8 +848,7 @@ css_error node_has_id(void *pw, void *node,
 		lwc_string *name, bool *match)
 {
 	xmlNode *n = node;
-	xmlAttr *id;
-	xmlChar *value = NULL;
+	xmlChar *value;
 	const char *start;
 	const char *data;
 	size_t len;
@@ -869,24 +856,10 @@ css_error node_has_id(void *pw, void *node,
 	*match = false;
 
 	/* See if there's an id attribute on this node */
-	id = xmlHasProp(n, (const xmlChar *) "id");
-	if (id == NULL)
+	start = node_attribute(n, "id", &value);
+	if (start == NULL)
 		return CSS_OK;
 
-	/* We have an id attribute -- extract its value */
-	if (id->children != NULL && id->children->next == NULL &&
-			id->children->children == NULL) {
-		/* Simple case -- no XML entities */
-		start = (const char *) id->children->content;
-	} else {
-		/* Awkward case -- fall back to string copying */
-		value = xmlGetProp(n, (const xmlChar *) "id");
-		if (value == NULL)
-			return CSS_OK;
-
-		start = (const char *) value;
-	}
-
 	/* Extract expected id data */
 	len = lwc_string_length(name);
 	data = lwc_string_data(name);
@@ -945,18 +918,18 @@ css_error node_has_attribute_equal(void *pw, void *node,
 		bool *match)
 {
 	xmlNode *n = node;
-	xmlChar *attr;
+	xmlChar *copy;
+	const char *attr;
 
 	*match = false;
 
-	attr = xmlGetProp(n, (const xmlChar *) lwc_string_data(name));
+	attr = node_attribute(n, lwc_string_data(name), &copy);
 	if (attr != NULL) {
-		*match = strlen((const char *) attr) ==
-					lwc_string_length(value) &&
-				strncasecmp((const char *) attr,
-					lwc_string_data(value),
+		*match = strlen(attr) == lwc_string_length(value) &&
+				strncasecmp(attr, lwc_string_data(value),
 					lwc_string_length(value)) == 0;
-		xmlFree(attr);
+		if (copy != NULL)
+			xmlFree(copy);
 	}
 
 	return CSS_OK;
@@ -981,15 +954,16 @@ css_error node_has_attribute_dashmatch(void *pw, void *node,
 		bool *match)
 {
 	xmlNode *n = node;
-	xmlChar *attr;
+	xmlChar *copy;
+	const char *attr;
         size_t vlen = lwc_string_length(value);
 
         *match = false;
 
-	attr = xmlGetProp(n, (const xmlChar *) lwc_string_data(name));
+	attr = node_attribute(n, lwc_string_data(name), &copy);
 	if (attr != NULL) {
 		const char *p;
-		const char *start = (const char *) attr;
+		const char *start = attr;
 		const char *end = start + strlen(start);
 
 		for (p = start; p <= end; p++) {
@@ -1005,6 +979,9 @@ css_error node_has_attribute_dashmatch(void *pw, void *node,
 				start = p + 1;
 			}
 		}
+
+		if (copy != NULL)
+			xmlFree(copy);
 	}
 
 	return CSS_OK;
@@ -1029,15 +1006,16 @@ css_error node_has_attribute_includes(void *pw, void *node,
 		bool *match)
 {
 	xmlNode *n = node;
-	xmlChar *attr;
+	xmlChar *copy;
+	const char *attr;
 	size_t vlen = lwc_string_length(value);
 
         *match = false;
 
-	attr = xmlGetProp(n, (const xmlChar *) lwc_string_data(name));
+	attr = node_attribute(n, lwc_string_data(name), &copy);
 	if (attr != NULL) {
 		const char *p;
-		const char *start = (const char *) attr;
+		const char *start = attr;
 		const char *end = start + strlen(start);
 
 		for (p = start; p <= end; p++) {
@@ -1053,6 +1031,9 @@ css_error node_has_attribute_includes(void *pw, void *node,
 				start = p + 1;
 			}
 		}
+
+		if (copy != NULL)
+			xmlFree(copy);
 	}
 
 	return CSS_OK;
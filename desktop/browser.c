@@ -43,6 +43,7 @@
 #include "css/css.h"
 #include "desktop/401login.h"
 #include "desktop/browser.h"
+#include "desktop/damage.h"
 #include "desktop/download.h"
 #include "desktop/frames.h"
 #include "desktop/history_core.h"
@@ -73,6 +74,9 @@ bool browser_reformat_pending;
 /** maximum frame depth */
 #define FRAME_DEPTH 8
 
+/** interval between redraws once a page has loaded, in cs */
+#define REDRAW_FRAME_PERIOD 2
+
 static void browser_window_go_post(struct browser_window *bw,
 		const char *url, char *post_urlenc,
 		struct fetch_multipart_data *post_multipart,
@@ -81,6 +85,13 @@ static void browser_window_go_post(struct browser_window *bw,
 static nserror browser_window_callback(hlcache_handle *c,
 		const hlcache_event *event, void *pw);
 static void browser_window_refresh(void *p);
+static void browser_window_queue_redraw(struct browser_window *bw,
+		const union content_msg_data *data);
+static void browser_window_redraw_pixels(const union content_msg_data *area,
+		struct rect *rect);
+static void browser_window_redraw_merge(union content_msg_data *area,
+		const union content_msg_data *other);
+static void browser_window_redraw_flush(void *p);
 static bool browser_window_check_throbber(struct browser_window *bw);
 static void browser_window_convert_to_download(struct browser_window *bw, 
 		llcache_handle *stream);
@@ -199,6 +210,11 @@ void browser_window_initialise_common(struct browser_window *bw,
 	bw->status_text_len = 0;
 	bw->status_match = 0;
 	bw->status_miss = 0;
+
+	/* initialise redraw coalescing */
+	bw->redraw_count = 0;
+	bw->redraw_requests = 0;
+	bw->redraw_paints = 0;
 }
 
 
@@ -504,6 +520,10 @@ nserror browser_window_callback(hlcache_handle *c,
 		bw->current_content = c;
 		bw->loading_content = NULL;
 
+		/* the whole window is about to be redrawn */
+		bw->redraw_count = 0;
+		schedule_remove(browser_window_redraw_flush, bw);
+
 		browser_window_remove_caret(bw);
 
 		bw->scroll = NULL;
@@ -535,9 +555,11 @@ nserror browser_window_callback(hlcache_handle *c,
 		}
 
 		/* text selection */
-		if (content_get_type(c) == CONTENT_HTML)
-			selection_init(bw->sel,
-					html_get_box_tree(bw->current_content));
+		bw->box_tree = NULL;
+		if (content_get_type(c) == CONTENT_HTML) {
+			bw->box_tree = html_get_box_tree(bw->current_content);
+			selection_init(bw->sel, bw->box_tree);
+		}
 		if (content_get_type(c) == CONTENT_TEXTPLAIN)
 			selection_init(bw->sel, NULL);
 
@@ -555,6 +577,24 @@ nserror browser_window_callback(hlcache_handle *c,
 	case CONTENT_MSG_DONE:
 		assert(bw->current_content == c);
 
+		/* iframes may have been parsed after the start of the
+		 * document was displayed */
+		if (content_get_type(c) == CONTENT_HTML &&
+				html_get_frameset(c) == NULL) {
+			struct content_html_iframe *iframe;
+			int iframes = 0;
+
+			for (iframe = html_get_iframe(c); iframe != NULL;
+					iframe = iframe->next)
+				iframes++;
+
+			if (iframes != bw->iframe_count) {
+				browser_window_destroy_children(bw);
+				browser_window_create_iframes(bw,
+						html_get_iframe(c));
+			}
+		}
+
 		browser_window_update(bw, false);
 		browser_window_set_status(bw, content_get_status_message(c));
 		browser_window_stop_throbber(bw);
@@ -599,8 +639,23 @@ nserror browser_window_callback(hlcache_handle *c,
 			/* reposition frames */
 			if (html_get_frameset(c) != NULL)
 				browser_window_recalculate_frameset(bw);
+			/* the box tree may have been rebuilt, as part of the
+			 * document changed after it was displayed */
+			if (html_get_box_tree(c) != bw->box_tree) {
+				browser_window_remove_caret(bw);
+				bw->scroll = NULL;
+				if (bw->drag_type == DRAGGING_SELECTION)
+					bw->drag_type = DRAGGING_NONE;
+				bw->box_tree = html_get_box_tree(c);
+				selection_init(bw->sel, bw->box_tree);
+
+				browser_window_destroy_children(bw);
+				if (html_get_iframe(c) != NULL)
+					browser_window_create_iframes(bw,
+							html_get_iframe(c));
+			}
 			/* reflow iframe positions */
-			if (html_get_iframe(c) != NULL)
+			else if (html_get_iframe(c) != NULL)
 				browser_window_recalculate_iframes(bw);
 			/* box tree may have changed, need to relabel */
 			selection_reinit(bw->sel, html_get_box_tree(c));
@@ -613,7 +668,7 @@ nserror browser_window_callback(hlcache_handle *c,
 		break;
 
 	case CONTENT_MSG_REDRAW:
-		gui_window_update_box(bw->window, &event->data);
+		browser_window_queue_redraw(bw, &event->data);
 		break;
 
 	case CONTENT_MSG_REFRESH:
@@ -700,6 +755,145 @@ void browser_window_refresh(void *p)
 	}
 }
 
+/**
+ * Queue an area of a browser window for redraw, merging it with areas
+ * already queued where that costs little.
+ *
+ * \param  bw    browser window
+ * \param  data  redraw data from CONTENT_MSG_REDRAW
+ *
+ * Contents may request many redraws in quick succession, for example as
+ * each image on a page arrives.  Rather than pass each to the front end,
+ * they are collected and passed on at most once per display frame, or
+ * once per option_min_redraw_period while the page is loading.
+ */
+
+void browser_window_queue_redraw(struct browser_window *bw,
+		const union content_msg_data *data)
+{
+	union content_msg_data area = *data;
+	struct rect rect, queued[BROWSER_REDRAW_AREAS];
+	int i, a, b;
+
+	bw->redraw_requests++;
+
+	if (bw->redraw_count == 0) {
+		int period = REDRAW_FRAME_PERIOD;
+
+		if (bw->current_content == NULL || content_get_status(
+				bw->current_content) != CONTENT_STATUS_DONE)
+			period = max(period, (int) option_min_redraw_period);
+
+		schedule(period, browser_window_redraw_flush, bw);
+	}
+
+	browser_window_redraw_pixels(&area, &rect);
+	for (i = 0; i != bw->redraw_count; i++)
+		browser_window_redraw_pixels(&bw->redraw[i], &queued[i]);
+
+	/* absorb queued areas for as long as the bounding box costs no more
+	 * to redraw than the areas separately */
+	while ((i = damage_find_free(&rect, queued, bw->redraw_count)) != -1) {
+		browser_window_redraw_merge(&area, &bw->redraw[i]);
+		damage_union(&rect, &queued[i]);
+
+		bw->redraw_count--;
+		bw->redraw[i] = bw->redraw[bw->redraw_count];
+		queued[i] = queued[bw->redraw_count];
+	}
+
+	if (bw->redraw_count != BROWSER_REDRAW_AREAS) {
+		bw->redraw[bw->redraw_count++] = area;
+		return;
+	}
+
+	/* no room; merge the pair of areas which wastes least */
+	damage_find_cheapest(&rect, queued, bw->redraw_count, &a, &b);
+	if (a == -1) {
+		browser_window_redraw_merge(&bw->redraw[b], &area);
+	} else {
+		browser_window_redraw_merge(&bw->redraw[a], &bw->redraw[b]);
+		bw->redraw[b] = area;
+	}
+}
+
+
+/**
+ * Find the pixels covered by an area queued for redraw.
+ *
+ * \param  area  area in CONTENT_MSG_REDRAW data
+ * \param  rect  updated to pixels covered by area
+ */
+
+void browser_window_redraw_pixels(const union content_msg_data *area,
+		struct rect *rect)
+{
+	rect->x0 = floorf(area->redraw.x);
+	rect->y0 = floorf(area->redraw.y);
+	rect->x1 = ceilf(area->redraw.x + area->redraw.width);
+	rect->y1 = ceilf(area->redraw.y + area->redraw.height);
+}
+
+
+/**
+ * Extend an area queued for redraw to cover another.
+ *
+ * \param  area   area, updated
+ * \param  other  area to merge into area
+ */
+
+void browser_window_redraw_merge(union content_msg_data *area,
+		const union content_msg_data *other)
+{
+	float x0, y0, x1, y1;
+
+	/* an object redrawn again in the same place may still be redrawn
+	 * alone */
+	if (area->redraw.full_redraw || other->redraw.full_redraw ||
+			area->redraw.object != other->redraw.object ||
+			area->redraw.x != other->redraw.x ||
+			area->redraw.y != other->redraw.y ||
+			area->redraw.width != other->redraw.width ||
+			area->redraw.height != other->redraw.height)
+		area->redraw.full_redraw = true;
+
+	x0 = min(area->redraw.x, other->redraw.x);
+	y0 = min(area->redraw.y, other->redraw.y);
+	x1 = max(area->redraw.x + area->redraw.width,
+			other->redraw.x + other->redraw.width);
+	y1 = max(area->redraw.y + area->redraw.height,
+			other->redraw.y + other->redraw.height);
+
+	area->redraw.x = x0;
+	area->redraw.y = y0;
+	area->redraw.width = x1 - x0;
+	area->redraw.height = y1 - y0;
+}
+
+
+/**
+ * Pass the areas queued for redraw to the front end.
+ *
+ * \param  p  browser window
+ */
+
+void browser_window_redraw_flush(void *p)
+{
+	struct browser_window *bw = p;
+	union content_msg_data redraw[BROWSER_REDRAW_AREAS];
+	int count = bw->redraw_count;
+	int i;
+
+	memcpy(redraw, bw->redraw, count * sizeof redraw[0]);
+	bw->redraw_count = 0;
+
+	for (i = 0; i != count; i++)
+		gui_window_update_box(bw->window, &redraw[i]);
+
+	bw->redraw_paints += count;
+}
+
+
 
 /**
  * Start the busy indicator.
@@ -803,7 +997,11 @@ void browser_window_update(struct browser_window *bw, bool scroll_to_top)
 	/* if frag_id exists, then try to scroll to it */
 	if (bw->frag_id && 
 			content_get_type(bw->current_content) == CONTENT_HTML) {
-		struct box *layout = html_get_box_tree(bw->current_content);
+		struct box *layout;
+
+		/* the fragment may be in a part which isn't laid out yet */
+		html_complete_layout(bw->current_content);
+		layout = html_get_box_tree(bw->current_content);
 
 		if ((pos = box_find_by_id(layout, bw->frag_id)) != 0) {
 			box_coords(pos, &x, &y);
@@ -1040,6 +1238,7 @@ void browser_window_destroy_internal(struct browser_window *bw)
 	}
 
 	schedule_remove(browser_window_refresh, bw);
+	schedule_remove(browser_window_redraw_flush, bw);
 
 	selection_destroy(bw->sel);
 	history_destroy(bw->history);
@@ -1051,6 +1250,8 @@ void browser_window_destroy_internal(struct browser_window *bw)
 	bw->status_text = NULL;
 	LOG(("Status text cache match:miss %d:%d", 
 	     bw->status_match, bw->status_miss));
+	LOG(("Redraw requests:paints %d:%d",
+	     bw->redraw_requests, bw->redraw_paints));
 }
 
 
@@ -28,6 +28,7 @@
 #include <stdbool.h>
 #include <time.h>
 
+#include "content/content.h"
 #include "render/html.h"
 
 struct box;
@@ -51,6 +52,9 @@ typedef void (*browser_move_callback)(struct browser_window *bw,
 
 
 
+/** Maximum number of separate areas of a browser window awaiting redraw. */
+#define BROWSER_REDRAW_AREAS 8
+
 /** Browser window data. */
 struct browser_window {
 	/** Page currently displayed, or 0. Must have status READY or DONE. */
@@ -63,6 +67,9 @@ struct browser_window {
 
 	/** Selection state */
 	struct selection *sel;
+	/** Box tree of current_content which the caret, selection and
+	 * scroll refer to, or 0. */
+	struct box *box_tree;
 
 	/** Handler for keyboard input, or 0. */
 	browser_caret_callback caret_callback;
@@ -177,6 +184,12 @@ struct browser_window {
 	int status_text_len; /**< Length of the ::status_text buffer. */
 	int status_match; /**< Number of times an idempotent status-set operation was performed. */
 	int status_miss; /**< Number of times status was really updated. */
+
+	/** Content redraws not yet passed to the front end. */
+	union content_msg_data redraw[BROWSER_REDRAW_AREAS];
+	int redraw_count; /**< Number of entries in ::redraw. */
+	int redraw_requests; /**< Number of redraws requested by contents. */
+	int redraw_paints; /**< Number of redraws passed to the front end. */
 };
 
 
@@ -290,11 +303,14 @@ char **global_history_get_recent(int *count);
 bool thumbnail_create(struct hlcache_handle *content, struct bitmap *bitmap,
 		const char *url);
 
-/* In platform specific schedule.c. */
+/* In platform specific schedule.c, or desktop/schedule.c. */
 void schedule(int t, void (*callback)(void *p), void *p);
 void schedule_remove(void (*callback)(void *p), void *p);
 bool schedule_run(void);
 
+/* In desktop/schedule.c. */
+int schedule_timeout(void);
+
 /* In platform specific theme_install.c. */
 #ifdef WITH_THEME_INSTALL
 void theme_install_start(struct hlcache_handle *c);
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Merging of areas queued for redraw (implementation).
+ *
+ * Both the core, which queues the areas contents ask to be redrawn, and
+ * front ends which queue the areas to repaint, keep a short list of areas.
+ * A new area absorbs any queued area where their bounding box costs no
+ * more to redraw than the two separately.  When the list is full, the two
+ * areas, new or queued, whose bounding box wastes least are merged.  Using
+ * the same rules at both levels means that areas merged by the core are
+ * not then split or merged differently by the front end.
+ */
+
+#include <limits.h>
+
+#include "desktop/damage.h"
+#include "render/box.h"
+#include "utils/utils.h"
+
+
+/**
+ * Find the area which would be redrawn needlessly if two areas were
+ * replaced by their bounding box.
+ *
+ * \param  a  area
+ * \param  b  another area
+ * \return  number of pixels wasted, or negative if the areas overlap so
+ *          much that their bounding box is cheaper to redraw than both
+ */
+
+int damage_waste(const struct rect *a, const struct rect *b)
+{
+	struct rect u = *a;
+
+	damage_union(&u, b);
+
+	return (u.x1 - u.x0) * (u.y1 - u.y0) -
+			(a->x1 - a->x0) * (a->y1 - a->y0) -
+			(b->x1 - b->x0) * (b->y1 - b->y0);
+}
+
+
+/**
+ * Extend an area to the bounding box of it and another.
+ *
+ * \param  a  area, updated
+ * \param  b  another area
+ */
+
+void damage_union(struct rect *a, const struct rect *b)
+{
+	a->x0 = min(a->x0, b->x0);
+	a->y0 = min(a->y0, b->y0);
+	a->x1 = max(a->x1, b->x1);
+	a->y1 = max(a->y1, b->y1);
+}
+
+
+/**
+ * Find a queued area which a new area can absorb at no cost.
+ *
+ * \param  area    new area
+ * \param  queued  queued areas
+ * \param  count   number of queued areas
+ * \return  index in queued, or -1 if none
+ *
+ * The caller merges the area found and calls again, until there are none.
+ */
+
+int damage_find_free(const struct rect *area, const struct rect *queued,
+		int count)
+{
+	int i;
+
+	for (i = 0; i != count; i++)
+		if (damage_waste(area, &queued[i]) <= 0)
+			return i;
+
+	return -1;
+}
+
+
+/**
+ * Find the pair of areas whose bounding box wastes least, for when the
+ * list of queued areas is full.
+ *
+ * \param  area    new area
+ * \param  queued  queued areas
+ * \param  count   number of queued areas, at least 1
+ * \param  a       updated to -1 to merge area into queued[*b], or to the
+ *                 index of a queued area to merge queued[*b] into, in
+ *                 which case area takes the place of queued[*b]
+ * \param  b       updated to index of a queued area
+ */
+
+void damage_find_cheapest(const struct rect *area, const struct rect *queued,
+		int count, int *a, int *b)
+{
+	int i, j, waste, best_waste = INT_MAX;
+
+	*a = -1;
+	*b = 0;
+
+	for (i = 0; i != count; i++) {
+		waste = damage_waste(area, &queued[i]);
+		if (waste < best_waste) {
+			best_waste = waste;
+			*a = -1;
+			*b = i;
+		}
+
+		for (j = i + 1; j != count; j++) {
+			waste = damage_waste(&queued[i], &queued[j]);
+			if (waste < best_waste) {
+				best_waste = waste;
+				*a = i;
+				*b = j;
+			}
+		}
+	}
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Merging of areas queued for redraw (interface).
+ */
+
+#ifndef _NETSURF_DESKTOP_DAMAGE_H_
+#define _NETSURF_DESKTOP_DAMAGE_H_
+
+struct rect;
+
+int damage_waste(const struct rect *a, const struct rect *b);
+void damage_union(struct rect *a, const struct rect *b);
+int damage_find_free(const struct rect *area, const struct rect *queued,
+		int count);
+void damage_find_cheapest(const struct rect *area, const struct rect *queued,
+		int count, int *a, int *b);
+
+#endif
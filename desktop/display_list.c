@@ -0,0 +1,1053 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Recorded plot operations (implementation).
+ *
+ * While recording, the current plotters are replaced by display_list_plotters,
+ * which append each operation to a flat array. Each operation is given
+ * bounds, from its own geometry where that is known, intersected with the
+ * clip rectangle in effect and with the bounds given by the caller for the
+ * current group (see display_list_bounds()). Operations which would be
+ * entirely clipped away are not recorded at all.
+ *
+ * Operations are grouped into fixed size chunks with the union of their
+ * bounds, so that replay can skip large parts of the list at once.
+ *
+ * Contents (such as images) embedded in the recorded drawing are not
+ * recorded as the plot operations they would make, but as a request to
+ * redraw the content, so that animations and contents which plot
+ * independently of the plotters continue to work on replay.
+ *
+ * Replay issues clip operations lazily, only before an operation which is
+ * actually plotted, so that the many clip changes made while drawing
+ * invisible parts of a document cost nothing.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "content/content.h"
+#include "content/hlcache.h"
+#include "desktop/display_list.h"
+#include "desktop/plotters.h"
+#include "utils/log.h"
+
+/** Number of operations in a chunk */
+#define DISPLAY_LIST_CHUNK 64
+/** Maximum number of operations in a list */
+#define DISPLAY_LIST_MAX_OPS 131072
+
+/** Rectangle, in the coordinates given to the plotters */
+struct display_list_rect {
+	int x0, y0, x1, y1;
+};
+
+/** Type of recorded operation */
+typedef enum {
+	DISPLAY_LIST_CLIP,
+	DISPLAY_LIST_ARC,
+	DISPLAY_LIST_DISC,
+	DISPLAY_LIST_LINE,
+	DISPLAY_LIST_RECTANGLE,
+	DISPLAY_LIST_POLYGON,
+	DISPLAY_LIST_PATH,
+	DISPLAY_LIST_BITMAP,
+	DISPLAY_LIST_TEXT,
+	DISPLAY_LIST_CONTENT,
+	DISPLAY_LIST_CONTENT_TILED
+} display_list_type;
+
+/** Recorded operation */
+struct display_list_op {
+	display_list_type type;
+	struct display_list_rect bounds;	/**< Area affected */
+	union {
+		struct display_list_rect clip;
+		struct {
+			int x, y, radius, angle1, angle2;
+			plot_style_t style;
+		} arc;
+		struct {
+			int x0, y0, x1, y1;
+			plot_style_t style;
+		} line;
+		struct {
+			size_t p;		/**< Offset of points in data */
+			unsigned int n;
+			plot_style_t style;
+		} polygon;
+		struct {
+			size_t p;		/**< Offset of path in data */
+			unsigned int n;
+			colour fill;
+			float width;
+			colour c;
+			float transform[6];
+		} path;
+		struct {
+			int x, y, width, height;
+			struct bitmap *bitmap;
+			colour bg;
+			bitmap_flags_t flags;
+		} bitmap;
+		struct {
+			int x, y;
+			size_t text;		/**< Offset of text in data */
+			size_t length;
+			plot_font_style_t fstyle;
+		} text;
+		struct {
+			struct hlcache_handle *h;
+			int x, y, width, height;
+			struct display_list_rect clip;
+			colour bg;
+			bool repeat_x, repeat_y;
+		} content;
+	} data;
+};
+
+/** Summary of a chunk of operations */
+struct display_list_chunk {
+	struct display_list_rect bounds;	/**< Union of op bounds */
+	int clip;		/**< Index of last clip op in chunk, or -1 */
+};
+
+/** Display list */
+struct display_list {
+	struct display_list_op *op;		/**< Operations */
+	unsigned int count;			/**< Number of operations */
+	unsigned int size;			/**< Allocated operations */
+	struct display_list_chunk *chunk;	/**< One per CHUNK ops */
+	char *data;			/**< Text, points and paths */
+	size_t data_length;		/**< Used bytes of data */
+	size_t data_size;		/**< Allocated bytes of data */
+	bool failed;			/**< Recording ran out of memory */
+};
+
+
+/** List being recorded, or 0 */
+static struct display_list *display_list_current;
+/** Plotters in use before recording started */
+static struct plotter_table display_list_saved_plot;
+/** Current clip rectangle while recording */
+static struct display_list_rect display_list_clip;
+/** Bounds for the next group started */
+static struct display_list_rect display_list_next_bounds;
+static bool display_list_next_bounds_set;
+/** Stack of group bounds */
+static struct display_list_rect *display_list_group;
+static unsigned int display_list_group_depth;
+static unsigned int display_list_group_size;
+
+/** Everything */
+static const struct display_list_rect display_list_everything = {
+	INT_MIN, INT_MIN, INT_MAX, INT_MAX
+};
+
+
+static bool display_list_plot_clip(int x0, int y0, int x1, int y1);
+static bool display_list_plot_arc(int x, int y, int radius, int angle1,
+		int angle2, const plot_style_t *pstyle);
+static bool display_list_plot_disc(int x, int y, int radius,
+		const plot_style_t *pstyle);
+static bool display_list_plot_line(int x0, int y0, int x1, int y1,
+		const plot_style_t *pstyle);
+static bool display_list_plot_rectangle(int x0, int y0, int x1, int y1,
+		const plot_style_t *pstyle);
+static bool display_list_plot_polygon(const int *p, unsigned int n,
+		const plot_style_t *pstyle);
+static bool display_list_plot_path(const float *p, unsigned int n,
+		colour fill, float width, colour c, const float transform[6]);
+static bool display_list_plot_bitmap(int x, int y, int width, int height,
+		struct bitmap *bitmap, colour bg, bitmap_flags_t flags);
+static bool display_list_plot_text(int x, int y, const char *text,
+		size_t length, const plot_font_style_t *fstyle);
+static bool display_list_plot_group_start(const char *name);
+static bool display_list_plot_group_end(void);
+static struct display_list_op *display_list_add(display_list_type type,
+		int x0, int y0, int x1, int y1);
+static bool display_list_store(const void *p, size_t size, size_t *offset);
+static bool display_list_plot(const struct display_list *dl,
+		const struct display_list_op *op, int x, int y,
+		const struct display_list_rect *clip);
+static void display_list_intersect(struct display_list_rect *r,
+		const struct display_list_rect *s);
+static bool display_list_intersects(const struct display_list_rect *r,
+		const struct display_list_rect *s);
+
+
+/** Plotters which record to display_list_current */
+static const struct plotter_table display_list_plotters = {
+	.clip = display_list_plot_clip,
+	.arc = display_list_plot_arc,
+	.disc = display_list_plot_disc,
+	.line = display_list_plot_line,
+	.rectangle = display_list_plot_rectangle,
+	.polygon = display_list_plot_polygon,
+	.path = display_list_plot_path,
+	.bitmap = display_list_plot_bitmap,
+	.text = display_list_plot_text,
+	.group_start = display_list_plot_group_start,
+	.group_end = display_list_plot_group_end,
+	.flush = NULL,
+	.option_knockout = false
+};
+
+
+/**
+ * Create an empty display list.
+ *
+ * \return  new display list, or 0 on memory exhaustion
+ */
+
+struct display_list *display_list_create(void)
+{
+	return calloc(1, sizeof (struct display_list));
+}
+
+
+/**
+ * Destroy a display list.
+ *
+ * \param  dl  display list to destroy
+ */
+
+void display_list_destroy(struct display_list *dl)
+{
+	assert(dl != display_list_current);
+
+	free(dl->op);
+	free(dl->chunk);
+	free(dl->data);
+	free(dl);
+}
+
+
+/**
+ * Start recording plot operations to a display list.
+ *
+ * \param  dl  empty display list to record to
+ * \return  true on success, false if already recording
+ *
+ * The current plotters are saved and replaced until display_list_record_end()
+ * is called.
+ */
+
+bool display_list_record_start(struct display_list *dl)
+{
+	assert(dl->count == 0);
+
+	if (display_list_current)
+		return false;
+
+	display_list_current = dl;
+	display_list_saved_plot = plot;
+	plot = display_list_plotters;
+
+	display_list_clip = display_list_everything;
+	display_list_next_bounds_set = false;
+	display_list_group_depth = 0;
+
+	return true;
+}
+
+
+/**
+ * Finish recording, and restore the previous plotters.
+ *
+ * \return  true if the display list is complete, false if recording failed
+ */
+
+bool display_list_record_end(void)
+{
+	struct display_list *dl = display_list_current;
+
+	assert(dl);
+
+	plot = display_list_saved_plot;
+	display_list_current = NULL;
+
+	free(display_list_group);
+	display_list_group = NULL;
+	display_list_group_size = 0;
+
+	LOG(("%u ops, %zu bytes of data%s", dl->count, dl->data_length,
+			dl->failed ? ", failed" : ""));
+
+	return !dl->failed;
+}
+
+
+/**
+ * Find if a display list is being recorded.
+ *
+ * \return  true if plot operations are being recorded
+ */
+
+bool display_list_recording(void)
+{
+	return display_list_current != NULL;
+}
+
+
+/**
+ * Give the bounds of everything plotted in the next group.
+ *
+ * \param  x0  left of bounds
+ * \param  y0  top of bounds
+ * \param  x1  right of bounds
+ * \param  y1  bottom of bounds
+ *
+ * The bounds apply until the group_end matching the next group_start. Groups
+ * without bounds inherit those of the enclosing group. Only effective while
+ * recording.
+ */
+
+void display_list_bounds(int x0, int y0, int x1, int y1)
+{
+	if (!display_list_current)
+		return;
+
+	display_list_next_bounds.x0 = x0;
+	display_list_next_bounds.y0 = y0;
+	display_list_next_bounds.x1 = x1;
+	display_list_next_bounds.y1 = y1;
+	display_list_next_bounds_set = true;
+}
+
+
+/**
+ * Redraw a content, or record the redraw if a display list is being recorded.
+ *
+ * Takes the same parameters as content_redraw().
+ */
+
+bool display_list_content_redraw(struct hlcache_handle *h, int x, int y,
+		int width, int height,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		float scale, colour background_colour)
+{
+	struct display_list_op *op;
+
+	if (!display_list_current)
+		return content_redraw(h, x, y, width, height,
+				clip_x0, clip_y0, clip_x1, clip_y1,
+				scale, background_colour);
+
+	assert(scale == 1.0);
+
+	op = display_list_add(DISPLAY_LIST_CONTENT,
+			clip_x0, clip_y0, clip_x1, clip_y1);
+	if (!op)
+		return !display_list_current->failed;
+
+	op->data.content.h = h;
+	op->data.content.x = x;
+	op->data.content.y = y;
+	op->data.content.width = width;
+	op->data.content.height = height;
+	op->data.content.clip = op->bounds;
+	op->data.content.bg = background_colour;
+	op->data.content.repeat_x = false;
+	op->data.content.repeat_y = false;
+
+	return true;
+}
+
+
+/**
+ * Redraw a content with tiling, or record the redraw if a display list is
+ * being recorded.
+ *
+ * Takes the same parameters as content_redraw_tiled().
+ */
+
+bool display_list_content_redraw_tiled(struct hlcache_handle *h,
+		int x, int y, int width, int height,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		float scale, colour background_colour,
+		bool repeat_x, bool repeat_y)
+{
+	struct display_list_op *op;
+
+	if (!display_list_current)
+		return content_redraw_tiled(h, x, y, width, height,
+				clip_x0, clip_y0, clip_x1, clip_y1,
+				scale, background_colour, repeat_x, repeat_y);
+
+	assert(scale == 1.0);
+
+	op = display_list_add(DISPLAY_LIST_CONTENT_TILED,
+			clip_x0, clip_y0, clip_x1, clip_y1);
+	if (!op)
+		return !display_list_current->failed;
+
+	op->data.content.h = h;
+	op->data.content.x = x;
+	op->data.content.y = y;
+	op->data.content.width = width;
+	op->data.content.height = height;
+	op->data.content.clip = op->bounds;
+	op->data.content.bg = background_colour;
+	op->data.content.repeat_x = repeat_x;
+	op->data.content.repeat_y = repeat_y;
+
+	return true;
+}
+
+
+/**
+ * Replay a display list using the current plotters.
+ *
+ * \param  dl       display list to replay
+ * \param  x        offset to add to recorded coordinates
+ * \param  y        offset to add to recorded coordinates
+ * \param  clip_x0  clip rectangle, in target coordinates
+ * \param  clip_y0  clip rectangle
+ * \param  clip_x1  clip rectangle
+ * \param  clip_y1  clip rectangle
+ * \return  true on success, false on error
+ *
+ * The plotters must already be clipped to the clip rectangle. They are left
+ * clipped to it on return.
+ */
+
+bool display_list_replay(struct display_list *dl, int x, int y,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1)
+{
+	struct display_list_rect clip, pending, current;
+	const struct display_list_op *op;
+	const struct display_list_chunk *chunk;
+	unsigned int c, i, end;
+
+	assert(!dl->failed);
+
+	/* work in recorded coordinates */
+	clip.x0 = clip_x0 - x;
+	clip.y0 = clip_y0 - y;
+	clip.x1 = clip_x1 - x;
+	clip.y1 = clip_y1 - y;
+	pending = current = clip;
+
+	for (c = 0; c * DISPLAY_LIST_CHUNK < dl->count; c++) {
+		chunk = &dl->chunk[c];
+
+		if (!display_list_intersects(&chunk->bounds, &clip)) {
+			/* nothing visible: just track the clip rectangle */
+			if (chunk->clip != -1) {
+				pending = dl->op[chunk->clip].data.clip;
+				display_list_intersect(&pending, &clip);
+			}
+			continue;
+		}
+
+		end = (c + 1) * DISPLAY_LIST_CHUNK;
+		if (dl->count < end)
+			end = dl->count;
+
+		for (i = c * DISPLAY_LIST_CHUNK; i != end; i++) {
+			op = &dl->op[i];
+
+			if (op->type == DISPLAY_LIST_CLIP) {
+				pending = op->data.clip;
+				display_list_intersect(&pending, &clip);
+				continue;
+			}
+
+			if (pending.x1 <= pending.x0 ||
+					pending.y1 <= pending.y0 ||
+					!display_list_intersects(&op->bounds,
+					&pending))
+				continue;
+
+			if (memcmp(&pending, &current, sizeof pending) != 0) {
+				if (!plot.clip(pending.x0 + x, pending.y0 + y,
+						pending.x1 + x, pending.y1 + y))
+					return false;
+				current = pending;
+			}
+
+			if (!display_list_plot(dl, op, x, y, &pending))
+				return false;
+		}
+	}
+
+	if (memcmp(&clip, &current, sizeof clip) != 0)
+		return plot.clip(clip_x0, clip_y0, clip_x1, clip_y1);
+
+	return true;
+}
+
+
+/**
+ * Find the memory used by a display list.
+ *
+ * \param  dl  display list
+ * \return  size in bytes
+ */
+
+size_t display_list_size(const struct display_list *dl)
+{
+	return sizeof *dl + dl->size * sizeof dl->op[0] +
+			(dl->size / DISPLAY_LIST_CHUNK) * sizeof dl->chunk[0] +
+			dl->data_size;
+}
+
+
+/******************************************************************************
+ * Recording plotters                                                         *
+ ******************************************************************************/
+
+bool display_list_plot_clip(int x0, int y0, int x1, int y1)
+{
+	struct display_list *dl = display_list_current;
+	struct display_list_op *op;
+	struct display_list_chunk *chunk;
+
+	display_list_clip.x0 = x0;
+	display_list_clip.y0 = y0;
+	display_list_clip.x1 = x1;
+	display_list_clip.y1 = y1;
+
+	/* a clip followed directly by another has no effect */
+	if (dl->count && dl->op[dl->count - 1].type == DISPLAY_LIST_CLIP) {
+		dl->op[dl->count - 1].data.clip = display_list_clip;
+		return true;
+	}
+
+	op = display_list_add(DISPLAY_LIST_CLIP, INT_MIN, INT_MIN,
+			INT_MAX, INT_MAX);
+	if (!op)
+		return false;
+
+	op->data.clip = display_list_clip;
+
+	chunk = &dl->chunk[(dl->count - 1) / DISPLAY_LIST_CHUNK];
+	chunk->clip = dl->count - 1;
+
+	return true;
+}
+
+bool display_list_plot_arc(int x, int y, int radius, int angle1, int angle2,
+		const plot_style_t *pstyle)
+{
+	int w = pstyle->stroke_width + 1;
+	struct display_list_op *op;
+
+	op = display_list_add(DISPLAY_LIST_ARC, x - radius - w, y - radius - w,
+			x + radius + w, y + radius + w);
+	if (!op)
+		return !display_list_current->failed;
+
+	op->data.arc.x = x;
+	op->data.arc.y = y;
+	op->data.arc.radius = radius;
+	op->data.arc.angle1 = angle1;
+	op->data.arc.angle2 = angle2;
+	op->data.arc.style = *pstyle;
+
+	return true;
+}
+
+bool display_list_plot_disc(int x, int y, int radius,
+		const plot_style_t *pstyle)
+{
+	int w = pstyle->stroke_width + 1;
+	struct display_list_op *op;
+
+	op = display_list_add(DISPLAY_LIST_DISC, x - radius - w, y - radius - w,
+			x + radius + w, y + radius + w);
+	if (!op)
+		return !display_list_current->failed;
+
+	op->data.arc.x = x;
+	op->data.arc.y = y;
+	op->data.arc.radius = radius;
+	op->data.arc.style = *pstyle;
+
+	return true;
+}
+
+bool display_list_plot_line(int x0, int y0, int x1, int y1,
+		const plot_style_t *pstyle)
+{
+	int w = pstyle->stroke_width + 1;
+	struct display_list_op *op;
+
+	op = display_list_add(DISPLAY_LIST_LINE,
+			(x0 < x1 ? x0 : x1) - w, (y0 < y1 ? y0 : y1) - w,
+			(x0 < x1 ? x1 : x0) + w, (y0 < y1 ? y1 : y0) + w);
+	if (!op)
+		return !display_list_current->failed;
+
+	op->data.line.x0 = x0;
+	op->data.line.y0 = y0;
+	op->data.line.x1 = x1;
+	op->data.line.y1 = y1;
+	op->data.line.style = *pstyle;
+
+	return true;
+}
+
+bool display_list_plot_rectangle(int x0, int y0, int x1, int y1,
+		const plot_style_t *pstyle)
+{
+	int w = pstyle->stroke_width + 1;
+	struct display_list_op *op;
+
+	op = display_list_add(DISPLAY_LIST_RECTANGLE,
+			(x0 < x1 ? x0 : x1) - w, (y0 < y1 ? y0 : y1) - w,
+			(x0 < x1 ? x1 : x0) + w, (y0 < y1 ? y1 : y0) + w);
+	if (!op)
+		return !display_list_current->failed;
+
+	op->data.line.x0 = x0;
+	op->data.line.y0 = y0;
+	op->data.line.x1 = x1;
+	op->data.line.y1 = y1;
+	op->data.line.style = *pstyle;
+
+	return true;
+}
+
+bool display_list_plot_polygon(const int *p, unsigned int n,
+		const plot_style_t *pstyle)
+{
+	struct display_list_op *op;
+	int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+	unsigned int i;
+
+	if (n == 0)
+		return true;
+
+	for (i = 0; i != n; i++) {
+		if (p[i * 2] < x0)
+			x0 = p[i * 2];
+		if (x1 < p[i * 2])
+			x1 = p[i * 2];
+		if (p[i * 2 + 1] < y0)
+			y0 = p[i * 2 + 1];
+		if (y1 < p[i * 2 + 1])
+			y1 = p[i * 2 + 1];
+	}
+
+	op = display_list_add(DISPLAY_LIST_POLYGON, x0, y0, x1 + 1, y1 + 1);
+	if (!op)
+		return !display_list_current->failed;
+
+	if (!display_list_store(p, n * 2 * sizeof p[0], &op->data.polygon.p))
+		return false;
+	op->data.polygon.n = n;
+	op->data.polygon.style = *pstyle;
+
+	return true;
+}
+
+bool display_list_plot_path(const float *p, unsigned int n, colour fill,
+		float width, colour c, const float transform[6])
+{
+	struct display_list_op *op;
+
+	op = display_list_add(DISPLAY_LIST_PATH, INT_MIN, INT_MIN,
+			INT_MAX, INT_MAX);
+	if (!op)
+		return !display_list_current->failed;
+
+	if (!display_list_store(p, n * sizeof p[0], &op->data.path.p))
+		return false;
+	op->data.path.n = n;
+	op->data.path.fill = fill;
+	op->data.path.width = width;
+	op->data.path.c = c;
+	memcpy(op->data.path.transform, transform,
+			sizeof op->data.path.transform);
+
+	return true;
+}
+
+bool display_list_plot_bitmap(int x, int y, int width, int height,
+		struct bitmap *bitmap, colour bg, bitmap_flags_t flags)
+{
+	struct display_list_op *op;
+	int x0 = x, y0 = y, x1 = x + width, y1 = y + height;
+
+	/* tiled bitmaps fill the clip rectangle */
+	if (flags & BITMAPF_REPEAT_X) {
+		x0 = INT_MIN;
+		x1 = INT_MAX;
+	}
+	if (flags & BITMAPF_REPEAT_Y) {
+		y0 = INT_MIN;
+		y1 = INT_MAX;
+	}
+
+	op = display_list_add(DISPLAY_LIST_BITMAP, x0, y0, x1, y1);
+	if (!op)
+		return !display_list_current->failed;
+
+	op->data.bitmap.x = x;
+	op->data.bitmap.y = y;
+	op->data.bitmap.width = width;
+	op->data.bitmap.height = height;
+	op->data.bitmap.bitmap = bitmap;
+	op->data.bitmap.bg = bg;
+	op->data.bitmap.flags = flags;
+
+	return true;
+}
+
+bool display_list_plot_text(int x, int y, const char *text, size_t length,
+		const plot_font_style_t *fstyle)
+{
+	struct display_list_op *op;
+
+	/* the extent of text is not known here: rely on the group bounds */
+	op = display_list_add(DISPLAY_LIST_TEXT, INT_MIN, INT_MIN,
+			INT_MAX, INT_MAX);
+	if (!op)
+		return !display_list_current->failed;
+
+	if (!display_list_store(text, length, &op->data.text.text))
+		return false;
+	op->data.text.x = x;
+	op->data.text.y = y;
+	op->data.text.length = length;
+	op->data.text.fstyle = *fstyle;
+
+	return true;
+}
+
+bool display_list_plot_group_start(const char *name)
+{
+	struct display_list_rect *group;
+	struct display_list_rect bounds = display_list_everything;
+
+	if (display_list_group_depth == display_list_group_size) {
+		group = realloc(display_list_group,
+				(display_list_group_size + 32) *
+				sizeof *group);
+		if (!group) {
+			display_list_current->failed = true;
+			return false;
+		}
+		display_list_group = group;
+		display_list_group_size += 32;
+	}
+
+	if (display_list_group_depth)
+		bounds = display_list_group[display_list_group_depth - 1];
+	if (display_list_next_bounds_set)
+		display_list_intersect(&bounds, &display_list_next_bounds);
+	display_list_next_bounds_set = false;
+
+	display_list_group[display_list_group_depth++] = bounds;
+
+	return true;
+}
+
+bool display_list_plot_group_end(void)
+{
+	assert(display_list_group_depth);
+
+	display_list_group_depth--;
+
+	return true;
+}
+
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+/**
+ * Append an operation to the display list being recorded.
+ *
+ * \param  type  type of operation
+ * \param  x0    left of area affected
+ * \param  y0    top of area affected
+ * \param  x1    right of area affected
+ * \param  y1    bottom of area affected
+ * \return  new operation, with type and bounds filled in, or 0 if the
+ *          operation is clipped away or on memory exhaustion (in which case
+ *          the list is marked as failed)
+ */
+
+struct display_list_op *display_list_add(display_list_type type,
+		int x0, int y0, int x1, int y1)
+{
+	struct display_list *dl = display_list_current;
+	struct display_list_op *op;
+	struct display_list_chunk *chunk;
+	struct display_list_rect bounds = { x0, y0, x1, y1 };
+
+	if (dl->failed)
+		return NULL;
+
+	if (type != DISPLAY_LIST_CLIP) {
+		display_list_intersect(&bounds, &display_list_clip);
+		if (display_list_group_depth)
+			display_list_intersect(&bounds, &display_list_group[
+					display_list_group_depth - 1]);
+		if (bounds.x1 <= bounds.x0 || bounds.y1 <= bounds.y0)
+			return NULL;
+	}
+
+	if (dl->count == dl->size) {
+		unsigned int size = dl->size ? dl->size * 2 : 1024;
+		struct display_list_chunk *c;
+
+		if (DISPLAY_LIST_MAX_OPS < size) {
+			LOG(("too many operations"));
+			dl->failed = true;
+			return NULL;
+		}
+
+		op = realloc(dl->op, size * sizeof *op);
+		if (!op) {
+			dl->failed = true;
+			return NULL;
+		}
+		dl->op = op;
+
+		c = realloc(dl->chunk, size / DISPLAY_LIST_CHUNK * sizeof *c);
+		if (!c) {
+			dl->failed = true;
+			return NULL;
+		}
+		dl->chunk = c;
+
+		dl->size = size;
+	}
+
+	chunk = &dl->chunk[dl->count / DISPLAY_LIST_CHUNK];
+	if (dl->count % DISPLAY_LIST_CHUNK == 0) {
+		chunk->bounds.x0 = chunk->bounds.y0 = INT_MAX;
+		chunk->bounds.x1 = chunk->bounds.y1 = INT_MIN;
+		chunk->clip = -1;
+	}
+
+	if (type != DISPLAY_LIST_CLIP) {
+		if (bounds.x0 < chunk->bounds.x0)
+			chunk->bounds.x0 = bounds.x0;
+		if (bounds.y0 < chunk->bounds.y0)
+			chunk->bounds.y0 = bounds.y0;
+		if (chunk->bounds.x1 < bounds.x1)
+			chunk->bounds.x1 = bounds.x1;
+		if (chunk->bounds.y1 < bounds.y1)
+			chunk->bounds.y1 = bounds.y1;
+	}
+
+	op = &dl->op[dl->count++];
+	op->type = type;
+	op->bounds = bounds;
+
+	return op;
+}
+
+
+/**
+ * Copy data into the display list being recorded.
+ *
+ * \param  p       data to copy
+ * \param  size    size of data
+ * \param  offset  updated to offset of copy in the list's data
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool display_list_store(const void *p, size_t size, size_t *offset)
+{
+	struct display_list *dl = display_list_current;
+	/* keep copies aligned for int and float arrays */
+	size_t start = (dl->data_length + 7) & ~(size_t) 7;
+
+	if (dl->data_size < start + size) {
+		size_t data_size = dl->data_size ? dl->data_size : 4096;
+		char *data;
+
+		while (data_size < start + size)
+			data_size *= 2;
+
+		data = realloc(dl->data, data_size);
+		if (!data) {
+			dl->failed = true;
+			return false;
+		}
+		dl->data = data;
+		dl->data_size = data_size;
+	}
+
+	memcpy(dl->data + start, p, size);
+	dl->data_length = start + size;
+	*offset = start;
+
+	return true;
+}
+
+
+/**
+ * Plot a recorded operation.
+ *
+ * \param  dl    display list containing operation
+ * \param  op    operation to plot (not a clip)
+ * \param  x     offset to add to recorded coordinates
+ * \param  y     offset to add to recorded coordinates
+ * \param  clip  current clip rectangle, in recorded coordinates
+ * \return  true on success, false on error
+ */
+
+bool display_list_plot(const struct display_list *dl,
+		const struct display_list_op *op, int x, int y,
+		const struct display_list_rect *clip)
+{
+	struct display_list_rect r;
+
+	switch (op->type) {
+	case DISPLAY_LIST_ARC:
+		return plot.arc(op->data.arc.x + x, op->data.arc.y + y,
+				op->data.arc.radius, op->data.arc.angle1,
+				op->data.arc.angle2, &op->data.arc.style);
+
+	case DISPLAY_LIST_DISC:
+		return plot.disc(op->data.arc.x + x, op->data.arc.y + y,
+				op->data.arc.radius, &op->data.arc.style);
+
+	case DISPLAY_LIST_LINE:
+		return plot.line(op->data.line.x0 + x, op->data.line.y0 + y,
+				op->data.line.x1 + x, op->data.line.y1 + y,
+				&op->data.line.style);
+
+	case DISPLAY_LIST_RECTANGLE:
+		return plot.rectangle(op->data.line.x0 + x,
+				op->data.line.y0 + y,
+				op->data.line.x1 + x, op->data.line.y1 + y,
+				&op->data.line.style);
+
+	case DISPLAY_LIST_POLYGON:
+	{
+		const int *p = (const int *) (dl->data + op->data.polygon.p);
+		unsigned int i, n = op->data.polygon.n;
+		int *q;
+		bool ok;
+
+		q = malloc(n * 2 * sizeof *q);
+		if (!q)
+			return false;
+		for (i = 0; i != n; i++) {
+			q[i * 2] = p[i * 2] + x;
+			q[i * 2 + 1] = p[i * 2 + 1] + y;
+		}
+		ok = plot.polygon(q, n, &op->data.polygon.style);
+		free(q);
+		return ok;
+	}
+
+	case DISPLAY_LIST_PATH:
+	{
+		float transform[6];
+
+		memcpy(transform, op->data.path.transform, sizeof transform);
+		transform[4] += x;
+		transform[5] += y;
+		return plot.path((const float *) (dl->data + op->data.path.p),
+				op->data.path.n, op->data.path.fill,
+				op->data.path.width, op->data.path.c,
+				transform);
+	}
+
+	case DISPLAY_LIST_BITMAP:
+		return plot.bitmap(op->data.bitmap.x + x,
+				op->data.bitmap.y + y,
+				op->data.bitmap.width, op->data.bitmap.height,
+				op->data.bitmap.bitmap, op->data.bitmap.bg,
+				op->data.bitmap.flags);
+
+	case DISPLAY_LIST_TEXT:
+		return plot.text(op->data.text.x + x, op->data.text.y + y,
+				dl->data + op->data.text.text,
+				op->data.text.length, &op->data.text.fstyle);
+
+	case DISPLAY_LIST_CONTENT:
+	case DISPLAY_LIST_CONTENT_TILED:
+		r = op->data.content.clip;
+		display_list_intersect(&r, clip);
+		if (op->type == DISPLAY_LIST_CONTENT)
+			return content_redraw(op->data.content.h,
+					op->data.content.x + x,
+					op->data.content.y + y,
+					op->data.content.width,
+					op->data.content.height,
+					r.x0 + x, r.y0 + y, r.x1 + x, r.y1 + y,
+					1.0, op->data.content.bg);
+		return content_redraw_tiled(op->data.content.h,
+				op->data.content.x + x,
+				op->data.content.y + y,
+				op->data.content.width,
+				op->data.content.height,
+				r.x0 + x, r.y0 + y, r.x1 + x, r.y1 + y,
+				1.0, op->data.content.bg,
+				op->data.content.repeat_x,
+				op->data.content.repeat_y);
+
+	case DISPLAY_LIST_CLIP:
+		break;
+	}
+
+	assert(0);
+	return false;
+}
+
+
+/**
+ * Intersect a rectangle with another.
+ *
+ * \param  r  rectangle, updated to intersection
+ * \param  s  rectangle to intersect with
+ */
+
+void display_list_intersect(struct display_list_rect *r,
+		const struct display_list_rect *s)
+{
+	if (r->x0 < s->x0)
+		r->x0 = s->x0;
+	if (r->y0 < s->y0)
+		r->y0 = s->y0;
+	if (s->x1 < r->x1)
+		r->x1 = s->x1;
+	if (s->y1 < r->y1)
+		r->y1 = s->y1;
+}
+
+
+/**
+ * Test if two rectangles overlap.
+ *
+ * \param  r  rectangle
+ * \param  s  rectangle
+ * \return  true if the rectangles overlap or touch
+ */
+
+bool display_list_intersects(const struct display_list_rect *r,
+		const struct display_list_rect *s)
+{
+	/* edges are treated as inclusive, since front ends differ */
+	return r->x0 <= s->x1 && s->x0 <= r->x1 &&
+			r->y0 <= s->y1 && s->y0 <= r->y1;
+}
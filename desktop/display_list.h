@@ -0,0 +1,58 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Recorded plot operations (interface).
+ *
+ * A display list records the plot operations made through the current
+ * plotters, so that they can be replayed later for any clip rectangle,
+ * without repeating the work which generated them.
+ */
+
+#ifndef _NETSURF_DESKTOP_DISPLAY_LIST_H_
+#define _NETSURF_DESKTOP_DISPLAY_LIST_H_
+
+#include <stdbool.h>
+#include "desktop/plotters.h"
+
+struct display_list;
+struct hlcache_handle;
+
+struct display_list *display_list_create(void);
+void display_list_destroy(struct display_list *dl);
+
+bool display_list_record_start(struct display_list *dl);
+bool display_list_record_end(void);
+bool display_list_recording(void);
+void display_list_bounds(int x0, int y0, int x1, int y1);
+
+bool display_list_content_redraw(struct hlcache_handle *h, int x, int y,
+		int width, int height,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		float scale, colour background_colour);
+bool display_list_content_redraw_tiled(struct hlcache_handle *h,
+		int x, int y, int width, int height,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		float scale, colour background_colour,
+		bool repeat_x, bool repeat_y);
+
+bool display_list_replay(struct display_list *dl, int x, int y,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1);
+size_t display_list_size(const struct display_list *dl);
+
+#endif
@@ -34,6 +34,7 @@
 #include "desktop/history_core.h"
 #include "desktop/plotters.h"
 #include "image/bitmap.h"
+#include "image/image_cache.h"
 #include "render/font.h"
 #include "utils/log.h"
 #include "utils/url.h"
@@ -285,11 +286,13 @@ void history_add(struct history *history, hlcache_handle *content,
 			warn_user("NoMemory", 0);
 			return;
 		}
+		image_cache_set_synchronous(true);
 		if (thumbnail_create(content, bitmap, url) == false) {
 			/* Thumbnailing failed. Ignore it silently */
 			bitmap_destroy(bitmap);
 			bitmap = NULL;
 		}
+		image_cache_set_synchronous(false);
 	}
 	entry->bitmap = bitmap;
 
@@ -324,7 +327,9 @@ void history_update(struct history *history, hlcache_handle *content)
 	free(history->current->page.title);
 	history->current->page.title = title;
 
+	image_cache_set_synchronous(true);
 	thumbnail_create(content, history->current->bitmap, 0);
+	image_cache_set_synchronous(false);
 }
 
 
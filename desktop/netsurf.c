@@ -39,6 +39,7 @@
 #include "desktop/browser.h"
 #include "desktop/gui.h"
 #include "desktop/options.h"
+#include "render/font_cache.h"
 #include "utils/log.h"
 #include "utils/url.h"
 #include "utils/utf8.h"
@@ -154,6 +155,8 @@ void netsurf_exit(void)
 	gui_quit();
 	LOG(("Closing fetches"));
 	fetch_quit();
+	LOG(("Flushing font cache"));
+	font_cache_flush();
 	LOG(("Closing utf8"));
 	utf8_finalise();
 	LOG(("Destroying URLdb"));
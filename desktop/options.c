@@ -91,6 +91,8 @@ char *option_accept_language = 0;
 char *option_accept_charset = 0;
 /** Preferred maximum size of memory cache / bytes. */
 int option_memory_cache_size = 2 * 1024 * 1024;
+/** Preferred maximum size of decoded image cache / bytes. */
+int option_image_cache_size = 16 * 1024 * 1024;
 /** Preferred expiry age of disc cache / days. */
 int option_disc_cache_age = 28;
 /** Whether to block advertisements */
@@ -145,6 +147,8 @@ unsigned int option_min_reflow_period = 100; /* time in cs */
 #else
 unsigned int option_min_reflow_period = 25; /* time in cs */
 #endif
+/* Minimum time between redraws while a page is loading */
+unsigned int option_min_redraw_period = 10; /* time in cs */
 bool option_core_select_menu = false;
 /** top margin of exported page*/
 int option_margin_top = DEFAULT_MARGIN_TOP_MM;
@@ -218,6 +222,7 @@ struct {
 	{ "accept_language",	OPTION_STRING,	&option_accept_language },
 	{ "accept_charset",	OPTION_STRING,	&option_accept_charset },
 	{ "memory_cache_size",	OPTION_INTEGER,	&option_memory_cache_size },
+	{ "image_cache_size",	OPTION_INTEGER,	&option_image_cache_size },
 	{ "disc_cache_age",	OPTION_INTEGER,	&option_disc_cache_age },
 	{ "block_advertisements",
 				OPTION_BOOL,	&option_block_ads },
@@ -247,6 +252,7 @@ struct {
 	{ "scale",		OPTION_INTEGER,	&option_scale },
 	{ "incremental_reflow",	OPTION_BOOL,	&option_incremental_reflow },
 	{ "min_reflow_period",	OPTION_INTEGER,	&option_min_reflow_period },
+	{ "min_redraw_period",	OPTION_INTEGER,	&option_min_redraw_period },
  	{ "core_select_menu",	OPTION_BOOL,	&option_core_select_menu },
 	/* Fetcher options */
 	{ "max_fetchers",	OPTION_INTEGER,	&option_max_fetchers },
@@ -354,6 +360,8 @@ void options_read(const char *path)
 
 	if (option_memory_cache_size < 0)
 		option_memory_cache_size = 0;
+	if (option_image_cache_size < 0)
+		option_image_cache_size = 0;
 }
 
 
@@ -53,6 +53,7 @@ extern int option_font_min_size;
 extern char *option_accept_language;
 extern char *option_accept_charset;
 extern int option_memory_cache_size;
+extern int option_image_cache_size;
 extern int option_disc_cache_age;
 extern bool option_block_ads;
 extern int option_minimum_gif_delay;
@@ -85,6 +86,7 @@ extern int option_toolbar_status_width;
 extern int option_scale;
 extern bool option_incremental_reflow;
 extern unsigned int option_min_reflow_period;
+extern unsigned int option_min_redraw_period;
 extern bool option_core_select_menu;
 
 extern int option_margin_top;
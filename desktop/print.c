@@ -31,6 +31,7 @@
 #include "desktop/options.h"
 #include "desktop/print.h"
 #include "desktop/printer.h"
+#include "image/image_cache.h"
 #include "render/box.h"
 #include "utils/log.h"
 #include "utils/talloc.h"
@@ -130,6 +131,8 @@ bool print_draw_next_page(const struct printer *printer,
 	
 	html_redraw_printing = true;
 	html_redraw_printing_border = clip_y1;
+	/* images must be complete on the page */
+	image_cache_set_synchronous(true);
 	
 	printer->print_next_page();
 	if (!content_redraw(printed_content,
@@ -175,6 +178,7 @@ hlcache_handle *print_init(hlcache_handle *content,
 		return NULL;
 	
 	printed_content->data.html.bw = 0;
+	printed_content->data.html.display_list = 0;
 	
 	user_sentinel = talloc(printed_content, hlcache_handle_user);
 	user_sentinel->callback = 0;
@@ -247,6 +251,7 @@ bool print_cleanup(hlcache_handle *content, const struct printer *printer,
 	printer->print_end();
 	
 	html_redraw_printing = false;
+	image_cache_set_synchronous(false);
 	
 	if (printed_content) {
 		content_remove_user(printed_content, NULL, print_init);
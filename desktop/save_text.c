@@ -30,6 +30,7 @@
 #include "content/hlcache.h"
 #include "desktop/save_text.h"
 #include "render/box.h"
+#include "render/html.h"
 #include "utils/log.h"
 #include "utils/utf8.h"
 #include "utils/utils.h"
@@ -62,6 +63,7 @@ void save_as_text(hlcache_handle *c, char *path)
 		return;
 	}
 
+	html_complete_layout(c);
 	extract_text(html_get_box_tree(c), &first, &before, &save);
 	if (!save.block)
 		return;
@@ -0,0 +1,359 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Scheduled callbacks (implementation).
+ *
+ * For front ends without a scheduler of their own.  Callbacks are kept in
+ * a binary heap ordered by time due, so the next is always at the root,
+ * and in a hash table keyed on callback and parameter, so that replacing
+ * or removing one does not search.  Each entry records its position in
+ * the heap, making removal O(log n).  Freed entries are kept for reuse,
+ * as animations reschedule themselves every frame.
+ *
+ * As on RISC OS, scheduling a callback which is already scheduled with
+ * the same parameter moves it rather than adding another.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "desktop/browser.h"
+#include "utils/log.h"
+
+/** Number of hash table buckets; a power of two. */
+#define SCHED_HASH_SIZE 256
+
+/** A scheduled callback. */
+struct sched_entry {
+	uint64_t time;			/**< Time due, in ms */
+	void (*callback)(void *p);	/**< Function to call */
+	void *p;			/**< Parameter for callback */
+	unsigned int index;		/**< Position in sched_heap */
+	struct sched_entry *next;	/**< Next in hash chain or free list */
+};
+
+/** Heap of scheduled callbacks; each is due no earlier than its parent. */
+static struct sched_entry **sched_heap;
+/** Number of scheduled callbacks. */
+static unsigned int sched_count;
+/** Number of entries allocated in sched_heap. */
+static unsigned int sched_heap_size;
+
+/** Scheduled callbacks by callback and parameter. */
+static struct sched_entry *sched_hash[SCHED_HASH_SIZE];
+
+/** Unused entries. */
+static struct sched_entry *sched_free;
+
+static uint64_t schedule_now(void);
+static unsigned int schedule_hash(void (*callback)(void *p), void *p);
+static struct sched_entry *schedule_find(void (*callback)(void *p), void *p);
+static void schedule_unlink(struct sched_entry *entry);
+static void schedule_place(struct sched_entry *entry, unsigned int index);
+static void schedule_sift_up(unsigned int index);
+static void schedule_sift_down(unsigned int index);
+
+
+/**
+ * Schedule a callback.
+ *
+ * \param  t         interval before the callback should be made / cs
+ * \param  callback  callback function
+ * \param  p         user parameter, passed to callback function
+ *
+ * The callback function will be called as soon as possible after t cs have
+ * passed.  Any existing schedule of the same callback and parameter is
+ * replaced.
+ */
+
+void schedule(int t, void (*callback)(void *p), void *p)
+{
+	struct sched_entry *entry;
+	uint64_t time = schedule_now() + (t < 0 ? 0 : t) * 10;
+
+	entry = schedule_find(callback, p);
+	if (entry != NULL) {
+		bool earlier = time < entry->time;
+
+		entry->time = time;
+		if (earlier)
+			schedule_sift_up(entry->index);
+		else
+			schedule_sift_down(entry->index);
+		return;
+	}
+
+	if (sched_count == sched_heap_size) {
+		unsigned int size = sched_heap_size * 2 + 16;
+		struct sched_entry **heap;
+
+		heap = realloc(sched_heap, size * sizeof *heap);
+		if (heap == NULL) {
+			LOG(("out of memory scheduling %p(%p)", callback, p));
+			return;
+		}
+		sched_heap = heap;
+		sched_heap_size = size;
+	}
+
+	if (sched_free != NULL) {
+		entry = sched_free;
+		sched_free = entry->next;
+	} else {
+		entry = malloc(sizeof *entry);
+		if (entry == NULL) {
+			LOG(("out of memory scheduling %p(%p)", callback, p));
+			return;
+		}
+	}
+
+	entry->time = time;
+	entry->callback = callback;
+	entry->p = p;
+
+	entry->next = sched_hash[schedule_hash(callback, p)];
+	sched_hash[schedule_hash(callback, p)] = entry;
+
+	schedule_place(entry, sched_count++);
+	schedule_sift_up(entry->index);
+}
+
+
+/**
+ * Unschedule a callback.
+ *
+ * \param  callback  callback function
+ * \param  p         user parameter, passed to callback function
+ */
+
+void schedule_remove(void (*callback)(void *p), void *p)
+{
+	struct sched_entry *entry = schedule_find(callback, p);
+
+	if (entry != NULL)
+		schedule_unlink(entry);
+}
+
+
+/**
+ * Call any callbacks which are due.
+ *
+ * \return  true if any callbacks remain scheduled
+ *
+ * Callbacks which a callback schedules with no delay are left for the
+ * next call, so that one rescheduling itself cannot stall the caller.
+ */
+
+bool schedule_run(void)
+{
+	uint64_t now = schedule_now();
+
+	while (sched_count != 0 && sched_heap[0]->time < now) {
+		struct sched_entry *entry = sched_heap[0];
+		void (*callback)(void *p) = entry->callback;
+		void *p = entry->p;
+
+		/* unschedule first, as the callback may schedule itself */
+		schedule_unlink(entry);
+
+		callback(p);
+	}
+
+	return sched_count != 0;
+}
+
+
+/**
+ * Find how long a front end may wait before calling schedule_run() again.
+ *
+ * \return  time until the next callback is due in ms, 0 if one is overdue,
+ *          or -1 if nothing is scheduled
+ */
+
+int schedule_timeout(void)
+{
+	uint64_t now;
+
+	if (sched_count == 0)
+		return -1;
+
+	now = schedule_now();
+	if (sched_heap[0]->time < now)
+		return 0;
+
+	return sched_heap[0]->time - now + 1;
+}
+
+
+/**
+ * Read the current time.
+ *
+ * \return  time in ms
+ */
+
+uint64_t schedule_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/**
+ * Find the hash table bucket for a callback.
+ *
+ * \param  callback  callback function
+ * \param  p         user parameter
+ * \return  bucket index
+ */
+
+unsigned int schedule_hash(void (*callback)(void *p), void *p)
+{
+	uintptr_t h = (uintptr_t) callback ^ ((uintptr_t) p * 31);
+
+	return (h ^ (h >> 8) ^ (h >> 16)) & (SCHED_HASH_SIZE - 1);
+}
+
+
+/**
+ * Find a scheduled callback.
+ *
+ * \param  callback  callback function
+ * \param  p         user parameter
+ * \return  entry, or NULL if not scheduled
+ */
+
+struct sched_entry *schedule_find(void (*callback)(void *p), void *p)
+{
+	struct sched_entry *entry;
+
+	for (entry = sched_hash[schedule_hash(callback, p)]; entry != NULL;
+			entry = entry->next) {
+		if (entry->callback == callback && entry->p == p)
+			return entry;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Remove an entry from the hash table and heap, and free it.
+ *
+ * \param  entry  entry to remove
+ */
+
+void schedule_unlink(struct sched_entry *entry)
+{
+	struct sched_entry **link;
+	unsigned int index = entry->index;
+
+	for (link = &sched_hash[schedule_hash(entry->callback, entry->p)];
+			*link != entry; link = &(*link)->next)
+		;
+	*link = entry->next;
+
+	/* fill the hole with the last entry, which may belong above or
+	 * below it */
+	sched_count--;
+	if (index != sched_count) {
+		struct sched_entry *last = sched_heap[sched_count];
+
+		schedule_place(last, index);
+		schedule_sift_up(index);
+		schedule_sift_down(last->index);
+	}
+
+	entry->next = sched_free;
+	sched_free = entry;
+}
+
+
+/**
+ * Store an entry in the heap.
+ *
+ * \param  entry  entry to store
+ * \param  index  position in heap
+ */
+
+void schedule_place(struct sched_entry *entry, unsigned int index)
+{
+	sched_heap[index] = entry;
+	entry->index = index;
+}
+
+
+/**
+ * Move an entry towards the root of the heap until its parent is due
+ * no later than it.
+ *
+ * \param  index  position of entry in heap
+ */
+
+void schedule_sift_up(unsigned int index)
+{
+	struct sched_entry *entry = sched_heap[index];
+
+	while (index != 0) {
+		unsigned int parent = (index - 1) / 2;
+
+		if (sched_heap[parent]->time <= entry->time)
+			break;
+
+		schedule_place(sched_heap[parent], index);
+		index = parent;
+	}
+
+	schedule_place(entry, index);
+}
+
+
+/**
+ * Move an entry away from the root of the heap until neither child is due
+ * before it.
+ *
+ * \param  index  position of entry in heap
+ */
+
+void schedule_sift_down(unsigned int index)
+{
+	struct sched_entry *entry = sched_heap[index];
+
+	while (true) {
+		unsigned int child = index * 2 + 1;
+
+		if (child >= sched_count)
+			break;
+		if (child + 1 < sched_count &&
+				sched_heap[child + 1]->time <
+				sched_heap[child]->time)
+			child++;
+		if (entry->time <= sched_heap[child]->time)
+			break;
+
+		schedule_place(sched_heap[child], index);
+		index = child;
+	}
+
+	schedule_place(entry, index);
+}
@@ -256,6 +256,10 @@ void search_text(const char *string, int string_len,
 			content_get_type(c) != CONTENT_TEXTPLAIN))
 		return;
 
+	/* the whole document is searched */
+	if (content_get_type(c) == CONTENT_HTML)
+		html_complete_layout(c);
+
 	box = html_get_box_tree(c);
 
 	if (!box)
@@ -35,6 +35,7 @@
 #include "render/box.h"
 #include "render/font.h"
 #include "render/form.h"
+#include "render/html.h"
 #include "render/textplain.h"
 #include "utils/log.h"
 #include "utils/utf8.h"
@@ -721,8 +722,15 @@ void selection_select_all(struct selection *s)
 	
 	if (IS_INPUT(s->root))
 		selection_set_start(s, s->root->children->children->byte_offset);
-	else
+	else {
+		hlcache_handle *c = s->bw->current_content;
+
+		/* the whole document must be labelled */
+		if (c && content_get_type(c) == CONTENT_HTML)
+			html_complete_layout(c);
+
 		selection_set_start(s, 0);
+	}
 	selection_set_end(s, s->max_idx);
 }
 
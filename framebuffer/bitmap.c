@@ -22,8 +22,10 @@
 #include "assert.h"
 #include "image/bitmap.h"
 #include "framebuffer/bitmap.h"
+#include "image/scale_cache.h"
 
 #include "utils/log.h"
+#include "utils/pixel.h"
 
 /**
  * Create a bitmap.
@@ -116,7 +118,8 @@ void bitmap_destroy(void *bitmap)
                 LOG(("NULL bitmap!"));
                 return;
         }
-        
+
+	scale_cache_invalidate(bm);
 	free(bm->pixdata);
 	free(bm);
 }
@@ -142,6 +145,7 @@ bool bitmap_save(void *bitmap, const char *path, unsigned flags)
  * \param  bitmap  a bitmap, as returned by bitmap_create()
  */
 void bitmap_modified(void *bitmap) {
+	scale_cache_invalidate(bitmap);
 }
 
 
@@ -185,7 +189,6 @@ void bitmap_set_opaque(void *bitmap, bool opaque)
  */
 bool bitmap_test_opaque(void *bitmap)
 {
-        int tst;
 	struct bitmap *bm = bitmap;
 
         if (bitmap == NULL) {
@@ -193,13 +196,10 @@ bool bitmap_test_opaque(void *bitmap)
                 return false;
         }
 
-        tst = bm->width * bm->height;
-
-        while (tst-- > 0) {
-                if (bm->pixdata[(tst << 2) + 3] != 0xff) {
-                        LOG(("bitmap %p has transparency",bm));
-                        return false;                     
-                }   
+        if (pixel_test_opaque(bm->pixdata, bm->width, bm->height,
+			bm->width * 4) == false) {
+                LOG(("bitmap %p has transparency",bm));
+                return false;
         }
         LOG(("bitmap %p is opaque", bm));
 	return true;
@@ -19,6 +19,9 @@
 
 #include <inttypes.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <freetype/ftcache.h>
 
@@ -26,6 +29,7 @@
 #include "render/font.h"
 #include "utils/utf8.h"
 #include "utils/log.h"
+#include "utils/utils.h"
 #include "desktop/options.h"
 
 #include "framebuffer/gui.h"
@@ -64,6 +68,37 @@ typedef struct fb_faceid_s {
 
 static fb_faceid_t *fb_faces[FB_FACE_COUNT];
 
+/** Number of glyphs cached for each face and size; a power of two so
+ * that the slot is the low bits of the character code, which keeps all
+ * of ASCII in distinct slots. */
+#define FB_GLYPH_CACHE_SIZE 256
+
+/** Number of face and size combinations with cached glyphs. */
+#define FB_GLYPH_CACHE_COUNT 8
+
+/** Character code of an empty glyph cache slot. */
+#define FB_GLYPH_NONE 0xffffffff
+
+/* a glyph rendered at one size */
+typedef struct fb_glyph_s {
+        uint32_t ucs4; /* character, or FB_GLYPH_NONE */
+        int advance; /* horizontal advance in pixels */
+        int left; /* offset from pen position to left of bitmap */
+        int top; /* offset from baseline up to top of bitmap */
+        int width; /* width of bitmap */
+        int rows; /* height of bitmap */
+        uint8_t *coverage; /* width * rows bytes, or NULL if blank */
+} fb_glyph_t;
+
+/* direct mapped cache of the glyphs of one face at one size */
+typedef struct fb_glyph_cache_s {
+        fb_faceid_t *face; /* face, or NULL if unused */
+        FT_F26Dot6 size; /* size in 26.6 points */
+        fb_glyph_t glyph[FB_GLYPH_CACHE_SIZE];
+} fb_glyph_cache_t;
+
+static fb_glyph_cache_t fb_glyph_caches[FB_GLYPH_CACHE_COUNT];
+
 
 utf8_convert_ret utf8_to_local_encoding(const char *string, 
 				       size_t len,
@@ -216,6 +251,17 @@ bool fb_font_init(void)
 
 bool fb_font_finalise(void)
 {
+        int cache, loop;
+
+        for (cache = 0; cache < FB_GLYPH_CACHE_COUNT; cache++) {
+                for (loop = 0; loop < FB_GLYPH_CACHE_SIZE; loop++) {
+                        free(fb_glyph_caches[cache].glyph[loop].coverage);
+                        fb_glyph_caches[cache].glyph[loop].coverage = NULL;
+                        fb_glyph_caches[cache].glyph[loop].ucs4 = FB_GLYPH_NONE;
+                }
+                fb_glyph_caches[cache].face = NULL;
+        }
+
         FTC_Manager_Done(ft_cmanager );
         FT_Done_FreeType(library);
         return true;
@@ -268,19 +314,31 @@ static void fb_fill_scalar(const plot_font_style_t *fstyle, FTC_Scaler srec)
 	srec->x_res = srec->y_res = 72;
 }
 
-FT_Glyph fb_getglyph(const plot_font_style_t *fstyle, uint32_t ucs4)
+/* look up a glyph through the freetype caches and render it */
+static void fb_load_glyph(fb_glyph_cache_t *cache, fb_glyph_t *slot,
+                          uint32_t ucs4)
 {
         FT_UInt glyph_index;
         FTC_ScalerRec srec;
         FT_Glyph glyph;
+        FT_BitmapGlyph bglyph;
         FT_Error error;
-        fb_faceid_t *fb_face; 
+        int row, col;
 
-        fb_fill_scalar(fstyle, &srec);
+        free(slot->coverage);
+        slot->ucs4 = ucs4;
+        slot->advance = 0;
+        slot->left = slot->top = 0;
+        slot->width = slot->rows = 0;
+        slot->coverage = NULL;
 
-        fb_face = (fb_faceid_t *)srec.face_id;
+        srec.face_id = (FTC_FaceID)cache->face;
+        srec.width = srec.height = cache->size;
+        srec.pixel = 0;
+        srec.x_res = srec.y_res = 72;
 
-        glyph_index = FTC_CMapCache_Lookup(ft_cmap_cache, srec.face_id, fb_face->cidx, ucs4);
+        glyph_index = FTC_CMapCache_Lookup(ft_cmap_cache, srec.face_id,
+                                           cache->face->cidx, ucs4);
 
         error = FTC_ImageCache_LookupScaler(ft_image_cache, 
                                             &srec, 
@@ -290,8 +348,210 @@ FT_Glyph fb_getglyph(const plot_font_style_t *fstyle, uint32_t ucs4)
                                             glyph_index, 
                                             &glyph, 
                                             NULL);
+        if (error != 0)
+                return;
+
+        slot->advance = glyph->advance.x >> 16;
+
+        if (glyph->format != FT_GLYPH_FORMAT_BITMAP)
+                return;
+
+        bglyph = (FT_BitmapGlyph)glyph;
+        if (bglyph->bitmap.width <= 0 || bglyph->bitmap.rows <= 0)
+                return;
+
+        /* the freetype cache may discard its copy at any time, so keep
+         * our own, as coverage whatever the render mode */
+        slot->coverage = malloc(bglyph->bitmap.width * bglyph->bitmap.rows);
+        if (slot->coverage == NULL)
+                return;
+
+        slot->left = bglyph->left;
+        slot->top = bglyph->top;
+        slot->width = bglyph->bitmap.width;
+        slot->rows = bglyph->bitmap.rows;
+
+        for (row = 0; row < slot->rows; row++) {
+                const uint8_t *src = bglyph->bitmap.buffer +
+                                row * bglyph->bitmap.pitch;
+                uint8_t *dst = slot->coverage + row * slot->width;
+
+                if (bglyph->bitmap.pixel_mode == FT_PIXEL_MODE_MONO) {
+                        for (col = 0; col < slot->width; col++)
+                                dst[col] = (src[col >> 3] &
+                                            (0x80 >> (col & 7))) ? 0xff : 0;
+                } else {
+                        memcpy(dst, src, slot->width);
+                }
+        }
+}
+
+/* find the glyph cache for a style, reusing the oldest if it is new */
+static fb_glyph_cache_t *fb_glyph_cache(const plot_font_style_t *fstyle)
+{
+        static int next_victim = 0;
+        FTC_ScalerRec srec;
+        fb_glyph_cache_t *cache;
+        int loop;
+
+        fb_fill_scalar(fstyle, &srec);
+
+        for (loop = 0; loop < FB_GLYPH_CACHE_COUNT; loop++) {
+                cache = &fb_glyph_caches[loop];
+                if (cache->face == (fb_faceid_t *)srec.face_id &&
+                    cache->size == srec.width)
+                        return cache;
+        }
+
+        cache = &fb_glyph_caches[next_victim];
+        next_victim = (next_victim + 1) % FB_GLYPH_CACHE_COUNT;
+
+        for (loop = 0; loop < FB_GLYPH_CACHE_SIZE; loop++) {
+                free(cache->glyph[loop].coverage);
+                cache->glyph[loop].coverage = NULL;
+                cache->glyph[loop].ucs4 = FB_GLYPH_NONE;
+        }
+        cache->face = (fb_faceid_t *)srec.face_id;
+        cache->size = srec.width;
+
+        return cache;
+}
+
+/* get a glyph from a glyph cache, loading it if necessary */
+static const fb_glyph_t *fb_glyph(fb_glyph_cache_t *cache, uint32_t ucs4)
+{
+        fb_glyph_t *slot = &cache->glyph[ucs4 & (FB_GLYPH_CACHE_SIZE - 1)];
+
+        if (slot->ucs4 != ucs4)
+                fb_load_glyph(cache, slot, ucs4);
+
+        return slot;
+}
+
+/* decode the character at *offset, and advance *offset past it */
+static uint32_t fb_next_char(const char *string, size_t length,
+                             size_t *offset)
+{
+        uint32_t ucs4 = (unsigned char)string[*offset];
+
+        if (ucs4 < 0x80) {
+                *offset += 1;
+        } else {
+                ucs4 = utf8_to_ucs4(string + *offset, length - *offset);
+                *offset = utf8_next(string, length, *offset);
+        }
+
+        return ucs4;
+}
+
+/**
+ * Render a run of text into one coverage bitmap.
+ *
+ * \param  fstyle  style for this text
+ * \param  text    UTF-8 string to render
+ * \param  length  length of string
+ * \param  min_x   left of area to render, relative to start of text
+ * \param  max_x   right of area to render, relative to start of text
+ * \param  run     updated with rendered text
+ * \return  true on success, false on memory exhaustion
+ *
+ * Glyphs wholly outside min_x to max_x are left out, so that a long line
+ * which is mostly clipped costs little.
+ *
+ * The text is walked twice, first to find the bounds and then to render.
+ * Characters which share a glyph cache slot may replace one another in
+ * between, so each glyph is looked up again rather than remembered.
+ */
+bool fb_text_run(const plot_font_style_t *fstyle, const char *text,
+                 size_t length, int min_x, int max_x, fb_text_run_t *run)
+{
+        static uint8_t *coverage = NULL;
+        static size_t coverage_size = 0;
+
+        fb_glyph_cache_t *cache = fb_glyph_cache(fstyle);
+        const fb_glyph_t *glyph;
+        size_t nxtchr = 0;
+        size_t count = 0;
+        int x = 0;
+        int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+        int row, col;
 
-        return glyph;
+        run->coverage = NULL;
+
+        /* find the bounds of the visible glyphs */
+        while (nxtchr < length) {
+                glyph = fb_glyph(cache, fb_next_char(text, length, &nxtchr));
+
+                if (glyph->coverage != NULL &&
+                    x + glyph->left < max_x &&
+                    x + glyph->left + glyph->width > min_x) {
+                        count++;
+
+                        x0 = min(x0, x + glyph->left);
+                        x1 = max(x1, x + glyph->left + glyph->width);
+                        y0 = min(y0, -glyph->top);
+                        y1 = max(y1, glyph->rows - glyph->top);
+                }
+
+                x += glyph->advance;
+        }
+
+        if (count == 0)
+                return true;
+
+        run->x0 = x0;
+        run->y0 = y0;
+        run->width = x1 - x0;
+        run->rows = y1 - y0;
+
+        if ((size_t)(run->width * run->rows) > coverage_size) {
+                size_t size = run->width * run->rows;
+                uint8_t *p = realloc(coverage, size);
+                if (p == NULL)
+                        return false;
+                coverage = p;
+                coverage_size = size;
+        }
+        memset(coverage, 0, run->width * run->rows);
+
+        /* composite each glyph's coverage over those already placed, so
+         * overlapping glyphs look as they would if plotted in turn */
+        nxtchr = 0;
+        x = 0;
+        while (nxtchr < length) {
+                int gx;
+
+                glyph = fb_glyph(cache, fb_next_char(text, length, &nxtchr));
+                gx = x + glyph->left;
+                x += glyph->advance;
+
+                /* a glyph which failed to load in the first pass was
+                 * not measured, so it must also be kept in bounds */
+                if (glyph->coverage == NULL || gx >= max_x ||
+                    gx + glyph->width <= min_x ||
+                    gx < x0 || gx + glyph->width > x1 ||
+                    -glyph->top < y0 || glyph->rows - glyph->top > y1)
+                        continue;
+
+                for (row = 0; row < glyph->rows; row++) {
+                        const uint8_t *src = glyph->coverage +
+                                        row * glyph->width;
+                        uint8_t *dst = coverage +
+                                        (row - glyph->top - y0) * run->width +
+                                        gx - x0;
+
+                        for (col = 0; col < glyph->width; col++) {
+                                if (src[col] == 0)
+                                        continue;
+                                dst[col] += ((255 - dst[col]) * src[col]) /
+                                                255;
+                        }
+                }
+        }
+
+        run->coverage = coverage;
+
+        return true;
 }
 
 
@@ -308,20 +568,13 @@ static bool nsfont_width(const plot_font_style_t *fstyle,
                          const char *string, size_t length,
                          int *width)
 {
-        uint32_t ucs4;
+        fb_glyph_cache_t *cache = fb_glyph_cache(fstyle);
         size_t nxtchr = 0;
-        FT_Glyph glyph;
 
         *width = 0;
         while (nxtchr < length) {
-                ucs4 = utf8_to_ucs4(string + nxtchr, length - nxtchr);
-                nxtchr = utf8_next(string, length, nxtchr);
-
-                glyph = fb_getglyph(fstyle, ucs4);
-                if (glyph == NULL)
-                        continue;
-
-                *width += glyph->advance.x >> 16;
+                *width += fb_glyph(cache, fb_next_char(string, length,
+                                                       &nxtchr))->advance;
         }
 
 	return true;
@@ -343,23 +596,19 @@ static bool nsfont_position_in_string(const plot_font_style_t *fstyle,
 		const char *string, size_t length,
 		int x, size_t *char_offset, int *actual_x)
 {
-        uint32_t ucs4;
+        fb_glyph_cache_t *cache = fb_glyph_cache(fstyle);
         size_t nxtchr = 0;
-        FT_Glyph glyph;
+        size_t next;
 
         *actual_x = 0;
         while (nxtchr < length) {
-                ucs4 = utf8_to_ucs4(string + nxtchr, length - nxtchr);
-
-                glyph = fb_getglyph(fstyle, ucs4);
-                if (glyph == NULL)
-                        continue;
-
-                *actual_x += glyph->advance.x >> 16;
+                next = nxtchr;
+                *actual_x += fb_glyph(cache, fb_next_char(string, length,
+                                                          &next))->advance;
                 if (*actual_x > x)
                         break;
 
-                nxtchr = utf8_next(string, length, nxtchr);
+                nxtchr = next;
         }
 
         *char_offset = nxtchr;
@@ -387,26 +636,24 @@ static bool nsfont_split(const plot_font_style_t *fstyle,
 		const char *string, size_t length,
 		int x, size_t *char_offset, int *actual_x)
 {
+        fb_glyph_cache_t *cache = fb_glyph_cache(fstyle);
         uint32_t ucs4;
         size_t nxtchr = 0;
+        size_t next;
         int last_space_x = 0;
         int last_space_idx = 0;
-        FT_Glyph glyph;
 
         *actual_x = 0;
         while (nxtchr < length) {
-                ucs4 = utf8_to_ucs4(string + nxtchr, length - nxtchr);
-
-                glyph = fb_getglyph(fstyle, ucs4);
-                if (glyph == NULL)
-                        continue;
+                next = nxtchr;
+                ucs4 = fb_next_char(string, length, &next);
 
                 if (ucs4 == 0x20) {
                         last_space_x = *actual_x;
                         last_space_idx = nxtchr;
                 }
 
-                *actual_x += glyph->advance.x >> 16;
+                *actual_x += fb_glyph(cache, ucs4)->advance;
                 if (*actual_x > x) {
                         /* string has exceeded available width return previous
                          * space 
@@ -416,7 +663,7 @@ static bool nsfont_split(const plot_font_style_t *fstyle,
                         return true;
                 }
 
-                nxtchr = utf8_next(string, length, nxtchr);
+                nxtchr = next;
         }
 
         *char_offset = nxtchr;
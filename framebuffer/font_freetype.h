@@ -25,6 +25,17 @@
 
 extern int ft_load_type;
 
-FT_Glyph fb_getglyph(const plot_font_style_t *fstyle, uint32_t ucs4);
+/** A run of text rendered as a single 8 bit coverage bitmap. */
+typedef struct fb_text_run_s {
+        int x0; /**< left of bitmap, relative to the start of the text */
+        int y0; /**< top of bitmap, relative to the baseline */
+        int width; /**< width of bitmap */
+        int rows; /**< height of bitmap */
+        uint8_t *coverage; /**< width * rows bytes, or NULL if nothing
+                            * visible; valid until the next call */
+} fb_text_run_t;
+
+bool fb_text_run(const plot_font_style_t *fstyle, const char *text,
+                 size_t length, int min_x, int max_x, fb_text_run_t *run);
 
 #endif /* NETSURF_FB_FONT_FREETYPE_H */
@@ -37,6 +37,7 @@
 #include "framebuffer/framebuffer.h"
 #include "framebuffer/bitmap.h"
 #include "framebuffer/font.h"
+#include "image/scale_cache.h"
 
 /* netsurf framebuffer library handle */
 static nsfb_t *nsfb;
@@ -77,48 +78,28 @@ static bool framebuffer_plot_polygon(const int *p, unsigned int n, const plot_st
 static bool framebuffer_plot_text(int x, int y, const char *text, size_t length,
 		const plot_font_style_t *fstyle)
 {
-        uint32_t ucs4;
-        size_t nxtchr = 0;
-        FT_Glyph glyph;
-        FT_BitmapGlyph bglyph;
+        fb_text_run_t run;
+        nsfb_bbox_t clipbox;
         nsfb_bbox_t loc;
 
-        while (nxtchr < length) {
-                ucs4 = utf8_to_ucs4(text + nxtchr, length - nxtchr);
-                nxtchr = utf8_next(text, length, nxtchr);
-
-                glyph = fb_getglyph(fstyle, ucs4);
-                if (glyph == NULL)
-                        continue;
-
-                if (glyph->format == FT_GLYPH_FORMAT_BITMAP) {
-                        bglyph = (FT_BitmapGlyph)glyph;
-
-                        loc.x0 = x + bglyph->left;
-                        loc.y0 = y - bglyph->top;
-                        loc.x1 = loc.x0 + bglyph->bitmap.width;
-                        loc.y1 = loc.y0 + bglyph->bitmap.rows;
-
-                        /* now, draw to our target surface */
-                        if (bglyph->bitmap.pixel_mode == FT_PIXEL_MODE_MONO) {
-                            nsfb_plot_glyph1(nsfb, 
-                                             &loc, 
-                                             bglyph->bitmap.buffer, 
-                                             bglyph->bitmap.pitch, 
-                                             fstyle->foreground);
-                        } else {
-                            nsfb_plot_glyph8(nsfb, 
-                                             &loc, 
-                                             bglyph->bitmap.buffer, 
-                                             bglyph->bitmap.pitch, 
-                                             fstyle->foreground);
-                        }
-                }
-                x += glyph->advance.x >> 16;
-
-        }
-        return true;
+        nsfb_plot_get_clip(nsfb, &clipbox);
+
+        /* render the visible part of the text as a single bitmap, and plot
+         * that, rather than plotting each glyph separately */
+        if (!fb_text_run(fstyle, text, length,
+                         clipbox.x0 - x, clipbox.x1 - x, &run))
+                return false;
 
+        if (run.coverage == NULL)
+                return true;
+
+        loc.x0 = x + run.x0;
+        loc.y0 = y + run.y0;
+        loc.x1 = loc.x0 + run.width;
+        loc.y1 = loc.y0 + run.rows;
+
+        return nsfb_plot_glyph8(nsfb, &loc, run.coverage, run.width,
+                                fstyle->foreground);
 }
 #else
 static bool framebuffer_plot_text(int x, int y, const char *text, size_t length,
@@ -174,9 +155,19 @@ framebuffer_plot_bitmap(int x, int y,
         nsfb_bbox_t clipbox;
         bool repeat_x = (flags & BITMAPF_REPEAT_X);
         bool repeat_y = (flags & BITMAPF_REPEAT_Y);
+        struct bitmap *scaled;
 
         nsfb_plot_get_clip(nsfb, &clipbox);
 
+	/* scale once through the cache, rather than in every plot of every
+	 * tile; single pixels are plotted as rectangles anyway */
+	if ((bitmap->width != width || bitmap->height != height) &&
+			(bitmap->width != 1 || bitmap->height != 1)) {
+		scaled = scale_cache_get(bitmap, width, height, false);
+		if (scaled != NULL)
+			bitmap = scaled;
+	}
+
 	/* x and y define coordinate of top left of of the initial explicitly
 	 * placed tile. The width and height are the image scaling and the
 	 * bounding box defines the extent of the repeat (which may go in all
@@ -381,6 +372,17 @@ framebuffer_finalise(void)
     nsfb_finalise(nsfb);    
 }
 
+/* direct the plotters at another surface, returning the previous one */
+nsfb_t *
+framebuffer_set_surface(nsfb_t *surface)
+{
+    nsfb_t *previous = nsfb;
+
+    nsfb = surface;
+
+    return previous;
+}
+
 bool
 framebuffer_set_cursor(struct bitmap *bm)
 {
@@ -1,5 +1,6 @@
 nsfb_t *framebuffer_initialise(const char *fename, int width, int height, int bpp);
 void framebuffer_finalise(void);
+nsfb_t *framebuffer_set_surface(nsfb_t *surface);
 bool framebuffer_set_cursor(struct bitmap *bm);
 
 
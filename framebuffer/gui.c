@@ -33,6 +33,7 @@
 #include <libnsfb_plot.h>
 #include <libnsfb_event.h>
 
+#include "desktop/damage.h"
 #include "desktop/gui.h"
 #include "desktop/plotters.h"
 #include "desktop/netsurf.h"
@@ -42,16 +43,17 @@
 #include "utils/messages.h"
 #include "utils/utils.h"
 #include "desktop/textinput.h"
+#include "render/box.h"
 #include "render/form.h"
 
 #include "framebuffer/gui.h"
 #include "framebuffer/fbtk.h"
 #include "framebuffer/framebuffer.h"
 #include "framebuffer/bitmap.h"
-#include "framebuffer/schedule.h"
 #include "framebuffer/findfile.h"
 #include "framebuffer/image_data.h"
 #include "framebuffer/font.h"
+#include "framebuffer/tile_cache.h"
 
 #include "content/urldb.h"
 #include "desktop/history_core.h"
@@ -71,6 +73,10 @@ struct gui_window *window_list = NULL;
 
 bool redraws_pending = false;
 
+/** Maximum number of separate areas queued for redraw in a browser widget.
+ * When more are queued, the pair whose union wastes least is merged. */
+#define FB_DAMAGE_RECTS 8
+
 /* private data for browser user widget */
 struct browser_widget_s {
 	struct browser_window *bw; /**< The browser window connected to this gui window */
@@ -80,7 +86,10 @@ struct browser_widget_s {
 	bool redraw_required; /**< flag indicating the foreground loop
 			       * needs to redraw the browser widget.
 			       */
-	bbox_t redraw_box; /**< Area requiring redraw. */
+	bbox_t redraw_rect[FB_DAMAGE_RECTS]; /**< Areas requiring redraw. */
+	int redraw_count; /**< Number of entries in redraw_rect. */
+	unsigned long redraw_pixels; /**< Pixels redrawn since creation. */
+	unsigned int redraw_frames; /**< Redraws since creation. */
 	bool pan_required; /**< flag indicating the foreground loop
                             * needs to pan the window.
                             */
@@ -88,25 +97,72 @@ struct browser_widget_s {
 };
 
 
+/* add an area to a browser widget's damage list, merging areas as
+ * desktop/damage.c decides, as the core does before redraws reach here */
+static void fb_damage_add(struct browser_widget_s *bwidget, bbox_t *box)
+{
+        struct rect area, queued[FB_DAMAGE_RECTS];
+        int i, a, b;
+
+        area.x0 = box->x0;
+        area.y0 = box->y0;
+        area.x1 = box->x1;
+        area.y1 = box->y1;
+        for (i = 0; i < bwidget->redraw_count; i++) {
+                queued[i].x0 = bwidget->redraw_rect[i].x0;
+                queued[i].y0 = bwidget->redraw_rect[i].y0;
+                queued[i].x1 = bwidget->redraw_rect[i].x1;
+                queued[i].y1 = bwidget->redraw_rect[i].y1;
+        }
+
+        /* absorb queued areas into the new one for as long as that costs
+         * no more than redrawing them separately */
+        while ((i = damage_find_free(&area, queued,
+                        bwidget->redraw_count)) != -1) {
+                damage_union(&area, &queued[i]);
+                queued[i] = queued[--bwidget->redraw_count];
+        }
+
+        if (bwidget->redraw_count < FB_DAMAGE_RECTS) {
+                queued[bwidget->redraw_count++] = area;
+        } else {
+                /* list full; merge the pair which wastes least */
+                damage_find_cheapest(&area, queued, bwidget->redraw_count,
+                                &a, &b);
+                if (a == -1) {
+                        damage_union(&queued[b], &area);
+                } else {
+                        damage_union(&queued[a], &queued[b]);
+                        queued[b] = area;
+                }
+        }
+
+        for (i = 0; i < bwidget->redraw_count; i++) {
+                bwidget->redraw_rect[i].x0 = queued[i].x0;
+                bwidget->redraw_rect[i].y0 = queued[i].y0;
+                bwidget->redraw_rect[i].x1 = queued[i].x1;
+                bwidget->redraw_rect[i].y1 = queued[i].y1;
+        }
+}
+
 /* queue a redraw operation, co-ordinates are relative to the window */
 static void
 fb_queue_redraw(struct fbtk_widget_s *widget, int x0, int y0, int x1, int y1)
 {
         struct browser_widget_s *bwidget = fbtk_get_userpw(widget);
+        bbox_t box;
 
-        bwidget->redraw_box.x0 = min(bwidget->redraw_box.x0, x0);
-        bwidget->redraw_box.y0 = min(bwidget->redraw_box.y0, y0);
-        bwidget->redraw_box.x1 = max(bwidget->redraw_box.x1, x1);
-        bwidget->redraw_box.y1 = max(bwidget->redraw_box.y1, y1);
+        box.x0 = x0;
+        box.y0 = y0;
+        box.x1 = x1;
+        box.y1 = y1;
 
-        if (fbtk_clip_to_widget(widget, &bwidget->redraw_box)) {
-                bwidget->redraw_required = true;
-                fbtk_request_redraw(widget);
-        } else {
-                bwidget->redraw_box.y0 = bwidget->redraw_box.x0 = INT_MAX;
-                bwidget->redraw_box.y1 = bwidget->redraw_box.x1 = -(INT_MAX);
-                bwidget->redraw_required = false;
-        }
+        if (!fbtk_clip_to_widget(widget, &box))
+                return;
+
+        fb_damage_add(bwidget, &box);
+        bwidget->redraw_required = true;
+        fbtk_request_redraw(widget);
 }
 
 static void fb_pan(fbtk_widget_t *widget,
@@ -261,37 +317,55 @@ static void fb_redraw(fbtk_widget_t *widget,
         int y;
         int width;
         int height;
-
-
-        LOG(("redraw box %d,%d to %d,%d",bwidget->redraw_box.x0,bwidget->redraw_box.y0, bwidget->redraw_box.x1, bwidget->redraw_box.y1));
+        int i;
+        unsigned long pixels = 0;
+        bbox_t box;
 
         height = fbtk_get_height(widget);
         width = fbtk_get_width(widget);
         x = fbtk_get_x(widget);
         y = fbtk_get_y(widget);
 
-        /* adjust clipping co-ordinates according to window location */
-        bwidget->redraw_box.y0 += y;
-        bwidget->redraw_box.y1 += y;
-        bwidget->redraw_box.x0 += x;
-        bwidget->redraw_box.x1 += x;
+        /* redraw each queued area separately, so that distant small
+         * changes do not cause everything between them to be redrawn */
+        for (i = 0; i < bwidget->redraw_count; i++) {
+                /* adjust clipping co-ordinates according to window location */
+                box.x0 = bwidget->redraw_rect[i].x0 + x;
+                box.y0 = bwidget->redraw_rect[i].y0 + y;
+                box.x1 = bwidget->redraw_rect[i].x1 + x;
+                box.y1 = bwidget->redraw_rect[i].y1 + y;
+
+                nsfb_claim(fbtk_get_nsfb(widget), &box);
+
+                /* copy from rendered tiles where possible */
+                if (!tile_cache_redraw(fbtk_get_nsfb(widget), bw,
+                                       x, y, width, height,
+                                       bwidget->scrollx, bwidget->scrolly,
+                                       &box)) {
+                        /* redraw bounding box is relative to window */
+                        current_redraw_browser = bw;
+                        content_redraw(bw->current_content,
+                                       x - bwidget->scrollx,
+                                       y - bwidget->scrolly,
+                                       width, height,
+                                       box.x0, box.y0, box.x1, box.y1,
+                                       bw->scale, 0xFFFFFF);
+                        current_redraw_browser = NULL;
+                }
+
+                nsfb_update(fbtk_get_nsfb(widget), &box);
 
-        nsfb_claim(fbtk_get_nsfb(widget), &bwidget->redraw_box);
+                pixels += (box.x1 - box.x0) * (box.y1 - box.y0);
+        }
 
-        /* redraw bounding box is relative to window */
-	current_redraw_browser = bw;
-        content_redraw(bw->current_content,
-                       x - bwidget->scrollx, y - bwidget->scrolly,
-                       width, height,
-                       bwidget->redraw_box.x0, bwidget->redraw_box.y0,
-                       bwidget->redraw_box.x1, bwidget->redraw_box.y1,
-                       bw->scale, 0xFFFFFF);
-	current_redraw_browser = NULL;
+        bwidget->redraw_pixels += pixels;
+        bwidget->redraw_frames++;
 
-        nsfb_update(fbtk_get_nsfb(widget), &bwidget->redraw_box);
+        LOG(("redrew %d areas, %lu pixels (mean %lu per redraw)",
+             bwidget->redraw_count, pixels,
+             bwidget->redraw_pixels / bwidget->redraw_frames));
 
-        bwidget->redraw_box.y0 = bwidget->redraw_box.x0 = INT_MAX;
-        bwidget->redraw_box.y1 = bwidget->redraw_box.x1 = -(INT_MAX);
+        bwidget->redraw_count = 0;
         bwidget->redraw_required = false;
 }
 
@@ -426,6 +500,8 @@ static void gui_init(int argc, char** argv)
 
         fbtk = fbtk_init(nsfb);
 
+        tile_cache_init(fewidth, feheight, febpp);
+
 }
 
 static void gui_init2(int argc, char** argv)
@@ -478,10 +554,15 @@ void gui_poll(bool active)
         nsfb_event_t event;
         int timeout = 0;
 
-        active |= schedule_run() | redraws_pending;
+        schedule_run();
+
+        /* show the effect of any callbacks before waiting */
+        fbtk_redraw(fbtk);
 
-        if (!active)
-                timeout = -1;
+        /* wait for input until the next callback is due, unless fetches
+         * need polling */
+        if (!active && !redraws_pending)
+                timeout = schedule_timeout();
 
         fbtk_event(fbtk, &event, timeout);
 
@@ -496,6 +577,7 @@ void gui_poll(bool active)
 void gui_quit(void)
 {
         LOG(("gui_quit"));
+        tile_cache_finalise();
         framebuffer_finalise();
 
 	/* We don't care if this fails as we're about to exit, anyway */
@@ -1058,6 +1140,8 @@ gui_create_browser_window(struct browser_window *bw,
 
 void gui_window_destroy(struct gui_window *gw)
 {
+        tile_cache_discard(gw->bw);
+
         fbtk_destroy_widget(gw->window);
 
         free(gw);
@@ -1085,11 +1169,17 @@ void fb_window_scroll(struct fbtk_widget_s *browser, int x, int y)
 
 void gui_window_redraw(struct gui_window *g, int x0, int y0, int x1, int y1)
 {
+        struct browser_widget_s *bwidget = fbtk_get_userpw(g->browser);
+
+        tile_cache_invalidate(g->bw,
+                              x0 + bwidget->scrollx, y0 + bwidget->scrolly,
+                              x1 + bwidget->scrollx, y1 + bwidget->scrolly);
         fb_queue_redraw(g->browser, x0, y0, x1, y1);
 }
 
 void gui_window_redraw_window(struct gui_window *g)
 {
+        tile_cache_invalidate_all(g->bw);
         fb_queue_redraw(g->browser, 0, 0, fbtk_get_width(g->browser),fbtk_get_height(g->browser) );
 }
 
@@ -1097,6 +1187,10 @@ void gui_window_update_box(struct gui_window *g,
                            const union content_msg_data *data)
 {
         struct browser_widget_s *bwidget = fbtk_get_userpw(g->browser);
+
+        tile_cache_invalidate(g->bw, data->redraw.x, data->redraw.y,
+                              data->redraw.x + data->redraw.width,
+                              data->redraw.y + data->redraw.height);
         fb_queue_redraw(g->browser,
                         data->redraw.x - bwidget->scrollx,
                         data->redraw.y - bwidget->scrolly,
@@ -1311,6 +1405,7 @@ void gui_window_remove_caret(struct gui_window *g)
 
 void gui_window_new_content(struct gui_window *g)
 {
+        tile_cache_invalidate_all(g->bw);
 }
 
 bool gui_window_scroll_start(struct gui_window *g)
@@ -0,0 +1,650 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Rendered tile cache (implementation).
+ *
+ * Tiles are TILE_CACHE_SIZE pixels square and aligned to the document
+ * origin.  Each is rendered by pointing the plotters at an offscreen
+ * surface of the same depth as the screen, and its pixels are then kept,
+ * so drawing it again is a copy of rows into the screen.
+ *
+ * Content changes mark the affected part of a tile dirty rather than
+ * discarding it, so that a small animation only re-renders its own area.
+ * Once the browser has been idle for a moment, tiles around the viewport
+ * are rendered one at a time, ready for scrolling.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libnsfb.h>
+#include <libnsfb_plot.h>
+
+#include "content/content.h"
+#include "desktop/browser.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+#include "framebuffer/framebuffer.h"
+#include "framebuffer/tile_cache.h"
+
+/** Width and height of a tile, in pixels. */
+#define TILE_CACHE_SIZE 256
+
+/** Minimum memory budget for tiles, in bytes.  It is raised at start up to
+ * three screens' worth, so that the tiles in view are never evicted. */
+#define TILE_CACHE_LIMIT (16 * 1024 * 1024)
+
+/** Delay after the last redraw before tiles around the viewport are
+ * rendered, in cs. */
+#define TILE_CACHE_IDLE 10
+
+/** A rendered tile of a browser window's document. */
+struct tile {
+	struct browser_window *bw;	/**< Window the tile belongs to */
+	struct hlcache_handle *content;	/**< Content rendered */
+	float scale;			/**< Scale rendered at */
+	int x, y;			/**< Document position of top left */
+	uint8_t *pixels;		/**< Pixels, in the screen's format */
+	nsfb_bbox_t dirty;		/**< Area needing rendering, relative
+					 * to the tile; empty if x0 >= x1 */
+	struct tile *prev;		/**< Previous in use order */
+	struct tile *next;		/**< Next in use order */
+};
+
+/** Tiles, most recently used first. */
+static struct tile *tile_head;
+static struct tile *tile_tail;
+
+/** Total size of tile pixels, in bytes. */
+static size_t tile_cache_size;
+/** Memory budget for tile pixels, in bytes. */
+static size_t tile_cache_limit;
+
+/** Offscreen surface tiles are rendered into, or NULL if disabled. */
+static nsfb_t *tile_surface;
+/** Pixel buffer of tile_surface. */
+static uint8_t *tile_surface_ptr;
+/** Distance between rows of tile_surface, in bytes. */
+static int tile_surface_linelen;
+/** Bytes per pixel of the screen and tiles. */
+static int tile_bpp;
+
+/** Viewport last drawn, around which tiles are rendered while idle. */
+static struct {
+	struct browser_window *bw;
+	int x, y;		/**< Document position of top left */
+	int width, height;
+} tile_viewport;
+
+static int tile_index(int x);
+static struct tile *tile_cache_get(struct browser_window *bw, int x, int y,
+		int width, int height);
+static struct tile *tile_cache_find(struct browser_window *bw, int x, int y);
+static bool tile_cache_render(struct tile *tile, int width, int height);
+static void tile_cache_touch(struct tile *tile);
+static void tile_cache_unlink(struct tile *tile);
+static void tile_cache_evict(size_t size);
+static void tile_cache_mark(struct tile *tile, int x0, int y0, int x1, int y1);
+static void tile_cache_prerender(void *p);
+
+
+/**
+ * Initialise the tile cache
+ *
+ * \param  width   width of the screen
+ * \param  height  height of the screen
+ * \param  bpp     bits per pixel of the screen
+ * \return true if tiles will be used, false if windows must be redrawn
+ *         directly
+ */
+
+bool tile_cache_init(int width, int height, int bpp)
+{
+	size_t screen_tiles;
+
+	if (bpp < 8 || bpp % 8 != 0) {
+		LOG(("tile cache disabled at %d bpp", bpp));
+		return false;
+	}
+
+	tile_surface = nsfb_init(NSFB_FRONTEND_RAM);
+	if (tile_surface == NULL)
+		return false;
+
+	if (nsfb_set_geometry(tile_surface, TILE_CACHE_SIZE, TILE_CACHE_SIZE,
+			bpp) == -1 ||
+			nsfb_init_frontend(tile_surface) == -1 ||
+			nsfb_get_framebuffer(tile_surface, &tile_surface_ptr,
+			&tile_surface_linelen) == -1) {
+		LOG(("unable to create tile surface"));
+		nsfb_finalise(tile_surface);
+		tile_surface = NULL;
+		return false;
+	}
+
+	tile_bpp = bpp / 8;
+
+	/* a viewport at an arbitrary offset touches one more tile in each
+	 * direction than it would if aligned */
+	screen_tiles = (width / TILE_CACHE_SIZE + 2) *
+			(height / TILE_CACHE_SIZE + 2);
+	tile_cache_limit = max(TILE_CACHE_LIMIT, 3 * screen_tiles *
+			TILE_CACHE_SIZE * TILE_CACHE_SIZE * tile_bpp);
+
+	LOG(("tile cache of %u bytes", (unsigned int) tile_cache_limit));
+
+	return true;
+}
+
+
+/**
+ * Free all tiles and the tile surface
+ */
+
+void tile_cache_finalise(void)
+{
+	while (tile_head != NULL) {
+		struct tile *tile = tile_head;
+
+		tile_cache_unlink(tile);
+		free(tile->pixels);
+		free(tile);
+	}
+
+	if (tile_viewport.bw != NULL) {
+		schedule_remove(tile_cache_prerender, NULL);
+		tile_viewport.bw = NULL;
+	}
+
+	if (tile_surface != NULL) {
+		nsfb_finalise(tile_surface);
+		tile_surface = NULL;
+	}
+}
+
+
+/**
+ * Draw part of a browser window from tiles, rendering any which are needed
+ *
+ * \param  nsfb     screen
+ * \param  bw       browser window to draw
+ * \param  x        screen position of left of window
+ * \param  y        screen position of top of window
+ * \param  width    width of window
+ * \param  height   height of window
+ * \param  scrollx  document position shown at left of window
+ * \param  scrolly  document position shown at top of window
+ * \param  box      screen area to draw, within the window
+ * \return true on success, false if the area must be redrawn directly
+ *
+ * The caller must claim and update the area of the screen.
+ */
+
+bool tile_cache_redraw(nsfb_t *nsfb, struct browser_window *bw,
+		int x, int y, int width, int height, int scrollx, int scrolly,
+		const nsfb_bbox_t *box)
+{
+	uint8_t *screen_ptr;
+	int screen_linelen;
+	int dx0, dy0, dx1, dy1;
+	int tx, ty;
+
+	if (tile_surface == NULL || bw->current_content == NULL)
+		return false;
+
+	if (nsfb_get_framebuffer(nsfb, &screen_ptr, &screen_linelen) == -1)
+		return false;
+
+	/* area to draw, in document co-ordinates */
+	dx0 = box->x0 - x + scrollx;
+	dy0 = box->y0 - y + scrolly;
+	dx1 = box->x1 - x + scrollx;
+	dy1 = box->y1 - y + scrolly;
+
+	for (ty = tile_index(dy0) * TILE_CACHE_SIZE; ty < dy1;
+			ty += TILE_CACHE_SIZE) {
+		for (tx = tile_index(dx0) * TILE_CACHE_SIZE; tx < dx1;
+				tx += TILE_CACHE_SIZE) {
+			struct tile *tile;
+			int cx0 = max(dx0, tx);
+			int cy0 = max(dy0, ty);
+			int cx1 = min(dx1, tx + TILE_CACHE_SIZE);
+			int cy1 = min(dy1, ty + TILE_CACHE_SIZE);
+			size_t bytes = (cx1 - cx0) * tile_bpp;
+			const uint8_t *src;
+			uint8_t *dst;
+			int row;
+
+			tile = tile_cache_get(bw, tx, ty, width, height);
+			if (tile == NULL)
+				return false;
+
+			src = tile->pixels + ((cy0 - ty) * TILE_CACHE_SIZE +
+					(cx0 - tx)) * tile_bpp;
+			dst = screen_ptr + (cy0 - scrolly + y) * screen_linelen +
+					(cx0 - scrollx + x) * tile_bpp;
+			for (row = cy0; row != cy1; row++) {
+				memcpy(dst, src, bytes);
+				src += TILE_CACHE_SIZE * tile_bpp;
+				dst += screen_linelen;
+			}
+		}
+	}
+
+	/* render around this viewport once the user pauses */
+	if (tile_viewport.bw != NULL)
+		schedule_remove(tile_cache_prerender, NULL);
+	tile_viewport.bw = bw;
+	tile_viewport.x = scrollx;
+	tile_viewport.y = scrolly;
+	tile_viewport.width = width;
+	tile_viewport.height = height;
+	schedule(TILE_CACHE_IDLE, tile_cache_prerender, NULL);
+
+	return true;
+}
+
+
+/**
+ * Mark part of a browser window's document as changed
+ *
+ * \param  bw  browser window
+ * \param  x0  left of changed area, in document co-ordinates
+ * \param  y0  top of changed area
+ * \param  x1  right of changed area
+ * \param  y1  bottom of changed area
+ */
+
+void tile_cache_invalidate(struct browser_window *bw,
+		int x0, int y0, int x1, int y1)
+{
+	struct tile *tile;
+
+	for (tile = tile_head; tile != NULL; tile = tile->next) {
+		if (tile->bw != bw ||
+				x1 <= tile->x ||
+				tile->x + TILE_CACHE_SIZE <= x0 ||
+				y1 <= tile->y ||
+				tile->y + TILE_CACHE_SIZE <= y0)
+			continue;
+
+		tile_cache_mark(tile, x0 - tile->x, y0 - tile->y,
+				x1 - tile->x, y1 - tile->y);
+	}
+}
+
+
+/**
+ * Mark the whole of a browser window's document as changed
+ *
+ * \param  bw  browser window
+ *
+ * The tiles are kept, to save reallocating them when they are rendered
+ * again.
+ */
+
+void tile_cache_invalidate_all(struct browser_window *bw)
+{
+	struct tile *tile;
+
+	for (tile = tile_head; tile != NULL; tile = tile->next) {
+		if (tile->bw == bw)
+			tile_cache_mark(tile, 0, 0,
+					TILE_CACHE_SIZE, TILE_CACHE_SIZE);
+	}
+}
+
+
+/**
+ * Free all tiles of a browser window which is being destroyed
+ *
+ * \param  bw  browser window
+ */
+
+void tile_cache_discard(struct browser_window *bw)
+{
+	struct tile *tile, *next;
+
+	for (tile = tile_head; tile != NULL; tile = next) {
+		next = tile->next;
+		if (tile->bw != bw)
+			continue;
+
+		tile_cache_unlink(tile);
+		tile_cache_size -= TILE_CACHE_SIZE * TILE_CACHE_SIZE *
+				tile_bpp;
+		free(tile->pixels);
+		free(tile);
+	}
+
+	if (tile_viewport.bw == bw) {
+		schedule_remove(tile_cache_prerender, NULL);
+		tile_viewport.bw = NULL;
+	}
+}
+
+
+/**
+ * Find the index of the tile containing a document co-ordinate
+ *
+ * \param  x  co-ordinate, possibly negative
+ * \return  index of tile
+ */
+
+int tile_index(int x)
+{
+	if (x < 0)
+		return -((TILE_CACHE_SIZE - 1 - x) / TILE_CACHE_SIZE);
+
+	return x / TILE_CACHE_SIZE;
+}
+
+
+/**
+ * Find or create a tile, and render any part of it which is out of date
+ *
+ * \param  bw      browser window
+ * \param  x       document position of left of tile
+ * \param  y       document position of top of tile
+ * \param  width   width of window
+ * \param  height  height of window
+ * \return  tile, or NULL on memory exhaustion or render failure
+ */
+
+struct tile *tile_cache_get(struct browser_window *bw, int x, int y,
+		int width, int height)
+{
+	size_t size = TILE_CACHE_SIZE * TILE_CACHE_SIZE * tile_bpp;
+	struct tile *tile;
+
+	tile = tile_cache_find(bw, x, y);
+
+	if (tile == NULL) {
+		tile_cache_evict(size);
+
+		tile = malloc(sizeof *tile);
+		if (tile == NULL)
+			return NULL;
+		tile->pixels = malloc(size);
+		if (tile->pixels == NULL) {
+			free(tile);
+			return NULL;
+		}
+
+		tile->bw = bw;
+		tile->content = bw->current_content;
+		tile->scale = bw->scale;
+		tile->x = x;
+		tile->y = y;
+		tile->dirty.x0 = tile->dirty.y0 = 0;
+		tile->dirty.x1 = tile->dirty.y1 = TILE_CACHE_SIZE;
+
+		tile->prev = NULL;
+		tile->next = tile_head;
+		if (tile_head != NULL)
+			tile_head->prev = tile;
+		else
+			tile_tail = tile;
+		tile_head = tile;
+
+		tile_cache_size += size;
+	} else {
+		tile_cache_touch(tile);
+	}
+
+	/* a tile of a previous page, or at another scale, is all stale */
+	if (tile->content != bw->current_content || tile->scale != bw->scale) {
+		tile->content = bw->current_content;
+		tile->scale = bw->scale;
+		tile_cache_mark(tile, 0, 0, TILE_CACHE_SIZE, TILE_CACHE_SIZE);
+	}
+
+	if (tile->dirty.x0 < tile->dirty.x1 &&
+			!tile_cache_render(tile, width, height))
+		return NULL;
+
+	return tile;
+}
+
+
+/**
+ * Find an existing tile
+ *
+ * \param  bw  browser window
+ * \param  x   document position of left of tile
+ * \param  y   document position of top of tile
+ * \return  tile, or NULL if not cached
+ */
+
+struct tile *tile_cache_find(struct browser_window *bw, int x, int y)
+{
+	struct tile *tile;
+
+	for (tile = tile_head; tile != NULL; tile = tile->next) {
+		if (tile->bw == bw && tile->x == x && tile->y == y)
+			return tile;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Render the dirty area of a tile
+ *
+ * \param  tile    tile to render
+ * \param  width   width of window
+ * \param  height  height of window
+ * \return  true on success, false on error
+ */
+
+bool tile_cache_render(struct tile *tile, int width, int height)
+{
+	struct browser_window *bw = tile->bw;
+	size_t bytes = (tile->dirty.x1 - tile->dirty.x0) * tile_bpp;
+	const uint8_t *src;
+	uint8_t *dst;
+	nsfb_t *screen;
+	bool ok;
+	int row;
+
+	screen = framebuffer_set_surface(tile_surface);
+
+	current_redraw_browser = bw;
+	ok = content_redraw(bw->current_content, -tile->x, -tile->y,
+			width, height,
+			tile->dirty.x0, tile->dirty.y0,
+			tile->dirty.x1, tile->dirty.y1,
+			bw->scale, 0xFFFFFF);
+	current_redraw_browser = NULL;
+
+	framebuffer_set_surface(screen);
+
+	if (!ok)
+		return false;
+
+	/* only the dirty area of the surface is meaningful */
+	src = tile_surface_ptr + tile->dirty.y0 * tile_surface_linelen +
+			tile->dirty.x0 * tile_bpp;
+	dst = tile->pixels + (tile->dirty.y0 * TILE_CACHE_SIZE +
+			tile->dirty.x0) * tile_bpp;
+	for (row = tile->dirty.y0; row != tile->dirty.y1; row++) {
+		memcpy(dst, src, bytes);
+		src += tile_surface_linelen;
+		dst += TILE_CACHE_SIZE * tile_bpp;
+	}
+
+	tile->dirty.x0 = tile->dirty.y0 = 0;
+	tile->dirty.x1 = tile->dirty.y1 = 0;
+
+	return true;
+}
+
+
+/**
+ * Move a tile to the front of the use order
+ *
+ * \param  tile  tile which has been used
+ */
+
+void tile_cache_touch(struct tile *tile)
+{
+	if (tile == tile_head)
+		return;
+
+	tile_cache_unlink(tile);
+
+	tile->prev = NULL;
+	tile->next = tile_head;
+	if (tile_head != NULL)
+		tile_head->prev = tile;
+	else
+		tile_tail = tile;
+	tile_head = tile;
+}
+
+
+/**
+ * Remove a tile from the use order
+ *
+ * \param  tile  tile to remove
+ */
+
+void tile_cache_unlink(struct tile *tile)
+{
+	if (tile->prev != NULL)
+		tile->prev->next = tile->next;
+	else
+		tile_head = tile->next;
+
+	if (tile->next != NULL)
+		tile->next->prev = tile->prev;
+	else
+		tile_tail = tile->prev;
+}
+
+
+/**
+ * Free least recently used tiles until another can be added
+ *
+ * \param  size  size of tile to be added, in bytes
+ */
+
+void tile_cache_evict(size_t size)
+{
+	while (tile_tail != NULL && tile_cache_size + size > tile_cache_limit) {
+		struct tile *tile = tile_tail;
+
+		tile_cache_unlink(tile);
+		tile_cache_size -= size;
+		free(tile->pixels);
+		free(tile);
+	}
+}
+
+
+/**
+ * Add an area to the dirty area of a tile
+ *
+ * \param  tile  tile to mark
+ * \param  x0    left of area, relative to the tile
+ * \param  y0    top of area
+ * \param  x1    right of area
+ * \param  y1    bottom of area
+ */
+
+void tile_cache_mark(struct tile *tile, int x0, int y0, int x1, int y1)
+{
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, TILE_CACHE_SIZE);
+	y1 = min(y1, TILE_CACHE_SIZE);
+
+	if (tile->dirty.x1 <= tile->dirty.x0) {
+		tile->dirty.x0 = x0;
+		tile->dirty.y0 = y0;
+		tile->dirty.x1 = x1;
+		tile->dirty.y1 = y1;
+	} else {
+		tile->dirty.x0 = min(tile->dirty.x0, x0);
+		tile->dirty.y0 = min(tile->dirty.y0, y0);
+		tile->dirty.x1 = max(tile->dirty.x1, x1);
+		tile->dirty.y1 = max(tile->dirty.y1, y1);
+	}
+}
+
+
+/**
+ * Render one tile around the last viewport drawn, and reschedule until
+ * all are up to date
+ *
+ * \param  p  unused
+ */
+
+void tile_cache_prerender(void *p)
+{
+	struct browser_window *bw = tile_viewport.bw;
+	int content_width, content_height;
+	int col0, row0, col1, row1;
+	int col, row;
+
+	if (bw == NULL || bw->current_content == NULL ||
+			content_get_status(bw->current_content) !=
+			CONTENT_STATUS_DONE)
+		return;
+
+	content_width = content_get_width(bw->current_content);
+	content_height = content_get_height(bw->current_content);
+
+	/* the tiles in view, and one more in each direction */
+	col0 = tile_index(tile_viewport.x) - 1;
+	row0 = tile_index(tile_viewport.y) - 1;
+	col1 = tile_index(tile_viewport.x + tile_viewport.width - 1) + 1;
+	row1 = tile_index(tile_viewport.y + tile_viewport.height - 1) + 1;
+
+	col0 = max(col0, 0);
+	row0 = max(row0, 0);
+	col1 = min(col1, tile_index(content_width - 1));
+	row1 = min(row1, tile_index(content_height - 1));
+
+	/* rows below the viewport first, as scrolling down is commonest */
+	for (row = row1; row >= row0; row--) {
+		for (col = col0; col <= col1; col++) {
+			struct tile *tile;
+			int x = col * TILE_CACHE_SIZE;
+			int y = row * TILE_CACHE_SIZE;
+
+			tile = tile_cache_find(bw, x, y);
+			if (tile != NULL && tile->dirty.x1 <= tile->dirty.x0 &&
+					tile->content == bw->current_content &&
+					tile->scale == bw->scale)
+				continue;
+
+			if (tile_cache_get(bw, x, y, tile_viewport.width,
+					tile_viewport.height) == NULL)
+				return;
+
+			schedule(0, tile_cache_prerender, NULL);
+			return;
+		}
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Rendered tile cache (interface).
+ *
+ * Browser windows are drawn by copying from square tiles of the document
+ * which are rendered once and kept, so that scrolling back over a page
+ * does not redraw it.  Document co-ordinates here are in plotted pixels,
+ * as for the scroll offsets.
+ */
+
+#ifndef NETSURF_FB_TILE_CACHE_H
+#define NETSURF_FB_TILE_CACHE_H
+
+#include <stdbool.h>
+
+struct browser_window;
+struct nsfb_bbox_s;
+
+bool tile_cache_init(int width, int height, int bpp);
+void tile_cache_finalise(void);
+bool tile_cache_redraw(nsfb_t *nsfb, struct browser_window *bw,
+		int x, int y, int width, int height, int scrollx, int scrolly,
+		const struct nsfb_bbox_s *box);
+void tile_cache_invalidate(struct browser_window *bw,
+		int x0, int y0, int x1, int y1);
+void tile_cache_invalidate_all(struct browser_window *bw);
+void tile_cache_discard(struct browser_window *bw);
+
+#endif
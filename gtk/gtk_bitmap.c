@@ -31,7 +31,9 @@
 #include "gtk/gtk_bitmap.h"
 #include "gtk/gtk_scaffolding.h"
 #include "image/bitmap.h"
+#include "image/scale_cache.h"
 #include "utils/log.h"
+#include "utils/pixel.h"
 
 
 struct bitmap {
@@ -39,6 +41,7 @@ struct bitmap {
   GdkPixbuf *pretile_x;
   GdkPixbuf *pretile_y;
   GdkPixbuf *pretile_xy;
+  bool opaque;
 };
 
 #define MIN_PRETILE_WIDTH 256
@@ -66,6 +69,7 @@ void *bitmap_create(int width, int height, unsigned int state)
 	 */
 	gdk_pixbuf_fill(bmp->primary, 0);
         bmp->pretile_x = bmp->pretile_y = bmp->pretile_xy = NULL;
+	bmp->opaque = (state & BITMAP_OPAQUE) != 0;
 	return bmp;
 }
 
@@ -80,7 +84,7 @@ void bitmap_set_opaque(void *vbitmap, bool opaque)
 {
 	struct bitmap *bitmap = (struct bitmap *)vbitmap;
 	assert(bitmap);
-/* todo: set bitmap as opaque */
+	bitmap->opaque = opaque;
 }
 
 
@@ -94,8 +98,10 @@ bool bitmap_test_opaque(void *vbitmap)
 {
 	struct bitmap *bitmap = (struct bitmap *)vbitmap;
 	assert(bitmap);
-/* todo: test if bitmap as opaque */
-	return false;
+	return pixel_test_opaque(gdk_pixbuf_get_pixels(bitmap->primary),
+			gdk_pixbuf_get_width(bitmap->primary),
+			gdk_pixbuf_get_height(bitmap->primary),
+			gdk_pixbuf_get_rowstride(bitmap->primary));
 }
 
 
@@ -108,8 +114,7 @@ bool bitmap_get_opaque(void *vbitmap)
 {
 	struct bitmap *bitmap = (struct bitmap *)vbitmap;
 	assert(bitmap);
-/* todo: get whether bitmap is opaque */
-	return false;
+	return bitmap->opaque;
 }
 
 
@@ -181,6 +186,7 @@ void bitmap_destroy(void *vbitmap)
 {
 	struct bitmap *bitmap = (struct bitmap *)vbitmap;
 	assert(bitmap);
+	scale_cache_invalidate(bitmap);
         gtk_bitmap_free_pretiles(bitmap);
 	g_object_unref(bitmap->primary);
         free(bitmap);
@@ -218,6 +224,7 @@ bool bitmap_save(void *vbitmap, const char *path, unsigned flags)
  */
 void bitmap_modified(void *vbitmap) {
 	struct bitmap *bitmap = (struct bitmap *)vbitmap;
+	scale_cache_invalidate(bitmap);
         gtk_bitmap_free_pretiles(bitmap);
 }
 
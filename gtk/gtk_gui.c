@@ -62,6 +62,7 @@
 #include "gtk/gtk_history.h"
 #include "gtk/gtk_filetype.h"
 #include "gtk/gtk_download.h"
+#include "gtk/gtk_schedule.h"
 #include "render/box.h"
 #include "render/form.h"
 #include "render/html.h"
@@ -453,6 +454,9 @@ void gui_poll(bool active)
 		}
 	}
 
+	/* wake for the next scheduled callback, if blocking */
+	nsgtk_schedule_arm();
+
 	gtk_main_iteration_do(block);
 
 	for (unsigned int i = 0; i != fd_count; i++) {
@@ -39,6 +39,7 @@
 #include "desktop/options.h"
 #include "gtk/options.h"
 #include "gtk/gtk_bitmap.h"
+#include "image/scale_cache.h"
 
 #ifndef CAIRO_VERSION
 #error "nsgtk requires cairo"
@@ -417,13 +418,22 @@ static bool nsgtk_plot_bitmap(int x, int y, int width, int height,
 	int doneheight = 0, donewidth = 0;
 	GdkPixbuf *primary;
 	GdkPixbuf *pretiled = NULL;
+	struct bitmap *scaled;
 
 	bool repeat_x = (flags & BITMAPF_REPEAT_X);
 	bool repeat_y = (flags & BITMAPF_REPEAT_Y);
 
 	if (!(repeat_x || repeat_y)) {
-		/* Not repeating at all, so just pass it on */
+		/* Not repeating at all, so just pass it on, scaled through
+		 * the cache if possible */
 		primary = gtk_bitmap_get_primary(bitmap);
+		if (gdk_pixbuf_get_width(primary) != width ||
+				gdk_pixbuf_get_height(primary) != height) {
+			scaled = scale_cache_get(bitmap, width, height,
+					option_render_resample);
+			if (scaled != NULL)
+				primary = gtk_bitmap_get_primary(scaled);
+		}
 		return nsgtk_plot_pixbuf(x, y, width, height, primary, bg);
 	}
 
@@ -21,4 +21,6 @@
 
 typedef void (*gtk_callback)(void *p);
 
+void nsgtk_schedule_arm(void);
+
 #endif /* NETSURF_GTK_CALLBACK_H */
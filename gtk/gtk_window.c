@@ -26,6 +26,7 @@
 #include "desktop/searchweb.h"
 #include "desktop/textinput.h"
 #include "desktop/selection.h"
+#include "render/font_cache.h"
 #include "gtk/gtk_gui.h"
 #include "gtk/options.h"
 #include "gtk/gtk_scaffolding.h"
@@ -721,6 +722,9 @@ gboolean nsgtk_window_size_allocate_event(GtkWidget *widget,
 
 void nsgtk_reflow_all_windows(void)
 {
+	/* font choices may have changed */
+	font_cache_flush();
+
 	for (struct gui_window *g = window_list; g; g = g->next) {
 		nsgtk_tab_options_changed(GTK_WIDGET(
 				nsgtk_scaffolding_notebook(g->scaffold)));
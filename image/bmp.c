@@ -34,6 +34,7 @@
 #include "desktop/plotters.h"
 #include "image/bitmap.h"
 #include "image/bmp.h"
+#include "image/pretile.h"
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/utils.h"
@@ -137,21 +138,15 @@ bool nsbmp_redraw_tiled(struct content *c, int x, int y,
 		float scale, colour background_colour,
 		bool repeat_x, bool repeat_y)
 {
-	bitmap_flags_t flags = BITMAPF_NONE;
-
 	if (!c->data.bmp.bmp->decoded)
 		if (bmp_decode(c->data.bmp.bmp) != BMP_OK)
 			return false;
 
 	c->bitmap = c->data.bmp.bmp->bitmap;
 
-	if (repeat_x)
-		flags |= BITMAPF_REPEAT_X;
-	if (repeat_y)
-		flags |= BITMAPF_REPEAT_Y;
-
-	return plot.bitmap(x, y, width, height, c->bitmap,
-			background_colour, flags);
+	return pretile_plot_bitmap(x, y, width, height,
+			clip_x0, clip_y0, clip_x1, clip_y1,
+			c->bitmap, background_colour, repeat_x, repeat_y);
 }
 
 
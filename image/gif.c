@@ -22,8 +22,16 @@
  * Content for image/gif (implementation)
  *
  * All GIFs are dynamically decompressed using the routines that gifread.c
- * provides. Whilst this allows support for progressive decoding, it is
- * not implemented here as NetSurf currently does not provide such support.
+ * provides.  While a GIF is loading, the first frame is displayed as far as
+ * it has arrived; any animation starts once the whole GIF has arrived.
+ *
+ * All animations are driven by a single scheduled clock.  An animation only
+ * advances to its next frame if its current frame has been plotted, so
+ * GIFs which are scrolled out of view or in hidden windows pause until they
+ * are redrawn.  Decoded frames are kept, up to NSGIF_FRAME_CACHE_LIMIT bytes
+ * for all GIFs, so that looping animations are not decoded repeatedly.  An
+ * animation's frames are released when it pauses or finishes, leaving the
+ * space to those which are still being displayed.
  *
  * [rjw] - Sun 4th April 2004
  */
@@ -43,13 +51,31 @@
 #include "desktop/plotters.h"
 #include "image/bitmap.h"
 #include "image/gif.h"
+#include "image/pretile.h"
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/utils.h"
 
+/** Limit on the total size of cached animation frames, in bytes */
+#define NSGIF_FRAME_CACHE_LIMIT (4 * 1024 * 1024)
+
+/** Animated GIF contents */
+static struct content *nsgif_animations = NULL;
+/** Time the animation clock is scheduled for, or 0 if not scheduled */
+static unsigned int nsgif_clock_time = 0;
+/** Total size of cached animation frames */
+static size_t nsgif_frame_cache_size = 0;
+
 static void nsgif_invalidate(void *bitmap, void *private_word);
-static void nsgif_animate(void *p);
+static void nsgif_start(struct content *c);
+static void nsgif_stop(struct content *c);
+static int nsgif_frame_delay(struct content *c, int frame);
+static void nsgif_schedule(void);
+static void nsgif_clock(void *p);
+static void nsgif_animate(struct content *c);
 static gif_result nsgif_get_frame(struct content *c);
+static void nsgif_cache_frame(struct content *c, int frame);
+static void nsgif_release_frames(struct content *c);
 
 /* The Bitmap callbacks function table;
  * necessary for interaction with nsgiflib.
@@ -75,6 +101,63 @@ bool nsgif_create(struct content *c, const struct http_parameter *params)
 		return false;
 	}
 	gif_create(c->data.gif.gif, &gif_bitmap_callbacks);
+	c->data.gif.current_frame = 0;
+	c->data.gif.frames = NULL;
+	c->data.gif.next_animation = NULL;
+	c->data.gif.frame_time = 0;
+	c->data.gif.plotted = false;
+	c->data.gif.paused = false;
+	return true;
+}
+
+
+/**
+ * Process data for a CONTENT_GIF.
+ *
+ * The frames received so far are found, so that the first frame can be
+ * displayed while it arrives.  Errors are left for nsgif_convert().
+ */
+
+bool nsgif_process_data(struct content *c, const char *data,
+		unsigned int size)
+{
+	struct gif_animation *gif = c->data.gif.gif;
+	const char *source;
+	unsigned long source_size;
+	gif_result res;
+
+	source = content__get_source_data(c, &source_size);
+
+	/* the first frame is complete: the rest can wait for conversion,
+	 * but the source may have moved as it grew, and the first frame may
+	 * be redrawn before then */
+	if (gif->frame_count != 0) {
+		gif->gif_data = (unsigned char *) source;
+		gif->buffer_size = source_size;
+		return true;
+	}
+
+	do {
+		res = gif_initialise(gif, source_size,
+				(unsigned char *) source);
+	} while (res == GIF_WORKING);
+
+	if ((res != GIF_OK && res != GIF_INSUFFICIENT_FRAME_DATA) ||
+			gif->frame_count_partial == 0 ||
+			gif->width == 0 || gif->height == 0)
+		return true;
+
+	c->width = gif->width;
+	c->height = gif->height;
+
+	/* decode the first frame again, from the data which has arrived */
+	if (gif->decoded_frame == 0)
+		gif->decoded_frame = -1;
+
+	if (c->status == CONTENT_STATUS_LOADING)
+		content_set_ready(c);
+	content__progress(c, 0, c->height);
+
 	return true;
 }
 
@@ -129,11 +212,13 @@ bool nsgif_convert(struct content *c)
 	content__set_title(c, title);
 	c->size += (gif->width * gif->height * 4) + 16 + 44;
 
-	/* Schedule the animation if we have one */
+	/* Start the animation if we have one */
 	c->data.gif.current_frame = 0;
-	if (gif->frame_count_partial > 1)
-		schedule(gif->frames[0].frame_delay, nsgif_animate, c);
-	else
+	if (gif->frame_count_partial > 1) {
+		c->data.gif.frames = calloc(gif->frame_count_partial,
+				sizeof *c->data.gif.frames);
+		nsgif_start(c);
+	} else
 		bitmap_set_suspendable(gif->frame_image, gif, nsgif_invalidate);
 
 	/* Exit as a success */
@@ -156,10 +241,14 @@ bool nsgif_redraw(struct content *c, int x, int y,
 		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
 		float scale, colour background_colour)
 {
-	if (c->data.gif.current_frame != c->data.gif.gif->decoded_frame)
-		if (nsgif_get_frame(c) != GIF_OK)
-			return false;
-	c->bitmap = c->data.gif.gif->frame_image;
+	gif_result res;
+
+	res = nsgif_get_frame(c);
+	/* the frame may not have arrived completely */
+	if (res != GIF_OK && res != GIF_INSUFFICIENT_FRAME_DATA)
+		return false;
+	if (c->bitmap == NULL)
+		return true;
 	return plot.bitmap(x, y, width, height,	c->bitmap,
 			background_colour, BITMAPF_NONE);
 }
@@ -171,83 +260,316 @@ bool nsgif_redraw_tiled(struct content *c, int x, int y,
 		float scale, colour background_colour,
 		bool repeat_x, bool repeat_y)
 {
-	bitmap_flags_t flags = BITMAPF_NONE;
-
-	if (c->data.gif.current_frame != c->data.gif.gif->decoded_frame)
-		if (nsgif_get_frame(c) != GIF_OK)
-			return false;
+	gif_result res;
 
-	c->bitmap = c->data.gif.gif->frame_image;
+	res = nsgif_get_frame(c);
+	/* the frame may not have arrived completely */
+	if (res != GIF_OK && res != GIF_INSUFFICIENT_FRAME_DATA)
+		return false;
+	if (c->bitmap == NULL)
+		return true;
             
-	if (repeat_x)
-		flags |= BITMAPF_REPEAT_X;
-	if (repeat_y)
-		flags |= BITMAPF_REPEAT_Y;
-
-	return plot.bitmap(x, y, width, height, c->bitmap, background_colour, flags);
+	return pretile_plot_bitmap(x, y, width, height,
+			clip_x0, clip_y0, clip_x1, clip_y1,
+			c->bitmap, background_colour, repeat_x, repeat_y);
 }
 
 
 void nsgif_destroy(struct content *c)
 {
+	struct gif_animation *gif = c->data.gif.gif;
+
+	nsgif_stop(c);
+
 	/* Free all the associated memory buffers */
-	schedule_remove(nsgif_animate, c);
-	gif_finalise(c->data.gif.gif);
-	free(c->data.gif.gif);
+	if (c->data.gif.frames != NULL) {
+		nsgif_release_frames(c);
+		free(c->data.gif.frames);
+	}
+	gif_finalise(gif);
+	free(gif);
 }
 
 
 bool nsgif_clone(const struct content *old, struct content *new_content)
 {
-	/* Simply replay creation and conversion of content */
+	const char *data;
+	unsigned long size;
+
+	/* Simply replay creation and conversion of content, or the data
+	 * received so far if the old content is still loading */
 	if (nsgif_create(new_content, NULL) == false)
 		return false;
 
-	if (old->status == CONTENT_STATUS_READY ||
-			old->status == CONTENT_STATUS_DONE) {
+	if (old->status == CONTENT_STATUS_DONE) {
 		if (nsgif_convert(new_content) == false)
 			return false;
+	} else {
+		data = content__get_source_data(new_content, &size);
+		if (size > 0 && nsgif_process_data(new_content,
+				data, size) == false)
+			return false;
 	}
 
 	return true;
 }
 
 
+/**
+ * Add a GIF to the animations driven by the animation clock
+ *
+ * \param c  the content to animate
+ */
+void nsgif_start(struct content *c)
+{
+	c->data.gif.next_animation = nsgif_animations;
+	nsgif_animations = c;
+
+	c->data.gif.paused = false;
+	c->data.gif.frame_time = wallclock() + nsgif_frame_delay(c, 0);
+	nsgif_schedule();
+}
+
+
+/**
+ * Remove a GIF from the animations driven by the animation clock
+ *
+ * \param c  the content to stop animating
+ */
+void nsgif_stop(struct content *c)
+{
+	struct content **prev;
+
+	for (prev = &nsgif_animations; *prev != NULL;
+			prev = &(*prev)->data.gif.next_animation) {
+		if (*prev == c) {
+			*prev = c->data.gif.next_animation;
+			c->data.gif.next_animation = NULL;
+			break;
+		}
+	}
+
+	if (nsgif_animations == NULL && nsgif_clock_time != 0) {
+		schedule_remove(nsgif_clock, NULL);
+		nsgif_clock_time = 0;
+	}
+}
+
+
+/**
+ * Find how long a frame of a GIF is displayed for
+ *
+ * \param c      the content
+ * \param frame  the frame
+ * \return delay in cs
+ */
+int nsgif_frame_delay(struct content *c, int frame)
+{
+	int delay = c->data.gif.gif->frames[frame].frame_delay;
+
+	if (delay < option_minimum_gif_delay)
+		delay = option_minimum_gif_delay;
+
+	return delay;
+}
+
+
+/**
+ * Schedule the animation clock for the next frame of any running animation
+ */
+void nsgif_schedule(void)
+{
+	struct content *c;
+	unsigned int now = wallclock();
+	unsigned int next = 0;
+
+	for (c = nsgif_animations; c != NULL; c = c->data.gif.next_animation) {
+		if (c->data.gif.paused)
+			continue;
+		if (next == 0 || c->data.gif.frame_time < next)
+			next = c->data.gif.frame_time;
+	}
+
+	if (next == nsgif_clock_time)
+		return;
+
+	schedule_remove(nsgif_clock, NULL);
+	nsgif_clock_time = next;
+	if (next != 0)
+		schedule(next <= now ? 0 : next - now, nsgif_clock, NULL);
+}
+
+
+/**
+ * Advance every animation whose next frame is due
+ *
+ * \param p  unused
+ *
+ * Animations whose current frame has not been plotted since it was shown,
+ * or which are disabled by option_animate_images, are paused instead.
+ */
+void nsgif_clock(void *p)
+{
+	struct content *c, *next;
+	unsigned int now = wallclock();
+
+	nsgif_clock_time = 0;
+
+	for (c = nsgif_animations; c != NULL; c = next) {
+		next = c->data.gif.next_animation;
+
+		if (c->data.gif.paused || now < c->data.gif.frame_time)
+			continue;
+
+		if (!c->data.gif.plotted || !option_animate_images) {
+			/* not visible: nsgif_redraw() restarts it */
+			c->data.gif.paused = true;
+			nsgif_release_frames(c);
+			continue;
+		}
+
+		c->data.gif.plotted = false;
+		nsgif_animate(c);
+	}
+
+	nsgif_schedule();
+}
+
+
 /**
  * Updates the GIF bitmap to display the current frame
  *
  * \param c  the content to update
+ *
+ * Also records that the current frame has been plotted, restarting the
+ * animation if it was paused.
  */
 gif_result nsgif_get_frame(struct content *c)
 {
+	struct gif_animation *gif = c->data.gif.gif;
 	int previous_frame, current_frame, frame;
 	gif_result res = GIF_OK;
 
+	c->data.gif.plotted = true;
+	if (c->data.gif.paused && option_animate_images) {
+		c->data.gif.paused = false;
+		c->data.gif.frame_time = wallclock() +
+				nsgif_frame_delay(c, c->data.gif.current_frame);
+		nsgif_schedule();
+	}
+
 	current_frame = c->data.gif.current_frame;
 	if (!option_animate_images)
 		current_frame = 0;
-	if (current_frame < c->data.gif.gif->decoded_frame)
+
+	/* frames of animations are kept once decoded */
+	if (c->data.gif.frames != NULL &&
+			c->data.gif.frames[current_frame] != NULL) {
+		c->bitmap = c->data.gif.frames[current_frame];
+		return GIF_OK;
+	}
+
+	if (current_frame < gif->decoded_frame)
 		previous_frame = 0;
 	else
-		previous_frame = c->data.gif.gif->decoded_frame + 1;
+		previous_frame = gif->decoded_frame + 1;
 	for (frame = previous_frame; frame <= current_frame; frame++)
-		res = gif_decode_frame(c->data.gif.gif, frame);
+		res = gif_decode_frame(gif, frame);
+
+	c->bitmap = gif->frame_image;
+
+	/* a finished animation shows one frame, which needn't be kept */
+	if (res == GIF_OK && c->data.gif.frames != NULL &&
+			gif->loop_count >= 0 &&
+			gif->decoded_frame == current_frame)
+		nsgif_cache_frame(c, current_frame);
 
 	return res;
 }
 
 
+/**
+ * Keep a copy of the frame of an animation which has just been decoded
+ *
+ * \param c      the content
+ * \param frame  the frame, which is in gif->frame_image
+ *
+ * Nothing is done if the frame cache is full.
+ */
+void nsgif_cache_frame(struct content *c, int frame)
+{
+	struct gif_animation *gif = c->data.gif.gif;
+	struct bitmap *copy;
+	unsigned char *src, *dst;
+	size_t src_stride, dst_stride, size;
+	unsigned int y;
+
+	src_stride = bitmap_get_rowstride(gif->frame_image);
+	size = gif->height * src_stride;
+	if (NSGIF_FRAME_CACHE_LIMIT < nsgif_frame_cache_size + size)
+		return;
+
+	copy = bitmap_create(gif->width, gif->height, BITMAP_NEW);
+	if (copy == NULL)
+		return;
+
+	src = bitmap_get_buffer(gif->frame_image);
+	dst = bitmap_get_buffer(copy);
+	if (src == NULL || dst == NULL) {
+		bitmap_destroy(copy);
+		return;
+	}
+
+	dst_stride = bitmap_get_rowstride(copy);
+	for (y = 0; y != gif->height; y++)
+		memcpy(dst + y * dst_stride, src + y * src_stride,
+				gif->width * 4);
+
+	bitmap_set_opaque(copy, bitmap_get_opaque(gif->frame_image));
+	bitmap_modified(copy);
+
+	c->data.gif.frames[frame] = copy;
+	nsgif_frame_cache_size += gif->height * dst_stride;
+}
+
+
+/**
+ * Free the cached frames of an animation
+ *
+ * \param c  the content
+ *
+ * The current frame is decoded again when it is next plotted.
+ */
+void nsgif_release_frames(struct content *c)
+{
+	struct gif_animation *gif = c->data.gif.gif;
+	unsigned int i;
+
+	if (c->data.gif.frames == NULL)
+		return;
+
+	for (i = 0; i != gif->frame_count_partial; i++) {
+		if (c->data.gif.frames[i] == NULL)
+			continue;
+		if (c->bitmap == c->data.gif.frames[i])
+			c->bitmap = gif->frame_image;
+		nsgif_frame_cache_size -= gif->height *
+				bitmap_get_rowstride(c->data.gif.frames[i]);
+		bitmap_destroy(c->data.gif.frames[i]);
+		c->data.gif.frames[i] = NULL;
+	}
+}
+
+
 /**
  * Performs any necessary animation.
  *
- * \param p  The content to animate
-*/
-void nsgif_animate(void *p)
+ * \param c  The content to animate
+ */
+void nsgif_animate(struct content *c)
 {
-	struct content *c = p;
 	union content_msg_data data;
 	struct gif_animation *gif;
-	int delay;
 	int f;
 
 	/* Advance by a frame, updating the loop count accordingly */
@@ -269,15 +591,18 @@ void nsgif_animate(void *p)
 
 	/* Continue animating if we should */
 	if (gif->loop_count >= 0) {
-		delay = gif->frames[c->data.gif.current_frame].frame_delay;
-		if (delay < option_minimum_gif_delay)
-			delay = option_minimum_gif_delay;
-		schedule(delay, nsgif_animate, c);
+		c->data.gif.frame_time = wallclock() +
+				nsgif_frame_delay(c, c->data.gif.current_frame);
+	} else {
+		nsgif_stop(c);
+		nsgif_release_frames(c);
 	}
 
-	if ((!option_animate_images) ||
-			(!gif->frames[c->data.gif.current_frame].display))
+	if (!gif->frames[c->data.gif.current_frame].display) {
+		/* nothing to plot, so don't wait for a redraw */
+		c->data.gif.plotted = true;
 		return;
+	}
 
 	/* area within gif to redraw */
 	f = c->data.gif.current_frame;
@@ -30,15 +30,23 @@
 #include <stdbool.h>
 #include <libnsgif.h>
 
+struct bitmap;
 struct content;
 struct http_parameter;
 
 struct content_gif_data {
 	struct gif_animation *gif; /**< GIF animation data */
 	int current_frame;	   /**< current frame to display [0...(max-1)] */
+	struct bitmap **frames;	   /**< decoded frames of an animation, or 0 */
+	struct content *next_animation;	/**< next animated GIF */
+	unsigned int frame_time;   /**< time to advance to the next frame */
+	bool plotted;		   /**< current frame has been plotted */
+	bool paused;		   /**< animation waits for a redraw */
 };
 
 bool nsgif_create(struct content *c, const struct http_parameter *params);
+bool nsgif_process_data(struct content *c, const char *data,
+		unsigned int size);
 bool nsgif_convert(struct content *c);
 void nsgif_destroy(struct content *c);
 bool nsgif_redraw(struct content *c, int x, int y,
@@ -34,6 +34,7 @@
 #include "desktop/plotters.h"
 #include "image/bitmap.h"
 #include "image/ico.h"
+#include "image/pretile.h"
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/utils.h"
@@ -146,7 +147,6 @@ bool nsico_redraw_tiled(struct content *c, int x, int y,
 		bool repeat_x, bool repeat_y)
 {
 	struct bmp_image *bmp = ico_find(c->data.ico.ico, width, height);
-	bitmap_flags_t flags = BITMAPF_NONE;
 
 	if (!bmp->decoded)
 		if (bmp_decode(bmp) != BMP_OK)
@@ -154,12 +154,9 @@ bool nsico_redraw_tiled(struct content *c, int x, int y,
 
 	c->bitmap = bmp->bitmap;
 
-	if (repeat_x)
-		flags |= BITMAPF_REPEAT_X;
-	if (repeat_y)
-		flags |= BITMAPF_REPEAT_Y;
-
-	return plot.bitmap(x, y, width, height, c->bitmap, background_colour, flags);
+	return pretile_plot_bitmap(x, y, width, height,
+			clip_x0, clip_y0, clip_x1, clip_y1,
+			c->bitmap, background_colour, repeat_x, repeat_y);
 }
 
 
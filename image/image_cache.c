@@ -0,0 +1,683 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Decoded image cache (implementation).
+ *
+ * Registered contents are kept on a list in order of last use, most recent
+ * first.  Bitmaps are only ever discarded from a scheduled callback, never
+ * while a redraw may be using them, and bitmaps used in the last
+ * IMAGE_CACHE_MIN_AGE are never discarded, so the size limit may be
+ * exceeded while a large number of images is visible at once.
+ *
+ * Front ends may also discard the contents of a bitmap themselves, through
+ * the bitmap_set_suspendable() callback; the image is then decoded again
+ * into the same bitmap when it is next needed.
+ *
+ * Background decodes are queued in order of request.  Each run of
+ * image_cache_run() decodes from the head of the queue for up to
+ * IMAGE_CACHE_SLICE, so that input and painting are handled between
+ * slices.  Decoders which cannot stop part way through simply decode the
+ * whole image in one slice.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "content/content_protected.h"
+#include "desktop/browser.h"
+#include "desktop/options.h"
+#include "image/bitmap.h"
+#include "image/image_cache.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+/** Time since last use before a bitmap may be discarded / cs */
+#define IMAGE_CACHE_MIN_AGE 200
+/** Time to spend decoding in each background slice / ms */
+#define IMAGE_CACHE_SLICE 10
+/** Images of up to this many pixels are always decoded immediately */
+#define IMAGE_CACHE_SYNC_PIXELS (128 * 128)
+
+/** Decoded image cache entry */
+struct image_cache_entry {
+	struct content *content;	/**< Content owning the bitmap */
+	image_cache_decode_fn decode;	/**< Function to decode the image */
+	image_cache_abort_fn abort;	/**< Function to abandon a decode */
+	unsigned int last_used;		/**< Time of last use / cs */
+	size_t size;			/**< Size of decoded bitmap, or 0 */
+	bool valid;			/**< Bitmap holds the decoded image */
+	bool opaque;			/**< Image is known to be opaque */
+	bool failed;			/**< Decoding failed */
+	bool decoding;			/**< Decoder has returned MORE */
+	bool queued;			/**< On background decode queue */
+	unsigned int decode_time;	/**< CPU time of last decode / ms */
+	struct image_cache_entry *prev;	/**< Previous (more recent) entry */
+	struct image_cache_entry *next;	/**< Next (less recent) entry */
+	struct image_cache_entry *job_next;	/**< Next on decode queue */
+};
+
+/** Bitmap replaced by image_cache_discard(), awaiting destruction */
+struct image_cache_retired {
+	struct bitmap *bitmap;			/**< Bitmap to destroy */
+	struct image_cache_retired *next;	/**< Next in list */
+};
+
+/** Entries, most recently used first */
+static struct image_cache_entry *image_cache_head;
+/** Least recently used entry */
+static struct image_cache_entry *image_cache_tail;
+/** Bitmaps awaiting destruction */
+static struct image_cache_retired *image_cache_retired;
+/** Whether image_cache_clean() is scheduled */
+static bool image_cache_clean_scheduled;
+/** Background decode queue */
+static struct image_cache_entry *image_cache_jobs;
+/** Last entry on background decode queue */
+static struct image_cache_entry *image_cache_jobs_tail;
+/** Whether image_cache_run() is scheduled */
+static bool image_cache_run_scheduled;
+/** Whether a background slice is running */
+static bool image_cache_in_slice;
+/** End of current background slice */
+static clock_t image_cache_deadline;
+/** Whether to decode synchronously regardless of image size */
+static bool image_cache_synchronous;
+static struct image_cache_stats image_cache_stats;
+
+static void image_cache_link(struct image_cache_entry *entry);
+static void image_cache_unlink(struct image_cache_entry *entry);
+static image_cache_decode_result image_cache_decode(
+		struct image_cache_entry *entry);
+static void image_cache_decoded(struct image_cache_entry *entry);
+static void image_cache_abort(struct image_cache_entry *entry);
+static void image_cache_queue(struct image_cache_entry *entry);
+static void image_cache_dequeue(struct image_cache_entry *entry);
+static void image_cache_run(void *p);
+static void image_cache_redraw(struct content *c);
+static void image_cache_invalidate(void *bitmap, void *private_word);
+static void image_cache_schedule_clean(int t);
+static void image_cache_clean(void *p);
+
+
+/**
+ * Register a content with the cache
+ *
+ * \param c       Content to register
+ * \param decode  Function which decodes the content's image
+ * \param abort   Function which abandons a decode, or NULL if decode never
+ *                returns IMAGE_CACHE_DECODE_MORE
+ * \param opaque  Whether the image is known to be opaque before decoding
+ * \return true on success, false on memory exhaustion
+ *
+ * If content::bitmap is not NULL, it is taken to hold the decoded image.
+ * The bitmap remains owned by the content, and must be destroyed by the
+ * content after calling image_cache_remove().
+ */
+bool image_cache_add(struct content *c, image_cache_decode_fn decode,
+		image_cache_abort_fn abort, bool opaque)
+{
+	struct image_cache_entry *entry;
+
+	assert(c->image_cache == NULL);
+
+	entry = malloc(sizeof *entry);
+	if (entry == NULL)
+		return false;
+
+	entry->content = c;
+	entry->decode = decode;
+	entry->abort = abort;
+	entry->last_used = wallclock();
+	entry->size = 0;
+	entry->valid = false;
+	entry->opaque = opaque;
+	entry->failed = false;
+	entry->decoding = false;
+	entry->queued = false;
+	entry->decode_time = 0;
+
+	c->image_cache = entry;
+	image_cache_link(entry);
+
+	if (c->bitmap != NULL)
+		image_cache_decoded(entry);
+
+	return true;
+}
+
+
+/**
+ * Unregister a content from the cache
+ *
+ * \param c  Content to unregister
+ *
+ * Does nothing if the content is not registered.  Any decode in progress
+ * is abandoned.
+ */
+void image_cache_remove(struct content *c)
+{
+	struct image_cache_entry *entry = c->image_cache;
+
+	if (entry == NULL)
+		return;
+
+	image_cache_abort(entry);
+	image_cache_dequeue(entry);
+
+	image_cache_stats.size -= entry->size;
+
+	image_cache_unlink(entry);
+	free(entry);
+	c->image_cache = NULL;
+}
+
+
+/**
+ * Discard the decoded bitmap of a registered content
+ *
+ * \param c  Content whose bitmap to discard
+ * \return true on success, false on memory exhaustion
+ *
+ * The image will be decoded into a new bitmap on next use, e.g. at a
+ * different size.  The old bitmap may still be in use by the current
+ * redraw, so it is only destroyed from the scheduler.
+ */
+bool image_cache_discard(struct content *c)
+{
+	struct image_cache_entry *entry = c->image_cache;
+	struct image_cache_retired *retired;
+
+	assert(entry != NULL);
+
+	image_cache_abort(entry);
+	image_cache_dequeue(entry);
+	entry->failed = false;
+
+	if (c->bitmap == NULL)
+		return true;
+
+	retired = malloc(sizeof *retired);
+	if (retired == NULL)
+		return false;
+
+	retired->bitmap = c->bitmap;
+	retired->next = image_cache_retired;
+	image_cache_retired = retired;
+
+	/* stop the front end calling back into the entry */
+	bitmap_set_suspendable(c->bitmap, NULL, NULL);
+	c->bitmap = NULL;
+
+	image_cache_stats.size -= entry->size;
+	entry->size = 0;
+	entry->valid = false;
+
+	image_cache_schedule_clean(0);
+
+	return true;
+}
+
+
+/**
+ * Retrieve the decoded bitmap of a registered content
+ *
+ * \param c  Content to retrieve bitmap of
+ * \return Pointer to bitmap, or NULL if it could not be decoded
+ *
+ * The image is decoded if necessary, completing any background decode.
+ * The bitmap remains valid at least until control returns to the scheduler.
+ */
+struct bitmap *image_cache_get_bitmap(struct content *c)
+{
+	struct image_cache_entry *entry = c->image_cache;
+	image_cache_decode_result result;
+
+	assert(entry != NULL);
+
+	entry->last_used = wallclock();
+	if (entry != image_cache_head) {
+		image_cache_unlink(entry);
+		image_cache_link(entry);
+	}
+
+	if (entry->valid) {
+		image_cache_stats.hits++;
+		return c->bitmap;
+	}
+
+	if (entry->failed)
+		return NULL;
+
+	image_cache_dequeue(entry);
+
+	do {
+		result = image_cache_decode(entry);
+	} while (result == IMAGE_CACHE_DECODE_MORE);
+
+	if (result != IMAGE_CACHE_DECODE_DONE)
+		return NULL;
+
+	return c->bitmap;
+}
+
+
+/**
+ * Retrieve the decoded bitmap of a registered content for redraw
+ *
+ * \param c  Content to retrieve bitmap of
+ * \return Pointer to bitmap, or NULL if it is not available yet
+ *
+ * If the image is not decoded, small images are decoded immediately, and
+ * large images are queued for decoding in the background.  The content
+ * broadcasts CONTENT_MSG_REDRAW when the bitmap becomes available.
+ */
+struct bitmap *image_cache_request_bitmap(struct content *c)
+{
+	struct image_cache_entry *entry = c->image_cache;
+
+	assert(entry != NULL);
+
+	if (entry->valid || entry->failed || image_cache_synchronous ||
+			c->width * c->height <= IMAGE_CACHE_SYNC_PIXELS)
+		return image_cache_get_bitmap(c);
+
+	entry->last_used = wallclock();
+	if (entry != image_cache_head) {
+		image_cache_unlink(entry);
+		image_cache_link(entry);
+	}
+
+	image_cache_queue(entry);
+
+	return NULL;
+}
+
+
+/**
+ * Find whether a background decoder should stop
+ *
+ * \return true if the current slice of background decoding has ended
+ *
+ * Always false for decodes which must complete immediately.
+ */
+bool image_cache_yield(void)
+{
+	return image_cache_in_slice && image_cache_deadline <= clock();
+}
+
+
+/**
+ * Set whether redraws must decode images immediately
+ *
+ * \param synchronous  true to decode in image_cache_request_bitmap()
+ *
+ * Used while redrawing to somewhere other than a window, e.g. printing or
+ * creating thumbnails, where the redraw cannot be repeated later.
+ */
+void image_cache_set_synchronous(bool synchronous)
+{
+	image_cache_synchronous = synchronous;
+}
+
+
+/**
+ * Find whether the image of a registered content is opaque
+ *
+ * \param c  Content to examine
+ * \return true if the image is known to be opaque
+ *
+ * The image is not decoded; until it has been, only images which are opaque
+ * by their format are reported as opaque.
+ */
+bool image_cache_get_opaque(const struct content *c)
+{
+	assert(c->image_cache != NULL);
+
+	return c->image_cache->opaque;
+}
+
+
+/**
+ * Retrieve decoded image cache statistics
+ *
+ * \param stats  Updated to hold statistics since startup
+ */
+void image_cache_get_stats(struct image_cache_stats *stats)
+{
+	*stats = image_cache_stats;
+}
+
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+/**
+ * Insert an entry at the head of the list
+ *
+ * \param entry  Entry to insert
+ */
+void image_cache_link(struct image_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = image_cache_head;
+	if (image_cache_head != NULL)
+		image_cache_head->prev = entry;
+	else
+		image_cache_tail = entry;
+	image_cache_head = entry;
+}
+
+/**
+ * Remove an entry from the list
+ *
+ * \param entry  Entry to remove
+ */
+void image_cache_unlink(struct image_cache_entry *entry)
+{
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		image_cache_head = entry->next;
+
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		image_cache_tail = entry->prev;
+}
+
+/**
+ * Run a registered content's decoder once
+ *
+ * \param entry  Entry to decode
+ * \return result of decoder
+ */
+image_cache_decode_result image_cache_decode(struct image_cache_entry *entry)
+{
+	struct content *c = entry->content;
+	image_cache_decode_result result;
+	clock_t start;
+
+	if (entry->decoding == false) {
+		image_cache_stats.decodes++;
+		entry->decode_time = 0;
+	}
+
+	start = clock();
+	result = entry->decode(c);
+	entry->decode_time += (clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	if (result == IMAGE_CACHE_DECODE_MORE) {
+		assert(entry->abort != NULL);
+		entry->decoding = true;
+		return result;
+	}
+
+	entry->decoding = false;
+
+	if (result == IMAGE_CACHE_DECODE_ERROR || c->bitmap == NULL) {
+		LOG(("decoding %p failed", c));
+		entry->failed = true;
+		return IMAGE_CACHE_DECODE_ERROR;
+	}
+
+	image_cache_decoded(entry);
+
+	image_cache_stats.decode_time += entry->decode_time;
+	image_cache_stats.decode_bytes += entry->size;
+
+	LOG(("%s: %zu bytes in %u ms", content__get_url(c), entry->size,
+			entry->decode_time));
+
+	return result;
+}
+
+/**
+ * Account for a newly decoded bitmap
+ *
+ * \param entry  Entry whose content::bitmap has just been decoded
+ */
+void image_cache_decoded(struct image_cache_entry *entry)
+{
+	struct content *c = entry->content;
+
+	entry->valid = true;
+	entry->opaque = bitmap_get_opaque(c->bitmap);
+	entry->size = bitmap_get_rowstride(c->bitmap) * c->height;
+	image_cache_stats.size += entry->size;
+
+	bitmap_set_suspendable(c->bitmap, entry, image_cache_invalidate);
+
+	if ((size_t) option_image_cache_size < image_cache_stats.size)
+		image_cache_schedule_clean(0);
+}
+
+/**
+ * Bitmap suspension callback: the front end has discarded the bitmap data
+ *
+ * \param bitmap        Bitmap which was suspended
+ * \param private_word  Cache entry
+ */
+void image_cache_invalidate(void *bitmap, void *private_word)
+{
+	struct image_cache_entry *entry = private_word;
+
+	/* a decode into this bitmap has lost its work so far; it will be
+	 * restarted if the entry is still queued */
+	image_cache_abort(entry);
+
+	if (entry->valid == false)
+		return;
+
+	image_cache_stats.invalidations++;
+	image_cache_stats.size -= entry->size;
+	entry->size = 0;
+	entry->valid = false;
+}
+
+/**
+ * Schedule a call to image_cache_clean(), unless one is already scheduled
+ *
+ * \param t  Delay / cs
+ */
+void image_cache_schedule_clean(int t)
+{
+	if (image_cache_clean_scheduled)
+		return;
+
+	image_cache_clean_scheduled = true;
+	schedule(t, image_cache_clean, NULL);
+}
+
+/**
+ * Scheduler callback: discard least recently used bitmaps until the cache
+ * is within its size limit
+ *
+ * \param p  Unused
+ */
+void image_cache_clean(void *p)
+{
+	struct image_cache_entry *entry, *prev;
+	unsigned int now = wallclock();
+
+	image_cache_clean_scheduled = false;
+
+	while (image_cache_retired != NULL) {
+		struct image_cache_retired *retired = image_cache_retired;
+
+		image_cache_retired = retired->next;
+		bitmap_destroy(retired->bitmap);
+		free(retired);
+	}
+
+	for (entry = image_cache_tail; entry != NULL &&
+			(size_t) option_image_cache_size <
+			image_cache_stats.size; entry = prev) {
+		struct content *c = entry->content;
+
+		prev = entry->prev;
+
+		if (now - entry->last_used < IMAGE_CACHE_MIN_AGE) {
+			/* everything earlier in the list is more recent */
+			image_cache_schedule_clean(IMAGE_CACHE_MIN_AGE);
+			break;
+		}
+
+		if (c->bitmap == NULL || entry->decoding)
+			continue;
+
+		bitmap_destroy(c->bitmap);
+		c->bitmap = NULL;
+
+		image_cache_stats.evictions++;
+		image_cache_stats.size -= entry->size;
+		entry->size = 0;
+		entry->valid = false;
+	}
+}
+
+/**
+ * Abandon any decode in progress
+ *
+ * \param entry  Entry to abandon decode of
+ */
+void image_cache_abort(struct image_cache_entry *entry)
+{
+	if (entry->decoding == false)
+		return;
+
+	entry->abort(entry->content);
+	entry->decoding = false;
+}
+
+/**
+ * Add an entry to the background decode queue, unless already queued
+ *
+ * \param entry  Entry to queue
+ */
+void image_cache_queue(struct image_cache_entry *entry)
+{
+	if (entry->queued)
+		return;
+
+	entry->queued = true;
+	entry->job_next = NULL;
+	if (image_cache_jobs_tail != NULL)
+		image_cache_jobs_tail->job_next = entry;
+	else
+		image_cache_jobs = entry;
+	image_cache_jobs_tail = entry;
+
+	if (image_cache_run_scheduled == false) {
+		image_cache_run_scheduled = true;
+		schedule(0, image_cache_run, NULL);
+	}
+}
+
+/**
+ * Remove an entry from the background decode queue, if queued
+ *
+ * \param entry  Entry to remove
+ */
+void image_cache_dequeue(struct image_cache_entry *entry)
+{
+	struct image_cache_entry *prev = NULL, *job;
+
+	if (entry->queued == false)
+		return;
+
+	for (job = image_cache_jobs; job != entry; job = job->job_next)
+		prev = job;
+
+	if (prev != NULL)
+		prev->job_next = entry->job_next;
+	else
+		image_cache_jobs = entry->job_next;
+
+	if (image_cache_jobs_tail == entry)
+		image_cache_jobs_tail = prev;
+
+	entry->queued = false;
+}
+
+/**
+ * Scheduler callback: decode queued images for one slice
+ *
+ * \param p  Unused
+ */
+void image_cache_run(void *p)
+{
+	struct image_cache_entry *entry;
+	image_cache_decode_result result;
+
+	image_cache_run_scheduled = false;
+
+	image_cache_in_slice = true;
+	image_cache_deadline = clock() +
+			IMAGE_CACHE_SLICE * CLOCKS_PER_SEC / 1000;
+
+	while ((entry = image_cache_jobs) != NULL) {
+		result = image_cache_decode(entry);
+		if (result == IMAGE_CACHE_DECODE_MORE)
+			break;
+
+		image_cache_dequeue(entry);
+		image_cache_stats.background++;
+
+		if (result == IMAGE_CACHE_DECODE_DONE)
+			image_cache_redraw(entry->content);
+
+		if (image_cache_yield())
+			break;
+	}
+
+	image_cache_in_slice = false;
+
+	if (image_cache_jobs != NULL) {
+		image_cache_run_scheduled = true;
+		schedule(0, image_cache_run, NULL);
+	}
+}
+
+/**
+ * Ask the users of a content to redraw it, as its bitmap is now available
+ *
+ * \param c  Content which has been decoded
+ */
+void image_cache_redraw(struct content *c)
+{
+	union content_msg_data data;
+
+	data.redraw.x = 0;
+	data.redraw.y = 0;
+	data.redraw.width = c->width;
+	data.redraw.height = c->height;
+
+	data.redraw.full_redraw = !c->image_cache->opaque;
+
+	data.redraw.object = c;
+	data.redraw.object_x = 0;
+	data.redraw.object_y = 0;
+	data.redraw.object_width = c->width;
+	data.redraw.object_height = c->height;
+
+	content_broadcast(c, CONTENT_MSG_REDRAW, data);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Decoded image cache (interface).
+ *
+ * Image contents which can regenerate their bitmap from their source data
+ * register with the cache instead of keeping the bitmap for their lifetime.
+ * The bitmap is decoded when it is first needed, and bitmaps which have not
+ * been used recently are discarded when the total size of decoded bitmaps
+ * exceeds option_image_cache_size.
+ *
+ * Large images requested for redraw are decoded in the background, in
+ * short slices run from the scheduler, and a redraw of the content is
+ * requested when decoding completes.
+ */
+
+#ifndef _NETSURF_IMAGE_IMAGE_CACHE_H_
+#define _NETSURF_IMAGE_IMAGE_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct bitmap;
+struct content;
+
+/** Result of decoding */
+typedef enum {
+	IMAGE_CACHE_DECODE_DONE,	/**< Image decoded into content::bitmap */
+	IMAGE_CACHE_DECODE_MORE,	/**< Decoding is not yet complete */
+	IMAGE_CACHE_DECODE_ERROR	/**< Decoding failed */
+} image_cache_decode_result;
+
+/**
+ * Decode the image of a content into content::bitmap
+ *
+ * \param c  Content to decode
+ * \return result of decoding
+ *
+ * If content::bitmap is not NULL, it is of the right size and the image
+ * must be decoded into it, otherwise a bitmap must be created.
+ *
+ * A decoder may stop and return IMAGE_CACHE_DECODE_MORE when
+ * image_cache_yield() returns true, keeping its state in the content; it
+ * is then called again later to continue.  Such decoders must provide an
+ * image_cache_abort_fn.
+ */
+typedef image_cache_decode_result (*image_cache_decode_fn)(struct content *c);
+
+/**
+ * Abandon a decode which returned IMAGE_CACHE_DECODE_MORE
+ *
+ * \param c  Content being decoded
+ *
+ * Any state kept by the decoder must be freed.  content::bitmap must be
+ * left as it was before decoding started.
+ */
+typedef void (*image_cache_abort_fn)(struct content *c);
+
+/** Decoded image cache statistics */
+struct image_cache_stats {
+	unsigned int hits;		/**< Requests for a decoded bitmap */
+	unsigned int decodes;		/**< Requests which needed a decode */
+	unsigned int background;	/**< Decodes done in the background */
+	unsigned int evictions;		/**< Bitmaps discarded by the cache */
+	unsigned int invalidations;	/**< Bitmaps discarded by the front end */
+	unsigned int decode_time;	/**< Total CPU time decoding / ms */
+	size_t decode_bytes;		/**< Total size of bitmaps decoded */
+	size_t size;			/**< Current size of decoded bitmaps */
+};
+
+bool image_cache_add(struct content *c, image_cache_decode_fn decode,
+		image_cache_abort_fn abort, bool opaque);
+void image_cache_remove(struct content *c);
+bool image_cache_discard(struct content *c);
+struct bitmap *image_cache_get_bitmap(struct content *c);
+struct bitmap *image_cache_request_bitmap(struct content *c);
+bool image_cache_yield(void);
+void image_cache_set_synchronous(bool synchronous);
+bool image_cache_get_opaque(const struct content *c);
+void image_cache_get_stats(struct image_cache_stats *stats);
+
+#endif
@@ -21,6 +21,18 @@
  * Content for image/jpeg (implementation).
  *
  * This implementation uses the IJG JPEG library.
+ *
+ * While an image is being fetched it is decoded at full size as its data
+ * arrives, using a suspending data source, so that it can be displayed
+ * before it is complete.  Progressive JPEGs are decoded in the library's
+ * buffered-image mode, outputting the image again as each scan arrives.
+ *
+ * Once converted, images are decoded at the smallest of 1/1, 1/2, 1/4 and
+ * 1/8 of their size which is at least as large as they are plotted, using
+ * the library's DCT scaling, and decoded again at a larger size when
+ * necessary.  The full size bitmap decoded while loading is only kept if
+ * it was displayed at that size; otherwise it is released, and the image
+ * cache decodes the image again when it is next needed.
  */
 
 #include "utils/config.h"
@@ -37,9 +49,12 @@
 
 #include "desktop/plotters.h"
 #include "image/bitmap.h"
+#include "image/image_cache.h"
+#include "image/pretile.h"
 
 #include "utils/log.h"
 #include "utils/messages.h"
+#include "utils/pixel.h"
 #include "utils/utils.h"
 
 #define JPEG_INTERNAL_OPTIONS
@@ -63,31 +78,295 @@ struct nsjpeg_error_mgr {
 	jmp_buf setjmp_buffer;
 };
 
+/** Stage reached decoding an image as it arrives */
+typedef enum {
+	NSJPEG_HEADER,		/**< Reading header */
+	NSJPEG_START,		/**< Starting decompression */
+	NSJPEG_START_OUTPUT,	/**< Starting a pass of a progressive JPEG */
+	NSJPEG_SCANLINES,	/**< Reading scanlines */
+	NSJPEG_FINISH_OUTPUT,	/**< Finishing a pass of a progressive JPEG */
+	NSJPEG_COMPLETE,	/**< Every scanline decoded from all the data */
+	NSJPEG_FAILED		/**< The data could not be decoded */
+} nsjpeg_stage;
+
+/** State of a decode which may be continued later */
+struct nsjpeg_decoder {
+	struct jpeg_decompress_struct cinfo;
+	struct nsjpeg_error_mgr jerr;
+	struct jpeg_source_mgr source_mgr;
+	struct bitmap *bitmap;		/**< Bitmap being decoded into */
+	size_t rowstride;		/**< Row stride of bitmap */
+
+	/* used only while the image is loading */
+	nsjpeg_stage stage;		/**< Stage reached */
+	unsigned long offset;		/**< Source data consumed */
+	unsigned long skip;		/**< Source data still to be skipped */
+	bool displayed;			/**< Bitmap has been plotted */
+};
+
+/** Scanlines to decode between checks for the end of a time slice */
+#define NSJPEG_YIELD_ROWS 16
+/** Greatest reduction which libjpeg can apply while decoding */
+#define NSJPEG_MAX_SCALE 8
+
 
+static void nsjpeg_load(struct content *c, struct nsjpeg_decoder *d);
+static image_cache_decode_result nsjpeg_decode(struct content *c);
+static struct nsjpeg_decoder *nsjpeg_decode_start(struct content *c);
+static void nsjpeg_decode_abort(struct content *c);
+static void nsjpeg_expand_row(JSAMPROW row, int width);
+static void nsjpeg_set_scale(struct content *c, int width, int height);
+static struct bitmap *nsjpeg_redraw_bitmap(struct content *c,
+		int width, int height);
 static void nsjpeg_error_exit(j_common_ptr cinfo);
 static void nsjpeg_init_source(j_decompress_ptr cinfo);
 static boolean nsjpeg_fill_input_buffer(j_decompress_ptr cinfo);
 static void nsjpeg_skip_input_data(j_decompress_ptr cinfo, long num_bytes);
+static boolean nsjpeg_suspend_fill_input_buffer(j_decompress_ptr cinfo);
+static void nsjpeg_suspend_skip_input_data(j_decompress_ptr cinfo,
+		long num_bytes);
 static void nsjpeg_term_source(j_decompress_ptr cinfo);
 
 
+/**
+ * Create a CONTENT_JPEG.
+ */
+
+bool nsjpeg_create(struct content *c, const struct http_parameter *params)
+{
+	c->data.jpeg.scale = 1;
+	c->data.jpeg.want_scale = 1;
+	c->data.jpeg.decoder = NULL;
+
+	return true;
+}
+
+
+/**
+ * Process data for a CONTENT_JPEG.
+ *
+ * The image is decoded as far as the data received so far allows.  Errors
+ * are ignored here, and reported by nsjpeg_convert().
+ */
+
+bool nsjpeg_process_data(struct content *c, const char *data,
+		unsigned int size)
+{
+	struct jpeg_source_mgr source_mgr = { 0, 0,
+			nsjpeg_init_source, nsjpeg_suspend_fill_input_buffer,
+			nsjpeg_suspend_skip_input_data, jpeg_resync_to_restart,
+			nsjpeg_term_source };
+	struct nsjpeg_decoder *d = c->data.jpeg.decoder;
+	union content_msg_data msg_data;
+	const char *source;
+	unsigned long source_size, skip;
+
+	if (d == NULL) {
+		d = malloc(sizeof *d);
+		if (d == NULL) {
+			msg_data.error = messages_get("NoMemory");
+			content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+			return false;
+		}
+
+		d->bitmap = NULL;
+		d->rowstride = 0;
+		d->stage = NSJPEG_HEADER;
+		d->offset = 0;
+		d->skip = 0;
+		d->displayed = false;
+		d->source_mgr = source_mgr;
+		d->cinfo.err = jpeg_std_error(&d->jerr.pub);
+		d->jerr.pub.error_exit = nsjpeg_error_exit;
+		if (setjmp(d->jerr.setjmp_buffer)) {
+			jpeg_destroy_decompress(&d->cinfo);
+			free(d);
+
+			msg_data.error = messages_get("NoMemory");
+			content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+			return false;
+		}
+		jpeg_create_decompress(&d->cinfo);
+		d->cinfo.src = &d->source_mgr;
+		d->cinfo.client_data = d;
+
+		c->data.jpeg.decoder = d;
+	}
+
+	if (d->stage == NSJPEG_COMPLETE || d->stage == NSJPEG_FAILED)
+		return true;
+
+	/* libjpeg may need to reread data from before the start of this
+	 * block, so it reads from the whole of the source, which may have
+	 * moved since the last block */
+	source = content__get_source_data(c, &source_size);
+	skip = source_size - d->offset < d->skip ?
+			source_size - d->offset : d->skip;
+	d->offset += skip;
+	d->skip -= skip;
+	d->source_mgr.next_input_byte =
+			(const unsigned char *) source + d->offset;
+	d->source_mgr.bytes_in_buffer = source_size - d->offset;
+
+	if (setjmp(d->jerr.setjmp_buffer)) {
+		LOG(("%s", nsjpeg_error_buffer));
+		d->stage = NSJPEG_FAILED;
+		return true;
+	}
+
+	nsjpeg_load(c, d);
+
+	d->offset = (const char *) d->source_mgr.next_input_byte - source;
+
+	/* display the image as decoded so far while the rest arrives */
+	if (d->bitmap != NULL) {
+		bitmap_modified(d->bitmap);
+		if (c->status == CONTENT_STATUS_LOADING)
+			content_set_ready(c);
+	}
+
+	return true;
+}
+
+
+/**
+ * Decode as much of a CONTENT_JPEG as possible from the data received.
+ *
+ * \param c  content being loaded
+ * \param d  decoder state, with the data source set up
+ *
+ * Returns when the library suspends for lack of data or the image is
+ * complete.  Library errors longjmp() to nsjpeg_process_data().
+ */
+
+void nsjpeg_load(struct content *c, struct nsjpeg_decoder *d)
+{
+	uint8_t *pixels;
+	JSAMPROW scanlines[1];
+	int result;
+
+	while (1) {
+		switch (d->stage) {
+		case NSJPEG_HEADER:
+			if (jpeg_read_header(&d->cinfo, TRUE) ==
+					JPEG_SUSPENDED)
+				return;
+
+			d->cinfo.out_color_space = JCS_RGB;
+			d->cinfo.dct_method = JDCT_ISLOW;
+			d->cinfo.buffered_image =
+					jpeg_has_multiple_scans(&d->cinfo);
+			jpeg_calc_output_dimensions(&d->cinfo);
+
+			/* cleared, as rows are displayed as they arrive */
+			d->bitmap = bitmap_create(d->cinfo.output_width,
+					d->cinfo.output_height,
+					BITMAP_NEW | BITMAP_CLEAR_MEMORY);
+			if (d->bitmap == NULL) {
+				LOG(("failed to create bitmap"));
+				d->stage = NSJPEG_FAILED;
+				return;
+			}
+			d->rowstride = bitmap_get_rowstride(d->bitmap);
+
+			c->width = d->cinfo.output_width;
+			c->height = d->cinfo.output_height;
+
+			d->stage = NSJPEG_START;
+			break;
+
+		case NSJPEG_START:
+			if (!jpeg_start_decompress(&d->cinfo))
+				return;
+
+			d->stage = d->cinfo.buffered_image ?
+					NSJPEG_START_OUTPUT : NSJPEG_SCANLINES;
+			break;
+
+		case NSJPEG_START_OUTPUT:
+			/* absorb all the data received, then output the
+			 * image again if a new scan has started */
+			do {
+				result = jpeg_consume_input(&d->cinfo);
+			} while (result != JPEG_SUSPENDED &&
+					result != JPEG_REACHED_EOI);
+
+			if (d->cinfo.input_scan_number ==
+					d->cinfo.output_scan_number &&
+					!jpeg_input_complete(&d->cinfo))
+				return;
+
+			if (!jpeg_start_output(&d->cinfo,
+					d->cinfo.input_scan_number))
+				return;
+
+			d->stage = NSJPEG_SCANLINES;
+			break;
+
+		case NSJPEG_SCANLINES:
+			pixels = bitmap_get_buffer(d->bitmap);
+			if (pixels == NULL) {
+				LOG(("failed to get bitmap buffer"));
+				d->stage = NSJPEG_FAILED;
+				return;
+			}
+
+			while (d->cinfo.output_scanline !=
+					d->cinfo.output_height) {
+				int y = d->cinfo.output_scanline;
+
+				scanlines[0] = (JSAMPROW) (pixels +
+						d->rowstride * y);
+				if (jpeg_read_scanlines(&d->cinfo,
+						scanlines, 1) == 0)
+					return;
+
+				nsjpeg_expand_row(scanlines[0],
+						d->cinfo.output_width);
+				content__progress(c, y, y + 1);
+			}
+
+			d->stage = d->cinfo.buffered_image ?
+					NSJPEG_FINISH_OUTPUT : NSJPEG_COMPLETE;
+			break;
+
+		case NSJPEG_FINISH_OUTPUT:
+			if (!jpeg_finish_output(&d->cinfo))
+				return;
+
+			if (jpeg_input_complete(&d->cinfo) &&
+					d->cinfo.output_scan_number ==
+					d->cinfo.input_scan_number)
+				d->stage = NSJPEG_COMPLETE;
+			else
+				d->stage = NSJPEG_START_OUTPUT;
+			break;
+
+		case NSJPEG_COMPLETE:
+		case NSJPEG_FAILED:
+			return;
+		}
+	}
+}
+
 /**
  * Convert a CONTENT_JPEG for display.
+ *
+ * If the image was completely decoded as it arrived and has been plotted
+ * at full size, that bitmap is kept.  Otherwise only the header is read
+ * here, and the image is decoded by nsjpeg_decode() at the size it is
+ * plotted when the decoded image cache is first asked for the bitmap.
  */
 
 bool nsjpeg_convert(struct content *c)
 {
+	struct nsjpeg_decoder *d = c->data.jpeg.decoder;
 	struct jpeg_decompress_struct cinfo;
 	struct nsjpeg_error_mgr jerr;
 	struct jpeg_source_mgr source_mgr = { 0, 0,
 			nsjpeg_init_source, nsjpeg_fill_input_buffer,
 			nsjpeg_skip_input_data, jpeg_resync_to_restart,
 			nsjpeg_term_source };
-	unsigned int height;
-	unsigned int width;
-	struct bitmap * volatile bitmap = NULL;
-	uint8_t * volatile pixels = NULL;
-	size_t rowstride;
 	union content_msg_data msg_data;
 	const char *data;
 	unsigned long size;
@@ -95,82 +374,322 @@ bool nsjpeg_convert(struct content *c)
 
 	data = content__get_source_data(c, &size);
 
-	cinfo.err = jpeg_std_error(&jerr.pub);
-	jerr.pub.error_exit = nsjpeg_error_exit;
-	if (setjmp(jerr.setjmp_buffer)) {
-		jpeg_destroy_decompress(&cinfo);
-		if (bitmap)
-			bitmap_destroy(bitmap);
+	if (d != NULL && d->stage == NSJPEG_COMPLETE && d->displayed &&
+			c->data.jpeg.want_scale == 1) {
+		jpeg_destroy_decompress(&d->cinfo);
+		c->bitmap = d->bitmap;
+		free(d);
+		c->data.jpeg.decoder = NULL;
+
+		bitmap_set_opaque(c->bitmap, true);
+		bitmap_modified(c->bitmap);
+	} else {
+		/* incomplete, failed, or wanted at a smaller size: start
+		 * again from the whole data */
+		nsjpeg_decode_abort(c);
+
+		cinfo.err = jpeg_std_error(&jerr.pub);
+		jerr.pub.error_exit = nsjpeg_error_exit;
+		if (setjmp(jerr.setjmp_buffer)) {
+			jpeg_destroy_decompress(&cinfo);
+
+			msg_data.error = nsjpeg_error_buffer;
+			content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+			return false;
+		}
+		jpeg_create_decompress(&cinfo);
+		source_mgr.next_input_byte = (unsigned char *) data;
+		source_mgr.bytes_in_buffer = size;
+		cinfo.src = &source_mgr;
+		jpeg_read_header(&cinfo, TRUE);
+		cinfo.out_color_space = JCS_RGB;
+		jpeg_calc_output_dimensions(&cinfo);
+
+		c->width = cinfo.output_width;
+		c->height = cinfo.output_height;
 
-		msg_data.error = nsjpeg_error_buffer;
-		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
-		return false;
-	}
-	jpeg_create_decompress(&cinfo);
-	source_mgr.next_input_byte = (unsigned char *) data;
-	source_mgr.bytes_in_buffer = size;
-	cinfo.src = &source_mgr;
-	jpeg_read_header(&cinfo, TRUE);
-	cinfo.out_color_space = JCS_RGB;
-	cinfo.dct_method = JDCT_ISLOW;
-	jpeg_start_decompress(&cinfo);
-
-	width = cinfo.output_width;
-	height = cinfo.output_height;
-
-	bitmap = bitmap_create(width, height, BITMAP_NEW | BITMAP_OPAQUE);
-	if (bitmap)
-		pixels = bitmap_get_buffer(bitmap);
-	if ((!bitmap) || (!pixels)) {
 		jpeg_destroy_decompress(&cinfo);
-		if (bitmap)
-			bitmap_destroy(bitmap);
+	}
 
+	if (image_cache_add(c, nsjpeg_decode, nsjpeg_decode_abort, true) == false) {
 		msg_data.error = messages_get("NoMemory");
 		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 		return false;
 	}
 
-	rowstride = bitmap_get_rowstride(bitmap);
-	do {
-#if RGB_RED != 0 || RGB_GREEN != 1 || RGB_BLUE != 2 || RGB_PIXELSIZE != 4
-		int i;
-#endif
+	snprintf(title, sizeof(title), messages_get("JPEGTitle"),
+			c->width, c->height, size);
+	content__set_title(c, title);
+	c->status = CONTENT_STATUS_DONE;
+	/* Done: update status bar */
+	content_set_status(c, "");
+	return true;
+}
+
+
+/**
+ * Decode a CONTENT_JPEG into its bitmap.
+ *
+ * \param c  content to decode
+ * \return result of decoding
+ *
+ * Called by the decoded image cache.  If content::bitmap exists it is
+ * reused, otherwise a new bitmap is created at the reduction requested
+ * by nsjpeg_get_bitmap().  Decoding stops when image_cache_yield() says
+ * so, and continues from the same scanline when next called.
+ */
+
+image_cache_decode_result nsjpeg_decode(struct content *c)
+{
+	struct nsjpeg_decoder *d = c->data.jpeg.decoder;
+	uint8_t *pixels;
+
+	if (d == NULL) {
+		d = nsjpeg_decode_start(c);
+		if (d == NULL)
+			return IMAGE_CACHE_DECODE_ERROR;
+	}
+
+	if (setjmp(d->jerr.setjmp_buffer)) {
+		LOG(("%s", nsjpeg_error_buffer));
+		nsjpeg_decode_abort(c);
+		return IMAGE_CACHE_DECODE_ERROR;
+	}
+
+	/* the front end may move the buffer between calls */
+	pixels = bitmap_get_buffer(d->bitmap);
+	if (pixels == NULL) {
+		LOG(("failed to get bitmap buffer"));
+		nsjpeg_decode_abort(c);
+		return IMAGE_CACHE_DECODE_ERROR;
+	}
+
+	while (d->cinfo.output_scanline != d->cinfo.output_height) {
 		JSAMPROW scanlines[1];
 
 		scanlines[0] = (JSAMPROW) (pixels +
-				rowstride * cinfo.output_scanline);
-		jpeg_read_scanlines(&cinfo, scanlines, 1);
+				d->rowstride * d->cinfo.output_scanline);
+		jpeg_read_scanlines(&d->cinfo, scanlines, 1);
+		nsjpeg_expand_row(scanlines[0], d->cinfo.output_width);
+
+		if ((d->cinfo.output_scanline % NSJPEG_YIELD_ROWS) == 0 &&
+				d->cinfo.output_scanline !=
+				d->cinfo.output_height &&
+				image_cache_yield())
+			return IMAGE_CACHE_DECODE_MORE;
+	}
+	bitmap_modified(d->bitmap);
 
-#if RGB_RED != 0 || RGB_GREEN != 1 || RGB_BLUE != 2 || RGB_PIXELSIZE != 4
-		/* expand to RGBA */
-		for (i = width - 1; 0 <= i; i--) {
-			int r = scanlines[0][i * RGB_PIXELSIZE + RGB_RED];
-			int g = scanlines[0][i * RGB_PIXELSIZE + RGB_GREEN];
-			int b = scanlines[0][i * RGB_PIXELSIZE + RGB_BLUE];
-			scanlines[0][i * 4 + 0] = r;
-			scanlines[0][i * 4 + 1] = g;
-			scanlines[0][i * 4 + 2] = b;
-			scanlines[0][i * 4 + 3] = 0xff;
-		}
+	jpeg_finish_decompress(&d->cinfo);
+	jpeg_destroy_decompress(&d->cinfo);
+
+	c->bitmap = d->bitmap;
+	free(d);
+	c->data.jpeg.decoder = NULL;
+
+	return IMAGE_CACHE_DECODE_DONE;
+}
+
+
+/**
+ * Start decoding a CONTENT_JPEG.
+ *
+ * \param c  content to decode
+ * \return decoder state, or NULL on error
+ */
+
+struct nsjpeg_decoder *nsjpeg_decode_start(struct content *c)
+{
+	struct jpeg_source_mgr source_mgr = { 0, 0,
+			nsjpeg_init_source, nsjpeg_fill_input_buffer,
+			nsjpeg_skip_input_data, jpeg_resync_to_restart,
+			nsjpeg_term_source };
+	struct nsjpeg_decoder *d;
+	const char *data;
+	unsigned long size;
+
+	d = malloc(sizeof *d);
+	if (d == NULL) {
+		LOG(("failed to allocate decoder"));
+		return NULL;
+	}
+
+	data = content__get_source_data(c, &size);
+
+	if (c->bitmap == NULL)
+		c->data.jpeg.scale = c->data.jpeg.want_scale;
+
+	d->bitmap = NULL;
+	d->source_mgr = source_mgr;
+	d->cinfo.err = jpeg_std_error(&d->jerr.pub);
+	d->jerr.pub.error_exit = nsjpeg_error_exit;
+	if (setjmp(d->jerr.setjmp_buffer)) {
+		LOG(("%s", nsjpeg_error_buffer));
+		jpeg_destroy_decompress(&d->cinfo);
+		if (d->bitmap && d->bitmap != c->bitmap)
+			bitmap_destroy(d->bitmap);
+		free(d);
+		return NULL;
+	}
+	jpeg_create_decompress(&d->cinfo);
+	d->source_mgr.next_input_byte = (unsigned char *) data;
+	d->source_mgr.bytes_in_buffer = size;
+	d->cinfo.src = &d->source_mgr;
+	jpeg_read_header(&d->cinfo, TRUE);
+	d->cinfo.out_color_space = JCS_RGB;
+	d->cinfo.dct_method = JDCT_ISLOW;
+	d->cinfo.scale_num = 1;
+	d->cinfo.scale_denom = c->data.jpeg.scale;
+	jpeg_start_decompress(&d->cinfo);
+
+	if (c->bitmap)
+		d->bitmap = c->bitmap;
+	else
+		d->bitmap = bitmap_create(d->cinfo.output_width,
+				d->cinfo.output_height,
+				BITMAP_NEW | BITMAP_OPAQUE);
+	if (d->bitmap == NULL) {
+		LOG(("failed to create bitmap"));
+		jpeg_destroy_decompress(&d->cinfo);
+		free(d);
+		return NULL;
+	}
+	d->rowstride = bitmap_get_rowstride(d->bitmap);
+
+	c->data.jpeg.decoder = d;
+
+	return d;
+}
+
+
+/**
+ * Abandon decoding a CONTENT_JPEG.
+ *
+ * \param c  content being decoded
+ */
+
+void nsjpeg_decode_abort(struct content *c)
+{
+	struct nsjpeg_decoder *d = c->data.jpeg.decoder;
+
+	if (d == NULL)
+		return;
+
+	jpeg_destroy_decompress(&d->cinfo);
+	if (d->bitmap != NULL && d->bitmap != c->bitmap)
+		bitmap_destroy(d->bitmap);
+	free(d);
+	c->data.jpeg.decoder = NULL;
+}
+
+
+/**
+ * Convert a scanline output by libjpeg to RGBA, in place.
+ *
+ * \param row    scanline, with room for width RGBA pixels
+ * \param width  width of scanline in pixels
+ */
+
+void nsjpeg_expand_row(JSAMPROW row, int width)
+{
+#if RGB_RED == 0 && RGB_GREEN == 1 && RGB_BLUE == 2 && RGB_PIXELSIZE == 3
+	pixel_rgb_to_rgba(row, row, width);
+#elif RGB_RED != 0 || RGB_GREEN != 1 || RGB_BLUE != 2 || RGB_PIXELSIZE != 4
+	int i;
+
+	for (i = width - 1; 0 <= i; i--) {
+		int r = row[i * RGB_PIXELSIZE + RGB_RED];
+		int g = row[i * RGB_PIXELSIZE + RGB_GREEN];
+		int b = row[i * RGB_PIXELSIZE + RGB_BLUE];
+		row[i * 4 + 0] = r;
+		row[i * 4 + 1] = g;
+		row[i * 4 + 2] = b;
+		row[i * 4 + 3] = 0xff;
+	}
 #endif
-	} while (cinfo.output_scanline != cinfo.output_height);
-	bitmap_modified(bitmap);
+}
 
-	jpeg_finish_decompress(&cinfo);
-	jpeg_destroy_decompress(&cinfo);
 
-	c->width = width;
-	c->height = height;
-	c->bitmap = bitmap;
-	snprintf(title, sizeof(title), messages_get("JPEGTitle"),
-			width, height, size);
-	content__set_title(c, title);
-	c->size += height * rowstride;
-	c->status = CONTENT_STATUS_DONE;
-	/* Done: update status bar */
-	content_set_status(c, "");
-	return true;
+/**
+ * Retrieve the bitmap of a CONTENT_JPEG for plotting at a given size.
+ *
+ * \param c       content to retrieve bitmap of
+ * \param width   width the image will be plotted at
+ * \param height  height the image will be plotted at
+ * \return bitmap, or NULL if the image could not be decoded
+ *
+ * The image is decoded immediately if necessary.
+ */
+
+struct bitmap *nsjpeg_get_bitmap(struct content *c, int width, int height)
+{
+	/* not converted yet */
+	if (c->image_cache == NULL)
+		return NULL;
+
+	nsjpeg_set_scale(c, width, height);
+
+	return image_cache_get_bitmap(c);
+}
+
+
+/**
+ * Choose the reduction to decode a CONTENT_JPEG at.
+ *
+ * \param c       content to be plotted
+ * \param width   width the image will be plotted at
+ * \param height  height the image will be plotted at
+ *
+ * The bitmap will be no smaller than width by height unless the content
+ * is.  A bitmap, or a decode in progress, at a lower resolution than that
+ * is discarded.
+ */
+
+void nsjpeg_set_scale(struct content *c, int width, int height)
+{
+	int scale = NSJPEG_MAX_SCALE;
+
+	/* libjpeg rounds scaled dimensions up */
+	while (scale != 1 && ((c->width + scale - 1) / scale < width ||
+			(c->height + scale - 1) / scale < height))
+		scale /= 2;
+
+	if ((c->bitmap != NULL || c->data.jpeg.decoder != NULL) &&
+			scale < c->data.jpeg.scale)
+		image_cache_discard(c);
+
+	c->data.jpeg.want_scale = scale;
+}
+
+
+/**
+ * Find the bitmap to plot a CONTENT_JPEG with.
+ *
+ * \param c       content to be plotted
+ * \param width   width the image will be plotted at
+ * \param height  height the image will be plotted at
+ * \return bitmap, or NULL if none is available yet
+ */
+
+struct bitmap *nsjpeg_redraw_bitmap(struct content *c, int width, int height)
+{
+	struct nsjpeg_decoder *d = c->data.jpeg.decoder;
+
+	/* still loading: plot the image as decoded so far, and remember the
+	 * size wanted once it is converted */
+	if (c->image_cache == NULL) {
+		if (d == NULL || d->bitmap == NULL)
+			return NULL;
+
+		nsjpeg_set_scale(c, width, height);
+		d->displayed = true;
+
+		return d->bitmap;
+	}
+
+	nsjpeg_set_scale(c, width, height);
+
+	return image_cache_request_bitmap(c);
 }
 
 
@@ -230,6 +749,44 @@ void nsjpeg_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
 }
 
 
+/**
+ * JPEG data source manager: fill the input buffer, while loading.
+ *
+ * The data received so far has been used up, so suspend decoding until
+ * nsjpeg_process_data() is called with more.
+ */
+
+boolean nsjpeg_suspend_fill_input_buffer(j_decompress_ptr cinfo)
+{
+	return FALSE;
+}
+
+
+/**
+ * JPEG data source manager: skip num_bytes worth of data, while loading.
+ *
+ * Data which has not arrived yet is skipped by the next call to
+ * nsjpeg_process_data().
+ */
+
+void nsjpeg_suspend_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+	struct nsjpeg_decoder *d = cinfo->client_data;
+
+	if (num_bytes <= 0)
+		return;
+
+	if ((long) cinfo->src->bytes_in_buffer < num_bytes) {
+		d->skip += num_bytes - cinfo->src->bytes_in_buffer;
+		cinfo->src->next_input_byte += cinfo->src->bytes_in_buffer;
+		cinfo->src->bytes_in_buffer = 0;
+	} else {
+		cinfo->src->next_input_byte += num_bytes;
+		cinfo->src->bytes_in_buffer -= num_bytes;
+	}
+}
+
+
 /**
  * JPEG data source manager: terminate source.
  */
@@ -248,8 +805,13 @@ bool nsjpeg_redraw(struct content *c, int x, int y,
 		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
 		float scale, colour background_colour)
 {
+	struct bitmap *bitmap = nsjpeg_redraw_bitmap(c, width, height);
+
+	if (bitmap == NULL)
+		return true;
+
 	return plot.bitmap(x, y, width, height,
-			c->bitmap, background_colour, BITMAPF_NONE);
+			bitmap, background_colour, BITMAPF_NONE);
 }
 
 
@@ -263,16 +825,14 @@ bool nsjpeg_redraw_tiled(struct content *c, int x, int y,
 		float scale, colour background_colour,
 		bool repeat_x, bool repeat_y)
 {
-	bitmap_flags_t flags = BITMAPF_NONE;
+	struct bitmap *bitmap = nsjpeg_redraw_bitmap(c, width, height);
 
-	if (repeat_x)
-		flags |= BITMAPF_REPEAT_X;
-	if (repeat_y)
-		flags |= BITMAPF_REPEAT_Y;
+	if (bitmap == NULL)
+		return true;
 
-	return plot.bitmap(x, y, width, height,
-			c->bitmap, background_colour,
-			flags);
+	return pretile_plot_bitmap(x, y, width, height,
+			clip_x0, clip_y0, clip_x1, clip_y1,
+			bitmap, background_colour, repeat_x, repeat_y);
 }
 
 
@@ -282,6 +842,9 @@ bool nsjpeg_redraw_tiled(struct content *c, int x, int y,
 
 void nsjpeg_destroy(struct content *c)
 {
+	image_cache_remove(c);
+	/* abandon decoding an image which is still loading */
+	nsjpeg_decode_abort(c);
 	if (c->bitmap)
 		bitmap_destroy(c->bitmap);
 }
@@ -289,11 +852,22 @@ void nsjpeg_destroy(struct content *c)
 
 bool nsjpeg_clone(const struct content *old, struct content *new_content)
 {
-	/* Simply replay conversion */
-	if (old->status == CONTENT_STATUS_READY ||
-			old->status == CONTENT_STATUS_DONE) {
+	const char *data;
+	unsigned long size;
+
+	if (nsjpeg_create(new_content, NULL) == false)
+		return false;
+
+	/* Simply replay conversion, or the data received so far if the old
+	 * content is still loading */
+	if (old->status == CONTENT_STATUS_DONE) {
 		if (nsjpeg_convert(new_content) == false)
 			return false;
+	} else {
+		data = content__get_source_data(new_content, &size);
+		if (size > 0 && nsjpeg_process_data(new_content,
+				data, size) == false)
+			return false;
 	}
 
 	return true;
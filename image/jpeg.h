@@ -30,11 +30,18 @@
 
 struct bitmap;
 struct content;
+struct http_parameter;
+struct nsjpeg_decoder;
 
 struct content_jpeg_data {
-	int dummy; /* NOT USED but to satisfy Norcroft */
+	int scale;		/**< Reduction of decoded bitmap: 1, 2, 4 or 8 */
+	int want_scale;		/**< Reduction to use for the next decode */
+	struct nsjpeg_decoder *decoder;	/**< Decode in progress, or NULL */
 };
 
+bool nsjpeg_create(struct content *c, const struct http_parameter *params);
+bool nsjpeg_process_data(struct content *c, const char *data,
+		unsigned int size);
 bool nsjpeg_convert(struct content *c);
 void nsjpeg_destroy(struct content *c);
 bool nsjpeg_redraw(struct content *c, int x, int y,
@@ -47,6 +54,7 @@ bool nsjpeg_redraw_tiled(struct content *c, int x, int y,
 		float scale, colour background_colour,
 		bool repeat_x, bool repeat_y);
 bool nsjpeg_clone(const struct content *old, struct content *new_content);
+struct bitmap *nsjpeg_get_bitmap(struct content *c, int width, int height);
 
 #endif /* WITH_JPEG */
 
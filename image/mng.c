@@ -38,6 +38,7 @@
 #include "desktop/plotters.h"
 #include "image/bitmap.h"
 #include "image/mng.h"
+#include "image/pretile.h"
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/utils.h"
@@ -558,7 +559,6 @@ bool nsmng_redraw_tiled(struct content *c, int x, int y,
 		bool repeat_x, bool repeat_y)
 {
 	bool ret;
-	bitmap_flags_t flags = BITMAPF_NONE;
 
 	/* mark image as having been requested to display */
 	c->data.mng.displayed = true;
@@ -568,14 +568,9 @@ bool nsmng_redraw_tiled(struct content *c, int x, int y,
 		c->data.mng.opaque_test_pending = false;
 	}
 
-	if (repeat_x)
-		flags |= BITMAPF_REPEAT_X;
-	if (repeat_y)
-		flags |= BITMAPF_REPEAT_Y;
-
-	ret = plot.bitmap(x, y, width, height,
-			c->bitmap, background_colour,
-			flags);
+	ret = pretile_plot_bitmap(x, y, width, height,
+			clip_x0, clip_y0, clip_x1, clip_y1,
+			c->bitmap, background_colour, repeat_x, repeat_y);
 
 	/*	Check if we need to restart the animation
 	*/
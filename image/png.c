@@ -33,9 +33,12 @@
 #include "content/content_protected.h"
 
 #include "image/bitmap.h"
+#include "image/image_cache.h"
+#include "image/pretile.h"
 
 #include "utils/log.h"
 #include "utils/messages.h"
+#include "utils/pixel.h"
 #include "utils/utils.h"
 
 #ifdef WITH_PNG
@@ -57,6 +60,7 @@ static void info_callback(png_structp png, png_infop info);
 static void row_callback(png_structp png, png_bytep new_row,
 		png_uint_32 row_num, int pass);
 static void end_callback(png_structp png, png_infop info);
+static image_cache_decode_result nspng_decode(struct content *c);
 
 
 bool nspng_create(struct content *c, const struct http_parameter *params)
@@ -127,6 +131,13 @@ bool nspng_process_data(struct content *c, const char *data, unsigned int size)
 	png_process_data(c->data.png.png, c->data.png.info,
 			(uint8_t *) data, size);
 
+	/* display the rows decoded so far while the rest arrive */
+	if (c->data.png.bitmap != NULL && c->status != CONTENT_STATUS_DONE) {
+		bitmap_modified(c->data.png.bitmap);
+		if (c->status == CONTENT_STATUS_LOADING)
+			content_set_ready(c);
+	}
+
 	return true;
 }
 
@@ -147,8 +158,12 @@ void info_callback(png_structp png, png_infop info)
 	png_get_IHDR(png, info, &width, &height, &bit_depth,
 			&color_type, &interlace, 0, 0);
 
-	/* Claim the required memory for the converted PNG */
-        c->data.png.bitmap = bitmap_create(width, height, BITMAP_NEW);
+	/* Claim the required memory for the converted PNG, unless we are
+	 * decoding again into an existing bitmap.  It is cleared, as it may
+	 * be displayed before every row has arrived. */
+	if (c->data.png.bitmap == NULL)
+		c->data.png.bitmap = bitmap_create(width, height,
+				BITMAP_NEW | BITMAP_CLEAR_MEMORY);
 	if (c->data.png.bitmap == NULL) {
 		/* Failed -- bail out */
 		longjmp(png_jmpbuf(png), 1);
@@ -206,7 +221,7 @@ void row_callback(png_structp png, png_bytep new_row,
 		png_uint_32 row_num, int pass)
 {
 	struct content *c = png_get_progressive_ptr(png);
-	unsigned long i, j, rowbytes = c->data.png.rowbytes;
+	unsigned long rowbytes = c->data.png.rowbytes;
 	unsigned int start, step;
 	unsigned char *buffer, *row;
 
@@ -239,16 +254,20 @@ void row_callback(png_structp png, png_bytep new_row,
 		 * into consideration */
 		row = buffer + (c->data.png.rowstride * row_num);
 
-		for (j = 0, i = start; i < rowbytes; i += step) {
-			row[i++] = new_row[j++];
-			row[i++] = new_row[j++];
-			row[i++] = new_row[j++];
-			row[i++] = new_row[j++];
+		if (start < rowbytes) {
+			/* step is the gap between pixels of this pass */
+			step += 4;
+			pixel_copy_spaced(row + start, new_row,
+					(rowbytes - start + step - 1) / step,
+					step / 4);
 		}
 	} else {
 		/* Do a fast memcpy of the row data */
 		memcpy(row, new_row, rowbytes);
 	}
+
+	if (c->status != CONTENT_STATUS_DONE)
+		content__progress(c, row_num, row_num + 1);
 }
 
 
@@ -279,9 +298,21 @@ bool nspng_convert(struct content *c)
 
 	assert(c->data.png.bitmap != NULL);
 
+	/* The bitmap now belongs to the decoded image cache, which may
+	 * discard it and call nspng_decode() to recreate it */
 	c->bitmap = c->data.png.bitmap;
+	c->data.png.bitmap = NULL;
 	bitmap_set_opaque(c->bitmap, bitmap_test_opaque(c->bitmap));
 	bitmap_modified(c->bitmap);
+
+	if (image_cache_add(c, nspng_decode, NULL, false) == false) {
+		union content_msg_data msg_data;
+
+		msg_data.error = messages_get("NoMemory");
+		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+		return false;
+	}
+
 	c->status = CONTENT_STATUS_DONE;
 	content_set_status(c, "");
 
@@ -289,8 +320,73 @@ bool nspng_convert(struct content *c)
 }
 
 
+/**
+ * Decode a converted CONTENT_PNG into its bitmap again.
+ *
+ * \param c  content to decode
+ * \return result of decoding
+ *
+ * Called by the decoded image cache after it has discarded the bitmap.  The
+ * whole of the source data is fed through a new progressive reader, using
+ * the same callbacks as the initial decode.
+ */
+
+image_cache_decode_result nspng_decode(struct content *c)
+{
+	const char *data;
+	unsigned long size;
+
+	data = content__get_source_data(c, &size);
+
+	c->data.png.bitmap = c->bitmap;
+
+	c->data.png.png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+			0, 0, 0);
+	if (c->data.png.png == NULL)
+		return IMAGE_CACHE_DECODE_ERROR;
+
+	c->data.png.info = png_create_info_struct(c->data.png.png);
+	if (c->data.png.info == NULL) {
+		png_destroy_read_struct(&c->data.png.png,
+				&c->data.png.info, 0);
+		return IMAGE_CACHE_DECODE_ERROR;
+	}
+
+	if (setjmp(png_jmpbuf(c->data.png.png))) {
+		png_destroy_read_struct(&c->data.png.png,
+				&c->data.png.info, 0);
+		LOG(("Failed to decode data"));
+		if (c->data.png.bitmap != NULL &&
+				c->data.png.bitmap != c->bitmap)
+			bitmap_destroy(c->data.png.bitmap);
+		c->data.png.bitmap = NULL;
+		return IMAGE_CACHE_DECODE_ERROR;
+	}
+
+	png_set_progressive_read_fn(c->data.png.png, c,
+			info_callback, row_callback, end_callback);
+	png_process_data(c->data.png.png, c->data.png.info,
+			(uint8_t *) data, size);
+
+	png_destroy_read_struct(&c->data.png.png, &c->data.png.info, 0);
+
+	c->bitmap = c->data.png.bitmap;
+	c->data.png.bitmap = NULL;
+	if (c->bitmap == NULL)
+		return IMAGE_CACHE_DECODE_ERROR;
+
+	bitmap_set_opaque(c->bitmap, bitmap_test_opaque(c->bitmap));
+	bitmap_modified(c->bitmap);
+
+	return IMAGE_CACHE_DECODE_DONE;
+}
+
+
 void nspng_destroy(struct content *c)
 {
+	image_cache_remove(c);
+	if (c->bitmap != NULL)
+		bitmap_destroy(c->bitmap);
         if (c->data.png.bitmap != NULL) {
                 bitmap_destroy(c->data.png.bitmap);
         }
@@ -302,9 +398,18 @@ bool nspng_redraw(struct content *c, int x, int y,
 		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
 		float scale, colour background_colour)
 {
-	assert(c->bitmap != NULL);
+	struct bitmap *bitmap;
+
+	if (c->image_cache == NULL)
+		/* still loading: plot the rows decoded so far */
+		bitmap = c->data.png.bitmap;
+	else
+		bitmap = image_cache_request_bitmap(c);
+
+	if (bitmap == NULL)
+		return true;
 
-	return plot.bitmap(x, y, width, height, c->bitmap, 
+	return plot.bitmap(x, y, width, height, bitmap, 
                            background_colour, BITMAPF_NONE);
 }
 
@@ -313,17 +418,20 @@ bool nspng_redraw_tiled(struct content *c, int x, int y, int width, int height,
 		float scale, colour background_colour,
 		bool repeat_x, bool repeat_y)
 {
-	bitmap_flags_t flags = 0;
+	struct bitmap *bitmap;
 
-	assert(c->bitmap != NULL);
+	if (c->image_cache == NULL)
+		/* still loading: plot the rows decoded so far */
+		bitmap = c->data.png.bitmap;
+	else
+		bitmap = image_cache_request_bitmap(c);
 
-	if (repeat_x)
-		flags |= BITMAPF_REPEAT_X;
-	if (repeat_y)
-		flags |= BITMAPF_REPEAT_Y;
+	if (bitmap == NULL)
+		return true;
 
-	return plot.bitmap(x, y, width, height, c->bitmap,
-				background_colour, flags);
+	return pretile_plot_bitmap(x, y, width, height,
+			clip_x0, clip_y0, clip_x1, clip_y1,
+			bitmap, background_colour, repeat_x, repeat_y);
 }
 
 bool nspng_clone(const struct content *old, struct content *new_content)
@@ -341,8 +449,8 @@ bool nspng_clone(const struct content *old, struct content *new_content)
 			return false;
 	}
 
-	if (old->status == CONTENT_STATUS_READY ||
-			old->status == CONTENT_STATUS_DONE) {
+	/* READY means that the old content is still loading */
+	if (old->status == CONTENT_STATUS_DONE) {
 		if (nspng_convert(new_content) == false)
 			return false;
 	}
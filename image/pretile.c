@@ -0,0 +1,169 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Repeated bitmap plotting (implementation).
+ *
+ * Backgrounds are often tiny images, such as a 1 pixel wide gradient,
+ * repeated across a whole page.  Plotters tile them with one plot per
+ * copy, so a small tile is first repeated into one at least
+ * PRETILE_MIN_SIZE pixels across in each repeating direction, which is
+ * kept in the scale cache.  Tiles of a single colour are plotted as a
+ * rectangle instead.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "desktop/plotters.h"
+#include "image/bitmap.h"
+#include "image/pretile.h"
+#include "image/scale_cache.h"
+
+/** Size in each repeating direction to expand small tiles to / pixels */
+#define PRETILE_MIN_SIZE 256
+/** Bitmaps of up to this many pixels are checked for a single colour */
+#define PRETILE_SOLID_PIXELS (64 * 64)
+
+static bool pretile_uniform(struct bitmap *bitmap, uint8_t pixel[4]);
+
+
+/**
+ * Plot a bitmap repeated across and / or down
+ *
+ * \param  x                  left of the tile at the origin of the repeat
+ * \param  y                  top of the tile at the origin of the repeat
+ * \param  width              width of each tile
+ * \param  height             height of each tile
+ * \param  clip_x0            clip rectangle
+ * \param  clip_y0            clip rectangle
+ * \param  clip_x1            clip rectangle
+ * \param  clip_y1            clip rectangle
+ * \param  bitmap             bitmap to plot
+ * \param  background_colour  the background colour
+ * \param  repeat_x           whether to repeat across
+ * \param  repeat_y           whether to repeat down
+ * \return true on success, false on error
+ *
+ * Takes the same parameters as the redraw_tiled content handler entry.
+ */
+
+bool pretile_plot_bitmap(int x, int y, int width, int height,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		struct bitmap *bitmap, colour background_colour,
+		bool repeat_x, bool repeat_y)
+{
+	bitmap_flags_t flags = BITMAPF_NONE;
+	int bitmap_width = bitmap_get_width(bitmap);
+	int bitmap_height = bitmap_get_height(bitmap);
+	int columns = 1, rows = 1;
+	struct bitmap *tiled;
+	uint8_t pixel[4];
+
+	if (repeat_x)
+		flags |= BITMAPF_REPEAT_X;
+	if (repeat_y)
+		flags |= BITMAPF_REPEAT_Y;
+
+	if (flags == BITMAPF_NONE || bitmap_width <= 0 || bitmap_height <= 0)
+		return plot.bitmap(x, y, width, height, bitmap,
+				background_colour, flags);
+
+	if (bitmap_width * bitmap_height <= PRETILE_SOLID_PIXELS &&
+			pretile_uniform(bitmap, pixel)) {
+		plot_style_t style = {
+			.fill_type = PLOT_OP_TYPE_SOLID,
+			.fill_colour = pixel[0] | pixel[1] << 8 |
+					pixel[2] << 16
+		};
+		int x0 = repeat_x ? clip_x0 : x;
+		int y0 = repeat_y ? clip_y0 : y;
+		int x1 = repeat_x ? clip_x1 : x + width;
+		int y1 = repeat_y ? clip_y1 : y + height;
+
+		if (pixel[3] == 0)
+			return true;
+
+		if (pixel[3] == 0xff) {
+			if (x0 < clip_x0)
+				x0 = clip_x0;
+			if (y0 < clip_y0)
+				y0 = clip_y0;
+			if (clip_x1 < x1)
+				x1 = clip_x1;
+			if (clip_y1 < y1)
+				y1 = clip_y1;
+			if (x1 <= x0 || y1 <= y0)
+				return true;
+			return plot.rectangle(x0, y0, x1, y1, &style);
+		}
+	}
+
+	if (repeat_x && bitmap_width < PRETILE_MIN_SIZE)
+		columns = (PRETILE_MIN_SIZE + bitmap_width - 1) /
+				bitmap_width;
+	if (repeat_y && bitmap_height < PRETILE_MIN_SIZE)
+		rows = (PRETILE_MIN_SIZE + bitmap_height - 1) / bitmap_height;
+
+	tiled = scale_cache_get_tiled(bitmap, columns, rows);
+	if (tiled != NULL) {
+		bitmap = tiled;
+		width *= columns;
+		height *= rows;
+	}
+
+	return plot.bitmap(x, y, width, height, bitmap, background_colour,
+			flags);
+}
+
+
+/**
+ * Find whether every pixel of a bitmap is the same
+ *
+ * \param  bitmap  bitmap to test
+ * \param  pixel   updated to the colour of the pixels, as R, G, B, A
+ * \return true if the bitmap is a single colour
+ */
+
+bool pretile_uniform(struct bitmap *bitmap, uint8_t pixel[4])
+{
+	const uint8_t *buffer = bitmap_get_buffer(bitmap);
+	size_t rowstride = bitmap_get_rowstride(bitmap);
+	int width = bitmap_get_width(bitmap);
+	int height = bitmap_get_height(bitmap);
+	int x, y;
+
+	if (buffer == NULL)
+		return false;
+
+	memcpy(pixel, buffer, 4);
+
+	for (y = 0; y != height; y++) {
+		const uint8_t *row = buffer + rowstride * y;
+
+		for (x = 0; x != width; x++)
+			if (memcmp(row + x * 4, pixel, 4) != 0)
+				return false;
+	}
+
+	if (bitmap_get_opaque(bitmap))
+		pixel[3] = 0xff;
+
+	return true;
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright 2008 Vincent Sanders <vince@simtec.co.uk>
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
  *
  * This file is part of NetSurf, http://www.netsurf-browser.org/
  *
@@ -16,9 +16,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef FRAMEBUFFER_SCHEDULE_H
-#define FRAMEBUFFER_SCHEDULE_H
+/** \file
+ * Repeated bitmap plotting (interface).
+ */
+
+#ifndef _NETSURF_IMAGE_PRETILE_H_
+#define _NETSURF_IMAGE_PRETILE_H_
+
+#include <stdbool.h>
+
+#include "desktop/plot_style.h"
+
+struct bitmap;
 
-void list_schedule(void);
+bool pretile_plot_bitmap(int x, int y, int width, int height,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		struct bitmap *bitmap, colour background_colour,
+		bool repeat_x, bool repeat_y);
 
 #endif
@@ -20,11 +20,15 @@
  * Content handler for image/svg using librsvg (implementation).
  *
  * SVG files are rendered to a NetSurf bitmap by creating a Cairo rendering
- * surface (content_rsvg_data.cs) over the bitmap's data, creating a Cairo
- * drawing context using that surface, and then passing that drawing context
- * to librsvg which then uses Cairo calls to plot the graphic to the bitmap.
- * We store this in content->bitmap, and then use the usual bitmap plotter
- * function to render it for redraw requests.
+ * surface over the bitmap's data, creating a Cairo drawing context using
+ * that surface, and then passing that drawing context to librsvg which then
+ * uses Cairo calls to plot the graphic to the bitmap.  A rendering at the
+ * natural size is stored in content->bitmap.
+ *
+ * Redraws at other sizes are rendered again at that size, rather than
+ * scaling the bitmap, and kept in the scale cache so that repeated plots
+ * at the same size, such as a tiled background or an icon used many times,
+ * are a plain bitmap plot.
  */
 
 #include "utils/config.h"
@@ -41,6 +45,8 @@
 #include "content/content_protected.h"
 #include "desktop/plotters.h"
 #include "image/bitmap.h"
+#include "image/pretile.h"
+#include "image/scale_cache.h"
 #include "utils/log.h"
 #include "utils/utils.h"
 #include "utils/messages.h"
@@ -48,6 +54,10 @@
 
 static inline void rsvg_argb_to_abgr(uint32_t pixels[], int width, int height,
 				size_t rowstride);
+static bool rsvg_render(struct bitmap *bitmap, int width, int height,
+		void *pw);
+static struct bitmap *rsvg_redraw_bitmap(struct content *c, int width,
+		int height);
 
 bool rsvg_create(struct content *c, const struct http_parameter *params)
 {
@@ -55,8 +65,6 @@ bool rsvg_create(struct content *c, const struct http_parameter *params)
 	union content_msg_data msg_data;
 
 	d->rsvgh = NULL;
-	d->cs = NULL;
-	d->ct = NULL;
 	d->bitmap = NULL;
 
 	if ((d->rsvgh = rsvg_handle_new()) == NULL) {
@@ -140,36 +148,19 @@ bool rsvg_convert(struct content *c)
 	c->height = rsvgsize.height;
 
 	if ((d->bitmap = bitmap_create(c->width, c->height,
-			BITMAP_NEW)) == NULL) {
+			BITMAP_CLEAR_MEMORY)) == NULL) {
 		LOG(("Failed to create bitmap for rsvg render."));
 		msg_data.error = messages_get("NoMemory");
 		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 		return false;
 	}
 
-	if ((d->cs = cairo_image_surface_create_for_data(
-			(unsigned char *)bitmap_get_buffer(d->bitmap),
-			CAIRO_FORMAT_ARGB32,
-			c->width, c->height,
-			bitmap_get_rowstride(d->bitmap))) == NULL) {
-		LOG(("Failed to create Cairo image surface for rsvg render."));
+	if (rsvg_render(d->bitmap, c->width, c->height, c) == false) {
 		msg_data.error = messages_get("NoMemory");
 		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 		return false;
 	}
 
-	if ((d->ct = cairo_create(d->cs)) == NULL) {
-		LOG(("Failed to create Cairo drawing context for rsvg render."));
-		msg_data.error = messages_get("NoMemory");
-		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
-		return false;
-	}
-
-	rsvg_handle_render_cairo(d->rsvgh, d->ct);
-	rsvg_argb_to_abgr((uint32_t *)bitmap_get_buffer(d->bitmap),
-				c->width, c->height,
-				bitmap_get_rowstride(d->bitmap));
-
 	c->bitmap = d->bitmap;
 	bitmap_modified(c->bitmap);
 	c->status = CONTENT_STATUS_DONE;
@@ -179,12 +170,84 @@ bool rsvg_convert(struct content *c)
 	return true;
 }
 
+/**
+ * Render the graphic into a bitmap.
+ *
+ * \param  bitmap  bitmap to render into, cleared to transparent
+ * \param  width   width of bitmap
+ * \param  height  height of bitmap
+ * \param  pw      the content
+ * \return true on success, false on memory exhaustion
+ */
+
+bool rsvg_render(struct bitmap *bitmap, int width, int height, void *pw)
+{
+	struct content *c = pw;
+	cairo_surface_t *cs;
+	cairo_t *ct;
+	bool ok;
+
+	cs = cairo_image_surface_create_for_data(
+			(unsigned char *)bitmap_get_buffer(bitmap),
+			CAIRO_FORMAT_ARGB32, width, height,
+			bitmap_get_rowstride(bitmap));
+	if (cairo_surface_status(cs) != CAIRO_STATUS_SUCCESS) {
+		LOG(("Failed to create Cairo image surface for rsvg render."));
+		cairo_surface_destroy(cs);
+		return false;
+	}
+
+	ct = cairo_create(cs);
+	ok = (cairo_status(ct) == CAIRO_STATUS_SUCCESS);
+	if (ok) {
+		cairo_scale(ct, (double) width / c->width,
+				(double) height / c->height);
+		rsvg_handle_render_cairo(c->data.rsvg.rsvgh, ct);
+		cairo_surface_flush(cs);
+		rsvg_argb_to_abgr((uint32_t *)bitmap_get_buffer(bitmap),
+				width, height, bitmap_get_rowstride(bitmap));
+	} else {
+		LOG(("Failed to create Cairo drawing context for rsvg render."));
+	}
+
+	cairo_destroy(ct);
+	cairo_surface_destroy(cs);
+
+	return ok;
+}
+
+/**
+ * Find the bitmap to plot the graphic at a given size.
+ *
+ * \return rendering at that size if possible, otherwise the rendering at
+ *         natural size for the plotter to scale
+ */
+
+struct bitmap *rsvg_redraw_bitmap(struct content *c, int width, int height)
+{
+	struct bitmap *bitmap;
+
+	if (width == c->width && height == c->height)
+		return c->bitmap;
+
+	bitmap = scale_cache_get_rendered(c->bitmap, width, height,
+			rsvg_render, c);
+	if (bitmap == NULL)
+		return c->bitmap;
+
+	return bitmap;
+}
+
 bool rsvg_redraw(struct content *c, int x, int y, int width, int height,
 			int clip_x0, int clip_y0, int clip_x1, int clip_y1,
 			float scale, colour background_colour)
 {
-	plot.bitmap(x, y, width, height, c->bitmap, background_colour, BITMAPF_NONE);
-	return true;
+	if (c->bitmap == NULL)
+		return true;
+
+	return plot.bitmap(x, y, width, height,
+			rsvg_redraw_bitmap(c, width, height),
+			background_colour, BITMAPF_NONE);
 }
 
 bool rsvg_redraw_tiled(struct content *c, int x, int y, int width, int height,
@@ -192,17 +255,22 @@ bool rsvg_redraw_tiled(struct content *c, int x, int y, int width, int height,
 		float scale, colour background_colour,
 		bool repeat_x, bool repeat_y)
 {
-	return true;
+	if (c->bitmap == NULL)
+		return true;
+
+	return pretile_plot_bitmap(x, y, width, height,
+			clip_x0, clip_y0, clip_x1, clip_y1,
+			rsvg_redraw_bitmap(c, width, height),
+			background_colour, repeat_x, repeat_y);
 }
 
 void rsvg_destroy(struct content *c)
 {
 	struct content_rsvg_data *d = &c->data.rsvg;
 
+	/* destroying the bitmap also discards renderings at other sizes */
 	if (d->bitmap != NULL) bitmap_destroy(d->bitmap);
 	if (d->rsvgh != NULL) rsvg_handle_free(d->rsvgh);
-	if (d->ct != NULL) cairo_destroy(d->ct);
-	if (d->cs != NULL) cairo_surface_destroy(d->cs);
 
 	return;
 }
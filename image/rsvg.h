@@ -37,9 +37,7 @@ struct http_parameter;
 
 struct content_rsvg_data {
 	RsvgHandle *rsvgh;	/**< Context handle for RSVG renderer */
-	cairo_surface_t *cs;	/**< The surface built inside a nsbitmap */
-	cairo_t *ct;		/**< Cairo drawing context */
-	struct bitmap *bitmap;	/**< Created NetSurf bitmap */
+	struct bitmap *bitmap;	/**< Rendering at natural size */
 };
 
 bool rsvg_create(struct content *c, const struct http_parameter *params);
@@ -0,0 +1,709 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Scaled bitmap cache (implementation).
+ *
+ * Copies of a bitmap are either scaled, repeated to make a larger tile at
+ * the same scale, or rendered afresh at another size by the owner of the
+ * bitmap.
+ *
+ * Entries are found through a small hash table on the source bitmap, and
+ * are also kept on a list in order of last use, most recent first.  When
+ * the total size of the scaled bitmaps exceeds SCALE_CACHE_LIMIT, entries
+ * are discarded from the end of the list.  Scaled bitmaps are only used
+ * for the duration of a plot, so an entry may be discarded at any time.
+ *
+ * Smooth scaling uses a separable tent filter over premultiplied pixels,
+ * widened when reducing so that every source pixel contributes.  Smooth
+ * and unsmoothed copies are cached separately.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image/bitmap.h"
+#include "image/scale_cache.h"
+#include "utils/log.h"
+
+/** Maximum total size of scaled bitmaps / bytes */
+#define SCALE_CACHE_LIMIT (8 * 1024 * 1024)
+/** Number of hash table buckets */
+#define SCALE_CACHE_BUCKETS 64
+/** Fractional bits of filter weights */
+#define SCALE_CACHE_SHIFT 14
+
+/** Scaled bitmap cache entry */
+struct scale_cache_entry {
+	struct bitmap *bitmap;		/**< Source bitmap */
+	int width;			/**< Width scaled to */
+	int height;			/**< Height scaled to */
+	bool smooth;			/**< Scaled with filtering */
+	int columns;			/**< Repeats across, 1 if scaled, or
+					     0 if rendered */
+	int rows;			/**< Repeats down, as columns */
+	struct bitmap *scaled;		/**< Scaled copy of bitmap */
+	size_t size;			/**< Size of scaled copy / bytes */
+	struct scale_cache_entry *hash_next;	/**< Next in bucket */
+	struct scale_cache_entry *prev;	/**< Previous (more recent) entry */
+	struct scale_cache_entry *next;	/**< Next (less recent) entry */
+};
+
+/** Filter taps for one axis */
+struct scale_cache_filter {
+	int taps;		/**< Source pixels per destination pixel */
+	int *index;		/**< Source pixel of each tap */
+	int *weight;		/**< Weight of each tap */
+};
+
+/** Hash table of entries, on source bitmap */
+static struct scale_cache_entry *scale_cache_table[SCALE_CACHE_BUCKETS];
+/** Entries, most recently used first */
+static struct scale_cache_entry *scale_cache_head;
+/** Least recently used entry */
+static struct scale_cache_entry *scale_cache_tail;
+/** Total size of scaled bitmaps / bytes */
+static size_t scale_cache_size;
+
+static struct bitmap *scale_cache_find(struct bitmap *bitmap, int width,
+		int height, bool smooth, int columns, int rows,
+		scale_cache_render_fn render, void *pw);
+static unsigned int scale_cache_hash(struct bitmap *bitmap);
+static void scale_cache_remove(struct scale_cache_entry *entry);
+static struct bitmap *scale_cache_scale(struct bitmap *bitmap, int width,
+		int height, bool smooth);
+static struct bitmap *scale_cache_tile(struct bitmap *bitmap, int columns,
+		int rows);
+static struct bitmap *scale_cache_render(struct bitmap *bitmap, int width,
+		int height, scale_cache_render_fn render, void *pw);
+static void scale_cache_nearest(const uint8_t *src, size_t src_stride,
+		int src_w, int src_h, uint8_t *dst, size_t dst_stride,
+		int dst_w, int dst_h);
+static bool scale_cache_smooth(const uint8_t *src, size_t src_stride,
+		int src_w, int src_h, uint8_t *dst, size_t dst_stride,
+		int dst_w, int dst_h, bool opaque);
+static bool scale_cache_filter_init(struct scale_cache_filter *f,
+		int src, int dst);
+static void scale_cache_filter_free(struct scale_cache_filter *f);
+
+
+/**
+ * Find a bitmap scaled to a given size, scaling and caching it if needed
+ *
+ * \param  bitmap  bitmap to scale
+ * \param  width   width to scale to
+ * \param  height  height to scale to
+ * \param  smooth  whether to filter, rather than pick the nearest pixels
+ * \return scaled bitmap, or NULL if the caller should scale it itself
+ *
+ * The scaled bitmap remains owned by the cache, and is only valid until
+ * the next call to a scale_cache function.
+ */
+
+struct bitmap *scale_cache_get(struct bitmap *bitmap, int width, int height,
+		bool smooth)
+{
+	return scale_cache_find(bitmap, width, height, smooth, 1, 1,
+			NULL, NULL);
+}
+
+
+/**
+ * Find a bitmap repeated to make a larger tile, creating it if needed
+ *
+ * \param  bitmap   bitmap to repeat
+ * \param  columns  number of times to repeat across
+ * \param  rows     number of times to repeat down
+ * \return tiled bitmap, or NULL if the caller should use bitmap itself
+ *
+ * The tiled bitmap remains owned by the cache, and is only valid until
+ * the next call to a scale_cache function.
+ */
+
+struct bitmap *scale_cache_get_tiled(struct bitmap *bitmap, int columns,
+		int rows)
+{
+	if (columns <= 0 || rows <= 0 || (columns == 1 && rows == 1))
+		return NULL;
+
+	return scale_cache_find(bitmap, bitmap_get_width(bitmap) * columns,
+			bitmap_get_height(bitmap) * rows, false,
+			columns, rows, NULL, NULL);
+}
+
+
+/**
+ * Find an image rendered at a given size, rendering it if needed
+ *
+ * \param  bitmap  bitmap holding the image at its own size, used as the key
+ * \param  width   width to render at
+ * \param  height  height to render at
+ * \param  render  function to render the image into a new bitmap
+ * \param  pw      private word for render
+ * \return rendered bitmap, or NULL if the caller should scale bitmap
+ *
+ * The rendered bitmap remains owned by the cache, and is only valid until
+ * the next call to a scale_cache function.  Destroying bitmap discards all
+ * renderings made for it.
+ */
+
+struct bitmap *scale_cache_get_rendered(struct bitmap *bitmap, int width,
+		int height, scale_cache_render_fn render, void *pw)
+{
+	return scale_cache_find(bitmap, width, height, true, 0, 0,
+			render, pw);
+}
+
+
+/**
+ * Find a derived copy of a bitmap, creating and caching it if needed
+ *
+ * \param  bitmap   source bitmap
+ * \param  width    width of copy
+ * \param  height   height of copy
+ * \param  smooth   whether to filter when scaling
+ * \param  columns  number of repeats across, 1 to scale, or 0 to render
+ * \param  rows     number of repeats down, as columns
+ * \param  render   function to render the copy, if columns is 0
+ * \param  pw       private word for render
+ * \return copy, or NULL if not possible
+ */
+
+struct bitmap *scale_cache_find(struct bitmap *bitmap, int width,
+		int height, bool smooth, int columns, int rows,
+		scale_cache_render_fn render, void *pw)
+{
+	unsigned int bucket = scale_cache_hash(bitmap);
+	struct scale_cache_entry *entry, *victim;
+	struct bitmap *scaled;
+	size_t size;
+
+	if (width <= 0 || height <= 0)
+		return NULL;
+
+	for (entry = scale_cache_table[bucket]; entry != NULL;
+			entry = entry->hash_next) {
+		if (entry->bitmap == bitmap && entry->width == width &&
+				entry->height == height &&
+				entry->smooth == smooth &&
+				entry->columns == columns &&
+				entry->rows == rows)
+			break;
+	}
+
+	if (entry != NULL) {
+		/* move to head of list */
+		if (entry != scale_cache_head) {
+			entry->prev->next = entry->next;
+			if (entry->next != NULL)
+				entry->next->prev = entry->prev;
+			else
+				scale_cache_tail = entry->prev;
+			entry->prev = NULL;
+			entry->next = scale_cache_head;
+			scale_cache_head->prev = entry;
+			scale_cache_head = entry;
+		}
+		return entry->scaled;
+	}
+
+	/* large targets would displace everything else for little gain, as
+	 * they are usually only partly visible */
+	size = (size_t) width * height * 4;
+	if (size > SCALE_CACHE_LIMIT / 4)
+		return NULL;
+
+	entry = malloc(sizeof *entry);
+	if (entry == NULL)
+		return NULL;
+
+	if (columns == 0)
+		scaled = scale_cache_render(bitmap, width, height, render, pw);
+	else if (columns == 1 && rows == 1)
+		scaled = scale_cache_scale(bitmap, width, height, smooth);
+	else
+		scaled = scale_cache_tile(bitmap, columns, rows);
+	if (scaled == NULL) {
+		free(entry);
+		return NULL;
+	}
+
+	/* the source may itself be a cached copy, such as a rendering which
+	 * is being tiled, and must survive until it has been plotted */
+	while (scale_cache_size + size > SCALE_CACHE_LIMIT) {
+		victim = scale_cache_tail;
+		while (victim != NULL && victim->scaled == bitmap)
+			victim = victim->prev;
+		if (victim == NULL)
+			break;
+
+		scale_cache_remove(victim);
+	}
+
+	entry->bitmap = bitmap;
+	entry->width = width;
+	entry->height = height;
+	entry->smooth = smooth;
+	entry->columns = columns;
+	entry->rows = rows;
+	entry->scaled = scaled;
+	entry->size = size;
+	entry->hash_next = scale_cache_table[bucket];
+	scale_cache_table[bucket] = entry;
+	entry->prev = NULL;
+	entry->next = scale_cache_head;
+	if (scale_cache_head != NULL)
+		scale_cache_head->prev = entry;
+	else
+		scale_cache_tail = entry;
+	scale_cache_head = entry;
+	scale_cache_size += size;
+
+	return scaled;
+}
+
+
+/**
+ * Discard all scaled copies of a bitmap
+ *
+ * \param  bitmap  bitmap which has been modified or is being destroyed
+ */
+
+void scale_cache_invalidate(struct bitmap *bitmap)
+{
+	struct scale_cache_entry *entry, *next;
+
+	for (entry = scale_cache_table[scale_cache_hash(bitmap)];
+			entry != NULL; entry = next) {
+		next = entry->hash_next;
+		if (entry->bitmap == bitmap)
+			scale_cache_remove(entry);
+	}
+}
+
+
+/**
+ * Find the hash table bucket for a bitmap
+ */
+
+unsigned int scale_cache_hash(struct bitmap *bitmap)
+{
+	/* the low bits are the same for every allocation */
+	return ((uintptr_t) bitmap >> 4) % SCALE_CACHE_BUCKETS;
+}
+
+
+/**
+ * Remove an entry from the cache and destroy its scaled bitmap
+ */
+
+void scale_cache_remove(struct scale_cache_entry *entry)
+{
+	struct scale_cache_entry **link;
+
+	for (link = &scale_cache_table[scale_cache_hash(entry->bitmap)];
+			*link != entry; link = &(*link)->hash_next)
+		;
+	*link = entry->hash_next;
+
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		scale_cache_head = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		scale_cache_tail = entry->prev;
+
+	scale_cache_size -= entry->size;
+
+	/* the entry must be unlinked first, as destroying a bitmap calls
+	 * scale_cache_invalidate() */
+	bitmap_destroy(entry->scaled);
+	free(entry);
+}
+
+
+/**
+ * Create a scaled copy of a bitmap
+ *
+ * \return new bitmap, or NULL on memory exhaustion
+ */
+
+struct bitmap *scale_cache_scale(struct bitmap *bitmap, int width,
+		int height, bool smooth)
+{
+	bool opaque = bitmap_get_opaque(bitmap);
+	const uint8_t *src = bitmap_get_buffer(bitmap);
+	uint8_t *dst;
+	struct bitmap *scaled;
+
+	if (src == NULL)
+		return NULL;
+
+	scaled = bitmap_create(width, height,
+			opaque ? BITMAP_OPAQUE : BITMAP_NEW);
+	if (scaled == NULL)
+		return NULL;
+
+	dst = bitmap_get_buffer(scaled);
+	if (dst == NULL) {
+		bitmap_destroy(scaled);
+		return NULL;
+	}
+
+	if (smooth) {
+		if (!scale_cache_smooth(src, bitmap_get_rowstride(bitmap),
+				bitmap_get_width(bitmap),
+				bitmap_get_height(bitmap),
+				dst, bitmap_get_rowstride(scaled),
+				width, height, opaque)) {
+			bitmap_destroy(scaled);
+			return NULL;
+		}
+	} else {
+		scale_cache_nearest(src, bitmap_get_rowstride(bitmap),
+				bitmap_get_width(bitmap),
+				bitmap_get_height(bitmap),
+				dst, bitmap_get_rowstride(scaled),
+				width, height);
+	}
+
+	bitmap_set_opaque(scaled, opaque);
+	bitmap_modified(scaled);
+
+	return scaled;
+}
+
+
+/**
+ * Create a copy of a bitmap repeated across and down
+ *
+ * \return new bitmap, or NULL on memory exhaustion
+ */
+
+struct bitmap *scale_cache_tile(struct bitmap *bitmap, int columns, int rows)
+{
+	bool opaque = bitmap_get_opaque(bitmap);
+	const uint8_t *src = bitmap_get_buffer(bitmap);
+	size_t src_stride = bitmap_get_rowstride(bitmap), dst_stride;
+	int width = bitmap_get_width(bitmap);
+	int height = bitmap_get_height(bitmap);
+	struct bitmap *tiled;
+	uint8_t *dst;
+	int x, y;
+
+	if (src == NULL)
+		return NULL;
+
+	tiled = bitmap_create(width * columns, height * rows,
+			opaque ? BITMAP_OPAQUE : BITMAP_NEW);
+	if (tiled == NULL)
+		return NULL;
+
+	dst = bitmap_get_buffer(tiled);
+	if (dst == NULL) {
+		bitmap_destroy(tiled);
+		return NULL;
+	}
+	dst_stride = bitmap_get_rowstride(tiled);
+
+	/* build the first row of tiles, then copy it down */
+	for (y = 0; y != height; y++)
+		for (x = 0; x != columns; x++)
+			memcpy(dst + dst_stride * y + (size_t) width * 4 * x,
+					src + src_stride * y,
+					(size_t) width * 4);
+	for (y = height; y != height * rows; y++)
+		memcpy(dst + dst_stride * y, dst + dst_stride * (y - height),
+				(size_t) width * columns * 4);
+
+	bitmap_set_opaque(tiled, opaque);
+	bitmap_modified(tiled);
+
+	return tiled;
+}
+
+
+/**
+ * Create a new rendering of an image
+ *
+ * \return new bitmap, or NULL on error
+ */
+
+struct bitmap *scale_cache_render(struct bitmap *bitmap, int width,
+		int height, scale_cache_render_fn render, void *pw)
+{
+	struct bitmap *rendered;
+
+	rendered = bitmap_create(width, height, BITMAP_CLEAR_MEMORY);
+	if (rendered == NULL)
+		return NULL;
+
+	if (!render(rendered, width, height, pw)) {
+		bitmap_destroy(rendered);
+		return NULL;
+	}
+
+	bitmap_set_opaque(rendered, bitmap_get_opaque(bitmap));
+	bitmap_modified(rendered);
+
+	return rendered;
+}
+
+
+/**
+ * Scale pixels by picking the source pixel under the centre of each
+ * destination pixel
+ */
+
+void scale_cache_nearest(const uint8_t *src, size_t src_stride,
+		int src_w, int src_h, uint8_t *dst, size_t dst_stride,
+		int dst_w, int dst_h)
+{
+	int x, y;
+
+	for (y = 0; y != dst_h; y++) {
+		const uint8_t *row = src + src_stride *
+				(((2 * (size_t) y + 1) * src_h) / (2 * dst_h));
+		uint8_t *out = dst + dst_stride * y;
+
+		for (x = 0; x != dst_w; x++) {
+			size_t sx = ((2 * (size_t) x + 1) * src_w) /
+					(2 * dst_w);
+			memcpy(out + x * 4, row + sx * 4, 4);
+		}
+	}
+}
+
+
+/**
+ * Scale pixels with a tent filter
+ *
+ * \return true on success, false on memory exhaustion
+ *
+ * Rows are premultiplied and filtered horizontally into a buffer with 8
+ * fractional bits, which is then filtered vertically.
+ */
+
+bool scale_cache_smooth(const uint8_t *src, size_t src_stride,
+		int src_w, int src_h, uint8_t *dst, size_t dst_stride,
+		int dst_w, int dst_h, bool opaque)
+{
+	struct scale_cache_filter fx, fy;
+	uint16_t *tmp;
+	uint8_t *row;
+	int x, y, t, c;
+
+	if (!scale_cache_filter_init(&fx, src_w, dst_w))
+		return false;
+	if (!scale_cache_filter_init(&fy, src_h, dst_h)) {
+		scale_cache_filter_free(&fx);
+		return false;
+	}
+
+	tmp = malloc((size_t) dst_w * src_h * 4 * sizeof *tmp);
+	row = malloc((size_t) src_w * 4);
+	if (tmp == NULL || row == NULL) {
+		LOG(("out of memory scaling %i x %i to %i x %i",
+				src_w, src_h, dst_w, dst_h));
+		free(tmp);
+		free(row);
+		scale_cache_filter_free(&fx);
+		scale_cache_filter_free(&fy);
+		return false;
+	}
+
+	/* horizontal pass */
+	for (y = 0; y != src_h; y++) {
+		const uint8_t *in = src + src_stride * y;
+		uint16_t *out = tmp + (size_t) dst_w * 4 * y;
+
+		if (opaque) {
+			memcpy(row, in, src_w * 4);
+		} else {
+			for (x = 0; x != src_w; x++) {
+				unsigned int a = in[x * 4 + 3];
+
+				row[x * 4] = (in[x * 4] * a + 127) / 255;
+				row[x * 4 + 1] = (in[x * 4 + 1] * a + 127) / 255;
+				row[x * 4 + 2] = (in[x * 4 + 2] * a + 127) / 255;
+				row[x * 4 + 3] = a;
+			}
+		}
+
+		for (x = 0; x != dst_w; x++) {
+			const int *index = fx.index + x * fx.taps;
+			const int *weight = fx.weight + x * fx.taps;
+			uint32_t sum[4] = { 0, 0, 0, 0 };
+
+			for (t = 0; t != fx.taps; t++) {
+				const uint8_t *p = row + index[t] * 4;
+
+				sum[0] += p[0] * weight[t];
+				sum[1] += p[1] * weight[t];
+				sum[2] += p[2] * weight[t];
+				sum[3] += p[3] * weight[t];
+			}
+
+			for (c = 0; c != 4; c++)
+				out[x * 4 + c] = (sum[c] +
+						(1 << (SCALE_CACHE_SHIFT - 9))) >>
+						(SCALE_CACHE_SHIFT - 8);
+		}
+	}
+
+	/* vertical pass */
+	for (y = 0; y != dst_h; y++) {
+		const int *index = fy.index + y * fy.taps;
+		const int *weight = fy.weight + y * fy.taps;
+		uint8_t *out = dst + dst_stride * y;
+
+		for (x = 0; x != dst_w; x++) {
+			uint32_t sum[4] = { 0, 0, 0, 0 };
+			unsigned int a;
+
+			for (t = 0; t != fy.taps; t++) {
+				const uint16_t *p = tmp +
+						((size_t) index[t] * dst_w + x) * 4;
+
+				sum[0] += p[0] * weight[t];
+				sum[1] += p[1] * weight[t];
+				sum[2] += p[2] * weight[t];
+				sum[3] += p[3] * weight[t];
+			}
+
+			for (c = 0; c != 4; c++) {
+				sum[c] = (sum[c] +
+						(1 << (SCALE_CACHE_SHIFT + 7))) >>
+						(SCALE_CACHE_SHIFT + 8);
+				if (sum[c] > 255)
+					sum[c] = 255;
+			}
+
+			a = sum[3];
+			if (opaque || a == 255) {
+				out[x * 4] = sum[0];
+				out[x * 4 + 1] = sum[1];
+				out[x * 4 + 2] = sum[2];
+			} else if (a == 0) {
+				out[x * 4] = out[x * 4 + 1] = out[x * 4 + 2] = 0;
+			} else {
+				for (c = 0; c != 3; c++) {
+					unsigned int v = (sum[c] * 255 + a / 2) / a;
+					out[x * 4 + c] = v > 255 ? 255 : v;
+				}
+			}
+			out[x * 4 + 3] = opaque ? 255 : a;
+		}
+	}
+
+	free(tmp);
+	free(row);
+	scale_cache_filter_free(&fx);
+	scale_cache_filter_free(&fy);
+
+	return true;
+}
+
+
+/**
+ * Calculate tent filter taps for scaling one axis
+ *
+ * \param  f    filter to fill in
+ * \param  src  source size
+ * \param  dst  destination size
+ * \return true on success, false on memory exhaustion
+ *
+ * The weights of each destination pixel sum to 1 << SCALE_CACHE_SHIFT.
+ * Taps beyond the edges are clamped to the edge pixels.
+ */
+
+bool scale_cache_filter_init(struct scale_cache_filter *f, int src, int dst)
+{
+	double scale = (double) src / dst;
+	double support = scale > 1 ? scale : 1;
+	double *w;
+	int d, t;
+
+	f->taps = (int) (2 * support) + 2;
+	f->index = malloc((size_t) dst * f->taps * sizeof *f->index);
+	f->weight = malloc((size_t) dst * f->taps * sizeof *f->weight);
+	w = malloc(f->taps * sizeof *w);
+	if (f->index == NULL || f->weight == NULL || w == NULL) {
+		free(w);
+		scale_cache_filter_free(f);
+		return false;
+	}
+
+	for (d = 0; d != dst; d++) {
+		int *index = f->index + d * f->taps;
+		int *weight = f->weight + d * f->taps;
+		double centre = (d + 0.5) * scale - 0.5;
+		double total = 0;
+		int first = (int) (centre - support) + 1, sum = 0, heaviest = 0;
+
+		if (centre - support + 1 < first)
+			first--;
+
+		for (t = 0; t != f->taps; t++) {
+			double distance = (first + t - centre) / support;
+
+			if (distance < 0)
+				distance = -distance;
+			w[t] = distance < 1 ? 1 - distance : 0;
+			total += w[t];
+
+			index[t] = first + t;
+			if (index[t] < 0)
+				index[t] = 0;
+			else if (src <= index[t])
+				index[t] = src - 1;
+		}
+
+		for (t = 0; t != f->taps; t++) {
+			weight[t] = (int) (w[t] / total *
+					(1 << SCALE_CACHE_SHIFT) + 0.5);
+			sum += weight[t];
+			if (weight[heaviest] < weight[t])
+				heaviest = t;
+		}
+
+		/* put any rounding error on the heaviest tap */
+		weight[heaviest] += (1 << SCALE_CACHE_SHIFT) - sum;
+	}
+
+	free(w);
+
+	return true;
+}
+
+
+/**
+ * Free the taps of a filter
+ */
+
+void scale_cache_filter_free(struct scale_cache_filter *f)
+{
+	free(f->index);
+	free(f->weight);
+	f->index = NULL;
+	f->weight = NULL;
+}
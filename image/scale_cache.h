@@ -0,0 +1,60 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Scaled bitmap cache (interface).
+ *
+ * Front end plotters which are asked to plot a bitmap at other than its
+ * own size may use scale_cache_get() to obtain a copy of the bitmap at
+ * that size, instead of scaling it on every plot.  scale_cache_get_tiled()
+ * gives a small bitmap repeated into a larger tile, for backgrounds.
+ * scale_cache_get_rendered() caches the output of a content handler which
+ * can render itself at any size, such as a vector image.
+ *
+ * Every front end must call scale_cache_invalidate() from bitmap_modified()
+ * and bitmap_destroy().
+ */
+
+#ifndef _NETSURF_IMAGE_SCALE_CACHE_H_
+#define _NETSURF_IMAGE_SCALE_CACHE_H_
+
+#include <stdbool.h>
+
+struct bitmap;
+
+/**
+ * Function to render an image into a bitmap
+ *
+ * \param  bitmap  bitmap to render into
+ * \param  width   width of bitmap
+ * \param  height  height of bitmap
+ * \param  pw      private word passed to scale_cache_get_rendered()
+ * \return true on success, false on error
+ */
+typedef bool (*scale_cache_render_fn)(struct bitmap *bitmap, int width,
+		int height, void *pw);
+
+struct bitmap *scale_cache_get(struct bitmap *bitmap, int width, int height,
+		bool smooth);
+struct bitmap *scale_cache_get_tiled(struct bitmap *bitmap, int columns,
+		int rows);
+struct bitmap *scale_cache_get_rendered(struct bitmap *bitmap, int width,
+		int height, scale_cache_render_fn render, void *pw);
+void scale_cache_invalidate(struct bitmap *bitmap);
+
+#endif
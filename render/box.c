@@ -39,10 +39,34 @@
 #include "utils/utils.h"
 
 static bool box_contains_point(struct box *box, int x, int y, bool *physically);
+static unsigned int box_index_band(const struct box_index *index, int y);
 
 #define box_is_float(box) (box->type == BOX_FLOAT_LEFT || \
 		box->type == BOX_FLOAT_RIGHT)
 
+/** Number of non-float children a box must have to be indexed */
+#define BOX_INDEX_MIN_CHILDREN 64
+/** Average number of children per band of an index */
+#define BOX_INDEX_BAND_CHILDREN 8
+
+/**
+ * Index of the non-float children of a box by vertical position.
+ *
+ * The vertical extent of the children is divided into equal bands. For each
+ * band the positions of the first and last children whose descendant boxes
+ * intersect it are recorded, so that the children at a given height can be
+ * found without visiting every child.
+ */
+struct box_index {
+	int y0;			/**< Top of first band, relative to box */
+	int band_height;	/**< Height of each band */
+	unsigned int bands;	/**< Number of bands */
+	unsigned int *first;	/**< Position of first child in each band */
+	unsigned int *end;	/**< Position after last child in each band */
+	struct box **child;	/**< Non-float children, in tree order */
+	unsigned int count;	/**< Number of non-float children */
+};
+
 typedef struct box_duplicate_llist box_duplicate_llist;
 struct box_duplicate_llist {
 	struct box_duplicate_llist *prev;
@@ -118,6 +142,7 @@ struct box * box_create(css_computed_style *style,
 	box->background = NULL;
 	box->object = NULL;
 	box->object_params = NULL;
+	box->child_index = NULL;
 
 	return box;
 }
@@ -134,6 +159,8 @@ void box_add_child(struct box *parent, struct box *child)
 	assert(parent);
 	assert(child);
 
+	box_index_discard(parent);
+
 	if (parent->children != 0) {	/* has children already */
 		parent->last->next = child;
 		child->prev = parent->last;
@@ -156,6 +183,9 @@ void box_add_child(struct box *parent, struct box *child)
 
 void box_insert_sibling(struct box *box, struct box *new_box)
 {
+	if (box->parent)
+		box_index_discard(box->parent);
+
 	new_box->parent = box->parent;
 	new_box->prev = box;
 	new_box->next = box->next;
@@ -180,6 +210,7 @@ void box_unlink_and_free(struct box *box)
 	struct box *prev = box->prev;
 
 	if (parent) {
+		box_index_discard(parent);
 		if (parent->children == box)
 			parent->children = next;
 		if (parent->last == box)
@@ -316,7 +347,7 @@ struct box *box_at_point(struct box *box, const int x, const int y,
 		hlcache_handle **content)
 {
 	int bx = *box_x, by = *box_y;
-	struct box *child, *sibling;
+	struct box *child, *sibling, *first, *end;
 	bool physically;
 
 	assert(box);
@@ -353,7 +384,10 @@ struct box *box_at_point(struct box *box, const int x, const int y,
 
 non_float_children:
 	/* non-float children */
-	for (child = box->children; child; child = child->next) {
+	first = box->children;
+	end = NULL;
+	box_index_find(box, y - by, y - by + 1, &first, &end);
+	for (child = first; child && child != end; child = child->next) {
 		if (box_is_float(child))
 			continue;
 		if (box_contains_point(child, x - bx, y - by, &physically)) {
@@ -416,7 +450,13 @@ siblings:
 		} else {
 			bx -= box->x - scroll_get_offset(box->scroll_x);
 			by -= box->y - scroll_get_offset(box->scroll_y);
-			for (sibling = box->next; sibling;
+			end = NULL;
+			if (box->parent && box_index_find(box->parent,
+					y - by, y - by + 1, &first, &end) &&
+					!first)
+				/* no siblings at this height */
+				end = box->next;
+			for (sibling = box->next; sibling && sibling != end;
 					sibling = sibling->next) {
 				if (box_is_float(sibling))
 					continue;
@@ -939,6 +979,7 @@ bool box_duplicate_main_tree(struct box *box, struct content *c, int *count)
 	box->width = UNKNOWN_WIDTH;
 	box->min_width = 0;
 	box->max_width = UNKNOWN_MAX_WIDTH;
+	box->child_index = NULL;
 
 	(*count)++;
 
@@ -1129,3 +1170,178 @@ bool box_hscrollbar_present(const struct box * const box)
 			box->padding[LEFT] + box->width + box->padding[RIGHT] +
 			box->border[RIGHT].width < box->descendant_x1;
 }
+
+
+/**
+ * Build the vertical position index of a box's non-float children.
+ *
+ * \param  box  box to index the children of
+ *
+ * The descendant bounding boxes of the children must be up to date, so this
+ * is called from layout once they have been calculated. Boxes with few
+ * children are not indexed. Failure to allocate the index is not an error;
+ * the box is simply left unindexed.
+ */
+
+void box_index_build(struct box *box)
+{
+	struct box_index *index;
+	struct box *c;
+	unsigned int count = 0, visits = 0, i, b, b0, b1;
+	int y0 = INT_MAX, y1 = INT_MIN;
+
+	box_index_discard(box);
+
+	for (c = box->children; c; c = c->next) {
+		if (box_is_float(c))
+			continue;
+		count++;
+		if (c->y + c->descendant_y0 < y0)
+			y0 = c->y + c->descendant_y0;
+		if (y1 < c->y + c->descendant_y1)
+			y1 = c->y + c->descendant_y1;
+	}
+
+	if (count < BOX_INDEX_MIN_CHILDREN || y1 <= y0)
+		return;
+
+	index = talloc(box, struct box_index);
+	if (!index)
+		return;
+
+	index->y0 = y0;
+	index->bands = count / BOX_INDEX_BAND_CHILDREN;
+	index->band_height = (y1 - y0 + index->bands - 1) / index->bands;
+	if (index->band_height < 1)
+		index->band_height = 1;
+	index->bands = (y1 - y0 + index->band_height - 1) / index->band_height;
+	index->count = count;
+	index->first = talloc_array(index, unsigned int, index->bands);
+	index->end = talloc_array(index, unsigned int, index->bands);
+	index->child = talloc_array(index, struct box *, count);
+	if (!index->first || !index->end || !index->child) {
+		talloc_free(index);
+		return;
+	}
+
+	for (b = 0; b != index->bands; b++) {
+		index->first[b] = count;
+		index->end[b] = 0;
+	}
+
+	for (c = box->children, i = 0; c; c = c->next) {
+		if (box_is_float(c))
+			continue;
+
+		b0 = box_index_band(index, c->y + c->descendant_y0);
+		b1 = box_index_band(index, c->y + c->descendant_y1);
+		if (b1 < b0)
+			b1 = b0;
+		for (b = b0; b <= b1; b++) {
+			if (index->first[b] == count)
+				index->first[b] = i;
+			index->end[b] = i + 1;
+		}
+
+		/* children which overlap heavily make the index useless */
+		visits += b1 - b0 + 1;
+		if (BOX_INDEX_BAND_CHILDREN * count < visits) {
+			talloc_free(index);
+			return;
+		}
+
+		index->child[i++] = c;
+	}
+
+	box->child_index = index;
+}
+
+
+/**
+ * Discard the vertical position index of a box's children, if any.
+ *
+ * \param  box  box whose children have changed
+ *
+ * Must be called whenever the list of children of a box is modified.
+ */
+
+void box_index_discard(struct box *box)
+{
+	if (box->child_index) {
+		talloc_free(box->child_index);
+		box->child_index = NULL;
+	}
+}
+
+
+/**
+ * Find the non-float children of a box which may intersect a vertical range.
+ *
+ * \param  box    box to search the children of
+ * \param  y0     top of range, relative to box
+ * \param  y1     bottom of range (exclusive), relative to box
+ * \param  first  updated to first child to consider, or 0 if none
+ * \param  end    updated to child after last to consider, or 0 for the end
+ *                of the list
+ * \return  true if the box's children are indexed, false if not, in which
+ *          case first and end are not updated and all children must be
+ *          considered
+ *
+ * All non-float children intersecting the range are in first .. end, in
+ * tree order. Floats and other children may also be present, so callers
+ * must still test each child.
+ */
+
+bool box_index_find(const struct box *box, int y0, int y1,
+		struct box **first, struct box **end)
+{
+	const struct box_index *index = box->child_index;
+	unsigned int b, b0, b1, f, e;
+
+	if (!index)
+		return false;
+
+	*first = *end = NULL;
+
+	if (y1 <= index->y0 || y1 <= y0 ||
+			index->y0 + (int) index->bands * index->band_height <=
+			y0)
+		return true;
+
+	b0 = box_index_band(index, y0);
+	b1 = box_index_band(index, y1 - 1);
+	f = index->count;
+	e = 0;
+	for (b = b0; b <= b1; b++) {
+		if (index->first[b] < f)
+			f = index->first[b];
+		if (e < index->end[b])
+			e = index->end[b];
+	}
+
+	if (f < e) {
+		*first = index->child[f];
+		*end = e < index->count ? index->child[e] : NULL;
+	}
+
+	return true;
+}
+
+
+/**
+ * Find the band of an index containing a position, clamped to the bands.
+ *
+ * \param  index  index to search
+ * \param  y      position, relative to box
+ * \return  band number
+ */
+
+unsigned int box_index_band(const struct box_index *index, int y)
+{
+	if (y < index->y0)
+		return 0;
+	if (index->bands <= (unsigned int) ((y - index->y0) /
+			index->band_height))
+		return index->bands - 1;
+	return (y - index->y0) / index->band_height;
+}
@@ -95,6 +95,7 @@
 #include "css/css.h"
 
 struct box;
+struct box_index;
 struct column;
 struct object_params;
 struct object_param;
@@ -245,6 +246,10 @@ struct box {
 	struct hlcache_handle* object;
 	/** Parameters for the object, or 0. */
 	struct object_params *object_params;
+
+	/** Index of non-float children by vertical position, or 0 if the
+	 * children are not indexed. Built by box_index_build(). */
+	struct box_index *child_index;
 };
 
 /** Table column data. */
@@ -321,9 +326,19 @@ bool box_vscrollbar_present(const struct box *box);
 bool box_hscrollbar_present(const struct box *box);
 
 bool xml_to_box(xmlNode *n, struct content *c);
+bool xml_to_box_partial(xmlNode *n, xmlNode *body, xmlNode *pending,
+		struct content *c, bool *started);
+bool xml_to_box_continue(xmlNode *pending, struct content *c);
 
 bool box_normalise_block(struct box *block, struct content *c);
+bool box_normalise_block_from(struct box *block, struct box *last,
+		struct box *inline_last, struct content *c);
 
 struct box* box_duplicate_tree(struct box *root, struct content *c);
 
+void box_index_build(struct box *box);
+void box_index_discard(struct box *box);
+bool box_index_find(const struct box *box, int y0, int y1,
+		struct box **first, struct box **end);
+
 #endif
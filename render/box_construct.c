@@ -90,10 +90,30 @@ const char *TARGET_PARENT = "_parent";
 const char *TARGET_TOP = "_top";
 const char *TARGET_BLANK = "_blank";
 
+/** Construction of the boxes for a body which is still being parsed. */
+struct box_construct_state {
+	xmlNode *body;		/**< Body element */
+	xmlNode *last;		/**< Last child of body converted, or 0 */
+	xmlNode *pending;	/**< Child of body to stop converting at, or 0 */
+	struct box *box;	/**< Box for body, or 0 if not yet created */
+	/** Current inline container in box, or 0 */
+	struct box *inline_container;
+	char *title;		/**< Title inherited from body */
+	/** Last child of box when it was last normalised */
+	struct box *normalised;
+	/** Last child of normalised when it was last normalised, if it is
+	 * an inline container */
+	struct box *inline_normalised;
+};
+
 static bool convert_xml_to_box(xmlNode *n, struct content *content,
 		const css_computed_style *parent_style,
 		struct box *parent, struct box **inline_container,
 		char *href, const char *target, char *title);
+static bool box_construct_body(struct content *content);
+static void box_construct_normalised(struct box_construct_state *state);
+static box_type box_type_for_style(const css_computed_style *style,
+		bool root);
 bool box_construct_element(xmlNode *n, struct content *content,
 		const css_computed_style *parent_style,
 		struct box *parent, struct box **inline_container,
@@ -198,6 +218,161 @@ bool xml_to_box(xmlNode *n, struct content *c)
 }
 
 
+/**
+ * Start constructing a box tree for a document which is still being parsed.
+ *
+ * \param  n        xml tree
+ * \param  body     body element of n
+ * \param  pending  first child of body which may not be complete, or 0
+ * \param  c        content of type CONTENT_HTML to construct box tree in
+ * \param  started  updated to false if the document's style doesn't allow
+ *                  its body to be constructed a part at a time, in which
+ *                  case nothing is constructed
+ * \return  true on success, false on memory exhaustion
+ *
+ * Boxes are constructed for the children of body before pending.  The rest
+ * are added by xml_to_box_continue() as they are parsed.
+ */
+
+bool xml_to_box_partial(xmlNode *n, xmlNode *body, xmlNode *pending,
+		struct content *c, bool *started)
+{
+	css_computed_style *html_style, *body_style;
+	struct box_construct_state *state;
+	bool block;
+
+	assert(c->type == CONTENT_HTML);
+	assert(body->parent == n);
+
+	/* more children can only be appended to a body which is a block */
+	html_style = box_get_style(c, NULL, n);
+	if (html_style == NULL)
+		return false;
+	body_style = box_get_style(c, html_style, body);
+	css_computed_style_destroy(html_style);
+	if (body_style == NULL)
+		return false;
+	block = box_type_for_style(body_style, false) == BOX_BLOCK;
+	css_computed_style_destroy(body_style);
+
+	*started = block;
+	if (!block)
+		return true;
+
+	state = talloc(c, struct box_construct_state);
+	if (state == NULL)
+		return false;
+
+	state->body = body;
+	state->last = NULL;
+	state->pending = pending;
+	state->box = NULL;
+	state->inline_container = NULL;
+	state->title = NULL;
+	state->normalised = NULL;
+	state->inline_normalised = NULL;
+
+	c->data.html.box_state = state;
+
+	if (!xml_to_box(n, c))
+		return false;
+
+	box_construct_normalised(state);
+
+	return true;
+}
+
+
+/**
+ * Continue constructing a box tree started by xml_to_box_partial().
+ *
+ * \param  pending  first child of body which may not be complete, or 0 if
+ *                  the document has been parsed completely
+ * \param  c        content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ *
+ * When pending is 0 the box tree is complete, and the construction state is
+ * discarded.
+ */
+
+bool xml_to_box_continue(xmlNode *pending, struct content *c)
+{
+	struct box_construct_state *state = c->data.html.box_state;
+
+	assert(state != NULL);
+
+	state->pending = pending;
+
+	if (state->box != NULL) {
+		if (!box_construct_body(c))
+			return false;
+
+		if (!box_normalise_block_from(state->box, state->normalised,
+				state->inline_normalised, c))
+			return false;
+
+		box_construct_normalised(state);
+	}
+
+	if (pending == NULL) {
+		talloc_free(state);
+		c->data.html.box_state = NULL;
+	}
+
+	return true;
+}
+
+
+/**
+ * Record how much of the body's box has been normalised.
+ *
+ * \param  state  construction state, with the body's box normalised
+ */
+
+void box_construct_normalised(struct box_construct_state *state)
+{
+	state->normalised = NULL;
+	state->inline_normalised = NULL;
+
+	if (state->box == NULL)
+		return;
+
+	state->normalised = state->box->last;
+	if (state->normalised != NULL &&
+			state->normalised->type == BOX_INLINE_CONTAINER)
+		state->inline_normalised = state->normalised->last;
+}
+
+
+/**
+ * Construct boxes for the children of body which have not been converted,
+ * up to the first which may not be complete.
+ *
+ * \param  content  content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool box_construct_body(struct content *content)
+{
+	struct box_construct_state *state = content->data.html.box_state;
+	xmlNode *c;
+
+	c = state->last != NULL ? state->last->next : state->body->children;
+
+	for (; c != NULL && c != state->pending; c = c->next) {
+		if (!convert_xml_to_box(c, content, state->box->style,
+				state->box, &state->inline_container,
+				state->box->href, state->box->target,
+				state->title))
+			return false;
+
+		state->last = c;
+	}
+
+	return true;
+}
+
+
 /* mapping from CSS display to box type
  * this table must be in sync with libcss' css_display enum */
 static const box_type box_map[] = {
@@ -292,7 +467,10 @@ bool box_construct_element(xmlNode *n, struct content *content,
 	assert(parent);
 	assert(inline_container);
 
-	gui_multitask();
+	/* the start of the document may be on display, and event handlers
+	 * must not see its box tree while it is being extended */
+	if (content->status == CONTENT_STATUS_LOADING)
+		gui_multitask();
 
 	/* In case the parent is a pre block, we clear the
 	 * strip_leading_newline flag since it is not used if we
@@ -330,24 +508,7 @@ bool box_construct_element(xmlNode *n, struct content *content,
 	if (!box)
 		return false;
 	/* set box type from computed display */
-	if ((css_computed_position(style) == CSS_POSITION_ABSOLUTE ||
-			css_computed_position(style) == CSS_POSITION_FIXED) &&
-			(css_computed_display_static(style) == 
-					CSS_DISPLAY_INLINE ||
-			 css_computed_display_static(style) == 
-					CSS_DISPLAY_INLINE_BLOCK ||
-			 css_computed_display_static(style) == 
-					CSS_DISPLAY_INLINE_TABLE)) {
-		/* Special case for absolute positioning: make absolute inlines
-		 * into inline block so that the boxes are constructed in an 
-		 * inline container as if they were not absolutely positioned. 
-		 * Layout expects and handles this. */
-		box->type = box_map[CSS_DISPLAY_INLINE_BLOCK];
-	} else {
-		/* Normal mapping */
-		box->type = box_map[css_computed_display(style, 
-				n->parent == NULL)];
-	}
+	box->type = box_type_for_style(style, n->parent == NULL);
 
 	/* special elements */
 	element = bsearch((const char *) n->name, element_table,
@@ -548,11 +709,27 @@ bool box_construct_element(xmlNode *n, struct content *content,
 
 		inline_container_c = 0;
 
-		for (c = n->children; convert_children && c; c = c->next)
-			if (!convert_xml_to_box(c, content, style, box,
-					&inline_container_c,
-					href, target, title))
+		if (content->data.html.box_state != NULL &&
+				content->data.html.box_state->body == n) {
+			/* the body is still being parsed: convert the
+			 * children which are complete, and keep the state
+			 * to continue with the rest */
+			struct box_construct_state *state =
+					content->data.html.box_state;
+
+			state->box = box;
+			state->title = title;
+
+			if (convert_children && !box_construct_body(content))
 				return false;
+		} else {
+			for (c = n->children; convert_children && c;
+					c = c->next)
+				if (!convert_xml_to_box(c, content, style, box,
+						&inline_container_c,
+						href, target, title))
+					return false;
+		}
 
 		if (css_computed_float(style) == CSS_FLOAT_NONE)
 			/* new inline container unless this is a float */
@@ -589,6 +766,36 @@ bool box_construct_element(xmlNode *n, struct content *content,
 }
 
 
+/**
+ * Find the type of box for an element from its computed style.
+ *
+ * \param  style  computed style of element
+ * \param  root   element is the root element
+ * \return  box type
+ */
+
+box_type box_type_for_style(const css_computed_style *style, bool root)
+{
+	if ((css_computed_position(style) == CSS_POSITION_ABSOLUTE ||
+			css_computed_position(style) == CSS_POSITION_FIXED) &&
+			(css_computed_display_static(style) == 
+					CSS_DISPLAY_INLINE ||
+			 css_computed_display_static(style) == 
+					CSS_DISPLAY_INLINE_BLOCK ||
+			 css_computed_display_static(style) == 
+					CSS_DISPLAY_INLINE_TABLE)) {
+		/* Special case for absolute positioning: make absolute inlines
+		 * into inline block so that the boxes are constructed in an 
+		 * inline container as if they were not absolutely positioned. 
+		 * Layout expects and handles this. */
+		return box_map[CSS_DISPLAY_INLINE_BLOCK];
+	}
+
+	/* Normal mapping */
+	return box_map[css_computed_display(style, root)];
+}
+
+
 /**
  * Construct the box tree for an XML text node.
  *
@@ -1894,7 +2101,9 @@ bool box_select(BOX_SPECIAL_PARAMS)
 	if (!gadget)
 		return false;
 
-	for (c = n->children; c; c = c->next) {
+	/* a box tree which is rebuilt keeps the options and their state */
+	for (c = gadget->data.select.num_items == 0 ? n->children : NULL;
+			c; c = c->next) {
 		if (strcmp((const char *) c->name, "option") == 0) {
 			if (!box_select_add_option(gadget, c))
 				goto no_memory;
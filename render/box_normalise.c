@@ -25,6 +25,7 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include "content/content_protected.h"
 #include "css/css.h"
 #include "css/select.h"
 #include "render/box.h"
@@ -74,6 +75,10 @@ static bool calculate_table_row(struct columns *col_info,
 		unsigned int col_span, unsigned int row_span,
 		unsigned int *start_column);
 static bool box_normalise_inline_container(struct box *cont, struct content *c);
+static bool box_normalise_block_children(struct box *block,
+		struct box *child, struct content *c);
+static bool box_normalise_inline_children(struct box *cont,
+		struct box *child, struct content *c);
 
 /**
  * Allocator
@@ -111,11 +116,6 @@ static void *myrealloc(void *ptr, size_t len, void *pw)
 
 bool box_normalise_block(struct box *block, struct content *c)
 {
-	struct box *child;
-	struct box *next_child;
-	struct box *table;
-	css_computed_style *style;
-
 	assert(block != NULL);
 
 	LOG(("block %p, block->type %u", block, block->type));
@@ -123,9 +123,66 @@ bool box_normalise_block(struct box *block, struct content *c)
 	assert(block->type == BOX_BLOCK || block->type == BOX_INLINE_BLOCK ||
 			block->type == BOX_TABLE_CELL);
 
-	gui_multitask();
+	/* as in box_construct_element(), not while the document is on
+	 * display */
+	if (c->status == CONTENT_STATUS_LOADING)
+		gui_multitask();
+
+	return box_normalise_block_children(block, block->children, c);
+}
+
+
+/**
+ * Normalise the boxes added to the end of a block since it was normalised.
+ *
+ * \param  block        box of type BLOCK
+ * \param  last         last child of block when it was normalised, or 0
+ * \param  inline_last  last child of last when it was normalised, if last
+ *                      is an inline container which may have had children
+ *                      added, or 0
+ * \param  c            content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ *
+ * Used while a document is constructed a part at a time.  Table parts added
+ * after a table which was implied for earlier ones get a table of their own.
+ */
+
+bool box_normalise_block_from(struct box *block, struct box *last,
+		struct box *inline_last, struct content *c)
+{
+	assert(block != NULL);
+	assert(block->type == BOX_BLOCK);
+
+	if (last == NULL)
+		return box_normalise_block_children(block, block->children, c);
+
+	if (last->type == BOX_INLINE_CONTAINER &&
+			!box_normalise_inline_children(last,
+			inline_last != NULL ? inline_last->next :
+			last->children, c))
+		return false;
+
+	return box_normalise_block_children(block, last->next, c);
+}
+
+
+/**
+ * Normalise children of a block from a given child to the last.
+ *
+ * \param  block  box of type BLOCK, INLINE_BLOCK, or TABLE_CELL
+ * \param  child  first child to normalise, or 0
+ * \param  c      content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool box_normalise_block_children(struct box *block, struct box *child,
+		struct content *c)
+{
+	struct box *next_child;
+	struct box *table;
+	css_computed_style *style;
 
-	for (child = block->children; child != NULL; child = next_child) {
+	for (; child != NULL; child = next_child) {
 		LOG(("child %p, child->type = %d", child, child->type));
 
 		next_child = child->next;	/* child may be destroyed */
@@ -849,14 +906,34 @@ bool calculate_table_row(struct columns *col_info,
 
 bool box_normalise_inline_container(struct box *cont, struct content * c)
 {
-	struct box *child;
-	struct box *next_child;
-
 	assert(cont != NULL);
 	assert(cont->type == BOX_INLINE_CONTAINER);
 	LOG(("cont %p", cont));
 
-	for (child = cont->children; child != NULL; child = next_child) {
+	if (!box_normalise_inline_children(cont, cont->children, c))
+		return false;
+
+	LOG(("cont %p done", cont));
+
+	return true;
+}
+
+
+/**
+ * Normalise children of an inline container from a given child to the last.
+ *
+ * \param  cont   box of type INLINE_CONTAINER
+ * \param  child  first child to normalise, or 0
+ * \param  c      content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool box_normalise_inline_children(struct box *cont, struct box *child,
+		struct content *c)
+{
+	struct box *next_child;
+
+	for (; child != NULL; child = next_child) {
 		next_child = child->next;
 		switch (child->type) {
 		case BOX_INLINE:
@@ -914,7 +991,5 @@ bool box_normalise_inline_container(struct box *cont, struct content * c)
 			assert(0);
 		}
 	}
-	LOG(("cont %p done", cont));
-
 	return true;
 }
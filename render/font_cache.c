@@ -0,0 +1,317 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Text measurement cache (implementation).
+ *
+ * Two tables are kept:
+ *
+ * - a small set of font styles, each with a table of advances for the ASCII
+ *   characters, filled in lazily as single characters are measured
+ * - a direct-mapped table of short text runs, keyed on font style and the
+ *   bytes of the run
+ *
+ * Runs are always measured as a whole by the front end, rather than by
+ * summing glyph advances, so that kerning and rounding done by the front end
+ * font code are preserved exactly.
+ *
+ * Foreground and background colours do not affect text metrics, so they are
+ * not part of the key.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "render/font.h"
+#include "render/font_cache.h"
+#include "utils/log.h"
+
+/** Number of font styles with glyph advance tables */
+#define FONT_CACHE_STYLES 16
+/** Number of text run entries (must be a power of 2) */
+#define FONT_CACHE_RUNS 2048
+/** Longest text run to cache, in bytes */
+#define FONT_CACHE_RUN_MAX 32
+
+/** Font style as far as text metrics are concerned */
+struct font_cache_key {
+	const struct font_functions *font_func;	/**< Font functions used */
+	plot_font_generic_family_t family;	/**< Generic family */
+	int size;				/**< Size */
+	int weight;				/**< Weight */
+	plot_font_flags_t flags;		/**< Flags */
+};
+
+/** Glyph advance table for a font style */
+struct font_cache_style {
+	struct font_cache_key key;	/**< Font style */
+	bool used;			/**< Entry is in use */
+	int advance[128];		/**< ASCII advances, or -1 if unknown */
+};
+
+/** Cached width of a text run */
+struct font_cache_run {
+	struct font_cache_key key;		/**< Font style */
+	unsigned int hash;			/**< Hash of style and text */
+	unsigned int length;			/**< Length of text, or 0 */
+	char text[FONT_CACHE_RUN_MAX];		/**< Text of run */
+	int width;				/**< Measured width */
+};
+
+static struct font_cache_style font_cache_styles[FONT_CACHE_STYLES];
+static unsigned int font_cache_style_victim;
+static struct font_cache_run font_cache_runs[FONT_CACHE_RUNS];
+static struct font_cache_stats font_cache_stats;
+
+static void font_cache_make_key(const struct font_functions *font_func,
+		const plot_font_style_t *fstyle, struct font_cache_key *key);
+static bool font_cache_key_match(const struct font_cache_key *a,
+		const struct font_cache_key *b);
+static struct font_cache_style *font_cache_find_style(
+		const struct font_cache_key *key);
+static unsigned int font_cache_hash(const struct font_cache_key *key,
+		const char *string, size_t length);
+
+
+/**
+ * Measure the width of a string, using cached metrics where available
+ *
+ * \param font_func  Font functions to measure with on a cache miss
+ * \param fstyle     Style of font
+ * \param string     UTF-8 string to measure
+ * \param length     Length of string, in bytes
+ * \param width      Updated to width of string[0..length)
+ * \return true on success, false on error
+ *
+ * Takes the same parameters as font_functions::font_width, prefixed by the
+ * font functions themselves, so callers can be converted mechanically.
+ */
+bool font_cache_width(const struct font_functions *font_func,
+		const plot_font_style_t *fstyle,
+		const char *string, size_t length, int *width)
+{
+	struct font_cache_key key;
+	struct font_cache_style *style;
+	struct font_cache_run *run;
+	unsigned int hash;
+	unsigned char c;
+
+	assert(font_func != NULL && fstyle != NULL && width != NULL);
+
+	if (length == 0) {
+		*width = 0;
+		return true;
+	}
+
+	font_cache_make_key(font_func, fstyle, &key);
+
+	/* Single ASCII characters: use the style's advance table */
+	c = (unsigned char) string[0];
+	if (length == 1 && c < 0x80) {
+		style = font_cache_find_style(&key);
+
+		if (style->advance[c] >= 0) {
+			font_cache_stats.glyph_hits++;
+			*width = style->advance[c];
+			return true;
+		}
+
+		font_cache_stats.glyph_misses++;
+		if (font_func->font_width(fstyle, string, 1, width) == false)
+			return false;
+
+		style->advance[c] = *width;
+		return true;
+	}
+
+	if (length > FONT_CACHE_RUN_MAX) {
+		font_cache_stats.uncached++;
+		return font_func->font_width(fstyle, string, length, width);
+	}
+
+	/* Short runs: direct-mapped table */
+	hash = font_cache_hash(&key, string, length);
+	run = &font_cache_runs[hash & (FONT_CACHE_RUNS - 1)];
+
+	if (run->length == length && run->hash == hash &&
+			font_cache_key_match(&run->key, &key) &&
+			memcmp(run->text, string, length) == 0) {
+		font_cache_stats.run_hits++;
+		*width = run->width;
+		return true;
+	}
+
+	font_cache_stats.run_misses++;
+	if (font_func->font_width(fstyle, string, length, width) == false)
+		return false;
+
+	run->key = key;
+	run->hash = hash;
+	run->length = length;
+	memcpy(run->text, string, length);
+	run->width = *width;
+
+	return true;
+}
+
+
+/**
+ * Discard all cached metrics
+ *
+ * Must be called whenever the mapping from font style to front end font
+ * changes, e.g. when the user selects different fonts.
+ */
+void font_cache_flush(void)
+{
+	unsigned int i;
+
+	LOG(("glyph %u/%u, run %u/%u, uncached %u",
+			font_cache_stats.glyph_hits,
+			font_cache_stats.glyph_hits +
+			font_cache_stats.glyph_misses,
+			font_cache_stats.run_hits,
+			font_cache_stats.run_hits +
+			font_cache_stats.run_misses,
+			font_cache_stats.uncached));
+
+	for (i = 0; i != FONT_CACHE_STYLES; i++)
+		font_cache_styles[i].used = false;
+
+	for (i = 0; i != FONT_CACHE_RUNS; i++)
+		font_cache_runs[i].length = 0;
+
+	font_cache_style_victim = 0;
+}
+
+
+/**
+ * Retrieve text measurement cache statistics
+ *
+ * \param stats  Updated to hold statistics since startup
+ */
+void font_cache_get_stats(struct font_cache_stats *stats)
+{
+	*stats = font_cache_stats;
+}
+
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+/**
+ * Build a cache key from a font style
+ *
+ * \param font_func  Font functions in use
+ * \param fstyle     Style of font
+ * \param key        Key to populate
+ */
+void font_cache_make_key(const struct font_functions *font_func,
+		const plot_font_style_t *fstyle, struct font_cache_key *key)
+{
+	/* Clear padding, so keys may be hashed bytewise */
+	memset(key, 0, sizeof *key);
+
+	key->font_func = font_func;
+	key->family = fstyle->family;
+	key->size = fstyle->size;
+	key->weight = fstyle->weight;
+	key->flags = fstyle->flags;
+}
+
+/**
+ * Compare two cache keys
+ *
+ * \param a  First key
+ * \param b  Second key
+ * \return true if the keys describe the same font
+ */
+bool font_cache_key_match(const struct font_cache_key *a,
+		const struct font_cache_key *b)
+{
+	return a->font_func == b->font_func && a->family == b->family &&
+			a->size == b->size && a->weight == b->weight &&
+			a->flags == b->flags;
+}
+
+/**
+ * Find the glyph advance table for a font style, creating it if necessary
+ *
+ * \param key  Font style to look for
+ * \return Pointer to style entry
+ *
+ * When all entries are in use, entries are reused in round-robin order.
+ */
+struct font_cache_style *font_cache_find_style(
+		const struct font_cache_key *key)
+{
+	struct font_cache_style *style;
+	unsigned int i;
+
+	for (i = 0; i != FONT_CACHE_STYLES; i++) {
+		style = &font_cache_styles[i];
+
+		if (style->used == false)
+			break;
+
+		if (font_cache_key_match(&style->key, key))
+			return style;
+	}
+
+	if (i == FONT_CACHE_STYLES) {
+		style = &font_cache_styles[font_cache_style_victim];
+		font_cache_style_victim = (font_cache_style_victim + 1) %
+				FONT_CACHE_STYLES;
+	}
+
+	style->key = *key;
+	style->used = true;
+	for (i = 0; i != sizeof style->advance / sizeof style->advance[0]; i++)
+		style->advance[i] = -1;
+
+	return style;
+}
+
+/**
+ * Hash a font style and text run.  The algorithm used is Fowler Noll Vo.
+ *
+ * \param key     Font style
+ * \param string  Text run
+ * \param length  Length of run, in bytes
+ * \return Hash value
+ */
+unsigned int font_cache_hash(const struct font_cache_key *key,
+		const char *string, size_t length)
+{
+	const unsigned char *k = (const unsigned char *) key;
+	unsigned int z = 0x811c9dc5;
+	size_t i;
+
+	for (i = 0; i != sizeof *key; i++) {
+		z *= 0x01000193;
+		z ^= k[i];
+	}
+
+	for (i = 0; i != length; i++) {
+		z *= 0x01000193;
+		z ^= (unsigned char) string[i];
+	}
+
+	return z;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Text measurement cache (interface).
+ *
+ * Sits between layout and the front end font_functions, so that widths of
+ * single characters (notably the inter-word space) and of short runs of text
+ * are only measured once per font style.
+ */
+
+#ifndef _NETSURF_RENDER_FONT_CACHE_H_
+#define _NETSURF_RENDER_FONT_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "desktop/plot_style.h"
+
+struct font_functions;
+
+/** Text measurement cache statistics */
+struct font_cache_stats {
+	unsigned int glyph_hits;	/**< Single character lookups hit */
+	unsigned int glyph_misses;	/**< Single character lookups missed */
+	unsigned int run_hits;		/**< Text run lookups hit */
+	unsigned int run_misses;	/**< Text run lookups missed */
+	unsigned int uncached;		/**< Runs too long to be cached */
+};
+
+bool font_cache_width(const struct font_functions *font_func,
+		const plot_font_style_t *fstyle,
+		const char *string, size_t length, int *width);
+void font_cache_flush(void);
+void font_cache_get_stats(struct font_cache_stats *stats);
+
+#endif
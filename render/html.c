@@ -32,6 +32,7 @@
 #include "content/content_protected.h"
 #include "content/fetch.h"
 #include "content/hlcache.h"
+#include "content/urldb.h"
 #include "desktop/browser.h"
 #include "desktop/gui.h"
 #include "desktop/options.h"
@@ -51,6 +52,16 @@
 #include "utils/utils.h"
 
 #define CHUNK 4096
+/** Most source to parse before returning to the front end */
+#define PARSE_SLICE (4 * CHUNK)
+
+/** Source size above which documents are laid out progressively */
+#define PROGRESSIVE_LAYOUT_SIZE (256 * 1024)
+
+/** Source size above which the body is displayed as it is parsed */
+#define INCREMENTAL_SIZE (64 * 1024)
+/** Time after which the body is displayed as it is parsed / cs */
+#define INCREMENTAL_DELAY 100
 
 /* Change these to 1 to cause a dump to stderr of the frameset or box
  * when the trees have been built.
@@ -58,12 +69,22 @@
 #define ALWAYS_DUMP_FRAMESET 0
 #define ALWAYS_DUMP_BOX 0
 
+static void html_parse_callback(void *p);
+static bool html_parse_source(struct content *c, bool all);
+static bool html_change_encoding(struct content *c);
+static bool html_sniff_encoding(struct content *c);
+static bool html_parse_progress(struct content *c);
+static void html_box_progress(void *p);
 static void html_finish_conversion(struct content *c);
+static void html_finish_conversion_callback(void *p);
+static void html_discard_box_tree(struct content *c);
+static bool html_select_stylesheets(struct content *c);
 static nserror html_convert_css_callback(hlcache_handle *css,
 		const hlcache_event *event, void *pw);
+static xmlNode *html_find_head(xmlNode *html);
 static bool html_meta_refresh(struct content *c, xmlNode *head);
 static bool html_head(struct content *c, xmlNode *head);
-static bool html_find_stylesheets(struct content *c, xmlNode *html);
+static bool html_find_stylesheets(struct content *c, xmlNode *root);
 static bool html_process_style_element(struct content *c, unsigned int *index,
 		xmlNode *style);
 static void html_inline_style_done(struct content_css_data *css, void *pw);
@@ -78,6 +99,8 @@ static void html_object_failed(struct box *box, struct content *content,
 static bool html_object_type_permitted(const content_type type,
 		const content_type *permitted_types);
 static void html_object_refresh(void *p);
+static void html_layout_continue(void *p);
+static void html_release_held(struct content *c);
 static void html_destroy_frameset(struct content_html_frames *frameset);
 static void html_destroy_iframe(struct content_html_iframe *iframe);
 #if ALWAYS_DUMP_FRAMESET
@@ -130,12 +153,28 @@ bool html_create(struct content *c, const http_parameter *params)
 	html->document = NULL;
 	html->quirks = BINDING_QUIRKS_MODE_NONE;
 	html->encoding = NULL;
+	html->encoding_source = ENCODING_SOURCE_DETECTED;
+	html->sniffed = false;
+	html->parsed = 0;
 	html->base_url = (char *) content__get_url(c);
 	html->base_target = NULL;
 	html->layout = NULL;
+	html->box_state = NULL;
+	html->box_state_stopped = false;
+	html->box_state_failed = false;
+	html->layout_budget = 0;
+	html->layout_held = NULL;
+	html->layout_held_count = 0;
+	html->layout_height = 0;
+	html->display_list = NULL;
+	html->display_list_bw = NULL;
+	html->display_list_background = 0;
+	html->display_list_redraws = 0;
 	html->background_colour = NS_TRANSPARENT;
 	html->stylesheet_count = 0;
 	html->stylesheets = NULL;
+	html->stylesheet_active = 0;
+	html->stylesheet_selected = 0;
 	html->select_ctx = NULL;
 	html->object_count = 0;
 	html->object = NULL;
@@ -157,17 +196,33 @@ bool html_create(struct content *c, const http_parameter *params)
 			goto error;
 		}
 		html->encoding_source = ENCODING_SOURCE_HEADER;
+	} else {
+		/* use the encoding the document was found to be in last
+		 * time, until the document says otherwise */
+		const struct url_data *data;
+
+		data = urldb_get_url_data(content__get_url(c));
+		if (data != NULL && data->charset != NULL) {
+			html->encoding = talloc_strdup(c, data->charset);
+			if (!html->encoding) {
+				error = BINDING_NOMEM;
+				goto error;
+			}
+			html->encoding_source = ENCODING_SOURCE_DETECTED;
+		}
 	}
 
 	/* Create the parser binding */
-	error = binding_create_tree(c, html->encoding, &html->parser_binding);
+	error = binding_create_tree(c, html->encoding,
+			html->encoding_source != ENCODING_SOURCE_HEADER,
+			&html->parser_binding);
 	if (error == BINDING_BADENCODING && html->encoding != NULL) {
 		/* Ok, we don't support the declared encoding. Bailing out 
 		 * isn't exactly user-friendly, so fall back to autodetect */
 		talloc_free(html->encoding);
 		html->encoding = NULL;
 
-		error = binding_create_tree(c, html->encoding, 
+		error = binding_create_tree(c, html->encoding, false,
 				&html->parser_binding);
 	}
 
@@ -191,48 +246,135 @@ error:
 /**
  * Process data for CONTENT_HTML.
  *
- * The data is parsed in chunks of size CHUNK, multitasking in between.
+ * The data is parsed later, a slice at a time, by html_parse_callback(), so
+ * that the front end stays responsive while large documents arrive.
  */
 
 bool html_process_data(struct content *c, const char *data, unsigned int size)
 {
-	unsigned long x;
+	if (!c->data.html.sniffed) {
+		unsigned long source_size;
+
+		/* wait for enough of the document to find its encoding */
+		content__get_source_data(c, &source_size);
+		if (source_size < BINDING_SNIFF_SIZE)
+			return true;
+
+		if (!html_sniff_encoding(c))
+			return false;
+	}
+
+	schedule(0, html_parse_callback, c);
+
+	return true;
+}
+
+
+/**
+ * schedule() callback to parse more of a document.
+ *
+ * \param  p  content of type CONTENT_HTML
+ *
+ * Parses at most PARSE_SLICE bytes of the source which has arrived before
+ * returning to the front end, and reschedules itself while more remains.
+ */
+
+void html_parse_callback(void *p)
+{
+	struct content *c = (struct content *) p;
+	unsigned long size;
+
+	assert(c->type == CONTENT_HTML);
+
+	if (c->status != CONTENT_STATUS_LOADING &&
+			c->status != CONTENT_STATUS_READY)
+		return;
+
+	if (!html_parse_source(c, false)) {
+		/* as when process_data fails; the error has been reported */
+		if (c->llcache != NULL) {
+			llcache_handle_abort(c->llcache);
+			llcache_handle_release(c->llcache);
+			c->llcache = NULL;
+		}
+		c->status = CONTENT_STATUS_ERROR;
+		return;
+	}
+
+	content__get_source_data(c, &size);
+	if (c->data.html.parsed < size)
+		schedule(0, html_parse_callback, c);
+}
+
+
+/**
+ * Pass source which has arrived to the parser.
+ *
+ * \param  c    content of type CONTENT_HTML
+ * \param  all  parse all the source, rather than a slice of PARSE_SLICE
+ * \return  true on success, false on error, which has been reported
+ *
+ * If the parser finds that the document is in another encoding, it is
+ * replaced and the source is parsed again from the start.
+ */
+
+bool html_parse_source(struct content *c, bool all)
+{
+	const char *source_data;
+	unsigned long source_size, end, length;
 	binding_error err;
-	const char *encoding;
+	union content_msg_data msg_data;
+
+	source_data = content__get_source_data(c, &source_size);
+
+	end = source_size;
+	if (!all && c->data.html.parsed + PARSE_SLICE < end)
+		end = c->data.html.parsed + PARSE_SLICE;
+
+	while (c->data.html.parsed < end) {
+		length = end - c->data.html.parsed;
+		if (CHUNK < length)
+			length = CHUNK;
 
-	for (x = 0; x + CHUNK <= size; x += CHUNK) {
 		err = binding_parse_chunk(c->data.html.parser_binding,
-				(const uint8_t *) data + x, CHUNK);
+				(const uint8_t *) source_data +
+				c->data.html.parsed, length);
 		if (err == BINDING_ENCODINGCHANGE) {
-			goto encoding_change;
-		} else if (err != BINDING_OK) {
-			union content_msg_data msg_data;
+			if (!html_change_encoding(c))
+				return false;
 
+			/* the encoding is now specified at parser-start,
+			 * so this can't happen again */
+			c->data.html.parsed = 0;
+			continue;
+		} else if (err != BINDING_OK) {
 			msg_data.error = messages_get("NoMemory");
 			content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
-
 			return false;
 		}
 
-		gui_multitask();
-	}
+		c->data.html.parsed += length;
 
-	err = binding_parse_chunk(c->data.html.parser_binding,
-			(const uint8_t *) data + x, (size - x));
-	if (err == BINDING_ENCODINGCHANGE) {
-		goto encoding_change;
-	} else if (err != BINDING_OK) {
-		union content_msg_data msg_data;
+		if (all)
+			gui_multitask();
+	}
 
-		msg_data.error = messages_get("NoMemory");
-		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+	return html_parse_progress(c);
+}
 
-		return false;
-	}
 
-	return true;
+/**
+ * Replace the parser when it finds that a document is in another encoding.
+ *
+ * \param  c  content of type CONTENT_HTML
+ * \return  true on success, false on error, which has been reported
+ */
 
-encoding_change:
+bool html_change_encoding(struct content *c)
+{
+	binding_error err;
+	const char *encoding;
+	union content_msg_data msg_data;
 
 	/* Retrieve new encoding */
 	encoding = binding_get_encoding(
@@ -244,8 +386,6 @@ encoding_change:
 
 	c->data.html.encoding = talloc_strdup(c, encoding);
 	if (c->data.html.encoding == NULL) {
-		union content_msg_data msg_data;
-
 		msg_data.error = messages_get("NoMemory");
 		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 		return false;
@@ -255,7 +395,7 @@ encoding_change:
 	binding_destroy_tree(c->data.html.parser_binding);
 
 	/* Create new binding, using the new encoding */
-	err = binding_create_tree(c, c->data.html.encoding,
+	err = binding_create_tree(c, c->data.html.encoding, false,
 			&c->data.html.parser_binding);
 	if (err == BINDING_BADENCODING) {
 		/* Ok, we don't support the declared encoding. Bailing out 
@@ -263,19 +403,18 @@ encoding_change:
 		talloc_free(c->data.html.encoding);
 		c->data.html.encoding = talloc_strdup(c, "Windows-1252");
 		if (c->data.html.encoding == NULL) {
-			union content_msg_data msg_data;
-
 			msg_data.error = messages_get("NoMemory");
 			content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 			return false;
 		}
 
-		err = binding_create_tree(c, c->data.html.encoding,
+		err = binding_create_tree(c, c->data.html.encoding, false,
 				&c->data.html.parser_binding);
 	}
 
 	if (err != BINDING_OK) {
-		union content_msg_data msg_data;
+		/* leave nothing for html_destroy() to free twice */
+		c->data.html.parser_binding = NULL;
 
 		if (err == BINDING_BADENCODING) {
 			LOG(("Bad encoding: %s", c->data.html.encoding 
@@ -287,17 +426,241 @@ encoding_change:
 		return false;
 	}
 
-	{
-		const char *source_data;
-		unsigned long source_size;
+	return true;
+}
+
+
+/**
+ * Find the encoding of a document from its start, before it is parsed.
+ *
+ * \param  c  content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ *
+ * An encoding given in the HTTP headers is used regardless.  Otherwise a
+ * meta element or byte order mark found here replaces that remembered for
+ * the URL, if any, so that the parser rarely has to start again.
+ */
+
+bool html_sniff_encoding(struct content *c)
+{
+	void *binding;
+	const char *source_data, *encoding;
+	unsigned long source_size;
+	char *copy;
+	bool certain;
+	binding_error err;
+	union content_msg_data msg_data;
+
+	c->data.html.sniffed = true;
+
+	if (c->data.html.encoding_source == ENCODING_SOURCE_HEADER &&
+			c->data.html.encoding != NULL)
+		return true;
+
+	source_data = content__get_source_data(c, &source_size);
+	encoding = binding_sniff_encoding((const uint8_t *) source_data,
+			source_size, &certain);
+	if (encoding == NULL)
+		return true;
+
+	copy = talloc_strdup(c, encoding);
+	if (copy == NULL) {
+		msg_data.error = messages_get("NoMemory");
+		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+		return false;
+	}
+
+	err = binding_create_tree(c, copy, !certain, &binding);
+	if (err == BINDING_BADENCODING) {
+		/* leave it to the parser */
+		talloc_free(copy);
+		return true;
+	} else if (err != BINDING_OK) {
+		talloc_free(copy);
+		msg_data.error = messages_get("NoMemory");
+		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+		return false;
+	}
+
+	binding_destroy_tree(c->data.html.parser_binding);
+	c->data.html.parser_binding = binding;
+
+	if (c->data.html.encoding != NULL)
+		talloc_free(c->data.html.encoding);
+	c->data.html.encoding = copy;
+	c->data.html.encoding_source = certain ? ENCODING_SOURCE_DETECTED :
+			ENCODING_SOURCE_META;
+
+	return true;
+}
+
+
+/**
+ * Make use of as much of a document as has been parsed.
+ *
+ * \param  c  content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ *
+ * The head is complete once the body has been started, so its stylesheets
+ * are fetched without waiting for the rest of the document.  When they have
+ * arrived, the complete part of the body is converted for display by
+ * html_box_progress().
+ */
+
+bool html_parse_progress(struct content *c)
+{
+	xmlNode *body, *pending, *head;
+	bool changed;
+	union content_msg_data msg_data;
+	int delay = 0;
+
+	body = binding_get_body(c->data.html.parser_binding,
+			&pending, &changed);
+	if (body == NULL)
+		return true;
+
+	if (c->data.html.stylesheets == NULL) {
+		/* the head is in use from now on, so the document can't be
+		 * reparsed in another encoding */
+		binding_fix_encoding(c->data.html.parser_binding);
+
+		if (c->data.html.encoding == NULL) {
+			const char *encoding = binding_get_encoding(
+					c->data.html.parser_binding,
+					&c->data.html.encoding_source);
+
+			c->data.html.encoding = talloc_strdup(c, encoding);
+			if (c->data.html.encoding == NULL) {
+				msg_data.error = messages_get("NoMemory");
+				content_broadcast(c, CONTENT_MSG_ERROR,
+						msg_data);
+				return false;
+			}
+		}
+
+		c->data.html.quirks = binding_get_quirks(
+				c->data.html.parser_binding);
+
+		head = html_find_head(body->parent);
+		if (head != NULL) {
+			if (!html_head(c, head)) {
+				msg_data.error = messages_get("NoMemory");
+				content_broadcast(c, CONTENT_MSG_ERROR,
+						msg_data);
+				return false;
+			}
+
+			/* handle meta refresh */
+			if (!html_meta_refresh(c, head))
+				return false;
+		}
+
+		/* fetch the head's stylesheets; those in the body are found
+		 * by html_convert() */
+		if (!html_find_stylesheets(c, head))
+			return false;
+	}
+
+	if (c->data.html.select_ctx == NULL ||
+			c->data.html.box_state_stopped)
+		return true;
+
+	/* once displayed, update no more often than it can be laid out */
+	if (c->data.html.box_state != NULL)
+		delay = (int) (c->reformat_time - wallclock());
+
+	schedule(delay < 0 ? 0 : delay, html_box_progress, c);
+
+	return true;
+}
+
+
+/**
+ * schedule() callback to convert the parsed part of the body for display.
+ *
+ * \param  p  content of type CONTENT_HTML
+ *
+ * The body is displayed once enough of the document has arrived, or it has
+ * been loading for long enough, and is then extended each time more of it
+ * has been parsed.  Documents for which a complete part of the body changes
+ * are converted when they have been parsed completely.
+ */
+
+void html_box_progress(void *p)
+{
+	struct content *c = (struct content *) p;
+	xmlNode *body, *pending;
+	unsigned long size;
+	unsigned int elapsed;
+	bool changed, started, ok;
+
+	assert(c->type == CONTENT_HTML);
+
+	/* html_convert() completes the box tree */
+	if ((c->status != CONTENT_STATUS_LOADING &&
+			c->status != CONTENT_STATUS_READY) ||
+			c->locked || c->data.html.document != NULL ||
+			c->data.html.box_state_stopped)
+		return;
 
-		source_data = content__get_source_data(c, &source_size);
+	body = binding_get_body(c->data.html.parser_binding,
+			&pending, &changed);
+	if (changed) {
+		LOG(("document changed after it was parsed"));
+		c->data.html.box_state_stopped = true;
+		return;
+	}
+
+	/* a pending of 0 may only be the end of the body so far */
+	if (pending == NULL)
+		return;
+
+	if (c->data.html.box_state == NULL) {
+		/* display small documents which arrive quickly all at once */
+		content__get_source_data(c, &size);
+		elapsed = wallclock() - c->time;
+		if (size < INCREMENTAL_SIZE && elapsed < INCREMENTAL_DELAY) {
+			schedule(INCREMENTAL_DELAY - elapsed,
+					html_box_progress, c);
+			return;
+		}
+
+		if (pending == body->children)
+			return;
+
+		LOG(("XML to box (partial)"));
+		c->locked = true;
+		ok = xml_to_box_partial(body->parent, body, pending, c,
+				&started);
+		c->locked = false;
+		if (!ok) {
+			LOG(("out of memory"));
+			c->data.html.box_state_stopped = true;
+			c->data.html.box_state_failed = true;
+			return;
+		}
 
-		/* Recurse to reprocess all that data.  This is safe because
-		 * the encoding is now specified at parser-start which means
-		 * it cannot be changed again. */
-		return html_process_data(c, source_data, source_size);
+		if (!started) {
+			LOG(("body can't be displayed as it is parsed"));
+			c->data.html.box_state_stopped = true;
+			return;
+		}
+
+		content_set_ready(c);
+		return;
 	}
+
+	c->locked = true;
+	ok = xml_to_box_continue(pending, c);
+	c->locked = false;
+	if (!ok) {
+		LOG(("out of memory"));
+		c->data.html.box_state_stopped = true;
+		c->data.html.box_state_failed = true;
+		return;
+	}
+
+	content__reformat(c, c->available_width, c->height);
 }
 
 /**
@@ -318,12 +681,15 @@ encoding_change:
 bool html_convert(struct content *c)
 {
 	binding_error err;
-	xmlNode *html, *head;
+	xmlNode *html, *head, *body, *pending;
 	union content_msg_data msg_data;
+	bool changed;
 	unsigned long size;
 	struct form *f;
 
 	/* finish parsing */
+	schedule_remove(html_parse_callback, c);
+
 	content__get_source_data(c, &size);
 	if (size == 0) {
 		/* Destroy current binding */
@@ -336,7 +702,7 @@ bool html_convert(struct content *c)
 		c->data.html.encoding = NULL;
 
 		/* Create new binding, using default charset */
-		err = binding_create_tree(c, NULL, 
+		err = binding_create_tree(c, NULL, false,
 				&c->data.html.parser_binding);
 		if (err != BINDING_OK) {
 			union content_msg_data msg_data;
@@ -352,11 +718,24 @@ bool html_convert(struct content *c)
 		}
 
 		/* Process the error page */
-		if (html_process_data(c, (char *) empty_document, 
-				SLEN(empty_document)) == false)
+		c->data.html.sniffed = true;
+		err = binding_parse_chunk(c->data.html.parser_binding,
+				(const uint8_t *) empty_document,
+				SLEN(empty_document));
+		if (err != BINDING_OK) {
+			msg_data.error = messages_get("NoMemory");
+			content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+			return false;
+		}
+	} else if (!c->data.html.sniffed) {
+		/* the document was too short to be parsed as it arrived */
+		if (!html_sniff_encoding(c))
 			return false;
 	}
 
+	if (!html_parse_source(c, true))
+		return false;
+
 	err = binding_parse_completed(c->data.html.parser_binding);
 	if (err != BINDING_OK) {
 		union content_msg_data msg_data;
@@ -400,14 +779,12 @@ bool html_convert(struct content *c)
 		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 		return false;
 	}
-	for (head = html->children;
-			head != 0 && head->type != XML_ELEMENT_NODE;
-			head = head->next)
-		;
-	if (head && strcmp((const char *) head->name, "head") != 0) {
-		head = 0;
-		LOG(("head element not found"));
-	}
+
+	/* the head has been processed already if the body was started
+	 * before the document was complete */
+	head = 0;
+	if (c->data.html.stylesheets == NULL)
+		head = html_find_head(html);
 
 	if (head) {
 		if (!html_head(c, head)) {
@@ -451,8 +828,19 @@ bool html_convert(struct content *c)
 	}
 
 	/* get stylesheets */
-	if (!html_find_stylesheets(c, html))
-		return false;
+	if (c->data.html.stylesheets == NULL) {
+		if (!html_find_stylesheets(c, html))
+			return false;
+	} else {
+		body = binding_get_body(c->data.html.parser_binding,
+				&pending, &changed);
+		if (!html_find_stylesheets(c, body))
+			return false;
+
+		/* the head's stylesheets may all have arrived already */
+		if (c->data.html.stylesheet_active == 0)
+			html_finish_conversion(c);
+	}
 
 	return true;
 }
@@ -461,13 +849,43 @@ bool html_convert(struct content *c)
  * Complete conversion of an HTML document
  * 
  * \param c  Content to convert
+ *
+ * Called when all the stylesheets found so far have arrived.  Before the
+ * document has been parsed completely these are those of the head, and the
+ * body is then converted by html_box_progress() as it is parsed.
  */
 void html_finish_conversion(struct content *c)
 {
 	union content_msg_data msg_data;
-	xmlNode *html;
-	uint32_t i;
-	css_error error;
+	xmlNode *html, *pending;
+	bool changed;
+	unsigned long size;
+	bool ok;
+
+	/* can't be completed inside html_convert(), as the content is in
+	 * use until that returns */
+	if (c->locked) {
+		schedule(0, html_finish_conversion_callback, c);
+		return;
+	}
+
+	if (c->data.html.document == NULL) {
+		/* a missing base stylesheet is reported once the document
+		 * has been parsed */
+		if (c->data.html.stylesheets[STYLESHEET_BASE].
+				data.external == NULL)
+			return;
+
+		if (!html_select_stylesheets(c)) {
+			LOG(("out of memory"));
+			c->data.html.box_state_stopped = true;
+			c->data.html.box_state_failed = true;
+			return;
+		}
+
+		schedule(0, html_box_progress, c);
+		return;
+	}
 
 	html = xmlDocGetRootElement(c->data.html.document);
 	assert(html != NULL);
@@ -480,59 +898,38 @@ void html_finish_conversion(struct content *c)
 		return;
 	}
 
-	/* Create selection context */
-	error = css_select_ctx_create(myrealloc, c, &c->data.html.select_ctx);
-	if (error != CSS_OK) {
+	if (c->data.html.box_state_failed ||
+			!html_select_stylesheets(c)) {
 		msg_data.error = messages_get("NoMemory");
 		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
-		c->status = CONTENT_MSG_ERROR;
+		c->status = CONTENT_STATUS_ERROR;
 		return;
 	}
 
-	/* Add sheets to it */
-	for (i = STYLESHEET_BASE; i != c->data.html.stylesheet_count; i++) {
-		const struct html_stylesheet *hsheet = 
-				&c->data.html.stylesheets[i];
-		css_stylesheet *sheet;
-		css_origin origin = CSS_ORIGIN_AUTHOR;
-
-		if (i < STYLESHEET_START)
-			origin = CSS_ORIGIN_UA;
-
-		if (hsheet->type == HTML_STYLESHEET_EXTERNAL &&
-				hsheet->data.external != NULL) {
-			struct content *s = hlcache_handle_get_content(
-					hsheet->data.external);
-
-			sheet = s-> data.css.sheet;
-		} else if (hsheet->type == HTML_STYLESHEET_INTERNAL) {
-			sheet = hsheet->data.internal->sheet;
-		} else {
-			sheet = NULL;
-		}
+	/* get icon */
+	favicon_get_icon(c, html);	
 
-		if (sheet != NULL) {
-			error = css_select_ctx_append_sheet(
-					c->data.html.select_ctx, sheet,
-					origin, CSS_MEDIA_SCREEN);
-			if (error != CSS_OK) {
-				msg_data.error = messages_get("NoMemory");
-				content_broadcast(c, CONTENT_MSG_ERROR, 
-						msg_data);
-				c->status = CONTENT_STATUS_ERROR;
-				return;
-			}
+	/* a part of the body which was converted while it was parsed may
+	 * have changed since, in which case the box tree is built again */
+	if (c->data.html.box_state != NULL) {
+		binding_get_body(c->data.html.parser_binding,
+				&pending, &changed);
+		if (changed) {
+			LOG(("rebuilding box tree"));
+			html_discard_box_tree(c);
 		}
 	}
 
-	/* get icon */
-	favicon_get_icon(c, html);	
-
-	/* convert xml tree to box tree */
+	/* convert xml tree to box tree, or the rest of the body if part of
+	 * it was converted while it was parsed */
 	LOG(("XML to box"));
 	content_set_status(c, messages_get("Processing"));
 	content_broadcast(c, CONTENT_MSG_STATUS, msg_data);
-	if (!xml_to_box(html, c)) {
+	if (c->data.html.box_state != NULL)
+		ok = xml_to_box_continue(NULL, c);
+	else
+		ok = xml_to_box(html, c);
+	if (!ok) {
 		msg_data.error = messages_get("NoMemory");
 		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 		c->status = CONTENT_STATUS_ERROR;
@@ -556,11 +953,27 @@ void html_finish_conversion(struct content *c)
 	}
 	/*imagemap_dump(c);*/
 
+	/* lay out large documents progressively, so that the start of the
+	 * document can be displayed before the whole of it has been laid
+	 * out */
+	content__get_source_data(c, &size);
+	if (PROGRESSIVE_LAYOUT_SIZE <= size)
+		c->data.html.layout_budget = LAYOUT_BUDGET_INITIAL;
+
 	/* Destroy the parser binding */
 	binding_destroy_tree(c->data.html.parser_binding);
 	c->data.html.parser_binding = NULL;
 
-	content_set_ready(c);
+	/* the start of the body may be on display already */
+	if (c->status == CONTENT_STATUS_READY)
+		content__reformat(c, c->available_width, c->height);
+	else
+		content_set_ready(c);
+
+	/* remember an encoding which had to be found, for next time */
+	if (c->data.html.encoding_source != ENCODING_SOURCE_HEADER)
+		urldb_set_url_charset(content__get_url(c),
+				c->data.html.encoding);
 
 	if (c->active == 0)
 		content_set_done(c);
@@ -569,6 +982,168 @@ void html_finish_conversion(struct content *c)
 }
 
 
+/**
+ * schedule() callback to complete conversion of an HTML document
+ *
+ * \param p  content to convert
+ */
+
+void html_finish_conversion_callback(void *p)
+{
+	struct content *c = (struct content *) p;
+
+	assert(c->type == CONTENT_HTML);
+
+	if (c->status != CONTENT_STATUS_LOADING &&
+			c->status != CONTENT_STATUS_READY)
+		return;
+
+	html_finish_conversion(c);
+}
+
+
+/**
+ * Discard a box tree which was constructed while the body was parsed.
+ *
+ * \param  c  content of type CONTENT_HTML
+ *
+ * The objects and iframes found in the box tree are released, so that they
+ * are found again when the tree is rebuilt.  The boxes themselves are freed
+ * with the content, as the browser window may still refer to them until it
+ * is told of the new tree by CONTENT_MSG_REFORMAT.
+ */
+
+void html_discard_box_tree(struct content *c)
+{
+	struct content_html_data *html = &c->data.html;
+	hlcache_handle *object;
+	unsigned int i;
+
+	schedule_remove(html_layout_continue, c);
+	html_redraw_discard_display_list(c);
+
+	for (i = 0; i != html->object_count; i++) {
+		object = html->object[i].content;
+		if (object == NULL)
+			continue;
+
+		if (content_get_type(object) == CONTENT_HTML)
+			schedule_remove(html_object_refresh, object);
+
+		if (html->bw != NULL &&
+				content_get_type(object) != CONTENT_UNKNOWN)
+			content_close(object);
+
+		/* objects which failed or completed aren't active */
+		if (content_get_status(object) != CONTENT_STATUS_DONE)
+			c->active--;
+
+		hlcache_handle_release(object);
+	}
+	talloc_free(html->object);
+	html->object = NULL;
+	html->object_count = 0;
+
+	if (html->iframe != NULL) {
+		html_destroy_iframe(html->iframe);
+		html->iframe = NULL;
+	}
+
+	talloc_free(html->layout_held);
+	html->layout_held = NULL;
+	html->layout_held_count = 0;
+
+	talloc_free(html->box_state);
+	html->box_state = NULL;
+	html->layout = NULL;
+}
+
+
+/**
+ * Add stylesheets which have arrived to the selection context.
+ *
+ * \param c  content of type CONTENT_HTML
+ * \return  true on success, false on memory exhaustion
+ *
+ * The selection context is created on the first call.  Each later call adds
+ * the stylesheets found since the previous one.
+ */
+
+bool html_select_stylesheets(struct content *c)
+{
+	uint32_t i;
+	css_error error;
+
+	/* Create selection context */
+	if (c->data.html.select_ctx == NULL) {
+		error = css_select_ctx_create(myrealloc, c,
+				&c->data.html.select_ctx);
+		if (error != CSS_OK)
+			return false;
+	}
+
+	/* Add sheets to it */
+	for (i = c->data.html.stylesheet_selected;
+			i != c->data.html.stylesheet_count; i++) {
+		const struct html_stylesheet *hsheet = 
+				&c->data.html.stylesheets[i];
+		css_stylesheet *sheet;
+		css_origin origin = CSS_ORIGIN_AUTHOR;
+
+		if (i < STYLESHEET_START)
+			origin = CSS_ORIGIN_UA;
+
+		if (hsheet->type == HTML_STYLESHEET_EXTERNAL &&
+				hsheet->data.external != NULL) {
+			struct content *s = hlcache_handle_get_content(
+					hsheet->data.external);
+
+			sheet = s-> data.css.sheet;
+		} else if (hsheet->type == HTML_STYLESHEET_INTERNAL) {
+			sheet = hsheet->data.internal->sheet;
+		} else {
+			sheet = NULL;
+		}
+
+		if (sheet != NULL) {
+			error = css_select_ctx_append_sheet(
+					c->data.html.select_ctx, sheet,
+					origin, CSS_MEDIA_SCREEN);
+			if (error != CSS_OK)
+				return false;
+		}
+	}
+
+	c->data.html.stylesheet_selected = c->data.html.stylesheet_count;
+
+	return true;
+}
+
+
+/**
+ * Find the head element of a document.
+ *
+ * \param  html  xml node of html element
+ * \return  xml node of head element, or 0 if there is none
+ */
+
+xmlNode *html_find_head(xmlNode *html)
+{
+	xmlNode *head;
+
+	for (head = html->children;
+			head != 0 && head->type != XML_ELEMENT_NODE;
+			head = head->next)
+		;
+	if (head && strcmp((const char *) head->name, "head") != 0) {
+		head = 0;
+		LOG(("head element not found"));
+	}
+
+	return head;
+}
+
+
 /**
  * Process elements in <head>.
  *
@@ -848,19 +1423,21 @@ bool html_meta_refresh(struct content *c, xmlNode *head)
 /**
  * Process inline stylesheets and fetch linked stylesheets.
  *
- * Uses STYLE and LINK elements inside and outside HEAD
+ * Uses STYLE and LINK elements within root.  The base, quirks and adblock
+ * stylesheets are fetched by the first call, and each later call adds the
+ * stylesheets of another part of the document.
  *
  * \param  c     content structure
- * \param  html  xml node of html element
+ * \param  root  xml node of element to search, or 0 for none
  * \return  true on success, false if an error occurred
  */
 
-bool html_find_stylesheets(struct content *c, xmlNode *html)
+bool html_find_stylesheets(struct content *c, xmlNode *root)
 {
 	static const content_type accept[] = { CONTENT_CSS, CONTENT_UNKNOWN };
 	xmlNode *node;
 	char *rel, *type, *media, *href, *url, *url2;
-	unsigned int i = STYLESHEET_START;
+	unsigned int i;
 	union content_msg_data msg_data;
 	url_func_result res;
 	struct html_stylesheet *stylesheets;
@@ -870,6 +1447,9 @@ bool html_find_stylesheets(struct content *c, xmlNode *html)
 	child.charset = c->data.html.encoding;
 	child.quirks = c->quirks;
 
+	if (c->data.html.stylesheets != NULL)
+		goto find;
+
 	/* stylesheet 0 is the base style sheet,
 	 * stylesheet 1 is the quirks mode style sheet,
 	 * stylesheet 2 is the adblocking stylesheet */
@@ -899,6 +1479,7 @@ bool html_find_stylesheets(struct content *c, xmlNode *html)
 		goto no_memory;
 
 	c->active++;
+	c->data.html.stylesheet_active++;
 
 	if (c->data.html.quirks == BINDING_QUIRKS_MODE_FULL) {
 		ns_error = hlcache_handle_retrieve(quirks_stylesheet_url, 0,
@@ -910,6 +1491,7 @@ bool html_find_stylesheets(struct content *c, xmlNode *html)
 			goto no_memory;
 
 		c->active++;
+		c->data.html.stylesheet_active++;
 	}
 
 	if (option_block_ads) {
@@ -922,20 +1504,21 @@ bool html_find_stylesheets(struct content *c, xmlNode *html)
 			goto no_memory;
 
 		c->active++;
+		c->data.html.stylesheet_active++;
 	}
 
-	node = html;
+find:
+	i = c->data.html.stylesheet_count;
+	node = root;
 
 	/* depth-first search the tree for link elements */
 	while (node) {
 		if (node->children) {  /* 1. children */
 			node = node->children;
-		} else if (node->next) {  /* 2. siblings */
-			node = node->next;
-		} else {  /* 3. ancestor siblings */
-			while (node && !node->next)
+		} else {  /* 2. siblings, 3. ancestor siblings, within root */
+			while (node != root && !node->next)
 				node = node->parent;
-			if (!node)
+			if (node == root)
 				break;
 			node = node->next;
 		}
@@ -1034,6 +1617,7 @@ bool html_find_stylesheets(struct content *c, xmlNode *html)
 				goto no_memory;
 
 			c->active++;
+			c->data.html.stylesheet_active++;
 
 			i++;
 		} else if (strcmp((const char *) node->name, "style") == 0) {
@@ -1137,12 +1721,14 @@ bool html_process_style_element(struct content *c, unsigned int *index,
 	}
 
 	c->active++;
+	c->data.html.stylesheet_active++;
 
 	/* Convert the content -- manually, as we want the result */
 	if (nscss_convert_css_data(sheet, 
 			html_inline_style_done, c) != CSS_OK) {
 		/* conversion failed */
 		c->active--;
+		c->data.html.stylesheet_active--;
 		nscss_destroy_css_data(sheet);
 		talloc_free(sheet);
 		sheet = NULL;
@@ -1170,7 +1756,8 @@ void html_inline_style_done(struct content_css_data *css, void *pw)
 {
 	struct content *html = pw;
 
-	if (--html->active == 0)
+	html->active--;
+	if (--html->data.html.stylesheet_active == 0)
 		html_finish_conversion(html);
 }
 
@@ -1209,6 +1796,7 @@ nserror html_convert_css_callback(hlcache_handle *css,
 	case CONTENT_MSG_DONE:
 		LOG(("got stylesheet '%s'", content_get_url(css)));
 		parent->active--;
+		parent->data.html.stylesheet_active--;
 		break;
 
 	case CONTENT_MSG_ERROR:
@@ -1217,6 +1805,7 @@ nserror html_convert_css_callback(hlcache_handle *css,
 		hlcache_handle_release(css);
 		s->data.external = NULL;
 		parent->active--;
+		parent->data.html.stylesheet_active--;
 		content_add_error(parent, "?", 0);
 		break;
 
@@ -1229,7 +1818,7 @@ nserror html_convert_css_callback(hlcache_handle *css,
 		assert(0);
 	}
 
-	if (parent->active == 0)
+	if (parent->data.html.stylesheet_active == 0)
 		html_finish_conversion(parent);
 
 	return NSERROR_OK;
@@ -1399,6 +1988,11 @@ nserror html_object_callback(hlcache_handle *object,
 		}
 
 		/* not acceptable */
+		html_redraw_discard_display_list(c);
+		html_release_held(c);
+		html_object_failed(box, c,
+				c->data.html.object[i].background);
+
 		hlcache_handle_release(object);
 
 		o->content = NULL;
@@ -1408,14 +2002,18 @@ nserror html_object_callback(hlcache_handle *object,
 		content_add_error(c, "?", 0);
 		html_set_status(c, messages_get("BadObject"));
 		content_broadcast(c, CONTENT_MSG_STATUS, event->data);
-
-		html_object_failed(box, c,
-				c->data.html.object[i].background);
 		break;
 
 	case CONTENT_MSG_READY:
+		/* the object may be displayed before it is complete, for
+		 * example an image which is decoded as it arrives */
+		html_redraw_discard_display_list(c);
+		html_release_held(c);
+		html_object_done(box, object, o->background);
 		if (content_get_type(object) == CONTENT_HTML) {
-			html_object_done(box, object, o->background);
+			/* the page's layout needs the object's complete
+			 * dimensions, so it can't be laid out progressively */
+			html_complete_layout(object);
 			if (c->status == CONTENT_STATUS_READY ||
 					c->status == CONTENT_STATUS_DONE)
 				content__reformat(c,
@@ -1425,11 +2023,22 @@ nserror html_object_callback(hlcache_handle *object,
 		break;
 
 	case CONTENT_MSG_DONE:
+		html_redraw_discard_display_list(c);
+		html_release_held(c);
 		html_object_done(box, object, o->background);
 		c->active--;
 		break;
 
 	case CONTENT_MSG_ERROR:
+	{
+		/* the object may have been displayed while it arrived */
+		bool displayed = (o->background ? box->background :
+				box->object) == object;
+
+		html_redraw_discard_display_list(c);
+		html_release_held(c);
+		html_object_failed(box, c, o->background);
+
 		hlcache_handle_release(object);
 
 		o->content = NULL;
@@ -1439,7 +2048,11 @@ nserror html_object_callback(hlcache_handle *object,
 		content_add_error(c, "?", 0);
 		html_set_status(c, event->data.error);
 		content_broadcast(c, CONTENT_MSG_STATUS, event->data);
-		html_object_failed(box, c, o->background);
+
+		if (displayed && (c->status == CONTENT_STATUS_READY ||
+				c->status == CONTENT_STATUS_DONE))
+			content__reformat(c, c->available_width, c->height);
+	}
 		break;
 
 	case CONTENT_MSG_STATUS:
@@ -1496,6 +2109,7 @@ nserror html_object_callback(hlcache_handle *object,
 	}
 
 	if (c->status == CONTENT_STATUS_READY && c->active == 0 &&
+			c->data.html.parser_binding == NULL &&
 			(event->type == CONTENT_MSG_LOADING ||
 			event->type == CONTENT_MSG_DONE ||
 			event->type == CONTENT_MSG_ERROR)) {
@@ -1507,19 +2121,30 @@ nserror html_object_callback(hlcache_handle *object,
 
 	/* If  1) the configuration option to reflow pages while objects are
 	 *        fetched is set
-	 *     2) an object is newly fetched & converted,
+	 *     2) an object is newly fetched & converted, or may be
+	 *        displayed while it is fetched,
 	 *     3) the object's parent HTML is ready for reformat,
 	 *     4) the time since the previous reformat is more than the
 	 *        configured minimum time between reformats
 	 * then reformat the page to display newly fetched objects */
 	else if (option_incremental_reflow &&
-			event->type == CONTENT_MSG_DONE &&
+			(event->type == CONTENT_MSG_READY ||
+			 event->type == CONTENT_MSG_DONE) &&
 			(c->status == CONTENT_STATUS_READY ||
 			 c->status == CONTENT_STATUS_DONE) &&
 			(wallclock() > c->reformat_time)) {
 		content__reformat(c, c->available_width, c->height);
 	}
 
+	/* lay out the start of the document again if boxes held back by
+	 * progressive layout were returned to the tree above */
+	if (c->data.html.layout_budget != 0 &&
+			c->data.html.layout_held_count == 0 &&
+			(c->status == CONTENT_STATUS_READY ||
+			 c->status == CONTENT_STATUS_DONE))
+		content__reformat(c, c->available_width,
+				c->data.html.layout_height);
+
 	return NSERROR_OK;
 }
 
@@ -1545,6 +2170,8 @@ void html_object_done(struct box *box, hlcache_handle *object,
 		b->max_width = UNKNOWN_MAX_WIDTH;
 
 	/* delete any clones of this box */
+	if (box->next && box->next->clone && box->parent)
+		box_index_discard(box->parent);
 	while (box->next && box->next->clone) {
 		/* box_free_box(box->next); */
 		box->next = box->next->next;
@@ -1559,7 +2186,8 @@ void html_object_done(struct box *box, hlcache_handle *object,
  * \param  content     document of type CONTENT_HTML
  * \param  background  the object was the background image for the box
  *
- * Any fallback content for the object is made visible.
+ * The object is detached from the box, if it was displayed while it
+ * arrived, and any fallback content for the object is made visible.
  */
 
 void html_object_failed(struct box *box, struct content *content,
@@ -1567,12 +2195,29 @@ void html_object_failed(struct box *box, struct content *content,
 {
 	struct box *b, *ic;
 
-	if (background)
+	if (background) {
+		box->background = NULL;
 		return;
+	}
+
+	if (box->object != NULL) {
+		box->object = NULL;
+
+		/* invalidate parent min, max widths */
+		for (b = box; b; b = b->parent)
+			b->max_width = UNKNOWN_MAX_WIDTH;
+	}
+
 	if (!box->fallback)
 		return;
 
 	/* make fallback boxes into children or siblings, as appropriate */
+	box_index_discard(box);
+	if (box->parent) {
+		box_index_discard(box->parent);
+		if (box->parent->parent)
+			box_index_discard(box->parent->parent);
+	}
 	if (box->type != BOX_INLINE) {
 		/* easy case: fallbacks become children */
 		assert(box->type == BOX_BLOCK ||
@@ -1731,9 +2376,20 @@ void html_reformat(struct content *c, int width, int height)
 
 	time_before = wallclock();
 
+	schedule_remove(html_layout_continue, c);
+
+	/* any recorded redraw is of the old layout */
+	html_redraw_discard_display_list(c);
+
 	layout_document(c, width, height);
 	layout = c->data.html.layout;
 
+	/* lay out the rest of the document later, if it was held back */
+	if (c->data.html.layout_held_count != 0) {
+		c->data.html.layout_height = height;
+		schedule(0, html_layout_continue, c);
+	}
+
 	/* width and height are at least margin box of document */
 	c->width = layout->x + layout->padding[LEFT] + layout->width +
 			layout->padding[RIGHT] + layout->border[RIGHT].width +
@@ -1755,6 +2411,78 @@ void html_reformat(struct content *c, int width, int height)
 }
 
 
+/**
+ * schedule() callback to continue progressive layout of a CONTENT_HTML
+ *
+ * \param p  content to lay out
+ */
+
+void html_layout_continue(void *p)
+{
+	struct content *c = (struct content *) p;
+
+	assert(c->type == CONTENT_HTML);
+
+	if (c->status != CONTENT_STATUS_READY &&
+			c->status != CONTENT_STATUS_DONE)
+		return;
+
+	c->data.html.layout_budget *= LAYOUT_BUDGET_GROWTH;
+
+	content__reformat(c, c->available_width, c->data.html.layout_height);
+}
+
+
+/**
+ * Return boxes held back by progressive layout to the box tree.
+ *
+ * \param  c  content of type CONTENT_HTML
+ *
+ * Called before the box tree is changed, as the change may move or replace
+ * the boxes where the tree was cut.  The document must then be laid out
+ * again before it is redrawn.
+ */
+
+void html_release_held(struct content *c)
+{
+	if (c->data.html.layout_held_count == 0)
+		return;
+
+	schedule_remove(html_layout_continue, c);
+	layout_release_held(c);
+}
+
+
+/**
+ * Lay out the whole of a document which is being laid out progressively.
+ *
+ * \param  h  HTML content
+ *
+ * Used when the whole box tree is needed, for example to search or save the
+ * document, and for documents which are objects in a page, as the page's
+ * layout depends on their dimensions.
+ */
+
+void html_complete_layout(hlcache_handle *h)
+{
+	struct content *c = hlcache_handle_get_content(h);
+
+	assert(c != NULL);
+	assert(c->type == CONTENT_HTML);
+
+	if (c->data.html.layout_budget == 0)
+		return;
+
+	c->data.html.layout_budget = 0;
+
+	if (c->data.html.layout_held_count != 0) {
+		schedule_remove(html_layout_continue, c);
+		content__reformat(c, c->available_width,
+				c->data.html.layout_height);
+	}
+}
+
+
 /**
  * Destroy a CONTENT_HTML and free all resources it owns.
  */
@@ -1769,6 +2497,13 @@ void html_destroy(struct content *c)
 
 	html = &c->data.html;
 
+	schedule_remove(html_parse_callback, c);
+	schedule_remove(html_layout_continue, c);
+	schedule_remove(html_box_progress, c);
+	schedule_remove(html_finish_conversion_callback, c);
+
+	html_redraw_discard_display_list(c);
+
 	/* Destroy forms */
 	for (f = html->forms; f != NULL; f = g) {
 		g = f->prev;
@@ -1902,13 +2637,13 @@ bool html_clone(const struct content *old, struct content *new_content)
 
 void html_set_status(struct content *c, const char *extra)
 {
-	unsigned int stylesheets = 0, objects = 0;
-	if (c->data.html.object_count == 0)
-		stylesheets = c->data.html.stylesheet_count - c->active;
-	else {
-		stylesheets = c->data.html.stylesheet_count;
-		objects = c->data.html.object_count - c->active;
-	}
+	unsigned int stylesheets, objects;
+
+	/* objects may be fetched while stylesheets in the body are */
+	stylesheets = c->data.html.stylesheet_count -
+			c->data.html.stylesheet_active;
+	objects = c->data.html.object_count -
+			(c->active - c->data.html.stylesheet_active);
 	content_set_status(c, "%u/%u %s %u/%u %s  %s",
 			stylesheets, c->data.html.stylesheet_count,
 			messages_get((c->data.html.stylesheet_count == 1) ?
@@ -25,6 +25,7 @@
 #ifndef _NETSURF_RENDER_HTML_H_
 #define _NETSURF_RENDER_HTML_H_
 
+#include <limits.h>
 #include <stdbool.h>
 #include "content/content_type.h"
 #include "css/css.h"
@@ -33,12 +34,15 @@
 
 struct fetch_multipart_data;
 struct box;
+struct box_construct_state;
 struct rect;
 struct browser_window;
 struct content;
+struct display_list;
 struct hlcache_handle;
 struct http_parameter;
 struct imagemap;
+struct layout_held;
 struct object_params;
 struct plotters;
 
@@ -137,11 +141,40 @@ struct content_html_data {
 	char *encoding;	/**< Encoding of source, 0 if unknown. */
 	binding_encoding_source encoding_source;
 				/**< Source of encoding information. */
+	/** The start of the source has been examined for its encoding. */
+	bool sniffed;
+	/** Length of source which has been passed to the parser. */
+	unsigned long parsed;
 
 	char *base_url;	/**< Base URL (may be a copy of content->url). */
 	char *base_target;	/**< Base target */
 
 	struct box *layout;  /**< Box tree, or 0. */
+	/** Construction of the box tree while the body is parsed, or 0. */
+	struct box_construct_state *box_state;
+	/** No more of the body is displayed until it has been parsed, as a
+	 * part which was complete has changed or its style doesn't allow it */
+	bool box_state_stopped;
+	/** Construction of the box tree while the body was parsed ran out
+	 * of memory; reported when the document has been parsed. */
+	bool box_state_failed;
+	/** Box budget for progressive layout, or 0 to lay out fully. */
+	unsigned int layout_budget;
+	/** Parts of the box tree held back by progressive layout. */
+	struct layout_held *layout_held;
+	/** Number of entries in layout_held. */
+	unsigned int layout_held_count;
+	/** Available height to use when progressive layout continues. */
+	int layout_height;
+	/** Recorded redraw of the layout, or 0. */
+	struct display_list *display_list;
+	/** Browser window display_list was recorded for. */
+	struct browser_window *display_list_bw;
+	/** Background colour display_list was recorded with. */
+	colour display_list_background;
+	/** Redraws since display_list was discarded, or
+	 * HTML_DISPLAY_LIST_NEVER if recording failed. */
+	unsigned int display_list_redraws;
 	colour background_colour;  /**< Document background colour. */
 	const struct font_functions *font_func;
 
@@ -151,6 +184,10 @@ struct content_html_data {
 	unsigned int stylesheet_count;
 	/** Stylesheets. Each may be 0. */
 	struct html_stylesheet *stylesheets;
+	/** Number of stylesheets still being fetched or converted. */
+	unsigned int stylesheet_active;
+	/** Number of stylesheets added to select_ctx. */
+	unsigned int stylesheet_selected;
 	/**< Style selection context */
 	css_select_ctx *select_ctx;
 
@@ -181,6 +218,9 @@ struct content_html_data {
 	struct box *box;
 };
 
+/** Value of display_list_redraws when the layout can't be recorded. */
+#define HTML_DISPLAY_LIST_NEVER UINT_MAX
+
 /** Render padding and margin box outlines in html_redraw(). */
 extern bool html_redraw_debug;
 
@@ -207,6 +247,7 @@ bool html_redraw(struct content *c, int x, int y,
 		int width, int height,
 		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
 		float scale, colour background_colour);
+void html_redraw_discard_display_list(struct content *c);
 
 
 /* redraw a short text string, complete with highlighting
@@ -223,6 +264,7 @@ bool text_redraw(const char *utf8_text, size_t utf8_len,
 
 xmlDoc *html_get_document(struct hlcache_handle *h);
 struct box *html_get_box_tree(struct hlcache_handle *h);
+void html_complete_layout(struct hlcache_handle *h);
 const char *html_get_encoding(struct hlcache_handle *h);
 binding_encoding_source html_get_encoding_source(struct hlcache_handle *h);
 struct content_html_frames *html_get_frameset(struct hlcache_handle *h);
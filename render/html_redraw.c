@@ -27,6 +27,7 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
@@ -35,6 +36,7 @@
 #include "css/css.h"
 #include "css/utils.h"
 #include "desktop/gui.h"
+#include "desktop/display_list.h"
 #include "desktop/plotters.h"
 #include "desktop/knockout.h"
 #include "desktop/selection.h"
@@ -43,7 +45,6 @@
 #include "desktop/print.h"
 #include "desktop/search.h"
 #include "desktop/scroll.h"
-#include "image/bitmap.h"
 #include "render/box.h"
 #include "render/font.h"
 #include "render/form.h"
@@ -53,6 +54,13 @@
 #include "utils/utils.h"
 
 
+/** Number of redraws of an unchanged layout before it is recorded */
+#define HTML_DISPLAY_LIST_DELAY 2
+
+static bool html_redraw_display_list(struct content *c, struct box *box,
+		int x, int y,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		colour background_colour);
 static bool html_redraw_box(struct box *box,
 		int x, int y,
 		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
@@ -120,7 +128,7 @@ bool html_redraw(struct content *c, int x, int y,
 		float scale, colour background_colour)
 {
 	struct box *box;
-	bool result = true, want_knockout;
+	bool result = true, want_knockout, want_display_list;
 	bool select, select_only;
 	plot_style_t pstyle_fill_bg = {
 		.fill_type = PLOT_OP_TYPE_SOLID,
@@ -130,6 +138,15 @@ bool html_redraw(struct content *c, int x, int y,
 	box = c->data.html.layout;
 	assert(box);
 
+	/* the display list is only for unscaled screen redraw, and doesn't
+	 * record transient highlighting */
+	want_display_list = scale == 1.0 && !plot.group_start &&
+			!html_redraw_printing && !html_redraw_debug &&
+			!display_list_recording() && !ghost_caret.defined &&
+			!(current_redraw_browser &&
+			(selection_defined(current_redraw_browser->sel) ||
+			current_redraw_browser->search_context));
+
 	want_knockout = plot.option_knockout;
 	if (want_knockout)
 		knockout_plot_start(&plot);
@@ -161,9 +178,14 @@ bool html_redraw(struct content *c, int x, int y,
 		result &= plot.rectangle(clip_x0, clip_y0, clip_x1, clip_y1,
 				&pstyle_fill_bg);
 	
-		result &= html_redraw_box(box, x, y,
-				clip_x0, clip_y0, clip_x1, clip_y1,
-				scale, pstyle_fill_bg.fill_colour);
+		if (want_display_list)
+			result &= html_redraw_display_list(c, box, x, y,
+					clip_x0, clip_y0, clip_x1, clip_y1,
+					pstyle_fill_bg.fill_colour);
+		else
+			result &= html_redraw_box(box, x, y,
+					clip_x0, clip_y0, clip_x1, clip_y1,
+					scale, pstyle_fill_bg.fill_colour);
 	}
 
 	if (select) {
@@ -189,6 +211,107 @@ bool html_redraw(struct content *c, int x, int y,
 }
 
 
+/**
+ * Draw a CONTENT_HTML at scale 1 by replaying its display list, recording it
+ * first if necessary.
+ *
+ * \param  c                  content of type CONTENT_HTML
+ * \param  box                root of box tree
+ * \param  x                  coordinate of top-left of redraw
+ * \param  y                  coordinate of top-left of redraw
+ * \param  clip_x0            clip rectangle
+ * \param  clip_y0            clip rectangle
+ * \param  clip_x1            clip rectangle
+ * \param  clip_y1            clip rectangle
+ * \param  background_colour  background colour under the document
+ * \return true if successful, false otherwise
+ *
+ * Recording walks the whole box tree, so it is only done once the layout has
+ * been redrawn unchanged a few times. Until then, and if recording fails, the
+ * box tree is drawn directly.
+ */
+
+bool html_redraw_display_list(struct content *c, struct box *box,
+		int x, int y,
+		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
+		colour background_colour)
+{
+	struct display_list *dl = c->data.html.display_list;
+	bool ok;
+
+	if (dl && (c->data.html.display_list_bw != current_redraw_browser ||
+			c->data.html.display_list_background !=
+			background_colour)) {
+		html_redraw_discard_display_list(c);
+		dl = NULL;
+	}
+
+	if (!dl) {
+		if (c->data.html.display_list_redraws ==
+				HTML_DISPLAY_LIST_NEVER)
+			return html_redraw_box(box, x, y,
+					clip_x0, clip_y0, clip_x1, clip_y1,
+					1.0, background_colour);
+
+		if (c->data.html.display_list_redraws <
+				HTML_DISPLAY_LIST_DELAY) {
+			c->data.html.display_list_redraws++;
+			return html_redraw_box(box, x, y,
+					clip_x0, clip_y0, clip_x1, clip_y1,
+					1.0, background_colour);
+		}
+
+		dl = display_list_create();
+		if (!dl || !display_list_record_start(dl)) {
+			if (dl)
+				display_list_destroy(dl);
+			return html_redraw_box(box, x, y,
+					clip_x0, clip_y0, clip_x1, clip_y1,
+					1.0, background_colour);
+		}
+
+		/* record everything, relative to the document origin */
+		ok = html_redraw_box(box, 0, 0, INT_MIN / 2, INT_MIN / 2,
+				INT_MAX / 2, INT_MAX / 2,
+				1.0, background_colour);
+		if (!display_list_record_end() || !ok) {
+			display_list_destroy(dl);
+			c->data.html.display_list_redraws =
+					HTML_DISPLAY_LIST_NEVER;
+			return html_redraw_box(box, x, y,
+					clip_x0, clip_y0, clip_x1, clip_y1,
+					1.0, background_colour);
+		}
+
+		c->data.html.display_list = dl;
+		c->data.html.display_list_bw = current_redraw_browser;
+		c->data.html.display_list_background = background_colour;
+	}
+
+	return display_list_replay(dl, x, y,
+			clip_x0, clip_y0, clip_x1, clip_y1);
+}
+
+
+/**
+ * Discard the recorded redraw of a CONTENT_HTML.
+ *
+ * \param  c  content of type CONTENT_HTML
+ *
+ * Must be called whenever anything which affects the redraw of the document
+ * changes.
+ */
+
+void html_redraw_discard_display_list(struct content *c)
+{
+	if (c->data.html.display_list) {
+		display_list_destroy(c->data.html.display_list);
+		c->data.html.display_list = NULL;
+	}
+	c->data.html.display_list_redraws = 0;
+}
+
+
 /**
  * Recursively draw a box.
  *
@@ -324,6 +447,9 @@ bool html_redraw_box(struct box *box,
 		else box->printed = true;/*it won't be printed anymore*/
 	}
 
+	/* everything drawn for this box is within the rectangle */
+	display_list_bounds(x0, y0, x1, y1);
+
 	/* if visibility is hidden render children only */
 	if (box->style && css_computed_visibility(box->style) == 
 			CSS_VISIBILITY_HIDDEN) {
@@ -650,7 +776,7 @@ bool html_redraw_box(struct box *box,
 	if (box->object) {
 		x_scrolled = x - scroll_get_offset(box->scroll_x) * scale;
 		y_scrolled = y - scroll_get_offset(box->scroll_y) * scale;
-		if (!content_redraw(box->object,
+		if (!display_list_content_redraw(box->object,
 				x_scrolled + padding_left,
 				y_scrolled + padding_top,
 				width, height, x0, y0, x1, y1, scale,
@@ -765,9 +891,17 @@ bool html_redraw_box_children(struct box *box,
 		int clip_x0, int clip_y0, int clip_x1, int clip_y1,
 		float scale, colour current_background_color)
 {
-	struct box *c;
+	struct box *c, *first = box->children, *end = NULL;
+	int y = y_parent + box->y - scroll_get_offset(box->scroll_y);
+	int slack = 2 + 2 / scale;
 
-	for (c = box->children; c; c = c->next) {
+	/* only visit children in the vertical range of the clip rectangle,
+	 * allowing for rounding when scaled */
+	if (box->child_index)
+		box_index_find(box, clip_y0 / scale - y - slack,
+				clip_y1 / scale - y + slack, &first, &end);
+
+	for (c = first; c && c != end; c = c->next) {
 
 		if (c->type != BOX_FLOAT_LEFT && c->type != BOX_FLOAT_RIGHT)
 			if (!html_redraw_box(c,
@@ -1590,15 +1724,11 @@ bool html_redraw_background(int x, int y, struct box *box, float scale,
 		/* handle background-repeat */
 		switch (css_computed_background_repeat(background->style)) {
 		case CSS_BACKGROUND_REPEAT_REPEAT:
-		{
-			struct bitmap *bmp = content_get_bitmap(
-					background->background);
 			repeat_x = repeat_y = true;
 			/* optimisation: only plot the colour if
 			 * bitmap is not opaque */
-			if (bmp != NULL)
-				plot_colour = !bitmap_get_opaque(bmp);
-		}
+			plot_colour = !content_get_opaque(
+					background->background);
 			break;
 		case CSS_BACKGROUND_REPEAT_REPEAT_X:
 			repeat_x = true;
@@ -1656,8 +1786,6 @@ bool html_redraw_background(int x, int y, struct box *box, float scale,
 	for (; clip_box; clip_box = clip_box->next) {
 		/* clip to child boxes if needed */
 		if (clip_to_children) {
-			struct bitmap *bmp = NULL;
-
 			assert(clip_box->type == BOX_TABLE_CELL);
 
 			/* update clip_* to the child cell */
@@ -1675,15 +1803,14 @@ bool html_redraw_background(int x, int y, struct box *box, float scale,
 			if (clip_x1 > px1) clip_x1 = px1;
 			if (clip_y1 > py1) clip_y1 = py1;
 
-			if (clip_box->background != NULL)
-				bmp = content_get_bitmap(clip_box->background);
-
 			/* <td> attributes override <tr> */
 			if ((clip_x0 >= clip_x1) || (clip_y0 >= clip_y1) ||
 					(css_computed_background_color(
 						clip_box->style, &bgcol) !=
 					CSS_BACKGROUND_COLOR_TRANSPARENT) ||
-					(bmp != NULL && bitmap_get_opaque(bmp)))
+					(clip_box->background != NULL &&
+					content_get_opaque(
+						clip_box->background)))
 				continue;
 		}
 
@@ -1720,7 +1847,7 @@ bool html_redraw_background(int x, int y, struct box *box, float scale,
 				if (!plot.clip(clip_x0, clip_y0,
 						clip_x1, clip_y1))
 					return false;
-				if (!content_redraw_tiled(
+				if (!display_list_content_redraw_tiled(
 						background->background, x, y,
 						ceilf(width * scale),
 						ceilf(height * scale),
@@ -1787,15 +1914,10 @@ bool html_redraw_inline_background(int x, int y, struct box *box, float scale,
 		/* handle background-repeat */
 		switch (css_computed_background_repeat(box->style)) {
 		case CSS_BACKGROUND_REPEAT_REPEAT:
-		{
-			struct bitmap *bmp = 
-					content_get_bitmap(box->background);
 			repeat_x = repeat_y = true;
 			/* optimisation: only plot the colour if
 			 * bitmap is not opaque */
-			if (bmp != NULL)
-				plot_colour = !bitmap_get_opaque(bmp);
-		}
+			plot_colour = !content_get_opaque(box->background);
 			break;
 		case CSS_BACKGROUND_REPEAT_REPEAT_X:
 			repeat_x = true;
@@ -1868,7 +1990,8 @@ bool html_redraw_inline_background(int x, int y, struct box *box, float scale,
 			if (!plot.clip(clip_x0, clip_y0,
 					clip_x1, clip_y1))
 				return false;
-			if (!content_redraw_tiled(box->background, x, y,
+			if (!display_list_content_redraw_tiled(
+					box->background, x, y,
 					ceilf(width * scale),
 					ceilf(height * scale),
 					clip_x0, clip_y0,
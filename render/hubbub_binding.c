@@ -19,21 +19,26 @@
 
 #define _GNU_SOURCE /* for strndup */
 #include <assert.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
 
 #include <libxml/HTMLparser.h>
 #include <libxml/HTMLtree.h>
+#include <libxml/dict.h>
 
 #include <hubbub/parser.h>
 #include <hubbub/tree.h>
 
+#include <parserutils/charset/mibenum.h>
+
 #include "render/form.h"
 #include "render/parser_binding.h"
 
 #include "utils/config.h"
 #include "utils/log.h"
 #include "utils/talloc.h"
+#include "utils/utils.h"
 
 typedef struct hubbub_ctx {
 	hubbub_parser *parser;
@@ -45,6 +50,7 @@ typedef struct hubbub_ctx {
 
 	const char *encoding;
 	binding_encoding_source encoding_source;
+	bool tentative;		/**< A meta element may change encoding */
 
 #define NUM_NAMESPACES (6)
 	xmlNsPtr namespaces[NUM_NAMESPACES];
@@ -53,6 +59,14 @@ typedef struct hubbub_ctx {
 	hubbub_tree_handler tree_handler;
 
 	struct form *forms;
+
+	xmlNodePtr body;	/**< Body element, or NULL if not yet created */
+	xmlNodePtr pending;	/**< First child of body which may be open */
+	bool changed;		/**< A complete part of the body has changed */
+	bool fixed_encoding;	/**< The document may no longer be reparsed */
+
+	xmlChar *value;		/**< Buffer for attribute values */
+	size_t value_size;	/**< Size of value buffer */
 } hubbub_ctx;
 
 static struct {
@@ -72,7 +86,24 @@ static struct {
 
 static inline char *c_string_from_hubbub_string(hubbub_ctx *ctx, 
 		const hubbub_string *str);
+static inline const xmlChar *name_from_hubbub_string(hubbub_ctx *ctx,
+		const hubbub_string *str);
+static const xmlChar *value_from_hubbub_string(hubbub_ctx *ctx,
+		const hubbub_string *str);
 static void create_namespaces(hubbub_ctx *ctx, xmlNode *root);
+static const char *sniff_meta(const uint8_t **pos, const uint8_t *end);
+static bool sniff_attribute(const uint8_t **pos, const uint8_t *end,
+		const uint8_t **name, size_t *name_len,
+		const uint8_t **value, size_t *value_len);
+static const char *sniff_content(const uint8_t *value, size_t len,
+		size_t *charset_len);
+static const char *sniff_charset(const char *name, size_t len);
+static const uint8_t *sniff_skip(const uint8_t *pos, const uint8_t *end,
+		const char *s);
+static bool sniff_match(const uint8_t *pos, const uint8_t *end,
+		const char *s);
+static bool node_complete(hubbub_ctx *ctx, xmlNode *n);
+static void note_change(hubbub_ctx *ctx, xmlNode *n);
 static hubbub_error create_comment(void *ctx, const hubbub_string *data, 
 		void **result);
 static hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
@@ -132,7 +163,18 @@ static void *myrealloc(void *ptr, size_t len, void *pw)
 	return talloc_realloc_size(pw, ptr, len);
 }
 
-binding_error binding_create_tree(void *arena, const char *charset, void **ctx)
+/**
+ * Create a parser and the document it builds.
+ *
+ * \param arena      talloc context for the parser
+ * \param charset    encoding of the document, or NULL to detect it
+ * \param tentative  charset is a guess which a meta element may correct
+ * \param ctx        updated to binding context
+ * \return  BINDING_OK on success, BINDING_BADENCODING if charset isn't
+ *          supported, or BINDING_NOMEM on memory exhaustion
+ */
+binding_error binding_create_tree(void *arena, const char *charset,
+		bool tentative, void **ctx)
 {
 	hubbub_ctx *c;
 	hubbub_parser_optparams params;
@@ -147,10 +189,19 @@ binding_error binding_create_tree(void *arena, const char *charset, void **ctx)
 	c->encoding = charset;
 	c->encoding_source = charset != NULL ? ENCODING_SOURCE_HEADER
 					     : ENCODING_SOURCE_DETECTED;
+	c->tentative = charset != NULL && tentative;
+	if (c->tentative)
+		c->encoding_source = ENCODING_SOURCE_META;
 	c->document = NULL;
 	c->owns_doc = true;
 	c->quirks = BINDING_QUIRKS_MODE_NONE;
 	c->forms = NULL;
+	c->body = NULL;
+	c->pending = NULL;
+	c->changed = false;
+	c->fixed_encoding = false;
+	c->value = NULL;
+	c->value_size = 0;
 
 	error = hubbub_parser_create(charset, true, myrealloc, arena, 
 			&c->parser);
@@ -170,6 +221,16 @@ binding_error binding_create_tree(void *arena, const char *charset, void **ctx)
 	}
 	c->document->_private = (void *) 0;
 
+	/* Element and attribute names are interned in the document's
+	 * dictionary, rather than copied for every node */
+	c->document->dict = xmlDictCreate();
+	if (c->document->dict == NULL) {
+		xmlFreeDoc(c->document);
+		hubbub_parser_destroy(c->parser);
+		free(c);
+		return BINDING_NOMEM;
+	}
+
 	for (i = 0; i < sizeof(c->namespaces) / sizeof(c->namespaces[0]); i++) {
 		c->namespaces[i] = NULL;
 	}
@@ -206,6 +267,7 @@ binding_error binding_destroy_tree(void *ctx)
 	c->encoding = NULL;
 	c->document = NULL;
 
+	free(c->value);
 	free(c);
 
 	return BINDING_OK;
@@ -230,9 +292,79 @@ binding_error binding_parse_completed(void *ctx)
 
 	error = hubbub_parser_completed(c->parser);
 
+	/* every element is closed now */
+	c->pending = NULL;
+
 	return error == HUBBUB_NOMEM ? BINDING_NOMEM : BINDING_OK;
 }
 
+/**
+ * Find the encoding of a document from its start, before parsing it.
+ *
+ * \param data     document source
+ * \param len      length of data; no more than BINDING_SNIFF_SIZE is used
+ * \param certain  updated to true if the encoding is from a byte order mark,
+ *                 or false if it is from a meta element and may be wrong
+ * \return  name of encoding, or NULL if none was found
+ *
+ * This is the prescan of the HTML5 encoding sniffing algorithm, which finds
+ * most meta elements before any of the document is parsed.  That saves
+ * parsing it again when the parser finds the meta element itself.
+ */
+const char *binding_sniff_encoding(const uint8_t *data, size_t len,
+		bool *certain)
+{
+	const uint8_t *pos = data;
+	const uint8_t *end = data + (len < BINDING_SNIFF_SIZE ?
+			len : BINDING_SNIFF_SIZE);
+	const char *charset;
+
+	*certain = true;
+
+	if (len >= 3 && data[0] == 0xef && data[1] == 0xbb && 
+			data[2] == 0xbf)
+		return sniff_charset("UTF-8", SLEN("UTF-8"));
+	if (len >= 2 && data[0] == 0xfe && data[1] == 0xff)
+		return sniff_charset("UTF-16BE", SLEN("UTF-16BE"));
+	if (len >= 2 && data[0] == 0xff && data[1] == 0xfe)
+		return sniff_charset("UTF-16LE", SLEN("UTF-16LE"));
+
+	*certain = false;
+
+	while (pos < end) {
+		if (sniff_match(pos, end, "<!--")) {
+			/* comment; may contain anything */
+			pos = sniff_skip(pos + 2, end, "-->");
+		} else if (sniff_match(pos, end, "<meta") && pos + 5 < end &&
+				(isspace(pos[5]) || pos[5] == '/')) {
+			pos += 5;
+			charset = sniff_meta(&pos, end);
+			if (charset != NULL)
+				return charset;
+		} else if (pos + 2 < end && pos[0] == '<' &&
+				(isalpha(pos[1]) || (pos[1] == '/' &&
+				isalpha(pos[2])))) {
+			const uint8_t *name, *value;
+			size_t name_len, value_len;
+
+			/* other tag; skip its attributes, which may contain
+			 * anything */
+			while (pos < end && !isspace(*pos) && *pos != '>')
+				pos++;
+			while (sniff_attribute(&pos, end, &name, &name_len,
+					&value, &value_len))
+				;
+		} else if (pos + 1 < end && pos[0] == '<' && (pos[1] == '!' ||
+				pos[1] == '/' || pos[1] == '?')) {
+			pos = sniff_skip(pos, end, ">");
+		} else {
+			pos++;
+		}
+	}
+
+	return NULL;
+}
+
 const char *binding_get_encoding(void *ctx, binding_encoding_source *source)
 {
 	hubbub_ctx *c = (hubbub_ctx *) ctx;
@@ -254,6 +386,53 @@ xmlDocPtr binding_get_document(void *ctx, binding_quirks_mode *quirks)
 	return doc;
 }
 
+binding_quirks_mode binding_get_quirks(void *ctx)
+{
+	hubbub_ctx *c = (hubbub_ctx *) ctx;
+
+	return c->quirks;
+}
+
+/**
+ * Find how much of the body of a document has been parsed completely.
+ *
+ * \param ctx      binding context
+ * \param pending  updated to the first child of body which may still be
+ *                 open, or NULL if all of its children are complete
+ * \param changed  updated to true if the parser has changed part of the
+ *                 body after it was complete, or the attributes of html or
+ *                 body, or has started a stylesheet in the body
+ * \return  body element, or NULL if the body has not been started
+ *
+ * The children of body before pending will not be changed by further
+ * parsing unless changed is set, so may be converted for display while the
+ * rest of the document arrives.
+ */
+xmlNodePtr binding_get_body(void *ctx, xmlNodePtr *pending, bool *changed)
+{
+	hubbub_ctx *c = (hubbub_ctx *) ctx;
+
+	*pending = c->pending;
+	*changed = c->changed;
+
+	return c->body;
+}
+
+/**
+ * Keep the current encoding for the rest of a document.
+ *
+ * \param ctx  binding context
+ *
+ * Once parts of the tree are in use the document can't be reparsed, so any
+ * later change of encoding from a meta element is ignored.
+ */
+void binding_fix_encoding(void *ctx)
+{
+	hubbub_ctx *c = (hubbub_ctx *) ctx;
+
+	c->fixed_encoding = true;
+}
+
 struct form *binding_get_forms(void *ctx)
 {
 	hubbub_ctx *c = (hubbub_ctx *) ctx;
@@ -297,6 +476,49 @@ char *c_string_from_hubbub_string(hubbub_ctx *ctx, const hubbub_string *str)
 	return strndup((const char *) str->ptr, (int) str->len);
 }
 
+/**
+ * Intern an element or attribute name in the document's dictionary.
+ *
+ * \param ctx  binding context
+ * \param str  name
+ * \return  interned name, owned by the document, or NULL on memory exhaustion
+ */
+const xmlChar *name_from_hubbub_string(hubbub_ctx *ctx,
+		const hubbub_string *str)
+{
+	return xmlDictLookup(ctx->document->dict, str->ptr, (int) str->len);
+}
+
+/**
+ * Terminate an attribute value, without allocating a copy of it.
+ *
+ * \param ctx  binding context
+ * \param str  value
+ * \return  value, valid until the next call, or NULL on memory exhaustion
+ *
+ * libxml copies the value into the attribute, so a buffer is reused rather
+ * than allocating a string for each attribute only to free it again.
+ */
+const xmlChar *value_from_hubbub_string(hubbub_ctx *ctx,
+		const hubbub_string *str)
+{
+	if (ctx->value_size <= str->len) {
+		size_t size = str->len + 64;
+		xmlChar *value = realloc(ctx->value, size);
+
+		if (value == NULL)
+			return NULL;
+
+		ctx->value = value;
+		ctx->value_size = size;
+	}
+
+	memcpy(ctx->value, str->ptr, str->len);
+	ctx->value[str->len] = '\0';
+
+	return ctx->value;
+}
+
 void create_namespaces(hubbub_ctx *ctx, xmlNode *root)
 {
 	uint32_t i;
@@ -313,6 +535,280 @@ void create_namespaces(hubbub_ctx *ctx, xmlNode *root)
 	}
 }
 
+/**
+ * Find the encoding declared by a meta element.
+ *
+ * \param pos  position after the element name, updated to the end of the
+ *             element
+ * \param end  end of data
+ * \return  name of encoding, or NULL if the element doesn't declare one
+ */
+const char *sniff_meta(const uint8_t **pos, const uint8_t *end)
+{
+	const uint8_t *name, *value, *charset = NULL;
+	size_t name_len, value_len, charset_len = 0;
+	bool pragma = false, need_pragma = false;
+	const char *encoding;
+
+	while (sniff_attribute(pos, end, &name, &name_len,
+			&value, &value_len)) {
+		if (name_len == SLEN("http-equiv") &&
+				strncasecmp((const char *) name, "http-equiv",
+				name_len) == 0) {
+			if (value_len == SLEN("content-type") &&
+					strncasecmp((const char *) value,
+					"content-type", value_len) == 0)
+				pragma = true;
+		} else if (name_len == SLEN("content") &&
+				strncasecmp((const char *) name, "content",
+				name_len) == 0) {
+			if (charset == NULL) {
+				charset = (const uint8_t *) sniff_content(
+						value, value_len,
+						&charset_len);
+				need_pragma = true;
+			}
+		} else if (name_len == SLEN("charset") &&
+				strncasecmp((const char *) name, "charset",
+				name_len) == 0) {
+			if (charset == NULL) {
+				charset = value;
+				charset_len = value_len;
+				need_pragma = false;
+			}
+		}
+	}
+
+	if (charset == NULL || (need_pragma && !pragma))
+		return NULL;
+
+	encoding = sniff_charset((const char *) charset, charset_len);
+
+	/* a document which declares itself UTF-16 in ASCII can't be, so is
+	 * assumed to be UTF-8, as HTML5 requires */
+	if (encoding != NULL && strncasecmp(encoding, "UTF-16",
+			SLEN("UTF-16")) == 0)
+		encoding = sniff_charset("UTF-8", SLEN("UTF-8"));
+
+	return encoding;
+}
+
+/**
+ * Read an attribute of a tag.
+ *
+ * \param pos        position in tag, updated to after the attribute
+ * \param end        end of data
+ * \param name       updated to attribute name
+ * \param name_len   updated to length of name
+ * \param value      updated to attribute value
+ * \param value_len  updated to length of value
+ * \return  true if an attribute was read, false at the end of the tag
+ */
+bool sniff_attribute(const uint8_t **pos, const uint8_t *end,
+		const uint8_t **name, size_t *name_len,
+		const uint8_t **value, size_t *value_len)
+{
+	const uint8_t *p = *pos;
+	uint8_t quote;
+
+	*value = p;
+	*value_len = 0;
+
+	while (p < end && (isspace(*p) || *p == '/'))
+		p++;
+
+	if (p == end || *p == '>') {
+		*pos = p;
+		return false;
+	}
+
+	/* name, which may begin with = */
+	*name = p++;
+	while (p < end && !isspace(*p) && *p != '/' && *p != '>' && *p != '=')
+		p++;
+	*name_len = p - *name;
+
+	while (p < end && isspace(*p))
+		p++;
+
+	if (p == end || *p != '=') {
+		*pos = p;
+		return true;
+	}
+
+	/* value */
+	p++;
+	while (p < end && isspace(*p))
+		p++;
+
+	if (p < end && (*p == '"' || *p == '\'')) {
+		quote = *p++;
+		*value = p;
+		while (p < end && *p != quote)
+			p++;
+		*value_len = p - *value;
+		if (p < end)
+			p++;
+	} else {
+		*value = p;
+		while (p < end && !isspace(*p) && *p != '>')
+			p++;
+		*value_len = p - *value;
+	}
+
+	*pos = p;
+
+	return true;
+}
+
+/**
+ * Find the charset parameter in the content attribute of a meta element.
+ *
+ * \param value        attribute value
+ * \param len          length of value
+ * \param charset_len  updated to length of charset
+ * \return  start of charset, or NULL if there is none
+ */
+const char *sniff_content(const uint8_t *value, size_t len,
+		size_t *charset_len)
+{
+	const uint8_t *p = value, *end = value + len, *charset;
+
+	while (p + SLEN("charset") <= end) {
+		if (strncasecmp((const char *) p, "charset",
+				SLEN("charset")) != 0) {
+			p++;
+			continue;
+		}
+
+		p += SLEN("charset");
+		while (p < end && isspace(*p))
+			p++;
+		if (p == end || *p != '=')
+			continue;
+
+		p++;
+		while (p < end && isspace(*p))
+			p++;
+		if (p == end)
+			return NULL;
+
+		if (*p == '"' || *p == '\'') {
+			uint8_t quote = *p++;
+
+			charset = p;
+			while (p < end && *p != quote)
+				p++;
+			/* unmatched quotes are ignored */
+			if (p == end)
+				return NULL;
+		} else {
+			charset = p;
+			while (p < end && !isspace(*p) && *p != ';')
+				p++;
+		}
+
+		*charset_len = p - charset;
+		return (const char *) charset;
+	}
+
+	return NULL;
+}
+
+/**
+ * Find the name of a known encoding.
+ *
+ * \param name  encoding name or alias
+ * \param len   length of name
+ * \return  canonical name, or NULL if the encoding isn't known
+ */
+const char *sniff_charset(const char *name, size_t len)
+{
+	uint16_t mibenum;
+
+	mibenum = parserutils_charset_mibenum_from_name(name, len);
+	if (mibenum == 0)
+		return NULL;
+
+	return parserutils_charset_mibenum_to_name(mibenum);
+}
+
+/**
+ * Skip to the end of a string.
+ *
+ * \param pos  position in data
+ * \param end  end of data
+ * \param s    string to find
+ * \return  position after the next occurrence of s, or end if none
+ */
+const uint8_t *sniff_skip(const uint8_t *pos, const uint8_t *end,
+		const char *s)
+{
+	for (; pos < end; pos++) {
+		if (sniff_match(pos, end, s))
+			return pos + strlen(s);
+	}
+
+	return end;
+}
+
+/**
+ * Compare data with a string, ignoring case.
+ *
+ * \param pos  position in data
+ * \param end  end of data
+ * \param s    string to compare
+ * \return  true if the data at pos starts with s
+ */
+bool sniff_match(const uint8_t *pos, const uint8_t *end, const char *s)
+{
+	size_t len = strlen(s);
+
+	return (size_t) (end - pos) >= len &&
+			strncasecmp((const char *) pos, s, len) == 0;
+}
+
+/**
+ * Determine whether a node is within a complete child of body.
+ *
+ * \param ctx  binding context
+ * \param n    node to test
+ * \return  true if n is a complete child of body or a descendant of one
+ */
+bool node_complete(hubbub_ctx *ctx, xmlNode *n)
+{
+	xmlNode *open;
+
+	if (ctx->body == NULL)
+		return false;
+
+	while (n != NULL && n->parent != ctx->body)
+		n = n->parent;
+	if (n == NULL)
+		return false;
+
+	/* the open children are at the end, so this is short */
+	for (open = ctx->pending; open != NULL; open = open->next)
+		if (open == n)
+			return false;
+
+	return true;
+}
+
+/**
+ * Record a change to the tree if it is within a complete child of body.
+ *
+ * \param ctx  binding context
+ * \param n    node being changed
+ */
+void note_change(hubbub_ctx *ctx, xmlNode *n)
+{
+	if (!ctx->changed && node_complete(ctx, n)) {
+		LOG(("complete node %p changed", n));
+		ctx->changed = true;
+	}
+}
+
 hubbub_error create_comment(void *ctx, const hubbub_string *data, void **result)
 {
 	hubbub_ctx *c = (hubbub_ctx *) ctx;
@@ -388,10 +884,10 @@ hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
 hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 {
 	hubbub_ctx *c = (hubbub_ctx *) ctx;
-	char *name;
+	const char *name;
 	xmlNodePtr n;
 
-	name = c_string_from_hubbub_string(c, &tag->name);
+	name = (const char *) name_from_hubbub_string(c, &tag->name);
 	if (name == NULL)
 		return HUBBUB_NOMEM;
 
@@ -409,26 +905,27 @@ hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 			xmlSetNs(n, c->namespaces[tag->ns - 1]);
 		}
 	}
-	if (n == NULL) {
-		free(name);
+	if (n == NULL)
 		return HUBBUB_NOMEM;
-	}
 	n->_private = (void *) (uintptr_t) 1;
 
 	if (tag->n_attributes > 0 && add_attributes(ctx, (void *) n, 
 			tag->attributes, tag->n_attributes) != HUBBUB_OK) {
 		xmlFreeNode(n);
-		free(name);
 		return HUBBUB_NOMEM;
 	}
 
+	/* a stylesheet in the body may restyle what precedes it */
+	if (c->body != NULL && (strcasecmp(name, "style") == 0 ||
+			strcasecmp(name, "link") == 0))
+		c->changed = true;
+
 	if (strcasecmp(name, "form") == 0) {
 		struct form *form = parse_form_element(n, c->encoding);
 
 		/* Memory exhaustion */
 		if (form == NULL) {
 			xmlFreeNode(n);
-			free(name);
 			return HUBBUB_NOMEM;
 		}
 
@@ -439,8 +936,6 @@ hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 
 	*result = (void *) n;
 
-	free(name);
-
 	return HUBBUB_OK;
 }
 
@@ -508,9 +1003,13 @@ hubbub_error unref_node(void *ctx, void *node)
 
 hubbub_error append_child(void *ctx, void *parent, void *child, void **result)
 {
+	hubbub_ctx *c = (hubbub_ctx *) ctx;
 	xmlNode *chld = (xmlNode *) child;
 	xmlNode *p = (xmlNode *) parent;
 
+	if (p != c->body)
+		note_change(c, p);
+
 	/** \todo Text node merging logic as per 
 	 * http://www.whatwg.org/specs/web-apps/current-work/multipage/ \
 	 * tree-construction.html#insert-a-character
@@ -536,6 +1035,15 @@ hubbub_error append_child(void *ctx, void *parent, void *child, void **result)
 	if (*result == NULL)
 		return HUBBUB_NOMEM;
 
+	if (p == c->body) {
+		/* the previous children have all been closed */
+		c->pending = *result;
+	} else if (c->body == NULL && chld->type == XML_ELEMENT_NODE &&
+			p->parent == (xmlNode *) c->document &&
+			strcmp((const char *) chld->name, "body") == 0) {
+		c->body = chld;
+	}
+
 	ref_node(ctx, *result);
 
 	return HUBBUB_OK;
@@ -544,11 +1052,20 @@ hubbub_error append_child(void *ctx, void *parent, void *child, void **result)
 hubbub_error insert_before(void *ctx, void *parent, void *child, 
 		void *ref_child, void **result)
 {
+	hubbub_ctx *c = (hubbub_ctx *) ctx;
 	xmlNode *chld = (xmlNode *) child;
 	xmlNode *ref = (xmlNode *) ref_child;
+	bool merge = chld->type == XML_TEXT_NODE && ref->prev != NULL &&
+			ref->prev->type == XML_TEXT_NODE;
 
-	if (chld->type == XML_TEXT_NODE && ref->prev != NULL && 
-			ref->prev->type == XML_TEXT_NODE) {
+	if ((xmlNode *) parent != c->body)
+		note_change(c, (xmlNode *) parent);
+	else if (ref != c->pending)
+		note_change(c, ref);
+	else if (merge)
+		note_change(c, ref->prev);
+
+	if (merge) {
 		/* Clone text node, as it'll be freed by libxml */
 		chld = xmlCopyNode(chld, 0);
 		if (chld == NULL)
@@ -564,6 +1081,10 @@ hubbub_error insert_before(void *ctx, void *parent, void *child,
 	if (*result == NULL)
 		return HUBBUB_NOMEM;
 
+	/* foster parented before an open table, so may be open itself */
+	if (ref == c->pending)
+		c->pending = *result;
+
 	ref_node(ctx, *result);
 
 	return HUBBUB_OK;
@@ -571,8 +1092,14 @@ hubbub_error insert_before(void *ctx, void *parent, void *child,
 
 hubbub_error remove_child(void *ctx, void *parent, void *child, void **result)
 {
+	hubbub_ctx *c = (hubbub_ctx *) ctx;
 	xmlNode *chld = (xmlNode *) child;
 
+	if (chld == c->pending)
+		c->pending = chld->next;
+	else
+		note_change(c, chld);
+
 	xmlUnlinkNode(chld);
 
 	*result = child;
@@ -598,10 +1125,14 @@ hubbub_error clone_node(void *ctx, void *node, bool deep, void **result)
 
 hubbub_error reparent_children(void *ctx, void *node, void *new_parent)
 {
+	hubbub_ctx *c = (hubbub_ctx *) ctx;
 	xmlNode *n = (xmlNode *) node;
 	xmlNode *p = (xmlNode *) new_parent;
 	xmlNode *child;
 
+	note_change(c, n);
+	note_change(c, p);
+
 	for (child = n->children; child != NULL; ) {
 		xmlNode *next = child->next;
 
@@ -712,36 +1243,34 @@ hubbub_error add_attributes(void *ctx, void *node,
 	xmlNode *n = (xmlNode *) node;
 	uint32_t attr;
 
+	/* from repeated html or body tags; they would restyle everything */
+	if (c->body != NULL && (n == c->body || n == c->body->parent))
+		c->changed = true;
+	else
+		note_change(c, n);
+
 	for (attr = 0; attr < n_attributes; attr++) {
 		xmlAttr *prop;
-		char *name, *value;
+		const xmlChar *name, *value;
 
-		name = c_string_from_hubbub_string(c, &attributes[attr].name);
+		name = name_from_hubbub_string(c, &attributes[attr].name);
 		if (name == NULL)
 			return HUBBUB_NOMEM;
 
-		value = c_string_from_hubbub_string(c, &attributes[attr].value);
-		if (value == NULL) {
-			free(name);
+		value = value_from_hubbub_string(c, &attributes[attr].value);
+		if (value == NULL)
 			return HUBBUB_NOMEM;
-		}
 
 		if (attributes[attr].ns != HUBBUB_NS_NULL && 
 				c->namespaces[0] != NULL) {
 			prop = xmlNewNsProp(n, 
 					c->namespaces[attributes[attr].ns - 1],
-					BAD_CAST name, BAD_CAST value);
+					name, value);
 		} else {
-			prop = xmlNewProp(n, BAD_CAST name, BAD_CAST value);
+			prop = xmlNewProp(n, name, value);
 		}
-		if (prop == NULL) {
-			free(value);
-			free(name);
+		if (prop == NULL)
 			return HUBBUB_NOMEM;
-		}
-
-		free(value);
-		free(name);
 	}
 
 	return HUBBUB_OK;
@@ -772,15 +1301,22 @@ hubbub_error change_encoding(void *ctx, const char *charset)
 	uint32_t source;
 	const char *name;
 
-	/* If we have an encoding here, it means we are *certain* */
-	if (c->encoding != NULL) {
+	/* If we have an encoding here, it means we are *certain*, unless it
+	 * was only sniffed */
+	if (c->encoding != NULL && !c->tentative) {
+		return HUBBUB_OK;
+	}
+
+	/* Too late to reparse: boxes have been built from the tree */
+	if (c->fixed_encoding) {
+		LOG(("ignoring change to %s", charset));
 		return HUBBUB_OK;
 	}
 
 	/* Find the confidence otherwise (can only be from a BOM) */
 	name = hubbub_parser_read_charset(c->parser, &source);
 
-	if (source == HUBBUB_CHARSET_CONFIDENT) {
+	if (source == HUBBUB_CHARSET_CONFIDENT && !c->tentative) {
 		c->encoding_source = ENCODING_SOURCE_DETECTED;
 		c->encoding = (char *) charset;
 		return HUBBUB_OK;
@@ -798,6 +1334,7 @@ hubbub_error change_encoding(void *ctx, const char *charset)
 	 * charset is in fact correct */
 	c->encoding = charset;
 	c->encoding_source = ENCODING_SOURCE_META;
+	c->tentative = false;
 
 	/* Equal encodings will have the same string pointers */
 	return (charset == name) ? HUBBUB_OK : HUBBUB_ENCODINGCHANGE;
@@ -47,6 +47,7 @@
 #include "desktop/scroll.h"
 #include "render/box.h"
 #include "render/font.h"
+#include "render/font_cache.h"
 #include "render/form.h"
 #include "render/layout.h"
 #include "render/table.h"
@@ -59,6 +60,13 @@
 
 #define AUTO INT_MIN
 
+/** A sequence of boxes held back from layout by progressive layout */
+struct layout_held {
+	struct box *box;	/**< Box after which the tree was cut */
+	struct box *next;	/**< Original box->next */
+	struct box *last;	/**< Original box->parent->last */
+};
+
 
 static bool layout_block_context(struct box *block, int viewport_height,
 		struct content *content);
@@ -117,6 +125,9 @@ static bool layout_absolute(struct box *box, struct box *containing_block,
 static void layout_compute_offsets(struct box *box,
 		struct box *containing_block,
 		int *top, int *right, int *bottom, int *left);
+static bool layout_document_part(struct content *content, int width,
+		int height);
+static bool layout_hold_back(struct content *content, unsigned int budget);
 
 
 /**
@@ -126,16 +137,70 @@ static void layout_compute_offsets(struct box *box,
  * \param  width     available width
  * \param  height    available height
  * \return  true on success, false on memory exhaustion
+ *
+ * If content->data.html.layout_budget is non-zero, progressive layout is in
+ * use: only the start of the document is laid out, and the rest of the box
+ * tree is held back (detached) until the next call.  The budget is increased
+ * until the laid out part covers the available height, or the whole document
+ * has been laid out, in which case layout_budget is reset to 0.
  */
 
 bool layout_document(struct content *content, int width, int height)
 {
 	bool ret;
 	struct box *doc = content->data.html.layout;
-	const struct font_functions *font_func = content->data.html.font_func;
 
 	assert(content->type == CONTENT_HTML);
 
+	layout_release_held(content);
+
+	if (content->data.html.layout_budget == 0)
+		return layout_document_part(content, width, height);
+
+	while (1) {
+		if (!layout_hold_back(content,
+				content->data.html.layout_budget))
+			return false;
+
+		ret = layout_document_part(content, width, height);
+
+		if (!ret || content->data.html.layout_held_count == 0) {
+			/* failed, or whole document laid out */
+			content->data.html.layout_budget = 0;
+			break;
+		}
+
+		if (height <= doc->y + doc->descendant_y1)
+			/* viewport covered */
+			break;
+
+		layout_release_held(content);
+		content->data.html.layout_budget *= LAYOUT_BUDGET_GROWTH;
+	}
+
+	LOG(("budget %u, held %u", content->data.html.layout_budget,
+			content->data.html.layout_held_count));
+
+	return ret;
+}
+
+
+/**
+ * Calculate positions of the boxes currently in a document's box tree.
+ *
+ * \param  content   content of type CONTENT_HTML
+ * \param  width     available width
+ * \param  height    available height
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool layout_document_part(struct content *content, int width,
+		int height)
+{
+	bool ret;
+	struct box *doc = content->data.html.layout;
+	const struct font_functions *font_func = content->data.html.font_func;
+
 	layout_minmax_block(doc, font_func);
 
 	layout_block_find_dimensions(width, height, 0, 0, doc);
@@ -1987,8 +2052,7 @@ bool layout_line(struct box *first, int *width, int *y,
 		} else if (b->type == BOX_INLINE_END) {
 			b->width = 0;
 			if (b->space) {
-				/** \todo optimize out */
-				font_func->font_width(&fstyle, " ", 1,
+				font_cache_width(font_func, &fstyle, " ", 1,
 						&space_after);
 			} else {
 				space_after = 0;
@@ -2026,7 +2090,8 @@ bool layout_line(struct box *first, int *width, int *y,
 							data.select.items; o;
 							o = o->next) {
 						int opt_width;
-						font_func->font_width(&fstyle,
+						font_cache_width(font_func,
+								&fstyle,
 								o->text,
 								strlen(o->text),
 								&opt_width);
@@ -2038,15 +2103,14 @@ bool layout_line(struct box *first, int *width, int *y,
 					if (option_core_select_menu)
 						b->width += SCROLLBAR_WIDTH;
 				} else {
-					font_func->font_width(&fstyle, b->text,
-						b->length, &b->width);
+					font_cache_width(font_func, &fstyle,
+						b->text, b->length, &b->width);
 				}
 			}
 
 			x += b->width;
 			if (b->space)
-				/** \todo optimize out */
-				font_func->font_width(&fstyle, " ", 1,
+				font_cache_width(font_func, &fstyle, " ", 1,
 						&space_after);
 			else
 				space_after = 0;
@@ -2194,9 +2258,9 @@ bool layout_line(struct box *first, int *width, int *y,
 				if (b->space) {
 					font_plot_style_from_css(b->style,
 							&fstyle);
-					/** \todo handle errors, optimize */
-					font_func->font_width(&fstyle, " ", 1,
-							&space_after);
+					/** \todo handle errors */
+					font_cache_width(font_func, &fstyle,
+							" ", 1, &space_after);
 				}
 			} else
 				space_after = 0;
@@ -2347,8 +2411,8 @@ bool layout_line(struct box *first, int *width, int *y,
 		else {
 			font_plot_style_from_css(split_box->style, &fstyle);
 			/** \todo handle errors */
-			font_func->font_width(&fstyle, split_box->text,
-					space, &w);
+			font_cache_width(font_func, &fstyle,
+					split_box->text, space, &w);
 		}
 
 		LOG(("splitting: split_box %p \"%.*s\", space %zu, w %i, "
@@ -2655,7 +2719,8 @@ struct box *layout_minmax_line(struct box *first,
 			if (0 < fixed)
 				max += fixed;
 			if (b->next && b->space) {
-				font_func->font_width(&fstyle, " ", 1, &width);
+				font_cache_width(font_func, &fstyle, " ", 1,
+						&width);
 				max += width;
 			}
 			continue;
@@ -2681,7 +2746,8 @@ struct box *layout_minmax_line(struct box *first,
 							data.select.items; o;
 							o = o->next) {
 						int opt_width;
-						font_func->font_width(&fstyle,
+						font_cache_width(font_func,
+								&fstyle,
 								o->text,
 								strlen(o->text),
 								&opt_width);
@@ -2695,13 +2761,14 @@ struct box *layout_minmax_line(struct box *first,
 						b->width += SCROLLBAR_WIDTH;
 
 				} else {
-					font_func->font_width(&fstyle, b->text,
-						b->length, &b->width);
+					font_cache_width(font_func, &fstyle,
+						b->text, b->length, &b->width);
 				}
 			}
 			max += b->width;
 			if (b->next && b->space) {
-				font_func->font_width(&fstyle, " ", 1, &width);
+				font_cache_width(font_func, &fstyle, " ", 1,
+						&width);
 				max += width;
 			}
 
@@ -2711,8 +2778,8 @@ struct box *layout_minmax_line(struct box *first,
 				for (j = i; j != b->length &&
 						b->text[j] != ' '; j++)
 					;
-				font_func->font_width(&fstyle, b->text + i,
-						j - i, &width);
+				font_cache_width(font_func, &fstyle,
+						b->text + i, j - i, &width);
 				if (min < width)
 					min = width;
 				i = j + 1;
@@ -3437,6 +3504,7 @@ void layout_minmax_table(struct box *table,
 		const struct font_functions *font_func)
 {
 	unsigned int i, j;
+	unsigned int spanning_cells = 0;
 	int border_spacing_h = 0;
 	int table_min = 0, table_max = 0;
 	int extra_fixed = 0;
@@ -3470,17 +3538,23 @@ void layout_minmax_table(struct box *table,
 		border_spacing_h = FIXTOINT(nscss_len2px(h, hu, table->style));
 	}
 
-	/* 1st pass: consider cells with colspan 1 only */
+	/* 1st pass: find min / max of every cell, and use cells with
+	 * colspan 1 only to update the columns */
 	for (row_group = table->children; row_group; row_group =row_group->next)
 	for (row = row_group->children; row; row = row->next)
 	for (cell = row->children; cell; cell = cell->next) {
 		assert(cell->type == BOX_TABLE_CELL);
 		assert(cell->style);
 
-		if (cell->columns != 1)
+		/* a cell's min / max doesn't depend on the columns, so
+		 * every cell can be measured here in one walk */
+		layout_minmax_block(cell, font_func);
+
+		if (cell->columns != 1) {
+			spanning_cells++;
 			continue;
+		}
 
-		layout_minmax_block(cell, font_func);
 		i = cell->start_column;
 
 		if (col[i].positioned)
@@ -3493,17 +3567,19 @@ void layout_minmax_table(struct box *table,
 			col[i].max = cell->max_width;
 	}
 
-	/* 2nd pass: cells which span multiple columns */
-	for (row_group = table->children; row_group; row_group =row_group->next)
-	for (row = row_group->children; row; row = row->next)
-	for (cell = row->children; cell; cell = cell->next) {
+	/* 2nd pass: cells which span multiple columns, if there are any
+	 * (tables of many cells, e.g. data dumps, rarely have them) */
+	for (row_group = table->children; row_group && spanning_cells;
+			row_group = row_group->next)
+	for (row = row_group->children; row && spanning_cells; row = row->next)
+	for (cell = row->children; cell && spanning_cells; cell = cell->next) {
 		unsigned int flexible_columns = 0;
 		int min = 0, max = 0, fixed_width = 0, extra;
 
 		if (cell->columns == 1)
 			continue;
 
-		layout_minmax_block(cell, font_func);
+		spanning_cells--;
 		i = cell->start_column;
 
 		/* find min width so far of spanned columns, and count
@@ -3728,7 +3804,7 @@ void layout_lists(struct box *box,
 				if (marker->width == UNKNOWN_WIDTH) {
 					font_plot_style_from_css(marker->style,
 							&fstyle);
-					font_func->font_width(&fstyle,
+					font_cache_width(font_func, &fstyle,
 							marker->text,
 							marker->length,
 							&marker->width);
@@ -4546,4 +4622,118 @@ void layout_calculate_descendant_bboxes(struct box *box)
 		if (box->descendant_y1 < child->y + child->descendant_y1)
 			box->descendant_y1 = child->y + child->descendant_y1;
 	}
+
+	/* children are in their final positions, so index them for
+	 * box_at_point() and redraw */
+	box_index_build(box);
+}
+
+
+/**
+ * Cut the box tree of a document after a number of boxes, for progressive
+ * layout.
+ *
+ * \param  content  content of type CONTENT_HTML, with nothing held back
+ * \param  budget   number of boxes to leave in the tree
+ * \return  true on success, false on memory exhaustion
+ *
+ * Boxes are counted in the order layout_block_context() visits them, with
+ * the children of inline containers included.  Tables and the contents of
+ * inline containers are never cut.  The tree is cut after the box which
+ * exhausts the budget, and after each of its ancestors, so the remaining
+ * tree is a well formed document prefix.
+ */
+
+bool layout_hold_back(struct content *content, unsigned int budget)
+{
+	struct box *doc = content->data.html.layout;
+	struct box *box, *child;
+	struct layout_held *held;
+	unsigned int count = 0, n = 0;
+
+	assert(content->data.html.layout_held_count == 0);
+
+	/* find the box that exhausts the budget */
+	box = doc->children;
+	while (box) {
+		count++;
+		if (box->type == BOX_INLINE_CONTAINER)
+			for (child = box->children; child; child = child->next)
+				count++;
+
+		if (budget <= count)
+			break;
+
+		if (box->type == BOX_BLOCK && !box->object && box->children) {
+			box = box->children;
+			continue;
+		}
+
+		while (box != doc && !box->next)
+			box = box->parent;
+		box = (box == doc) ? NULL : box->next;
+	}
+
+	if (box == NULL)
+		/* whole document fits */
+		return true;
+
+	for (child = box; child != doc; child = child->parent)
+		if (child->next)
+			n++;
+	if (n == 0)
+		return true;
+
+	held = talloc_array(content, struct layout_held, n);
+	if (!held)
+		return false;
+
+	/* detach everything after the box, at every level */
+	for (n = 0; box != doc; box = box->parent) {
+		if (!box->next)
+			continue;
+
+		held[n].box = box;
+		held[n].next = box->next;
+		held[n].last = box->parent->last;
+		n++;
+
+		box->next = NULL;
+		box->parent->last = box;
+		box_index_discard(box->parent);
+	}
+
+	content->data.html.layout_held = held;
+	content->data.html.layout_held_count = n;
+
+	return true;
+}
+
+
+/**
+ * Return boxes held back by layout_hold_back() to a document's box tree.
+ *
+ * \param  content  content of type CONTENT_HTML
+ */
+
+void layout_release_held(struct content *content)
+{
+	struct layout_held *held = content->data.html.layout_held;
+	struct box *b;
+	unsigned int i;
+
+	for (i = 0; i != content->data.html.layout_held_count; i++) {
+		held[i].box->next = held[i].next;
+		held[i].box->parent->last = held[i].last;
+		box_index_discard(held[i].box->parent);
+
+		/* min / max widths of ancestors only covered the part of
+		 * the tree which was present */
+		for (b = held[i].box->parent; b; b = b->parent)
+			b->max_width = UNKNOWN_MAX_WIDTH;
+	}
+
+	talloc_free(held);
+	content->data.html.layout_held = NULL;
+	content->data.html.layout_held_count = 0;
 }
@@ -29,7 +29,13 @@
 
 struct box;
 
+/** Initial number of boxes laid out by progressive layout */
+#define LAYOUT_BUDGET_INITIAL 2000
+/** Factor by which the progressive layout budget grows at each step */
+#define LAYOUT_BUDGET_GROWTH 4
+
 bool layout_document(struct content *content, int width, int height);
+void layout_release_held(struct content *content);
 bool layout_inline_container(struct box *box, int width,
 		struct box *cont, int cx, int cy, struct content *content);
 void layout_calculate_descendant_bboxes(struct box *box);
@@ -19,6 +19,7 @@
 #ifndef _NETSURF_RENDER_PARSER_BINDING_H_
 #define _NETSURF_RENDER_PARSER_BINDING_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <libxml/tree.h>
@@ -45,14 +46,23 @@ typedef enum binding_quirks_mode {
 	BINDING_QUIRKS_MODE_FULL
 } binding_quirks_mode;
 
-binding_error binding_create_tree(void *arena, const char *charset, void **ctx);
+/** Length of the start of a document in which its encoding is sniffed */
+#define BINDING_SNIFF_SIZE 1024
+
+binding_error binding_create_tree(void *arena, const char *charset,
+		bool tentative, void **ctx);
 binding_error binding_destroy_tree(void *ctx);
 
 binding_error binding_parse_chunk(void *ctx, const uint8_t *data, size_t len);
 binding_error binding_parse_completed(void *ctx);
 
+const char *binding_sniff_encoding(const uint8_t *data, size_t len,
+		bool *certain);
 const char *binding_get_encoding(void *ctx, binding_encoding_source *source);
 xmlDocPtr binding_get_document(void *ctx, binding_quirks_mode *quirks);
+binding_quirks_mode binding_get_quirks(void *ctx);
+xmlNodePtr binding_get_body(void *ctx, xmlNodePtr *pending, bool *changed);
+void binding_fix_encoding(void *ctx);
 
 struct form *binding_get_forms(void *ctx);
 struct form_control *binding_get_control_for_node(void *ctx, xmlNodePtr node);
@@ -66,6 +66,12 @@ static plot_font_style_t textplain_style = {
 static int textplain_tab_width = 256;  /* try for a sensible default */
 
 static bool textplain_create_internal(struct content *c, const char *encoding);
+static bool textplain_index(struct content *c, bool final);
+static bool textplain_add_logical_line(struct content *c);
+static bool textplain_wrap_line(struct content *c,
+		const struct textplain_logical_line *logical, size_t columns);
+static bool textplain_add_physical_line(struct content *c,
+		size_t start, size_t length);
 static int textplain_coord_from_offset(const char *text, size_t offset,
 	size_t length);
 static float textplain_line_height(void);
@@ -126,8 +132,16 @@ bool textplain_create_internal(struct content *c, const char *encoding)
 	c->data.textplain.utf8_data = utf8_data;
 	c->data.textplain.utf8_data_size = 0;
 	c->data.textplain.utf8_data_allocated = CHUNK;
+	c->data.textplain.logical_line = 0;
+	c->data.textplain.logical_line_count = 0;
+	c->data.textplain.logical_line_allocated = 0;
+	c->data.textplain.indexed = 0;
+	c->data.textplain.open_line.start = 0;
+	c->data.textplain.open_line.length = 0;
+	c->data.textplain.open_line.columns = 0;
 	c->data.textplain.physical_line = 0;
 	c->data.textplain.physical_line_count = 0;
+	c->data.textplain.physical_line_allocated = 0;
 	c->data.textplain.formatted_width = 0;
 
 	return true;
@@ -169,7 +183,9 @@ bool textplain_process_data(struct content *c,
 				utf8_data_allocated - outbytesleft;
 
 		if (count == (size_t)(-1) && errno == E2BIG) {
-			size_t allocated = CHUNK +
+			/* grow geometrically, so that large files aren't
+			 * copied over and over */
+			size_t allocated = 2 *
 					c->data.textplain.utf8_data_allocated;
 			char *utf8_data = talloc_realloc(c,
 					c->data.textplain.utf8_data,
@@ -195,6 +211,9 @@ bool textplain_process_data(struct content *c,
 	} while (!(c->data.textplain.converted == source_size ||
 			(count == (size_t)(-1) && errno == EINVAL)));
 
+	if (!textplain_index(c, false))
+		goto no_memory;
+
 	return true;
 
 no_memory:
@@ -210,6 +229,14 @@ no_memory:
 
 bool textplain_convert(struct content *c)
 {
+	union content_msg_data msg_data;
+
+	if (!textplain_index(c, true)) {
+		msg_data.error = messages_get("NoMemory");
+		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
+		return false;
+	}
+
 	iconv_close(c->data.textplain.iconv_cd);
 	c->data.textplain.iconv_cd = 0;
 
@@ -220,21 +247,106 @@ bool textplain_convert(struct content *c)
 }
 
 
+/**
+ * Find the line breaks in text which has been converted since last time.
+ *
+ * \param  c      content of type CONTENT_TEXTPLAIN
+ * \param  final  all of the text has been converted
+ * \return  true on success, false on memory exhaustion
+ *
+ * A line break at the end of the text is left until more arrives, as it
+ * may be the first of a CR/LF pair.
+ */
+
+bool textplain_index(struct content *c, bool final)
+{
+	struct content_textplain_data *text = &c->data.textplain;
+	const char *utf8_data = text->utf8_data;
+	size_t utf8_data_size = text->utf8_data_size;
+	struct textplain_logical_line *line = &text->open_line;
+	size_t i;
+
+	for (i = text->indexed; i != utf8_data_size; i++) {
+		size_t next_col;
+
+		if (utf8_data[i] == '\n' || utf8_data[i] == '\r') {
+			if (i + 1 == utf8_data_size && !final)
+				break;
+
+			line->length = i - line->start;
+			if (!textplain_add_logical_line(c)) {
+				text->indexed = i;
+				return false;
+			}
+
+			/* skip second char of CR/LF or LF/CR pair */
+			if (i + 1 < utf8_data_size &&
+				utf8_data[i+1] != utf8_data[i] &&
+				(utf8_data[i+1] == '\n' || utf8_data[i+1] == '\r'))
+				i++;
+
+			line->start = i + 1;
+			line->columns = 0;
+			continue;
+		}
+
+		/* as measured by textplain_wrap_line(), with tabs expanded
+		 * to the next tab stop */
+		next_col = line->columns + 1;
+		if (utf8_data[i] == '\t')
+			next_col = (next_col + TAB_WIDTH - 1) & ~(TAB_WIDTH - 1);
+		line->columns = next_col;
+	}
+
+	text->indexed = i;
+	line->length = i - line->start;
+
+	return true;
+}
+
+
+/**
+ * Add the open line to the completed lines of a CONTENT_TEXTPLAIN.
+ *
+ * \param  c  content of type CONTENT_TEXTPLAIN
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool textplain_add_logical_line(struct content *c)
+{
+	struct content_textplain_data *text = &c->data.textplain;
+
+	if (text->logical_line_count == text->logical_line_allocated) {
+		unsigned long allocated = 1024 +
+				2 * text->logical_line_allocated;
+		struct textplain_logical_line *line = talloc_realloc(c,
+				text->logical_line,
+				struct textplain_logical_line, allocated);
+		if (!line)
+			return false;
+		text->logical_line = line;
+		text->logical_line_allocated = allocated;
+	}
+
+	text->logical_line[text->logical_line_count++] = text->open_line;
+
+	return true;
+}
+
+
 /**
  * Reformat a CONTENT_TEXTPLAIN to a new width.
+ *
+ * Lines which fit the width are taken from the index built as the text was
+ * converted, so only those which must be wrapped are scanned again.
  */
 
 void textplain_reformat(struct content *c, int width, int height)
 {
-	char *utf8_data = c->data.textplain.utf8_data;
-	size_t utf8_data_size = c->data.textplain.utf8_data_size;
-	unsigned long line_count = 0;
-	struct textplain_line *line = c->data.textplain.physical_line;
-	struct textplain_line *line1;
-	size_t i, space, col;
+	struct content_textplain_data *text = &c->data.textplain;
+	unsigned long i, line_count;
 	size_t columns = 80;
 	int character_width;
-	size_t line_start;
 
 	/* compute available columns (assuming monospaced font) - use 8
 	 * characters for better accuracy */
@@ -243,74 +355,137 @@ void textplain_reformat(struct content *c, int width, int height)
 	columns = (width - MARGIN - MARGIN) * 8 / character_width;
 	textplain_tab_width = (TAB_WIDTH * character_width) / 8;
 
-	c->data.textplain.formatted_width = width;
+	text->formatted_width = width;
 
-	c->data.textplain.physical_line_count = 0;
+	text->physical_line_count = 0;
 
-	if (!line) {
-		c->data.textplain.physical_line = line =
-				talloc_array(c, struct textplain_line, 1024 + 3);
+	/* at least one physical line for each logical line, including the
+	 * open one */
+	line_count = text->logical_line_count + 1;
+	if (text->physical_line_allocated < line_count) {
+		struct textplain_line *line = talloc_realloc(c,
+				text->physical_line, struct textplain_line,
+				line_count + 3);
 		if (!line)
 			goto no_memory;
+		text->physical_line = line;
+		text->physical_line_allocated = line_count;
 	}
 
-	line[line_count++].start = line_start = 0;
+	for (i = 0; i != line_count; i++) {
+		const struct textplain_logical_line *logical =
+				i == text->logical_line_count ?
+				&text->open_line : &text->logical_line[i];
+
+		if (logical->columns < columns) {
+			if (!textplain_add_physical_line(c, logical->start,
+					logical->length))
+				goto no_memory;
+		} else {
+			if (!textplain_wrap_line(c, logical, columns))
+				goto no_memory;
+		}
+	}
+	text->physical_line[text->physical_line_count].start =
+			text->utf8_data_size;
+
+	c->width = width;
+	c->height = text->physical_line_count * textplain_line_height() +
+			MARGIN + MARGIN;
+
+	return;
+
+no_memory:
+	LOG(("out of memory (line_count %lu)", text->physical_line_count));
+	text->physical_line_count = 0;
+	return;
+}
+
+
+/**
+ * Wrap a line which is too long for the available width.
+ *
+ * \param  c        content of type CONTENT_TEXTPLAIN
+ * \param  logical  line to wrap
+ * \param  columns  available columns
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool textplain_wrap_line(struct content *c,
+		const struct textplain_logical_line *logical, size_t columns)
+{
+	const char *utf8_data = c->data.textplain.utf8_data;
+	size_t end = logical->start + logical->length;
+	size_t line_start = logical->start;
+	size_t i, space, col, length;
+
 	space = 0;
-	for (i = 0, col = 0; i != utf8_data_size; i++) {
-		bool term = (utf8_data[i] == '\n' || utf8_data[i] == '\r');
+	for (i = line_start, col = 0; i != end; i++) {
 		size_t next_col = col + 1;
 
 		if (utf8_data[i] == '\t')
 			next_col = (next_col + TAB_WIDTH - 1) & ~(TAB_WIDTH - 1);
 
-		if (term || next_col >= columns) {
-			if (line_count % 1024 == 0) {
-				line1 = talloc_realloc(c, line,
-						struct textplain_line, line_count + 1024 + 3);
-				if (!line1)
-					goto no_memory;
-				c->data.textplain.physical_line =
-						line = line1;
-			}
-			if (term) {
-				line[line_count-1].length = i - line_start;
-
-				/* skip second char of CR/LF or LF/CR pair */
-				if (i + 1 < utf8_data_size &&
-					utf8_data[i+1] != utf8_data[i] &&
-					(utf8_data[i+1] == '\n' || utf8_data[i+1] == '\r'))
-					i++;
-			}
-			else {
-				if (space) {
-					/* break at last space in line */
-					i = space;
-					line[line_count-1].length = (i + 1) - line_start;
-				}
-				else
-					line[line_count-1].length = i - line_start;
+		if (next_col >= columns) {
+			if (space) {
+				/* break at last space in line */
+				i = space;
+				length = (i + 1) - line_start;
 			}
-			line[line_count++].start = line_start = i + 1;
+			else
+				length = i - line_start;
+
+			if (!textplain_add_physical_line(c, line_start,
+					length))
+				return false;
+
+			line_start = i + 1;
 			col = 0;
 			space = 0;
 		} else {
-			col++;
+			col = next_col;
 			if (utf8_data[i] == ' ')
 				space = i;
 		}
 	}
-	line[line_count-1].length = i - line[line_count-1].start;
-	line[line_count].start = utf8_data_size;
 
-	c->data.textplain.physical_line_count = line_count;
-	c->width = width;
-	c->height = line_count * textplain_line_height() + MARGIN + MARGIN;
+	return textplain_add_physical_line(c, line_start, end - line_start);
+}
 
-	return;
 
-no_memory:
-	LOG(("out of memory (line_count %lu)", line_count));
-	return;
+/**
+ * Add a line to the display of a CONTENT_TEXTPLAIN.
+ *
+ * \param  c       content of type CONTENT_TEXTPLAIN
+ * \param  start   offset of line in utf8_data
+ * \param  length  length of line
+ * \return  true on success, false on memory exhaustion
+ */
+
+bool textplain_add_physical_line(struct content *c,
+		size_t start, size_t length)
+{
+	struct content_textplain_data *text = &c->data.textplain;
+	struct textplain_line *line;
+
+	if (text->physical_line_count == text->physical_line_allocated) {
+		unsigned long allocated = 1024 +
+				2 * text->physical_line_allocated;
+
+		/* room for a terminating entry, and more */
+		line = talloc_realloc(c, text->physical_line,
+				struct textplain_line, allocated + 3);
+		if (!line)
+			return false;
+		text->physical_line = line;
+		text->physical_line_allocated = allocated;
+	}
+
+	line = &text->physical_line[text->physical_line_count++];
+	line->start = start;
+	line->length = length;
+
+	return true;
 }
 
 
@@ -634,6 +809,7 @@ int textplain_find_line(hlcache_handle *h, unsigned offset)
 	struct textplain_line *line;
 	int nlines;
 	int lineno = 0;
+	int hi;
 
 	assert(c != NULL);
 	assert(c->type == CONTENT_TEXTPLAIN);
@@ -644,9 +820,16 @@ int textplain_find_line(hlcache_handle *h, unsigned offset)
 	if (offset > c->data.textplain.utf8_data_size)
 		return -1;
 
-/* \todo - implement binary search here */
-	while (lineno < nlines && line[lineno].start < offset)
-		lineno++;
+	/* find the first line starting at or after offset */
+	hi = nlines;
+	while (lineno < hi) {
+		int mid = lineno + (hi - lineno) / 2;
+
+		if (line[mid].start < offset)
+			lineno = mid + 1;
+		else
+			hi = mid;
+	}
 	if (line[lineno].start > offset)
 		lineno--;
 
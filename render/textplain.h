@@ -36,6 +36,13 @@ struct textplain_line {
 	size_t	length;
 };
 
+/** A line of the text as separated by line breaks in the source. */
+struct textplain_logical_line {
+	size_t start;		/**< Offset in utf8_data */
+	size_t length;		/**< Length, excluding the line break */
+	size_t columns;		/**< Columns needed to display unwrapped */
+};
+
 struct content_textplain_data {
 	char *encoding;
 	iconv_t iconv_cd;
@@ -43,7 +50,16 @@ struct content_textplain_data {
 	char *utf8_data;
 	size_t utf8_data_size;
 	size_t utf8_data_allocated;
+	/** Lines completed so far, indexed as the data is converted. */
+	struct textplain_logical_line *logical_line;
+	unsigned long logical_line_count;
+	unsigned long logical_line_allocated;
+	/** Length of utf8_data which has been indexed. */
+	size_t indexed;
+	/** The line being indexed, which has no line break yet. */
+	struct textplain_logical_line open_line;
 	unsigned long physical_line_count;
+	unsigned long physical_line_allocated;
 	struct textplain_line *physical_line;
 	int formatted_width;
 };
@@ -37,6 +37,7 @@
 #include "oslib/wimp.h"
 #include "content/content.h"
 #include "image/bitmap.h"
+#include "image/scale_cache.h"
 #include "riscos/bitmap.h"
 #include "riscos/image.h"
 #include "riscos/options.h"
@@ -570,6 +571,8 @@ void bitmap_destroy(void *vbitmap)
 
 	assert(bitmap);
 
+	scale_cache_invalidate(bitmap);
+
 	/* delink from list */
 	bitmap_maintenance = true;
 	if (bitmap_head == bitmap)
@@ -778,6 +781,7 @@ bool bitmap_save(void *vbitmap, const char *path, unsigned flags)
 void bitmap_modified(void *vbitmap) {
 	struct bitmap *bitmap = (struct bitmap *) vbitmap;
 	bitmap->state |= BITMAP_MODIFIED;
+	scale_cache_invalidate(bitmap);
 }
 
 
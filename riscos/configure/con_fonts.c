@@ -20,6 +20,7 @@
 #include "css/css.h"
 #include "desktop/options.h"
 #include "desktop/plot_style.h"
+#include "render/font_cache.h"
 #include "riscos/dialog.h"
 #include "riscos/gui.h"
 #include "riscos/menus.h"
@@ -168,6 +169,8 @@ bool ro_gui_options_fonts_ok(wimp_w w)
 
 	option_font_default = i;
 
+	font_cache_flush();
+
 	ro_gui_save_options();
 	return true;
 }
@@ -42,6 +42,7 @@
 #include "desktop/save_text.h"
 #include "desktop/selection.h"
 #include "image/bitmap.h"
+#include "image/image_cache.h"
 #include "render/box.h"
 #include "render/form.h"
 #include "riscos/dialog.h"
@@ -1451,7 +1452,9 @@ bool ro_gui_save_create_thumbnail(hlcache_handle *h, const char *name)
 		LOG(("Thumbnail initialisation failed."));
 		return false;
 	}
+	image_cache_set_synchronous(true);
 	thumbnail_create(h, bitmap, NULL);
+	image_cache_set_synchronous(false);
 	area = thumbnail_convert_8bpp(bitmap);
 	bitmap_destroy(bitmap);
 	if (!area) {
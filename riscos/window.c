@@ -50,6 +50,7 @@
 #include "desktop/textinput.h"
 #include "desktop/tree.h"
 #include "desktop/gui.h"
+#include "image/image_cache.h"
 #include "render/box.h"
 #include "render/form.h"
 #include "riscos/bitmap.h"
@@ -3367,7 +3368,9 @@ void ro_gui_window_iconise(struct gui_window *g,
 		LOG(("Thumbnail initialisation failed."));
 		return;
 	}
+	image_cache_set_synchronous(true);
 	thumbnail_create(h, bitmap, NULL);
+	image_cache_set_synchronous(false);
 	if (overlay)
 		bitmap_overlay_sprite(bitmap, overlay);
 	area = thumbnail_convert_8bpp(bitmap);
@@ -0,0 +1,591 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Image decoder benchmark.
+ *
+ * Usage: imagebench [-c chunk] [-r runs] file-or-directory...
+ *
+ * Each file is passed through the create, process_data and convert entries
+ * of the content handler for its extension, in chunks as if fetched, and
+ * then fully decoded.  Totals are reported per format:
+ *
+ *  - source MB/s and decoded megapixels/s, over CPU time
+ *  - peak size of bitmaps in use at once
+ *  - heap allocations per decode (glibc only)
+ *  - peak RSS of the process once the format is done
+ *
+ * The content layer, bitmaps and plotters are stubs, so only the decoders
+ * are measured.
+ */
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "content/content_protected.h"
+#include "content/hlcache.h"
+#include "desktop/options.h"
+#include "desktop/plotters.h"
+#include "image/bitmap.h"
+#include "image/image_cache.h"
+#ifdef WITH_JPEG
+#include "image/jpeg.h"
+#endif
+#ifdef WITH_GIF
+#include "image/gif.h"
+#endif
+#ifdef WITH_BMP
+#include "image/bmp.h"
+#include "image/ico.h"
+#endif
+#ifdef WITH_PNG
+#include "image/png.h"
+#endif
+#ifdef WITH_MNG
+#include "image/mng.h"
+#endif
+#include "utils/messages.h"
+#include "utils/utils.h"
+
+/** Content handler entries used by the benchmark */
+struct bench_format {
+	const char *name;
+	const char *extensions[3];
+	bool (*create)(struct content *c, const struct http_parameter *params);
+	bool (*process_data)(struct content *c, const char *data,
+			unsigned int size);
+	bool (*convert)(struct content *c);
+	void (*destroy)(struct content *c);
+	/* totals */
+	unsigned int files;
+	unsigned int failures;
+	unsigned int decodes;
+	size_t bytes;
+	double pixels;
+	double seconds;
+	unsigned long allocations;
+	size_t peak_bitmaps;
+	long peak_rss;
+};
+
+static struct bench_format bench_formats[] = {
+#ifdef WITH_JPEG
+	{ "JPEG", { "jpg", "jpeg", 0 }, nsjpeg_create, nsjpeg_process_data,
+			nsjpeg_convert, nsjpeg_destroy },
+#endif
+#ifdef WITH_PNG
+	{ "PNG", { "png", 0, 0 }, nspng_create, nspng_process_data,
+			nspng_convert, nspng_destroy },
+#endif
+#ifdef WITH_GIF
+	{ "GIF", { "gif", 0, 0 }, nsgif_create, nsgif_process_data,
+			nsgif_convert, nsgif_destroy },
+#endif
+#ifdef WITH_BMP
+	{ "BMP", { "bmp", 0, 0 }, nsbmp_create, 0,
+			nsbmp_convert, nsbmp_destroy },
+	{ "ICO", { "ico", 0, 0 }, nsico_create, 0,
+			nsico_convert, nsico_destroy },
+#endif
+#ifdef WITH_MNG
+	{ "MNG", { "mng", "jng", 0 }, nsmng_create, nsmng_process_data,
+			nsmng_convert, nsmng_destroy },
+#endif
+};
+
+#define BENCH_FORMATS (sizeof bench_formats / sizeof bench_formats[0])
+
+/** Source data received so far by the content being decoded */
+static const char *bench_source;
+static unsigned long bench_source_size;
+/** Size of bitmaps in existence, and the peak since last reset */
+static size_t bench_bitmaps, bench_peak_bitmaps;
+/** Heap allocations made */
+static unsigned long bench_allocations;
+
+static void bench_path(const char *path, size_t chunk, int runs);
+static void bench_file(const char *path, size_t chunk, int runs);
+static struct bench_format *bench_find_format(const char *path);
+static bool bench_decode(struct bench_format *format, const char *data,
+		size_t size, size_t chunk);
+static void bench_report(void);
+
+
+int main(int argc, char **argv)
+{
+	size_t chunk = 4096;
+	int runs = 1;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			chunk = strtoul(argv[++i], 0, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			runs = atoi(argv[++i]);
+		else
+			break;
+	}
+
+	if (i == argc || chunk == 0 || runs <= 0) {
+		fprintf(stderr, "Usage: %s [-c chunk] [-r runs] "
+				"file-or-directory...\n", argv[0]);
+		return 1;
+	}
+
+	/* decode in the caller, rather than in scheduled slices */
+	image_cache_set_synchronous(true);
+
+	for (; i != argc; i++)
+		bench_path(argv[i], chunk, runs);
+
+	bench_report();
+
+	return 0;
+}
+
+
+/**
+ * Benchmark a file, or every file in a directory tree.
+ */
+
+void bench_path(const char *path, size_t chunk, int runs)
+{
+	struct dirent *entry;
+	struct stat st;
+	char *child;
+	DIR *dir;
+
+	if (stat(path, &st) != 0) {
+		perror(path);
+		return;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		bench_file(path, chunk, runs);
+		return;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		if (child == NULL)
+			break;
+		sprintf(child, "%s/%s", path, entry->d_name);
+		bench_path(child, chunk, runs);
+		free(child);
+	}
+
+	closedir(dir);
+}
+
+
+/**
+ * Benchmark a file, if its extension is of a known format.
+ */
+
+void bench_file(const char *path, size_t chunk, int runs)
+{
+	struct bench_format *format = bench_find_format(path);
+	struct rusage usage;
+	unsigned long allocations;
+	clock_t start;
+	char *data;
+	long size;
+	FILE *fp;
+	int run;
+	bool ok = true;
+
+	if (format == NULL)
+		return;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		perror(path);
+		return;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(size > 0 ? size : 1);
+	if (data == NULL || fread(data, 1, size, fp) != (size_t) size) {
+		fprintf(stderr, "%s: read failed\n", path);
+		free(data);
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+
+	bench_peak_bitmaps = bench_bitmaps;
+	allocations = bench_allocations;
+	start = clock();
+
+	for (run = 0; run != runs && ok; run++)
+		ok = bench_decode(format, data, size, chunk);
+
+	if (!ok) {
+		fprintf(stderr, "%s: decode failed\n", path);
+		format->failures++;
+	} else {
+		format->files++;
+		format->decodes += runs;
+		format->bytes += (size_t) size * runs;
+		format->seconds += (double) (clock() - start) /
+				CLOCKS_PER_SEC;
+		format->allocations += bench_allocations - allocations;
+		if (format->peak_bitmaps < bench_peak_bitmaps)
+			format->peak_bitmaps = bench_peak_bitmaps;
+	}
+
+	getrusage(RUSAGE_SELF, &usage);
+	format->peak_rss = usage.ru_maxrss;
+
+	free(data);
+}
+
+
+/**
+ * Find the format of a file from its extension.
+ */
+
+struct bench_format *bench_find_format(const char *path)
+{
+	const char *dot = strrchr(path, '.');
+	unsigned int i, j;
+
+	if (dot == NULL)
+		return NULL;
+
+	for (i = 0; i != BENCH_FORMATS; i++)
+		for (j = 0; bench_formats[i].extensions[j] != NULL; j++)
+			if (strcasecmp(dot + 1,
+					bench_formats[i].extensions[j]) == 0)
+				return &bench_formats[i];
+
+	return NULL;
+}
+
+
+/**
+ * Pass an image through a content handler and decode it.
+ *
+ * \return true on success, false if the handler failed
+ */
+
+bool bench_decode(struct bench_format *format, const char *data,
+		size_t size, size_t chunk)
+{
+	struct content *c;
+	size_t offset, length;
+	bool ok = true;
+
+	c = calloc(1, sizeof *c);
+	if (c == NULL)
+		return false;
+	c->status = CONTENT_STATUS_LOADING;
+
+	bench_source = data;
+	bench_source_size = 0;
+
+	if (!format->create(c, NULL)) {
+		free(c);
+		return false;
+	}
+
+	for (offset = 0; offset < size && ok; offset += chunk) {
+		length = size - offset < chunk ? size - offset : chunk;
+		bench_source_size = offset + length;
+		if (format->process_data != NULL)
+			ok = format->process_data(c, data + offset, length);
+	}
+
+	if (ok)
+		ok = format->convert(c);
+
+	if (ok) {
+		if (c->image_cache != NULL && !image_cache_get_bitmap(c))
+			ok = false;
+		else
+			format->pixels += (double) c->width * c->height;
+	}
+
+	format->destroy(c);
+	free(c);
+
+	return ok;
+}
+
+
+/**
+ * Print the totals for each format.
+ */
+
+void bench_report(void)
+{
+	unsigned int i;
+
+	printf("%-5s %6s %5s %10s %9s %9s %10s %10s %10s\n",
+			"", "files", "fail", "MB", "MB/s", "Mpx/s",
+			"allocs", "bitmap KB", "RSS KB");
+
+	for (i = 0; i != BENCH_FORMATS; i++) {
+		struct bench_format *f = &bench_formats[i];
+		double s = f->seconds > 0 ? f->seconds : 1e-9;
+
+		if (f->files == 0 && f->failures == 0)
+			continue;
+
+		printf("%-5s %6u %5u %10.2f %9.2f %9.2f %10.0f %10lu "
+				"%10ld\n",
+				f->name, f->files, f->failures,
+				f->bytes / 1e6, f->bytes / 1e6 / s,
+				f->pixels / 1e6 / s,
+				f->decodes ? (double) f->allocations /
+						f->decodes : 0,
+				(unsigned long) (f->peak_bitmaps / 1024),
+				f->peak_rss);
+	}
+}
+
+
+/******************************************************************************
+ * Allocation counting                                                        *
+ ******************************************************************************/
+
+#ifdef __GLIBC__
+/* interpose on the glibc allocator, so that allocations made by the image
+ * libraries are counted too */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	bench_allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	bench_allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	bench_allocations++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+
+/******************************************************************************
+ * Stub bitmap implementation                                                 *
+ ******************************************************************************/
+
+struct bitmap {
+	int width;
+	int height;
+	bool opaque;
+	unsigned char *pixels;
+};
+
+void *bitmap_create(int width, int height, unsigned int state)
+{
+	struct bitmap *bitmap = calloc(1, sizeof *bitmap);
+
+	if (bitmap == NULL)
+		return NULL;
+
+	bitmap->pixels = calloc((size_t) width * height, 4);
+	if (bitmap->pixels == NULL) {
+		free(bitmap);
+		return NULL;
+	}
+	bitmap->width = width;
+	bitmap->height = height;
+	bitmap->opaque = (state & BITMAP_OPAQUE) != 0;
+
+	bench_bitmaps += (size_t) width * height * 4;
+	if (bench_peak_bitmaps < bench_bitmaps)
+		bench_peak_bitmaps = bench_bitmaps;
+
+	return bitmap;
+}
+
+void bitmap_destroy(void *vbitmap)
+{
+	struct bitmap *bitmap = vbitmap;
+
+	bench_bitmaps -= (size_t) bitmap->width * bitmap->height * 4;
+	free(bitmap->pixels);
+	free(bitmap);
+}
+
+unsigned char *bitmap_get_buffer(void *vbitmap)
+{
+	return ((struct bitmap *) vbitmap)->pixels;
+}
+
+size_t bitmap_get_rowstride(void *vbitmap)
+{
+	return ((struct bitmap *) vbitmap)->width * 4;
+}
+
+size_t bitmap_get_bpp(void *vbitmap)
+{
+	return 4;
+}
+
+int bitmap_get_width(void *vbitmap)
+{
+	return ((struct bitmap *) vbitmap)->width;
+}
+
+int bitmap_get_height(void *vbitmap)
+{
+	return ((struct bitmap *) vbitmap)->height;
+}
+
+void bitmap_set_opaque(void *vbitmap, bool opaque)
+{
+	((struct bitmap *) vbitmap)->opaque = opaque;
+}
+
+bool bitmap_get_opaque(void *vbitmap)
+{
+	return ((struct bitmap *) vbitmap)->opaque;
+}
+
+bool bitmap_test_opaque(void *vbitmap)
+{
+	return false;
+}
+
+bool bitmap_save(void *vbitmap, const char *path, unsigned flags)
+{
+	return true;
+}
+
+void bitmap_modified(void *vbitmap)
+{
+}
+
+void bitmap_set_suspendable(void *vbitmap, void *private_word,
+		void (*invalidate)(void *vbitmap, void *private_word))
+{
+}
+
+
+/******************************************************************************
+ * Stub content layer                                                         *
+ ******************************************************************************/
+
+bool verbose_log;
+struct plotter_table plot;
+int option_image_cache_size = 16 * 1024 * 1024;
+bool option_animate_images = true;
+int option_minimum_gif_delay = 10;
+
+void content_set_ready(struct content *c)
+{
+	c->status = CONTENT_STATUS_READY;
+}
+
+void content_set_done(struct content *c)
+{
+	c->status = CONTENT_STATUS_DONE;
+}
+
+void content__progress(struct content *c, int y0, int y1)
+{
+}
+
+void content_set_status(struct content *c, const char *status_message, ...)
+{
+}
+
+void content_broadcast(struct content *c, content_msg msg,
+		union content_msg_data data)
+{
+}
+
+bool content__set_title(struct content *c, const char *title)
+{
+	return true;
+}
+
+struct content *hlcache_handle_get_content(const hlcache_handle *handle)
+{
+	return NULL;
+}
+
+const char *content__get_url(struct content *c)
+{
+	return "file:///imagebench";
+}
+
+const char *content__get_source_data(struct content *c, unsigned long *size)
+{
+	*size = bench_source_size;
+	return bench_source;
+}
+
+const char *messages_get(const char *key)
+{
+	return key;
+}
+
+void warn_user(const char *warning, const char *detail)
+{
+	fprintf(stderr, "%s %s\n", warning, detail);
+}
+
+void die(const char * const error)
+{
+	fprintf(stderr, "%s\n", error);
+	exit(1);
+}
+
+unsigned int wallclock(void)
+{
+	return clock() / (CLOCKS_PER_SEC / 100);
+}
+
+void schedule(int t, void (*callback)(void *p), void *p)
+{
+}
+
+void schedule_remove(void (*callback)(void *p), void *p)
+{
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Check utils/pixel.c against simple per-byte implementations, and time
+ * both.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/pixel.h"
+
+#define WIDTH 1024
+#define HEIGHT 768
+#define RUNS 20
+
+static void ref_rgb_to_rgba(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i;
+
+	for (i = count; i-- != 0; ) {
+		uint8_t r = src[i * 3], g = src[i * 3 + 1], b = src[i * 3 + 2];
+		dst[i * 4] = r;
+		dst[i * 4 + 1] = g;
+		dst[i * 4 + 2] = b;
+		dst[i * 4 + 3] = 0xff;
+	}
+}
+
+static void ref_swap_rb(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i != count; i++) {
+		uint8_t r = src[i * 4], b = src[i * 4 + 2];
+		dst[i * 4] = b;
+		dst[i * 4 + 1] = src[i * 4 + 1];
+		dst[i * 4 + 2] = r;
+		dst[i * 4 + 3] = src[i * 4 + 3];
+	}
+}
+
+static void ref_copy_spaced(uint8_t *dst, const uint8_t *src, size_t count,
+		size_t spacing)
+{
+	size_t i;
+
+	for (i = 0; i != count; i++)
+		memcpy(dst + i * spacing * 4, src + i * 4, 4);
+}
+
+static bool ref_test_opaque(const uint8_t *pixels, size_t width,
+		size_t height, size_t rowstride)
+{
+	size_t x, y;
+
+	for (y = 0; y != height; y++)
+		for (x = 0; x != width; x++)
+			if (pixels[y * rowstride + x * 4 + 3] != 0xff)
+				return false;
+
+	return true;
+}
+
+static double elapsed(clock_t start)
+{
+	return (double) (clock() - start) * 1000 / CLOCKS_PER_SEC;
+}
+
+static void fill(uint8_t *buffer, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i != size; i++)
+		buffer[i] = rand();
+}
+
+static int check(const char *name, const uint8_t *a, const uint8_t *b,
+		size_t size)
+{
+	if (memcmp(a, b, size) == 0)
+		return 0;
+
+	printf("%s: MISMATCH\n", name);
+	return 1;
+}
+
+int main(void)
+{
+	size_t count = WIDTH * HEIGHT, size = count * 4;
+	uint8_t *a = malloc(size), *b = malloc(size), *src = malloc(size);
+	size_t n, spacing;
+	int failures = 0, run;
+	clock_t start;
+	bool ra, rb;
+
+	if (a == NULL || b == NULL || src == NULL) {
+		printf("out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	fill(src, size);
+
+	/* correctness, including odd lengths and in-place use */
+	for (n = 0; n != 37; n++) {
+		memcpy(a, src, size);
+		memcpy(b, src, size);
+		pixel_rgb_to_rgba(a, a, n);
+		ref_rgb_to_rgba(b, b, n);
+		failures += check("rgb_to_rgba", a, b, n * 4);
+
+		pixel_swap_rb(a, src, n);
+		ref_swap_rb(b, src, n);
+		failures += check("swap_rb", a, b, n * 4);
+
+		for (spacing = 1; spacing != 9; spacing++) {
+			memset(a, 0, size);
+			memset(b, 0, size);
+			pixel_copy_spaced(a, src, n, spacing);
+			ref_copy_spaced(b, src, n, spacing);
+			failures += check("copy_spaced", a, b, n * 4 * 9);
+		}
+
+		memset(a, 0xff, size);
+		if (n != 0)
+			a[(n - 1) * 4 + 3] = 0xfe;
+		if (pixel_test_opaque(a, n, 1, n * 4) !=
+				ref_test_opaque(a, n, 1, n * 4)) {
+			printf("test_opaque: MISMATCH\n");
+			failures++;
+		}
+	}
+
+	/* timing */
+	printf("%u x %u pixels, %u runs, ms\n", WIDTH, HEIGHT, RUNS);
+
+	memcpy(a, src, size);
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		ref_rgb_to_rgba(a, src, count);
+	printf("rgb_to_rgba  ref %8.1f", elapsed(start));
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		pixel_rgb_to_rgba(a, src, count);
+	printf("  pixel %8.1f\n", elapsed(start));
+
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		ref_swap_rb(a, src, count);
+	printf("swap_rb      ref %8.1f", elapsed(start));
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		pixel_swap_rb(a, src, count);
+	printf("  pixel %8.1f\n", elapsed(start));
+
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		ref_copy_spaced(a, src, count / 2, 2);
+	printf("copy_spaced  ref %8.1f", elapsed(start));
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		pixel_copy_spaced(a, src, count / 2, 2);
+	printf("  pixel %8.1f\n", elapsed(start));
+
+	memset(a, 0xff, size);
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		ra = ref_test_opaque(a, WIDTH, HEIGHT, WIDTH * 4);
+	printf("test_opaque  ref %8.1f", elapsed(start));
+	start = clock();
+	for (run = 0; run != RUNS; run++)
+		rb = pixel_test_opaque(a, WIDTH, HEIGHT, WIDTH * 4);
+	printf("  pixel %8.1f\n", elapsed(start));
+	if (ra != rb) {
+		printf("test_opaque: MISMATCH\n");
+		failures++;
+	}
+
+	free(a);
+	free(b);
+	free(src);
+
+	printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Pixel format conversion (implementation).
+ *
+ * These are written in portable C, as NetSurf must build with compilers
+ * which have no vector extensions.  Where possible they work on a whole
+ * 32-bit pixel at a time, and the loops are unrolled, so that a compiler
+ * which can vectorise will do so.  Words are accessed through memcpy(),
+ * which compilers reduce to a single load or store, so buffers need not
+ * be aligned.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utils/pixel.h"
+
+static bool pixel_little_endian(void);
+
+
+/**
+ * Expand packed 24-bit RGB pixels to 32-bit RGBA, with opaque alpha
+ *
+ * \param dst    Buffer to receive count RGBA pixels
+ * \param src    count RGB pixels
+ * \param count  Number of pixels
+ *
+ * dst may equal src, as is the case for decoders which produce RGB rows
+ * directly in the bitmap.
+ */
+void pixel_rgb_to_rgba(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	const uint8_t *s = src + count * 3;
+	uint8_t *d = dst + count * 4;
+	bool little_endian = pixel_little_endian();
+
+	/* work backwards, reading each group of pixels before writing it,
+	 * so that expanding in place never overwrites unread pixels */
+	while (count >= 4) {
+		uint32_t in[3], out[4];
+
+		s -= 12;
+		d -= 16;
+		memcpy(in, s, 12);
+
+		/* in holds r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3 */
+		if (little_endian) {
+			out[0] = in[0] | 0xff000000;
+			out[1] = (in[0] >> 24) | (in[1] << 8) | 0xff000000;
+			out[2] = (in[1] >> 16) | (in[2] << 16) | 0xff000000;
+			out[3] = (in[2] >> 8) | 0xff000000;
+		} else {
+			out[0] = in[0] | 0x000000ff;
+			out[1] = (in[0] << 24) | (in[1] >> 8) | 0x000000ff;
+			out[2] = (in[1] << 16) | (in[2] >> 16) | 0x000000ff;
+			out[3] = (in[2] << 8) | 0x000000ff;
+		}
+
+		memcpy(d, out, 16);
+
+		count -= 4;
+	}
+
+	while (count != 0) {
+		uint8_t r, g, b;
+
+		s -= 3;
+		d -= 4;
+		r = s[0];
+		g = s[1];
+		b = s[2];
+
+		d[0] = r; d[1] = g; d[2] = b; d[3] = 0xff;
+
+		count--;
+	}
+}
+
+
+/**
+ * Exchange the first and third bytes of 32-bit pixels, e.g. RGBA to BGRA
+ *
+ * \param dst    Buffer to receive count pixels
+ * \param src    count pixels
+ * \param count  Number of pixels
+ */
+void pixel_swap_rb(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	uint32_t keep, low, high;
+	size_t i;
+
+	/* bytes 0 and 2 of a pixel are at different bit positions in the
+	 * word depending on byte order */
+	if (pixel_little_endian()) {
+		keep = 0xff00ff00;
+		low = 0x000000ff;
+		high = 0x00ff0000;
+	} else {
+		keep = 0x00ff00ff;
+		low = 0x0000ff00;
+		high = 0xff000000;
+	}
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		uint32_t w[4];
+
+		memcpy(w, src + i * 4, 16);
+		w[0] = (w[0] & keep) | ((w[0] & low) << 16) |
+				((w[0] & high) >> 16);
+		w[1] = (w[1] & keep) | ((w[1] & low) << 16) |
+				((w[1] & high) >> 16);
+		w[2] = (w[2] & keep) | ((w[2] & low) << 16) |
+				((w[2] & high) >> 16);
+		w[3] = (w[3] & keep) | ((w[3] & low) << 16) |
+				((w[3] & high) >> 16);
+		memcpy(dst + i * 4, w, 16);
+	}
+
+	for (; i != count; i++) {
+		uint32_t w;
+
+		memcpy(&w, src + i * 4, 4);
+		w = (w & keep) | ((w & low) << 16) | ((w & high) >> 16);
+		memcpy(dst + i * 4, &w, 4);
+	}
+}
+
+
+/**
+ * Copy contiguous 32-bit pixels to every spacing'th pixel of a row
+ *
+ * \param dst      First destination pixel
+ * \param src      count contiguous pixels
+ * \param count    Number of pixels
+ * \param spacing  Distance between destination pixels, in pixels
+ *
+ * Used to place the pixels of an interlaced pass.  dst and src may not
+ * overlap.
+ */
+void pixel_copy_spaced(uint8_t *dst, const uint8_t *src, size_t count,
+		size_t spacing)
+{
+	size_t stride = spacing * 4;
+
+	if (spacing == 1) {
+		memcpy(dst, src, count * 4);
+		return;
+	}
+
+	while (count >= 4) {
+		memcpy(dst, src, 4);
+		memcpy(dst + stride, src + 4, 4);
+		memcpy(dst + stride * 2, src + 8, 4);
+		memcpy(dst + stride * 3, src + 12, 4);
+		dst += stride * 4;
+		src += 16;
+		count -= 4;
+	}
+
+	while (count != 0) {
+		memcpy(dst, src, 4);
+		dst += stride;
+		src += 4;
+		count--;
+	}
+}
+
+
+/**
+ * Find whether every pixel of an RGBA image is fully opaque
+ *
+ * \param pixels     First row of image
+ * \param width      Width of image, in pixels
+ * \param height     Height of image, in rows
+ * \param rowstride  Distance between rows, in bytes
+ * \return true if every alpha byte is 0xff
+ */
+bool pixel_test_opaque(const uint8_t *pixels, size_t width, size_t height,
+		size_t rowstride)
+{
+	size_t x, y;
+
+	for (y = 0; y != height; y++) {
+		const uint8_t *row = pixels + y * rowstride;
+		uint32_t acc = 0xffffffff;
+		uint8_t bytes[4];
+
+		/* AND pixels together a block at a time; the alpha byte of
+		 * the result is 0xff only if it is in every pixel */
+		for (x = 0; x + 8 <= width; x += 8) {
+			uint32_t w[8];
+
+			memcpy(w, row + x * 4, 32);
+			acc &= w[0] & w[1] & w[2] & w[3] &
+					w[4] & w[5] & w[6] & w[7];
+
+			memcpy(bytes, &acc, 4);
+			if (bytes[3] != 0xff)
+				return false;
+		}
+
+		for (; x != width; x++) {
+			if (row[x * 4 + 3] != 0xff)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * Find the byte order of the machine
+ *
+ * \return true if the least significant byte of a word is stored first
+ */
+bool pixel_little_endian(void)
+{
+	const uint32_t one = 1;
+
+	return *(const uint8_t *) &one == 1;
+}
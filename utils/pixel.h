@@ -0,0 +1,42 @@
+/*
+ * Copyright 2010 Mark Benjamin <netsurf-browser.org.MarkBenjamin@dfgh.net>
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Pixel format conversion (interface).
+ *
+ * Conversions between the byte orders used by image decoders, the core
+ * bitmap format (R, G, B, A bytes) and front end bitmap formats.  Unless
+ * stated otherwise, the source and destination may be the same buffer,
+ * but may not otherwise overlap.
+ */
+
+#ifndef _NETSURF_UTILS_PIXEL_H_
+#define _NETSURF_UTILS_PIXEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+void pixel_rgb_to_rgba(uint8_t *dst, const uint8_t *src, size_t count);
+void pixel_swap_rb(uint8_t *dst, const uint8_t *src, size_t count);
+void pixel_copy_spaced(uint8_t *dst, const uint8_t *src, size_t count,
+		size_t spacing);
+bool pixel_test_opaque(const uint8_t *pixels, size_t width, size_t height,
+		size_t rowstride);
+
+#endif
@@ -23,6 +23,7 @@
 
 #include "image/bitmap.h"
 #include "windows/bitmap.h"
+#include "image/scale_cache.h"
 
 #include "utils/log.h"
 
@@ -114,7 +115,8 @@ void bitmap_destroy(void *bitmap)
 		LOG(("NULL bitmap!"));
 		return;
 	}
-	
+
+	scale_cache_invalidate(bm);
 	free(bm->pixdata);
 	free(bm);
 }
@@ -140,6 +142,7 @@ bool bitmap_save(void *bitmap, const char *path, unsigned flags)
  * \param  bitmap  a bitmap, as returned by bitmap_create()
  */
 void bitmap_modified(void *bitmap) {
+	scale_cache_invalidate(bitmap);
 }
 
 